@@ -0,0 +1,187 @@
+#include "compression.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+// zlib window bits selecting the gzip wrapper instead of zlib's own
+#define GZIP_WINDOW_BITS (15 + 16)
+
+/**
+ * Compare a token against a string of known length, ignoring case
+ * 
+ * @param token token to compare
+ * @param length token length
+ * @param value NUL-terminated string
+ * @return 1 if equal, 0 otherwise
+ */
+static int token_equals(const char *token, size_t length, const char *value) {
+    return strlen(value) == length && strncasecmp(token, value, length) == 0;
+}
+
+/**
+ * Check whether a content type matches a compression policy
+ * 
+ * @param patterns comma-separated types, a trailing '*' after the slash matches a family; may be NULL
+ * @param content_type content type, parameters after ';' are ignored
+ * @return 1 if it matches, 0 otherwise
+ */
+int compression_type_matches(const char *patterns, const char *content_type) {
+    if (!patterns || !content_type) {
+        return 0;
+    }
+    
+    size_t type_length = strcspn(content_type, "; ");
+    const char *slash = memchr(content_type, '/', type_length);
+    
+    const char *p = patterns;
+    while (*p) {
+        p += strspn(p, " ,");
+        size_t length = strcspn(p, ", ");
+        if (length == 0) {
+            break;
+        }
+        
+        if (length >= 2 && p[length - 2] == '/' && p[length - 1] == '*') {
+            // Family: everything up to and including the slash must match
+            if (slash && (size_t)(slash - content_type) == length - 2 &&
+                strncasecmp(p, content_type, length - 1) == 0) {
+                return 1;
+            }
+        } else if (length == type_length && strncasecmp(p, content_type, length) == 0) {
+            return 1;
+        }
+        p += length;
+    }
+    
+    return 0;
+}
+
+/**
+ * Check whether an Accept-Encoding header allows an encoding
+ * 
+ * @param accept_encoding header value, may be NULL
+ * @param encoding encoding name
+ * @return 1 if allowed, 0 otherwise
+ */
+int compression_accepts(const char *accept_encoding, const char *encoding) {
+    if (!accept_encoding || !encoding) {
+        return 0;
+    }
+    
+    int star = 0;
+    const char *p = accept_encoding;
+    while (*p) {
+        p += strspn(p, " \t,");
+        size_t length = strcspn(p, " \t,;");
+        if (length == 0) {
+            break;
+        }
+        const char *name = p;
+        p += length;
+        
+        // Only the quality parameter matters; q=0 means "not acceptable"
+        int allowed = 1;
+        size_t params = strcspn(p, ",");
+        const char *q = p;
+        while ((q = memchr(q, 'q', params - (size_t)(q - p))) != NULL) {
+            const char *value = q + 1 + strspn(q + 1, " \t");
+            if (*value == '=') {
+                allowed = strtod(value + 1, NULL) > 0;
+                break;
+            }
+            q++;
+        }
+        p += params;
+        
+        if (token_equals(name, length, encoding)) {
+            return allowed;
+        }
+        if (token_equals(name, length, "*")) {
+            star = allowed;
+        }
+    }
+    
+    return star;
+}
+
+/**
+ * Gzip a buffer
+ * 
+ * @param data input
+ * @param size input size
+ * @param out receives the malloc'd compressed bytes on success
+ * @param out_size receives the compressed size on success
+ * @return 0 on success, -1 if it did not shrink enough or on error
+ */
+int compression_gzip(const void *data, size_t size, unsigned char **out, size_t *out_size) {
+    if (!data || size < COMPRESSION_MIN_SIZE || size > UINT_MAX || !out || !out_size) {
+        return -1;
+    }
+    
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    
+    // Anything that does not fit in the limit is not worth keeping
+    size_t limit = size - size / 8;
+    unsigned char *buffer = malloc(limit);
+    if (!buffer) {
+        deflateEnd(&stream);
+        return -1;
+    }
+    
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)size;
+    stream.next_out = buffer;
+    stream.avail_out = (uInt)limit;
+    
+    int rc = deflate(&stream, Z_FINISH);
+    size_t produced = stream.total_out;
+    deflateEnd(&stream);
+    
+    if (rc != Z_STREAM_END) {
+        free(buffer);
+        return -1;
+    }
+    
+    *out = buffer;
+    *out_size = produced;
+    return 0;
+}
+
+/**
+ * Gunzip a buffer of known decompressed size
+ * 
+ * @param data gzip stream
+ * @param size stream size
+ * @param out destination
+ * @param out_size expected decompressed size
+ * @return 0 on success, -1 if the stream is corrupt or of another size
+ */
+int compression_gunzip(const void *data, size_t size, void *out, size_t out_size) {
+    if (!data || !out || size > UINT_MAX || out_size > UINT_MAX) {
+        return -1;
+    }
+    
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, GZIP_WINDOW_BITS) != Z_OK) {
+        return -1;
+    }
+    
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)size;
+    stream.next_out = out;
+    stream.avail_out = (uInt)out_size;
+    
+    int rc = inflate(&stream, Z_FINISH);
+    size_t produced = stream.total_out;
+    inflateEnd(&stream);
+    
+    return rc == Z_STREAM_END && produced == out_size ? 0 : -1;
+}
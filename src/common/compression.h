@@ -0,0 +1,27 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+
+// Content-Encoding of compressed stored content (the only codec so far)
+#define COMPRESSION_GZIP "gzip"
+
+// Bodies smaller than this are never worth compressing
+#define COMPRESSION_MIN_SIZE 256
+
+// Does content_type match the comma-separated patterns? A pattern is a
+// full type ("application/json") or a type family ("text/*")
+int compression_type_matches(const char *patterns, const char *content_type);
+
+// Does an Accept-Encoding header value allow encoding? Honors "*" and q=0
+int compression_accepts(const char *accept_encoding, const char *encoding);
+
+// Gzip data into a malloc'd buffer. Fails (-1) when the result would not be
+// at least an eighth smaller than the input, since decoding then costs more
+// than it saves.
+int compression_gzip(const void *data, size_t size, unsigned char **out, size_t *out_size);
+
+// Gunzip data into out, which must receive exactly out_size bytes
+int compression_gunzip(const void *data, size_t size, void *out, size_t out_size);
+
+#endif /* COMPRESSION_H */
@@ -3,6 +3,87 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+
+// Connection pool size used in thread-per-connection mode when unset
+#define THREAD_PER_CONNECTION_POOL_SIZE 16
+
+/**
+ * Resolve "auto" thread and pool sizes
+ * 
+ * @param config pointer to Config structure
+ */
+static void resolve_defaults(Config *config) {
+    if (config->http_threads == 0 && !config->thread_per_connection) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        config->http_threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    
+    if (config->pg_pool_size == 0) {
+        config->pg_pool_size = config->thread_per_connection ?
+            THREAD_PER_CONNECTION_POOL_SIZE : config->http_threads;
+    }
+}
+
+/**
+ * Append a connection string to a list
+ * 
+ * @param list list to grow
+ * @param count entries in the list
+ * @param conninfo connection string, of the given length
+ * @param length conninfo length
+ * @return 0 on success, -1 on memory error
+ */
+static int add_conninfo(char ***list, int *count, const char *conninfo, size_t length) {
+    char **grown = (char **)realloc(*list, (*count + 1) * sizeof(char *));
+    if (!grown) {
+        return -1;
+    }
+    *list = grown;
+    
+    grown[*count] = strndup(conninfo, length);
+    if (!grown[*count]) {
+        return -1;
+    }
+    (*count)++;
+    
+    return 0;
+}
+
+/**
+ * Append the ';'-separated connection strings of a variable to a list
+ * 
+ * @param list list to grow
+ * @param count entries in the list
+ * @param value variable value
+ * @return 0 on success, -1 on memory error
+ */
+int config_add_conninfos(char ***list, int *count, const char *value) {
+    const char *p = value;
+    while (*p) {
+        size_t length = strcspn(p, ";");
+        if (length > strspn(p, " ") && add_conninfo(list, count, p, length) != 0) {
+            return -1;
+        }
+        p += length;
+        p += *p == ';';
+    }
+    
+    return 0;
+}
+
+/**
+ * Free a list of connection strings
+ * 
+ * @param list list to free
+ * @param count entries in the list
+ */
+void config_free_conninfos(char **list, int count) {
+    for (int i = 0; i < count; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
 
 /**
  * Initialize configuration with default values
@@ -17,6 +98,17 @@ Config *config_init(void) {
     
     config->http_port = DEFAULT_HTTP_PORT;
     config->pg_conninfo = strdup(DEFAULT_PG_CONNINFO);
+    config->http_threads = DEFAULT_HTTP_THREADS;
+    config->thread_per_connection = 0;
+    config->pg_pool_size = DEFAULT_PG_POOL_SIZE;
+    config->cache_size = (size_t)DEFAULT_CACHE_SIZE_MB * 1024 * 1024;
+    config->upload_expiry_hours = DEFAULT_UPLOAD_EXPIRY_HOURS;
+    config->async_connections = DEFAULT_ASYNC_CONNECTIONS;
+    config->replicas = NULL;
+    config->replica_count = 0;
+    config->shards = NULL;
+    config->shard_count = 0;
+    config->read_after_write_ms = DEFAULT_READ_AFTER_WRITE_MS;
     
     if (!config->pg_conninfo) {
         free(config);
@@ -40,6 +132,9 @@ void config_free(Config *config) {
         free(config->pg_conninfo);
     }
     
+    config_free_conninfos(config->replicas, config->replica_count);
+    config_free_conninfos(config->shards, config->shard_count);
+    
     free(config);
 }
 
@@ -53,6 +148,18 @@ static void print_usage(const char *program) {
     printf("Options:\n");
     printf("  -p, --port PORT       HTTP port (default: %d)\n", DEFAULT_HTTP_PORT);
     printf("  -d, --db CONNINFO     PostgreSQL connection string (default: %s)\n", DEFAULT_PG_CONNINFO);
+    printf("  -t, --threads N       HTTP worker threads, 0 for thread-per-connection (default: CPUs)\n");
+    printf("  -c, --pool-size N     PostgreSQL connection pool size (default: thread count)\n");
+    printf("  -m, --cache-size MB   Object cache size, 0 to disable (default: %d)\n", DEFAULT_CACHE_SIZE_MB);
+    printf("  -u, --upload-expiry H Drop unfinished multipart uploads after H hours, 0 never (default: %d)\n",
+           DEFAULT_UPLOAD_EXPIRY_HOURS);
+    printf("  -a, --async N         Non-blocking connections serving GET/HEAD, 0 to disable (default: %d)\n",
+           DEFAULT_ASYNC_CONNECTIONS);
+    printf("  -r, --replica CONNINFO Hot standby serving reads, repeat for several\n");
+    printf("  -s, --shard CONNINFO  Database holding a share of the objects, repeat for each;\n"
+           "                        replaces --db, order matters\n");
+    printf("  -w, --read-after-write MS Read keys from the primary this long after writing them,\n"
+           "                        0 never (default: %d)\n", DEFAULT_READ_AFTER_WRITE_MS);
     printf("  -h, --help            Display this help message\n");
 }
 
@@ -72,6 +179,14 @@ int config_parse_args(Config *config, int argc, char **argv) {
     static struct option long_options[] = {
         {"port", required_argument, 0, 'p'},
         {"db", required_argument, 0, 'd'},
+        {"threads", required_argument, 0, 't'},
+        {"pool-size", required_argument, 0, 'c'},
+        {"cache-size", required_argument, 0, 'm'},
+        {"upload-expiry", required_argument, 0, 'u'},
+        {"async", required_argument, 0, 'a'},
+        {"replica", required_argument, 0, 'r'},
+        {"shard", required_argument, 0, 's'},
+        {"read-after-write", required_argument, 0, 'w'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -79,7 +194,7 @@ int config_parse_args(Config *config, int argc, char **argv) {
     int option_index = 0;
     int c;
     
-    while ((c = getopt_long(argc, argv, "p:d:h", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "p:d:t:c:m:u:a:r:s:w:h", long_options, &option_index)) != -1) {
         switch (c) {
             case 'p':
                 config->http_port = atoi(optarg);
@@ -99,6 +214,69 @@ int config_parse_args(Config *config, int argc, char **argv) {
                 }
                 break;
                 
+            case 't':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    return -1;
+                }
+                config->http_threads = atoi(optarg);
+                config->thread_per_connection = config->http_threads == 0;
+                break;
+                
+            case 'c':
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Invalid pool size: %s\n", optarg);
+                    return -1;
+                }
+                config->pg_pool_size = atoi(optarg);
+                break;
+                
+            case 'm':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid cache size: %s\n", optarg);
+                    return -1;
+                }
+                config->cache_size = (size_t)atoi(optarg) * 1024 * 1024;
+                break;
+                
+            case 'u':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid upload expiry: %s\n", optarg);
+                    return -1;
+                }
+                config->upload_expiry_hours = atoi(optarg);
+                break;
+                
+            case 'a':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid async connection count: %s\n", optarg);
+                    return -1;
+                }
+                config->async_connections = atoi(optarg);
+                break;
+                
+            case 'r':
+                if (add_conninfo(&config->replicas, &config->replica_count,
+                                 optarg, strlen(optarg)) != 0) {
+                    return -1;
+                }
+                break;
+                
+            case 's':
+                if (add_conninfo(&config->shards, &config->shard_count,
+                                 optarg, strlen(optarg)) != 0) {
+                    return -1;
+                }
+                break;
+                
+            case 'w':
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "Invalid read-after-write window: %s\n", optarg);
+                    return -1;
+                }
+                config->read_after_write_ms = atoi(optarg);
+                break;
+                
             case 'h':
                 print_usage(argv[0]);
                 return 1;
@@ -113,5 +291,97 @@ int config_parse_args(Config *config, int argc, char **argv) {
         }
     }
     
+    resolve_defaults(config);
+    
     return 0;
-} 
\ No newline at end of file
+}
+
+/**
+ * Load server settings from PGS3_* environment variables
+ * 
+ * PGS3_HTTP_THREADS   HTTP worker threads, 0 for thread-per-connection
+ * PGS3_POOL_SIZE      PostgreSQL connection pool size
+ * PGS3_CACHE_SIZE     object cache size in megabytes, 0 to disable
+ * PGS3_UPLOAD_EXPIRY  hours before unfinished multipart uploads are dropped, 0 never
+ * PGS3_ASYNC_CONNECTIONS  non-blocking connections serving GET/HEAD, 0 to disable
+ * PGS3_REPLICAS       hot standby connection strings serving reads, separated by ';'
+ * PGS3_SHARDS         databases the objects are spread over by key, separated by ';'
+ * PGS3_READ_AFTER_WRITE_MS  milliseconds a written key is read from the primary, 0 never
+ * 
+ * @param config pointer to Config structure
+ * @return 0 on success, -1 on error
+ */
+int config_load_env(Config *config) {
+    if (!config) {
+        return -1;
+    }
+    
+    const char *threads = getenv("PGS3_HTTP_THREADS");
+    if (threads) {
+        if (atoi(threads) < 0) {
+            fprintf(stderr, "Invalid PGS3_HTTP_THREADS: %s\n", threads);
+            return -1;
+        }
+        config->http_threads = atoi(threads);
+        config->thread_per_connection = config->http_threads == 0;
+    }
+    
+    const char *pool_size = getenv("PGS3_POOL_SIZE");
+    if (pool_size) {
+        if (atoi(pool_size) <= 0) {
+            fprintf(stderr, "Invalid PGS3_POOL_SIZE: %s\n", pool_size);
+            return -1;
+        }
+        config->pg_pool_size = atoi(pool_size);
+    }
+    
+    const char *cache_size = getenv("PGS3_CACHE_SIZE");
+    if (cache_size) {
+        if (atoi(cache_size) < 0) {
+            fprintf(stderr, "Invalid PGS3_CACHE_SIZE: %s\n", cache_size);
+            return -1;
+        }
+        config->cache_size = (size_t)atoi(cache_size) * 1024 * 1024;
+    }
+    
+    const char *upload_expiry = getenv("PGS3_UPLOAD_EXPIRY");
+    if (upload_expiry) {
+        if (atoi(upload_expiry) < 0) {
+            fprintf(stderr, "Invalid PGS3_UPLOAD_EXPIRY: %s\n", upload_expiry);
+            return -1;
+        }
+        config->upload_expiry_hours = atoi(upload_expiry);
+    }
+    
+    const char *async_connections = getenv("PGS3_ASYNC_CONNECTIONS");
+    if (async_connections) {
+        if (atoi(async_connections) < 0) {
+            fprintf(stderr, "Invalid PGS3_ASYNC_CONNECTIONS: %s\n", async_connections);
+            return -1;
+        }
+        config->async_connections = atoi(async_connections);
+    }
+    
+    const char *replicas = getenv("PGS3_REPLICAS");
+    if (replicas && config_add_conninfos(&config->replicas, &config->replica_count, replicas) != 0) {
+        return -1;
+    }
+    
+    const char *shards = getenv("PGS3_SHARDS");
+    if (shards && config_add_conninfos(&config->shards, &config->shard_count, shards) != 0) {
+        return -1;
+    }
+    
+    const char *read_after_write = getenv("PGS3_READ_AFTER_WRITE_MS");
+    if (read_after_write) {
+        if (atoi(read_after_write) < 0) {
+            fprintf(stderr, "Invalid PGS3_READ_AFTER_WRITE_MS: %s\n", read_after_write);
+            return -1;
+        }
+        config->read_after_write_ms = atoi(read_after_write);
+    }
+    
+    resolve_defaults(config);
+    
+    return 0;
+}
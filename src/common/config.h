@@ -1,19 +1,43 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
 // Default values
 #define DEFAULT_HTTP_PORT 9000
 #define DEFAULT_PG_CONNINFO "host=localhost user=postgres password=postgres dbname=postgres"
+#define DEFAULT_HTTP_THREADS 0      // 0 = one per online CPU
+#define DEFAULT_PG_POOL_SIZE 0      // 0 = match the HTTP thread count
+#define DEFAULT_CACHE_SIZE_MB 64    // object cache budget; 0 = no cache
+#define DEFAULT_UPLOAD_EXPIRY_HOURS 24  // unfinished multipart uploads; 0 = keep
+#define DEFAULT_ASYNC_CONNECTIONS 0     // non-blocking connections; 0 = every query blocks
+#define DEFAULT_READ_AFTER_WRITE_MS 1000    // reads of a key just written go to the primary
 
 // Configuration structure
 typedef struct {
     unsigned int http_port;
     char *pg_conninfo;
+    unsigned int http_threads;      // worker threads; 0 = auto until args/env are loaded
+    int thread_per_connection;      // serve each client on its own thread instead
+    unsigned int pg_pool_size;      // maximum PostgreSQL connections
+    size_t cache_size;              // object cache budget in bytes, 0 disables it
+    unsigned int upload_expiry_hours;   // drop multipart uploads this old, 0 never
+    unsigned int async_connections; // event loop connections for GET/HEAD, 0 disables
+    char **replicas;                // hot standby conninfos serving reads
+    int replica_count;
+    char **shards;                  // databases sharing the objects by key hash, none if NULL
+    int shard_count;
+    unsigned int read_after_write_ms;   // primary reads after a write to a key, 0 never
 } Config;
 
 // Functions for config management
 Config *config_init(void);
 void config_free(Config *config);
 int config_parse_args(Config *config, int argc, char **argv);
+int config_load_env(Config *config);
+
+// Lists of connection strings, as given in PGS3_REPLICAS and PGS3_SHARDS
+int config_add_conninfos(char ***list, int *count, const char *value);
+void config_free_conninfos(char **list, int count);
 
 #endif /* CONFIG_H */ 
\ No newline at end of file
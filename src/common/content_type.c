@@ -0,0 +1,49 @@
+#include "content_type.h"
+#include <string.h>
+#include <strings.h>
+
+// Extensions recognised for uploads, compared case-insensitively
+static const struct {
+    const char *extension;
+    const char *content_type;
+} known_types[] = {
+    {"txt", "text/plain"},
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"xml", "application/xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"svg", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+};
+
+/**
+ * Guess a content type from the extension of a key or file name
+ * 
+ * @param key object key or path
+ * @return content type, application/octet-stream if unknown
+ */
+const char *content_type_for_key(const char *key) {
+    const char *slash = strrchr(key, '/');
+    const char *ext = strrchr(slash ? slash : key, '.');
+    
+    if (ext) {
+        ext++; // Skip the dot
+        for (size_t i = 0; i < sizeof(known_types) / sizeof(known_types[0]); i++) {
+            if (strcasecmp(ext, known_types[i].extension) == 0) {
+                return known_types[i].content_type;
+            }
+        }
+    }
+    
+    return "application/octet-stream";
+}
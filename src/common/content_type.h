@@ -0,0 +1,8 @@
+#ifndef CONTENT_TYPE_H
+#define CONTENT_TYPE_H
+
+// Guess a content type from the extension of a key or file name;
+// application/octet-stream when the extension is unknown
+const char *content_type_for_key(const char *key);
+
+#endif /* CONTENT_TYPE_H */
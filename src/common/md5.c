@@ -0,0 +1,166 @@
+#include "md5.h"
+#include <string.h>
+
+// Per-round shift amounts
+static const unsigned int shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// floor(abs(sin(i + 1)) * 2^32)
+static const uint32_t constants[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+/**
+ * Mix one 64-byte block into the state
+ * 
+ * @param state hash state
+ * @param block input block
+ */
+static void md5_transform(uint32_t state[4], const unsigned char block[64]) {
+    uint32_t m[16];
+    
+    // Input words are little-endian regardless of the host
+    for (int i = 0; i < 16; i++) {
+        m[i] = (uint32_t)block[i * 4] |
+               ((uint32_t)block[i * 4 + 1] << 8) |
+               ((uint32_t)block[i * 4 + 2] << 16) |
+               ((uint32_t)block[i * 4 + 3] << 24);
+    }
+    
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        
+        f += a + constants[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << shifts[i]) | (f >> (32 - shifts[i]));
+    }
+    
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+/**
+ * Start a new hash
+ * 
+ * @param ctx context to initialize
+ */
+void md5_init(Md5Context *ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+}
+
+/**
+ * Add bytes to a hash
+ * 
+ * @param ctx hash context
+ * @param data bytes to add
+ * @param size number of bytes
+ */
+void md5_update(Md5Context *ctx, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t used = (size_t)(ctx->length % 64);
+    
+    ctx->length += size;
+    
+    // Complete a partial block first
+    if (used > 0) {
+        size_t fill = 64 - used;
+        if (size < fill) {
+            memcpy(ctx->block + used, bytes, size);
+            return;
+        }
+        memcpy(ctx->block + used, bytes, fill);
+        md5_transform(ctx->state, ctx->block);
+        bytes += fill;
+        size -= fill;
+    }
+    
+    // Whole blocks straight from the input
+    while (size >= 64) {
+        md5_transform(ctx->state, bytes);
+        bytes += 64;
+        size -= 64;
+    }
+    
+    memcpy(ctx->block, bytes, size);
+}
+
+/**
+ * Finish a hash
+ * 
+ * @param ctx hash context (must be re-initialized before reuse)
+ * @param digest receives the 16-byte digest
+ */
+void md5_final(Md5Context *ctx, unsigned char digest[MD5_DIGEST_LENGTH]) {
+    uint64_t bits = ctx->length * 8;
+    size_t used = (size_t)(ctx->length % 64);
+    
+    // Pad with 0x80, zeros, then the message length in bits
+    unsigned char padding[72] = {0x80};
+    size_t pad_length = used < 56 ? 56 - used : 120 - used;
+    for (int i = 0; i < 8; i++) {
+        padding[pad_length + i] = (unsigned char)(bits >> (8 * i));
+    }
+    md5_update(ctx, padding, pad_length + 8);
+    
+    for (int i = 0; i < 4; i++) {
+        digest[i * 4] = (unsigned char)ctx->state[i];
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 3] = (unsigned char)(ctx->state[i] >> 24);
+    }
+}
+
+/**
+ * Finish a hash as lowercase hex
+ * 
+ * @param ctx hash context (must be re-initialized before reuse)
+ * @param hex receives 32 hex digits and a terminating NUL
+ */
+void md5_final_hex(Md5Context *ctx, char hex[MD5_HEX_LENGTH + 1]) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    
+    md5_final(ctx, digest);
+    
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[MD5_HEX_LENGTH] = '\0';
+}
@@ -0,0 +1,23 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MD5_DIGEST_LENGTH 16
+#define MD5_HEX_LENGTH 32
+
+// Incremental MD5 state (RFC 1321)
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;            // bytes hashed so far
+    unsigned char block[64];    // partial input block
+} Md5Context;
+
+// Functions for incremental hashing
+void md5_init(Md5Context *ctx);
+void md5_update(Md5Context *ctx, const void *data, size_t size);
+void md5_final(Md5Context *ctx, unsigned char digest[MD5_DIGEST_LENGTH]);
+void md5_final_hex(Md5Context *ctx, char hex[MD5_HEX_LENGTH + 1]);
+
+#endif /* MD5_H */
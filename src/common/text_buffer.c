@@ -0,0 +1,232 @@
+#include "text_buffer.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Make room for more bytes plus the terminating NUL
+ * 
+ * @param buffer text buffer
+ * @param extra bytes about to be appended
+ * @return 0 on success, -1 on allocation failure
+ */
+static int text_buffer_reserve(TextBuffer *buffer, size_t extra) {
+    if (buffer->failed) {
+        return -1;
+    }
+    
+    size_t needed = buffer->length + extra + 1;
+    if (needed <= buffer->capacity) {
+        return 0;
+    }
+    
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    
+    char *data = realloc(buffer->data, capacity);
+    if (!data) {
+        buffer->failed = 1;
+        return -1;
+    }
+    
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Append raw bytes
+ * 
+ * @param buffer text buffer
+ * @param data bytes to append
+ * @param length number of bytes
+ */
+void text_buffer_append(TextBuffer *buffer, const char *data, size_t length) {
+    if (text_buffer_reserve(buffer, length) != 0) {
+        return;
+    }
+    
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+/**
+ * Append a string
+ * 
+ * @param buffer text buffer
+ * @param str NUL-terminated string
+ */
+void text_buffer_append_str(TextBuffer *buffer, const char *str) {
+    text_buffer_append(buffer, str, strlen(str));
+}
+
+/**
+ * Append formatted text
+ * 
+ * @param buffer text buffer
+ * @param format printf format
+ */
+void text_buffer_printf(TextBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    
+    if (length < 0 || text_buffer_reserve(buffer, (size_t)length) != 0) {
+        return;
+    }
+    
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, (size_t)length + 1, format, args);
+    va_end(args);
+    buffer->length += (size_t)length;
+}
+
+/**
+ * Append a string escaped for use inside a JSON string literal
+ * 
+ * @param buffer text buffer
+ * @param str NUL-terminated UTF-8 string
+ */
+void text_buffer_append_json(TextBuffer *buffer, const char *str) {
+    const char *run = str;
+    
+    for (const char *p = str; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        
+        // Flush the unescaped run before this character
+        text_buffer_append(buffer, run, (size_t)(p - run));
+        run = p + 1;
+        
+        switch (c) {
+            case '"':
+                text_buffer_append_str(buffer, "\\\"");
+                break;
+            case '\\':
+                text_buffer_append_str(buffer, "\\\\");
+                break;
+            case '\n':
+                text_buffer_append_str(buffer, "\\n");
+                break;
+            case '\r':
+                text_buffer_append_str(buffer, "\\r");
+                break;
+            case '\t':
+                text_buffer_append_str(buffer, "\\t");
+                break;
+            default:
+                text_buffer_printf(buffer, "\\u%04x", c);
+                break;
+        }
+    }
+    
+    text_buffer_append_str(buffer, run);
+}
+
+/**
+ * Append a string escaped for XML character data or attribute values
+ * 
+ * @param buffer text buffer
+ * @param str NUL-terminated UTF-8 string
+ */
+void text_buffer_append_xml(TextBuffer *buffer, const char *str) {
+    const char *run = str;
+    
+    for (const char *p = str; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '&' && c != '<' && c != '>' && c != '"' && c != '\'' &&
+            (c >= 0x20 || c == '\t' || c == '\n')) {
+            continue;
+        }
+        
+        text_buffer_append(buffer, run, (size_t)(p - run));
+        run = p + 1;
+        
+        switch (c) {
+            case '&':
+                text_buffer_append_str(buffer, "&amp;");
+                break;
+            case '<':
+                text_buffer_append_str(buffer, "&lt;");
+                break;
+            case '>':
+                text_buffer_append_str(buffer, "&gt;");
+                break;
+            case '"':
+                text_buffer_append_str(buffer, "&quot;");
+                break;
+            case '\'':
+                text_buffer_append_str(buffer, "&apos;");
+                break;
+            // Other control characters are not allowed in XML 1.0 at all;
+            // a character reference is what S3 itself sends
+            default:
+                text_buffer_printf(buffer, "&#x%x;", c);
+                break;
+        }
+    }
+    
+    text_buffer_append_str(buffer, run);
+}
+
+/**
+ * Drop bytes from the front of the buffer
+ * 
+ * @param buffer text buffer
+ * @param length number of bytes already sent
+ */
+void text_buffer_consume(TextBuffer *buffer, size_t length) {
+    if (length >= buffer->length) {
+        buffer->length = 0;
+    } else {
+        memmove(buffer->data, buffer->data + length, buffer->length - length);
+        buffer->length -= length;
+    }
+    
+    if (buffer->data) {
+        buffer->data[buffer->length] = '\0';
+    }
+}
+
+/**
+ * Take ownership of the buffer contents
+ * 
+ * @param buffer text buffer, left empty
+ * @return NUL-terminated text (free with free()) or NULL after a failure
+ */
+char *text_buffer_detach(TextBuffer *buffer) {
+    char *data = buffer->failed ? NULL : buffer->data;
+    
+    if (!data && !buffer->failed) {
+        data = strdup("");
+    }
+    if (buffer->failed) {
+        free(buffer->data);
+    }
+    
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->failed = 0;
+    return data;
+}
+
+/**
+ * Release the buffer
+ * 
+ * @param buffer text buffer, left empty
+ */
+void text_buffer_free(TextBuffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->failed = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef TEXT_BUFFER_H
+#define TEXT_BUFFER_H
+
+#include <stddef.h>
+
+// Growable output buffer for response bodies. A zero-initialized buffer is
+// empty and ready to use; after an allocation failure further appends are
+// ignored and `failed` stays set.
+typedef struct {
+    char *data;         // NUL-terminated once anything was appended
+    size_t length;
+    size_t capacity;
+    int failed;
+} TextBuffer;
+
+// Functions for building text
+void text_buffer_append(TextBuffer *buffer, const char *data, size_t length);
+void text_buffer_append_str(TextBuffer *buffer, const char *str);
+void text_buffer_printf(TextBuffer *buffer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void text_buffer_append_json(TextBuffer *buffer, const char *str);
+void text_buffer_append_xml(TextBuffer *buffer, const char *str);
+void text_buffer_consume(TextBuffer *buffer, size_t length);
+char *text_buffer_detach(TextBuffer *buffer);
+void text_buffer_free(TextBuffer *buffer);
+
+#endif /* TEXT_BUFFER_H */
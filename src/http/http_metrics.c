@@ -0,0 +1,385 @@
+#include "http_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Label values of HttpOperation, named after the S3 API calls
+static const char *const operation_names[HTTP_OP_COUNT] = {
+    "ListBuckets", "ListObjects", "GetObject", "HeadObject", "PutObject", "UploadPart",
+    "DeleteObject", "DeleteObjects", "CreateMultipartUpload", "CompleteMultipartUpload",
+    "AbortMultipartUpload", "Other"
+};
+
+// Status codes the server answers with; the last series takes the rest
+static const unsigned int status_codes[HTTP_METRICS_CODES - 1] = {
+    200, 204, 206, 304, 400, 403, 404, 416, 500, 503
+};
+
+/**
+ * Read the monotonic clock
+ * 
+ * @return nanoseconds since an arbitrary point
+ */
+uint64_t http_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Add to a counter only the calling thread writes
+ * 
+ * @param counter counter in the thread's block
+ * @param value amount to add
+ */
+static void add(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Find the series of a status code
+ * 
+ * @param status HTTP status code, 0 if no response was queued
+ * @return index into the code dimension
+ */
+static int code_index(unsigned int status) {
+    for (int i = 0; i < HTTP_METRICS_CODES - 1; i++) {
+        if (status_codes[i] == status) {
+            return i;
+        }
+    }
+    return HTTP_METRICS_CODES - 1;
+}
+
+/**
+ * Format the labels of a series
+ * 
+ * @param labels buffer receiving the labels, without braces
+ * @param size buffer size
+ * @param operation operation index
+ * @param code index into the code dimension
+ */
+static void format_labels(char *labels, size_t size, int operation, int code) {
+    if (code < HTTP_METRICS_CODES - 1) {
+        snprintf(labels, size, "operation=\"%s\",code=\"%u\"",
+                 operation_names[operation], status_codes[code]);
+    } else {
+        snprintf(labels, size, "operation=\"%s\",code=\"other\"", operation_names[operation]);
+    }
+}
+
+/**
+ * Find the latency bucket of a duration
+ * 
+ * @param ns duration in nanoseconds
+ * @return bucket index, HTTP_METRICS_BUCKETS if above the last bound
+ */
+static int bucket_index(uint64_t ns) {
+    // Bounds are inclusive, so a duration on a bound belongs below it
+    uint64_t us = (ns + 999) / 1000;
+    uint64_t value = us > 0 ? us - 1 : 0;
+    if (value < 32) {
+        return 0;
+    }
+    
+    int octave = 63 - __builtin_clzll(value);
+    int index = (octave - 5) * 4 + (int)((value >> (octave - 2)) & 3);
+    return index < HTTP_METRICS_BUCKETS ? index : HTTP_METRICS_BUCKETS;
+}
+
+/**
+ * Get the upper bound of a latency bucket
+ * 
+ * @param index bucket index below HTTP_METRICS_BUCKETS
+ * @return bound in microseconds
+ */
+static uint64_t bucket_bound_us(int index) {
+    return (uint64_t)(5 + index % 4) << (3 + index / 4);
+}
+
+/**
+ * Put a thread's block back for the next thread; runs when it exits
+ * 
+ * @param arg the thread's HttpMetricsThread
+ */
+static void release_block(void *arg) {
+    HttpMetricsThread *block = (HttpMetricsThread *)arg;
+    HttpMetrics *metrics = block->owner;
+    
+    pthread_mutex_lock(&metrics->lock);
+    block->next_free = metrics->free_threads;
+    metrics->free_threads = block;
+    pthread_mutex_unlock(&metrics->lock);
+}
+
+/**
+ * Get the calling thread's block, taking one on its first request
+ * 
+ * Blocks of exited threads are reused with their counts, so a thread
+ * per connection does not grow the list, and nothing is ever lost.
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ * @return the block or NULL on memory error
+ */
+static HttpMetricsThread *thread_block(HttpMetrics *metrics) {
+    HttpMetricsThread *block = (HttpMetricsThread *)pthread_getspecific(metrics->key);
+    if (block) {
+        return block;
+    }
+    
+    pthread_mutex_lock(&metrics->lock);
+    block = metrics->free_threads;
+    if (block) {
+        metrics->free_threads = block->next_free;
+    } else {
+        block = (HttpMetricsThread *)calloc(1, sizeof(HttpMetricsThread));
+        if (block) {
+            block->owner = metrics;
+            block->next = metrics->threads;
+            metrics->threads = block;
+        }
+    }
+    pthread_mutex_unlock(&metrics->lock);
+    
+    if (block && pthread_setspecific(metrics->key, block) != 0) {
+        release_block(block);
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Create empty metrics
+ * 
+ * @return pointer to HttpMetrics structure or NULL if error
+ */
+HttpMetrics *http_metrics_create(void) {
+    HttpMetrics *metrics = (HttpMetrics *)calloc(1, sizeof(HttpMetrics));
+    if (!metrics) {
+        return NULL;
+    }
+    
+    if (pthread_key_create(&metrics->key, &release_block) != 0) {
+        free(metrics);
+        return NULL;
+    }
+    pthread_mutex_init(&metrics->lock, NULL);
+    
+    return metrics;
+}
+
+/**
+ * Start measuring a request
+ * 
+ * @param metrics pointer to HttpMetrics structure, NULL to measure nothing
+ * @param request measurements to initialize
+ * @param operation S3 operation of the request
+ */
+void http_metrics_begin(HttpMetrics *metrics, HttpRequestMetrics *request, HttpOperation operation) {
+    request->owner = metrics;
+    request->active = 0;
+    request->operation = operation;
+    request->status = 0;
+    request->start_ns = http_metrics_now();
+    request->database_ns = 0;
+    request->received = 0;
+    request->sent = 0;
+    
+    HttpMetricsThread *block = metrics ? thread_block(metrics) : NULL;
+    if (block) {
+        add(&block->started[operation], 1);
+        request->active = 1;
+    }
+}
+
+/**
+ * Record a finished request; later calls for it do nothing
+ * 
+ * The time not spent on the database counts as HTTP I/O and processing.
+ * 
+ * @param request measurements from http_metrics_begin
+ */
+void http_metrics_finish(HttpRequestMetrics *request) {
+    if (!request || !request->active) {
+        return;
+    }
+    request->active = 0;
+    
+    HttpMetricsThread *block = thread_block(request->owner);
+    if (!block) {
+        return;
+    }
+    
+    uint64_t elapsed = http_metrics_now() - request->start_ns;
+    uint64_t database = request->database_ns < elapsed ? request->database_ns : elapsed;
+    int operation = request->operation;
+    int code = code_index(request->status);
+    
+    add(&block->finished[operation], 1);
+    add(&block->received[operation], request->received);
+    add(&block->sent[operation], request->sent);
+    add(&block->database_ns[operation], database);
+    add(&block->io_ns[operation], elapsed - database);
+    add(&block->duration_ns[operation][code], elapsed);
+    add(&block->buckets[operation][code][bucket_index(elapsed)], 1);
+}
+
+/**
+ * Sum every thread's counters
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ * @param total block receiving the sums, zeroed
+ */
+static void sum_threads(HttpMetrics *metrics, HttpMetricsThread *total) {
+    pthread_mutex_lock(&metrics->lock);
+    for (HttpMetricsThread *block = metrics->threads; block; block = block->next) {
+        for (int op = 0; op < HTTP_OP_COUNT; op++) {
+            total->started[op] += __atomic_load_n(&block->started[op], __ATOMIC_RELAXED);
+            total->finished[op] += __atomic_load_n(&block->finished[op], __ATOMIC_RELAXED);
+            total->received[op] += __atomic_load_n(&block->received[op], __ATOMIC_RELAXED);
+            total->sent[op] += __atomic_load_n(&block->sent[op], __ATOMIC_RELAXED);
+            total->database_ns[op] += __atomic_load_n(&block->database_ns[op], __ATOMIC_RELAXED);
+            total->io_ns[op] += __atomic_load_n(&block->io_ns[op], __ATOMIC_RELAXED);
+            
+            for (int code = 0; code < HTTP_METRICS_CODES; code++) {
+                total->duration_ns[op][code] +=
+                    __atomic_load_n(&block->duration_ns[op][code], __ATOMIC_RELAXED);
+                for (int i = 0; i <= HTTP_METRICS_BUCKETS; i++) {
+                    total->buckets[op][code][i] +=
+                        __atomic_load_n(&block->buckets[op][code][i], __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&metrics->lock);
+}
+
+/**
+ * Append one counter or gauge per operation
+ * 
+ * @param out buffer receiving the exposition
+ * @param name metric name
+ * @param type "counter" or "gauge"
+ * @param help description
+ * @param values one value per operation
+ * @param scale divisor turning the values into the metric's unit
+ */
+static void render_per_operation(TextBuffer *out, const char *name, const char *type,
+                                 const char *help, const uint64_t *values, double scale) {
+    text_buffer_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    for (int op = 0; op < HTTP_OP_COUNT; op++) {
+        text_buffer_printf(out, "%s{operation=\"%s\"} %.9g\n",
+                           name, operation_names[op], (double)values[op] / scale);
+    }
+}
+
+/**
+ * Append the metrics in the Prometheus text format
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ * @param out buffer receiving the exposition
+ */
+void http_metrics_render(HttpMetrics *metrics, TextBuffer *out) {
+    HttpMetricsThread *total = (HttpMetricsThread *)calloc(1, sizeof(HttpMetricsThread));
+    if (!total) {
+        out->failed = 1;
+        return;
+    }
+    sum_threads(metrics, total);
+    
+    // A request may start on one thread and finish on another
+    uint64_t in_flight[HTTP_OP_COUNT];
+    for (int op = 0; op < HTTP_OP_COUNT; op++) {
+        in_flight[op] = total->started[op] > total->finished[op] ?
+                        total->started[op] - total->finished[op] : 0;
+    }
+    
+    render_per_operation(out, "pgs3_http_requests_in_flight", "gauge",
+                         "Requests received and not finished yet", in_flight, 1);
+    render_per_operation(out, "pgs3_http_received_bytes_total", "counter",
+                         "Request body bytes of finished requests", total->received, 1);
+    render_per_operation(out, "pgs3_http_sent_bytes_total", "counter",
+                         "Response body bytes of finished requests", total->sent, 1);
+    render_per_operation(out, "pgs3_http_database_seconds_total", "counter",
+                         "Time finished requests held pooled PostgreSQL connections, "
+                         "including the wait for one, or waited for statements on the event loop",
+                         total->database_ns, 1e9);
+    render_per_operation(out, "pgs3_http_io_seconds_total", "counter",
+                         "Rest of the time of finished requests: receiving bodies, sending "
+                         "responses and the server's own work", total->io_ns, 1e9);
+    
+    uint64_t counts[HTTP_OP_COUNT][HTTP_METRICS_CODES];
+    for (int op = 0; op < HTTP_OP_COUNT; op++) {
+        for (int code = 0; code < HTTP_METRICS_CODES; code++) {
+            counts[op][code] = 0;
+            for (int i = 0; i <= HTTP_METRICS_BUCKETS; i++) {
+                counts[op][code] += total->buckets[op][code][i];
+            }
+        }
+    }
+    
+    // Series of operations and codes never seen are left out
+    char labels[96];
+    text_buffer_append_str(out, "# HELP pgs3_http_requests_total Finished requests\n"
+                           "# TYPE pgs3_http_requests_total counter\n");
+    for (int op = 0; op < HTTP_OP_COUNT; op++) {
+        for (int code = 0; code < HTTP_METRICS_CODES; code++) {
+            if (counts[op][code] > 0) {
+                format_labels(labels, sizeof(labels), op, code);
+                text_buffer_printf(out, "pgs3_http_requests_total{%s} %lu\n",
+                                   labels, (unsigned long)counts[op][code]);
+            }
+        }
+    }
+    
+    text_buffer_append_str(out, "# HELP pgs3_http_request_duration_seconds Time from receiving a "
+                           "request to sending the last byte of its response\n"
+                           "# TYPE pgs3_http_request_duration_seconds histogram\n");
+    for (int op = 0; op < HTTP_OP_COUNT; op++) {
+        for (int code = 0; code < HTTP_METRICS_CODES; code++) {
+            if (counts[op][code] == 0) {
+                continue;
+            }
+            format_labels(labels, sizeof(labels), op, code);
+            
+            uint64_t cumulative = 0;
+            for (int i = 0; i < HTTP_METRICS_BUCKETS; i++) {
+                cumulative += total->buckets[op][code][i];
+                text_buffer_printf(out, "pgs3_http_request_duration_seconds_bucket{%s,le=\"%.6g\"} %lu\n",
+                                   labels, (double)bucket_bound_us(i) / 1e6, (unsigned long)cumulative);
+            }
+            text_buffer_printf(out, "pgs3_http_request_duration_seconds_bucket{%s,le=\"+Inf\"} %lu\n"
+                               "pgs3_http_request_duration_seconds_sum{%s} %.9g\n"
+                               "pgs3_http_request_duration_seconds_count{%s} %lu\n",
+                               labels, (unsigned long)counts[op][code],
+                               labels, (double)total->duration_ns[op][code] / 1e9,
+                               labels, (unsigned long)counts[op][code]);
+        }
+    }
+    
+    free(total);
+}
+
+/**
+ * Free the metrics once no thread records requests anymore
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ */
+void http_metrics_free(HttpMetrics *metrics) {
+    if (!metrics) {
+        return;
+    }
+    
+    // Deleting the key first keeps exiting threads from releasing blocks
+    pthread_key_delete(metrics->key);
+    
+    HttpMetricsThread *block = metrics->threads;
+    while (block) {
+        HttpMetricsThread *next = block->next;
+        free(block);
+        block = next;
+    }
+    
+    pthread_mutex_destroy(&metrics->lock);
+    free(metrics);
+}
@@ -0,0 +1,117 @@
+#ifndef HTTP_METRICS_H
+#define HTTP_METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "../common/text_buffer.h"
+
+// S3 operation a request performs, the first label of every metric
+typedef enum {
+    HTTP_OP_LIST_BUCKETS,
+    HTTP_OP_LIST_OBJECTS,
+    HTTP_OP_GET_OBJECT,
+    HTTP_OP_HEAD_OBJECT,
+    HTTP_OP_PUT_OBJECT,
+    HTTP_OP_UPLOAD_PART,
+    HTTP_OP_DELETE_OBJECT,
+    HTTP_OP_DELETE_OBJECTS,
+    HTTP_OP_CREATE_UPLOAD,
+    HTTP_OP_COMPLETE_UPLOAD,
+    HTTP_OP_ABORT_UPLOAD,
+    HTTP_OP_OTHER,              // statistics, metrics and unknown paths
+    HTTP_OP_COUNT
+} HttpOperation;
+
+// Status codes with their own series; any other one counts as "other"
+#define HTTP_METRICS_CODES 11
+
+// Latency buckets: 4 per power of two from 32 us up to 2^25 us (33.6 s),
+// so a bucket's bounds are at most 25% apart. Slower requests only
+// appear in +Inf.
+#define HTTP_METRICS_BUCKETS 80
+
+// Counters of one thread. Only that thread writes them, with relaxed
+// atomic stores a scrape can read at any time, so recording a request
+// takes no lock and shares no cache line with other threads.
+typedef struct HttpMetricsThread {
+    struct HttpMetricsThread *next;         // every block, for scrapes
+    struct HttpMetricsThread *next_free;    // blocks of exited threads
+    struct HttpMetrics *owner;
+    uint64_t started[HTTP_OP_COUNT];
+    uint64_t finished[HTTP_OP_COUNT];
+    uint64_t received[HTTP_OP_COUNT];       // request body bytes
+    uint64_t sent[HTTP_OP_COUNT];           // response body bytes
+    uint64_t database_ns[HTTP_OP_COUNT];
+    uint64_t io_ns[HTTP_OP_COUNT];
+    uint64_t duration_ns[HTTP_OP_COUNT][HTTP_METRICS_CODES];
+    uint64_t buckets[HTTP_OP_COUNT][HTTP_METRICS_CODES][HTTP_METRICS_BUCKETS + 1];
+} HttpMetricsThread;
+
+// Request metrics of a server, summed over its threads when scraped
+typedef struct HttpMetrics {
+    pthread_key_t key;          // the calling thread's block
+    pthread_mutex_t lock;       // guards the lists, not the counters
+    HttpMetricsThread *threads;
+    HttpMetricsThread *free_threads;
+} HttpMetrics;
+
+// Measurements of one request, recorded when it finishes
+typedef struct {
+    HttpMetrics *owner;
+    int active;                 // begun and not recorded yet
+    HttpOperation operation;
+    unsigned int status;        // 0 until a response is queued
+    uint64_t start_ns;
+    uint64_t database_ns;       // holding pooled connections and waiting for the event loop
+    uint64_t received;
+    uint64_t sent;
+} HttpRequestMetrics;
+
+/**
+ * Read the monotonic clock
+ * 
+ * @return nanoseconds since an arbitrary point
+ */
+uint64_t http_metrics_now(void);
+
+/**
+ * Create empty metrics
+ * 
+ * @return pointer to HttpMetrics structure or NULL if error
+ */
+HttpMetrics *http_metrics_create(void);
+
+/**
+ * Start measuring a request
+ * 
+ * @param metrics pointer to HttpMetrics structure, NULL to measure nothing
+ * @param request measurements to initialize
+ * @param operation S3 operation of the request
+ */
+void http_metrics_begin(HttpMetrics *metrics, HttpRequestMetrics *request, HttpOperation operation);
+
+/**
+ * Record a finished request; later calls for it do nothing
+ * 
+ * The time not spent on the database counts as HTTP I/O and processing.
+ * 
+ * @param request measurements from http_metrics_begin
+ */
+void http_metrics_finish(HttpRequestMetrics *request);
+
+/**
+ * Append the metrics in the Prometheus text format
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ * @param out buffer receiving the exposition
+ */
+void http_metrics_render(HttpMetrics *metrics, TextBuffer *out);
+
+/**
+ * Free the metrics once no thread records requests anymore
+ * 
+ * @param metrics pointer to HttpMetrics structure
+ */
+void http_metrics_free(HttpMetrics *metrics);
+
+#endif /* HTTP_METRICS_H */
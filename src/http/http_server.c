@@ -1,45 +1,405 @@
 #include "http_server.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <microhttpd.h>
-#include "../pg/pg_client.h"
+#include "../pg/pg_pool.h"
+#include "../common/compression.h"
 
 // URL paths for S3 API
 #define S3_PATH_LIST_BUCKETS "/"
 #define S3_PATH_LIST_OBJECTS "/public"
 #define S3_PATH_OBJECT_PREFIX "/public/"
+#define S3_PATH_CACHE_STATS "/_pgs3/cache"
+#define S3_PATH_METRICS "/metrics"
 
-// Context for PUT request
+// How long a request waits for a free database connection before a 503.
+// Streaming responses hold their connection, so waiting forever could
+// deadlock a worker thread behind its own downloads.
+#define HTTP_POOL_CHECKOUT_TIMEOUT_MS 5000
+
+// Objects up to this size are answered from one query and one buffer;
+// larger ones are streamed
+#define HTTP_PREFETCH_LIMIT (256 * 1024)
+
+// Block size MHD requests from streaming response callbacks
+#define HTTP_STREAM_BLOCK_SIZE (64 * 1024)
+
+// Largest POST body accepted; a CompleteMultipartUpload listing all
+// 10000 parts stays well below it
+#define HTTP_MAX_POST_BODY (2 * 1024 * 1024)
+
+// How often the server drops expired multipart uploads
+#define HTTP_UPLOAD_EXPIRY_INTERVAL_SECONDS 3600
+
+// How long reads avoid a standby after it failed to serve one
+#define HTTP_REPLICA_RETRY_SECONDS 5
+
+// Progress of a request whose statement runs on the event loop
+enum {
+    HTTP_ASYNC_NONE,        // nothing sent yet
+    HTTP_ASYNC_WAITING,     // suspended until the result arrives
+    HTTP_ASYNC_DONE,        // resumed, the result is in async_result
+    HTTP_ASYNC_SKIPPED      // served on a pooled connection instead
+};
+
+// Context for every request; PUT and POST keep their body state here
 typedef struct {
-    char *data;
-    size_t size;
-    size_t capacity;
+    S3Upload *upload;       // body is written to the database as it arrives
+    PgClient *client;       // connection owned by the upload
+    PgPool *pool;           // the pool it came from
+    TextBuffer body;        // POST body, collected whole
     char *content_type;
     const char *url;
     const char *method;
+    struct MHD_Connection *connection;  // resumed when the async statement completes
+    int async_state;        // HTTP_ASYNC_*
+    PGresult *async_result; // NULL if the statement could not run
+    ObjectCache *cache;     // cache active when the statement was sent, if any
+    uint64_t generation;    // its generation for the key at that time
+    HttpReplica *replica;   // standby running the statement, NULL for the primary
+    int primary_only;       // a standby failed this read; retry it on the primary
+    HttpRequestMetrics metrics; // recorded when the request finishes
+    HttpRequestMetrics *stream_metrics; // streamed body taking them over once queued
+    int database_depth;         // connections held and statements in progress
+    uint64_t database_started;  // when the outermost of them began
+    uint64_t suspended_at;      // when the request started waiting for the event loop
 } RequestContext;
 
+// Streaming object download. The reader holds no connection between
+// pieces; one is checked out of the pool for each piece it fetches.
+typedef struct {
+    PgPool *pool;           // where pieces are read from
+    S3ObjectReader *reader;
+    size_t start;           // object offset of the response's first byte
+    HttpRequestMetrics metrics; // the request's, recorded when the body is done
+} ObjectStream;
+
+// Streaming object listing
+typedef struct {
+    int connection_count;   // one per shard
+    PgPool **pools;         // where each connection goes back
+    PgClient **clients;
+    S3ListStream *list;
+    int xml;
+    int entries;            // entries encoded so far
+    int finished;           // closing part of the document written
+    TextBuffer out;         // encoded, not yet sent
+    TextBuffer prefixes;    // XML <CommonPrefixes>, sent after the <Contents>
+    HttpRequestMetrics metrics; // the request's, recorded when the body is done
+} ListStream;
+
 // Request handler structure
 typedef struct {
     char *url;
     int (*handler)(HttpServer *, struct MHD_Connection *, const char *, const char *, size_t *);
 } RequestHandler;
 
+// Request the calling thread is handling, for the response helpers below
+static __thread RequestContext *current_request;
+
+// MHD_create_response_from_buffer, counting the body as sent by the
+// current request
+static struct MHD_Response *buffer_response(size_t size, void *buffer, enum MHD_ResponseMemoryMode mode)
+{
+    RequestContext *ctx = current_request;
+    if (ctx && ctx->metrics.operation != HTTP_OP_HEAD_OBJECT) {
+        ctx->metrics.sent += size;
+    }
+    return MHD_create_response_from_buffer(size, buffer, mode);
+}
+
+// MHD_queue_response, recording the status of the current request. A
+// streamed response takes the request's metrics over, so the request
+// ends when the body does.
+static int queue_response(struct MHD_Connection *connection, unsigned int status_code,
+                          struct MHD_Response *response)
+{
+    RequestContext *ctx = current_request;
+    if (ctx) {
+        ctx->metrics.status = status_code;
+    }
+    
+    int ret = MHD_queue_response(connection, status_code, response);
+    
+    if (ctx && ctx->stream_metrics) {
+        if (ret == MHD_YES) {
+            *ctx->stream_metrics = ctx->metrics;
+            ctx->metrics.active = 0;
+        }
+        ctx->stream_metrics = NULL;
+    }
+    return ret;
+}
+
+// Have a streamed body record the current request when it is done
+static void stream_request_metrics(HttpRequestMetrics *metrics)
+{
+    if (current_request) {
+        current_request->stream_metrics = metrics;
+    }
+}
+
+// Start counting database time for the current request. Spans nest, so
+// several connections held at once are counted once.
+static void database_begin(void)
+{
+    RequestContext *ctx = current_request;
+    if (ctx && ctx->database_depth++ == 0) {
+        ctx->database_started = http_metrics_now();
+    }
+}
+
+// End a span started by database_begin
+static void database_end(void)
+{
+    RequestContext *ctx = current_request;
+    if (ctx && ctx->database_depth > 0 && --ctx->database_depth == 0) {
+        ctx->metrics.database_ns += http_metrics_now() - ctx->database_started;
+    }
+}
+
+// Check a connection out for the current request. The time from here until
+// request_checkin, waiting for the pool included, is database time.
+static PgClient *request_checkout(PgPool *pool)
+{
+    database_begin();
+    PgClient *client = pg_pool_checkout(pool, HTTP_POOL_CHECKOUT_TIMEOUT_MS);
+    if (!client) {
+        database_end();
+    }
+    return client;
+}
+
+// Give back a connection taken with request_checkout
+static void request_checkin(PgPool *pool, PgClient *client)
+{
+    pg_pool_checkin(pool, client);
+    database_end();
+}
+
 // Forward declarations
 static int handle_list_buckets(HttpServer *server, struct MHD_Connection *connection, 
                                const char *url, const char *upload_data, size_t *upload_data_size);
 static int handle_list_objects(HttpServer *server, struct MHD_Connection *connection, 
                                const char *url, const char *upload_data, size_t *upload_data_size);
 static int handle_get_object(HttpServer *server, struct MHD_Connection *connection, 
-                             const char *url, const char *upload_data, size_t *upload_data_size);
+                             RequestContext *ctx);
+static int handle_head_object(HttpServer *server, struct MHD_Connection *connection, 
+                              RequestContext *ctx);
 static int handle_put_object(HttpServer *server, struct MHD_Connection *connection, 
                              RequestContext *ctx, const char *upload_data, size_t *upload_data_size);
 static int handle_delete_object(HttpServer *server, struct MHD_Connection *connection, 
                                 const char *url, const char *upload_data, size_t *upload_data_size);
+static int handle_cache_stats(HttpServer *server, struct MHD_Connection *connection, 
+                              const char *url, const char *upload_data, size_t *upload_data_size);
+static int handle_metrics(HttpServer *server, struct MHD_Connection *connection);
+static int handle_create_upload(HttpServer *server, struct MHD_Connection *connection, 
+                                RequestContext *ctx);
+static int handle_complete_upload(HttpServer *server, struct MHD_Connection *connection, 
+                                  RequestContext *ctx, const char *upload_id);
+static int handle_abort_upload(HttpServer *server, struct MHD_Connection *connection, 
+                               const char *url, const char *upload_id);
+static int handle_delete_objects(HttpServer *server, struct MHD_Connection *connection, 
+                                 RequestContext *ctx);
+static int queue_error(struct MHD_Connection *connection, unsigned int status_code,
+                       const char *message);
+
+// Drop cached copies of objects changed by any server, and read them from
+// the primary until the standbys have replayed the change. A NULL or empty
+// payload means we do not know what changed (the listener reconnected,
+// the key was too long for a payload, or the table was truncated).
+static void object_changed_callback(void *arg, const char *payload)
+{
+    HttpServer *server = (HttpServer *)arg;
+    
+    if (!payload || !payload[0]) {
+        write_pins_add_all(server->pins);
+        if (server->cache) {
+            object_cache_clear(server->cache);
+        }
+    } else {
+        write_pins_add(server->pins, payload);
+        if (server->cache) {
+            object_cache_invalidate(server->cache, payload);
+        }
+    }
+}
+
+// The database holding a key
+static HttpShard *shard_for(HttpServer *server, const char *key)
+{
+    return &server->shards[pg_shard_ring_lookup(&server->ring, key)];
+}
+
+// An object was written through this server: drop the cached copy without
+// waiting for the notification, and read it from the primary for a while
+static void object_written(HttpServer *server, const char *key)
+{
+    if (server->cache) {
+        object_cache_invalidate(server->cache, key);
+    }
+    write_pins_add(server->pins, key);
+}
+
+// Pick the standby a read of key goes to: the least loaded one that has
+// not failed lately. NULL sends it to the primary, as when there are no
+// standbys or the key was just written (key NULL: a read of many keys).
+static HttpReplica *choose_replica(HttpServer *server, const char *key)
+{
+    if (server->replica_count == 0 || write_pins_contains(server->pins, key)) {
+        return NULL;
+    }
+    
+    // Ties go round-robin, so idle standbys share the light load too
+    unsigned int start = __atomic_fetch_add(&server->replica_cursor, 1, __ATOMIC_RELAXED);
+    time_t now = time(NULL);
+    HttpReplica *best = NULL;
+    int best_load = INT_MAX;
+    
+    for (int i = 0; i < server->replica_count; i++) {
+        HttpReplica *replica = &server->replicas[(start + i) % server->replica_count];
+        if (__atomic_load_n(&replica->down_until, __ATOMIC_RELAXED) > now) {
+            continue;
+        }
+        
+        int load = pg_pool_in_use(replica->pool) + pg_async_outstanding(replica->async);
+        if (load < best_load) {
+            best = replica;
+            best_load = load;
+        }
+    }
+    
+    return best;
+}
+
+// Leave a standby out of reads for a while after it failed one
+static void replica_failed(HttpReplica *replica)
+{
+    __atomic_store_n(&replica->down_until, time(NULL) + HTTP_REPLICA_RETRY_SECONDS,
+                     __ATOMIC_RELAXED);
+}
+
+// Whether a failed read says more about the standby that ran it than about
+// the object, as when a recovery conflict cancels the statement
+static int is_replica_failure(const S3Result *result)
+{
+    return result && (result->status == S3_ERROR_EXECUTION ||
+                      result->status == S3_ERROR_CONNECTION);
+}
+
+// The standby a pool connects to, NULL for a primary's pool
+static HttpReplica *replica_of_pool(HttpServer *server, PgPool *pool)
+{
+    for (int i = 0; i < server->replica_count; i++) {
+        if (server->replicas[i].pool == pool) {
+            return &server->replicas[i];
+        }
+    }
+    return NULL;
+}
+
+// Check out a connection of the primary holding key (NULL: of many keys,
+// which only happens with a single shard)
+static PgClient *checkout_primary(HttpServer *server, const char *key, PgPool **pool)
+{
+    *pool = key ? shard_for(server, key)->pool : server->shards[0].pool;
+    return request_checkout(*pool);
+}
+
+// Check out a connection for a read of key, from a standby if one is
+// usable and from the key's primary otherwise. *pool receives the pool to
+// check it back in to.
+static PgClient *checkout_for_read(HttpServer *server, const char *key, PgPool **pool)
+{
+    HttpReplica *replica = choose_replica(server, key);
+    if (replica) {
+        PgClient *client = request_checkout(replica->pool);
+        if (client) {
+            *pool = replica->pool;
+            return client;
+        }
+        replica_failed(replica);
+    }
+    
+    return checkout_primary(server, key, pool);
+}
+
+// The object cache, if it can be trusted right now. While a listener is
+// reconnecting, writes made through other servers would go unnoticed.
+static ObjectCache *active_cache(HttpServer *server)
+{
+    for (int i = 0; i < server->shard_count; i++) {
+        if (!pg_listener_is_listening(server->shards[i].listener)) {
+            return NULL;
+        }
+    }
+    return server->cache;
+}
+
+// Queue a 503 when no database connection can be obtained
+static int queue_unavailable(struct MHD_Connection *connection)
+{
+    const char *error = "Database unavailable";
+    struct MHD_Response *response = buffer_response(
+        strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
+    
+    int ret = queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Called on the event loop thread: keep the result and have MHD call the
+// request handler again
+static void async_query_done(void *arg, PGresult *res)
+{
+    RequestContext *ctx = (RequestContext *)arg;
+    
+    ctx->metrics.database_ns += http_metrics_now() - ctx->suspended_at;
+    ctx->async_result = res;
+    ctx->async_state = HTTP_ASYNC_DONE;
+    MHD_resume_connection(ctx->connection);
+}
+
+// Suspend the request while a statement runs on the event loop, so the
+// worker thread can serve other connections meanwhile. If the loop takes
+// no more work, the request is resumed right away and served on a pooled
+// connection instead.
+static int suspend_for_query(PgAsync *async, struct MHD_Connection *connection,
+                             RequestContext *ctx, S3StatementId statement, int n_params,
+                             const char *const *values, int result_format)
+{
+    ctx->async_state = HTTP_ASYNC_WAITING;
+    ctx->suspended_at = http_metrics_now();
+    
+    // Suspend first: the result may arrive before pg_async_submit returns
+    MHD_suspend_connection(connection);
+    if (pg_async_submit(async, statement, n_params, values, result_format,
+                        &async_query_done, ctx) != 0) {
+        ctx->async_state = HTTP_ASYNC_SKIPPED;
+        MHD_resume_connection(connection);
+    }
+    
+    return MHD_YES;
+}
+
+// Take the result a resumed request was waiting for. Anything else the
+// request needs from the database goes through the pool.
+static PGresult *take_async_result(RequestContext *ctx)
+{
+    PGresult *res = ctx->async_result;
+    ctx->async_result = NULL;
+    ctx->async_state = HTTP_ASYNC_SKIPPED;
+    return res;
+}
 
 // Handle PUT data
 static enum MHD_Result
@@ -62,98 +422,272 @@ request_completed_callback(void *cls, struct MHD_Connection *connection,
     RequestContext *ctx = *con_cls;
     
     if (ctx) {
-        if (ctx->data)
-            free(ctx->data);
+        http_metrics_finish(&ctx->metrics);
+        
+        // Client went away mid-upload: roll the partial object back
+        if (ctx->upload)
+            s3_upload_abort(ctx->upload);
+        if (ctx->client)
+            pg_pool_checkin(ctx->pool, ctx->client);
         if (ctx->content_type)
             free(ctx->content_type);
+        PQclear(ctx->async_result);
+        text_buffer_free(&ctx->body);
         free(ctx);
         *con_cls = NULL;
     }
 }
 
-// Main request handler callback
+// Start streaming a PUT body into the database. Returns 0 on success, -1
+// if no connection could be obtained and 1 if the body is too large.
+static int begin_put_upload(HttpServer *server, struct MHD_Connection *connection,
+                            RequestContext *ctx)
+{
+    // Extract key from URL (skip "/public/")
+    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
+    const char *length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Content-Length");
+    size_t expected_size = length ? (size_t)strtoull(length, NULL, 10) : 0;
+    
+    ctx->pool = shard_for(server, key)->pool;
+    ctx->client = request_checkout(ctx->pool);
+    if (!ctx->client) {
+        return -1;
+    }
+    
+    // UploadPart: the body becomes one part of a multipart upload
+    const char *upload_id = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "uploadId");
+    const char *part_number = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "partNumber");
+    if (upload_id && part_number) {
+        ctx->upload = pg_client_begin_part_upload(ctx->client, "public", key, upload_id,
+                                                  atoi(part_number));
+    } else {
+        ctx->upload = pg_client_begin_upload(ctx->client, "public", key, ctx->content_type);
+    }
+    if (!ctx->upload) {
+        request_checkin(ctx->pool, ctx->client);
+        ctx->client = NULL;
+        return -1;
+    }
+    
+    // Inline objects are stored in one statement once the body is complete,
+    // so they hold no connection while it arrives
+    if (s3_upload_detach(ctx->upload) == 0) {
+        request_checkin(ctx->pool, ctx->client);
+        ctx->client = NULL;
+        
+        if (expected_size > S3_INLINE_MAX_SIZE) {
+            s3_upload_abort(ctx->upload);
+            ctx->upload = NULL;
+            return 1;
+        }
+    } else {
+        // Receiving the body is not database time; only its writes are
+        database_end();
+    }
+    
+    s3_upload_reserve(ctx->upload, expected_size);
+    
+    return 0;
+}
+
+// Find a query argument that may have no value, like "?uploads"
 static enum MHD_Result
-request_handler(void *cls, struct MHD_Connection *connection,
-                const char *url, const char *method,
-                const char *version, const char *upload_data,
-                size_t *upload_data_size, void **con_cls)
+find_argument(void *cls, enum MHD_ValueKind kind, const char *key, const char *value)
 {
-    HttpServer *server = (HttpServer *)cls;
+    const char **name = (const char **)cls;
+    
+    if (*name && strcmp(key, *name) == 0) {
+        *name = NULL;
+        return MHD_NO;
+    }
+    
+    return MHD_YES;
+}
+
+static int has_argument(struct MHD_Connection *connection, const char *name)
+{
+    MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND, &find_argument, &name);
+    return name == NULL;
+}
+
+// The S3 operation a request performs, as dispatch_request routes it
+static HttpOperation request_operation(struct MHD_Connection *connection, const char *method,
+                                       const char *url)
+{
+    int object = strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0;
+    int upload = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "uploadId") != NULL;
+    
+    if (strcmp(method, "GET") == 0) {
+        if (strcmp(url, S3_PATH_LIST_BUCKETS) == 0) {
+            return HTTP_OP_LIST_BUCKETS;
+        } else if (strcmp(url, S3_PATH_LIST_OBJECTS) == 0) {
+            return HTTP_OP_LIST_OBJECTS;
+        } else if (object) {
+            return HTTP_OP_GET_OBJECT;
+        }
+    } else if (strcmp(method, "HEAD") == 0 && object) {
+        return HTTP_OP_HEAD_OBJECT;
+    } else if (strcmp(method, "PUT") == 0 && object) {
+        return upload ? HTTP_OP_UPLOAD_PART : HTTP_OP_PUT_OBJECT;
+    } else if (strcmp(method, "POST") == 0) {
+        if (strcmp(url, S3_PATH_LIST_OBJECTS) == 0 && has_argument(connection, "delete")) {
+            return HTTP_OP_DELETE_OBJECTS;
+        } else if (object && upload) {
+            return HTTP_OP_COMPLETE_UPLOAD;
+        } else if (object && has_argument(connection, "uploads")) {
+            return HTTP_OP_CREATE_UPLOAD;
+        }
+    } else if (strcmp(method, "DELETE") == 0 && object) {
+        return upload ? HTTP_OP_ABORT_UPLOAD : HTTP_OP_DELETE_OBJECT;
+    }
     
+    return HTTP_OP_OTHER;
+}
+
+// Route a request to its handler
+static enum MHD_Result
+dispatch_request(HttpServer *server, struct MHD_Connection *connection,
+                 const char *url, const char *method,
+                 const char *upload_data, size_t *upload_data_size, void **con_cls)
+{
     if (*con_cls == NULL) {
         // First call for this request
         RequestContext *ctx = malloc(sizeof(RequestContext));
         if (!ctx) return MHD_NO;
         
-        ctx->data = NULL;
-        ctx->size = 0;
-        ctx->capacity = 0;
+        ctx->upload = NULL;
+        ctx->client = NULL;
+        ctx->pool = NULL;
         ctx->content_type = NULL;
+        ctx->body = (TextBuffer){0};
         ctx->url = url;
         ctx->method = method;
+        ctx->connection = connection;
+        ctx->async_state = HTTP_ASYNC_NONE;
+        ctx->async_result = NULL;
+        ctx->cache = NULL;
+        ctx->generation = 0;
+        ctx->replica = NULL;
+        ctx->primary_only = 0;
+        ctx->stream_metrics = NULL;
+        ctx->database_depth = 0;
+        ctx->database_started = 0;
+        ctx->suspended_at = 0;
+        http_metrics_begin(server->metrics, &ctx->metrics, request_operation(connection, method, url));
+        *con_cls = ctx;
+        current_request = ctx;
         
-        // For PUT requests, get the content type
-        if (strcmp(method, "PUT") == 0) {
+        // For PUT and POST requests, get the content type
+        if (strcmp(method, "PUT") == 0 || strcmp(method, "POST") == 0) {
             MHD_get_connection_values(connection, MHD_HEADER_KIND, &put_data_handler, ctx);
             
             // Set default content type if not provided
             if (!ctx->content_type) {
                 ctx->content_type = strdup("application/octet-stream");
             }
+            
+            if (strcmp(method, "PUT") == 0 &&
+                strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
+                int rc = begin_put_upload(server, connection, ctx);
+                if (rc < 0) {
+                    return queue_unavailable(connection);
+                } else if (rc > 0) {
+                    return queue_error(connection, MHD_HTTP_PAYLOAD_TOO_LARGE, "Object is too large");
+                }
+            }
         }
         
-        *con_cls = ctx;
         return MHD_YES;
     }
     
     RequestContext *ctx = *con_cls;
     
-    printf("Processing request: %s %s\n", method, url);
-    
     // Handle PUT data upload
     if (strcmp(method, "PUT") == 0 && *upload_data_size > 0) {
-        // Allocate or expand buffer as needed
-        if (ctx->capacity < ctx->size + *upload_data_size) {
-            size_t new_capacity = ctx->capacity == 0 ? 
-                *upload_data_size * 2 : (ctx->size + *upload_data_size) * 2;
-            
-            char *new_data = realloc(ctx->data, new_capacity);
-            if (!new_data) {
-                return MHD_NO;
+        ctx->metrics.received += *upload_data_size;
+        
+        // Full chunks go to the database right away; a failure is kept in
+        // the upload and reported once the body is complete
+        if (ctx->upload) {
+            if (ctx->client) {
+                database_begin();
+            }
+            s3_upload_write(ctx->upload, upload_data, *upload_data_size);
+            if (ctx->client) {
+                database_end();
             }
-            
-            ctx->data = new_data;
-            ctx->capacity = new_capacity;
         }
         
-        // Copy the data
-        memcpy(ctx->data + ctx->size, upload_data, *upload_data_size);
-        ctx->size += *upload_data_size;
-        
         // Mark this chunk as processed
         *upload_data_size = 0;
         return MHD_YES;
     }
     
+    // POST bodies are small XML documents; collect them whole
+    if (strcmp(method, "POST") == 0 && *upload_data_size > 0) {
+        ctx->metrics.received += *upload_data_size;
+        if (ctx->body.length + *upload_data_size > HTTP_MAX_POST_BODY) {
+            // Further appends are ignored; rejected once the body is complete
+            ctx->body.failed = 1;
+        }
+        text_buffer_append(&ctx->body, upload_data, *upload_data_size);
+        
+        *upload_data_size = 0;
+        return MHD_YES;
+    }
+    
     // Process the actual request based on method and URL
-    if (strcmp(method, "GET") == 0) {
+    if (strcmp(method, "HEAD") == 0) {
+        if (strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
+            // Head object
+            return handle_head_object(server, connection, ctx);
+        }
+    } else if (strcmp(method, "GET") == 0) {
         if (strcmp(url, S3_PATH_LIST_BUCKETS) == 0) {
             // List buckets
             return handle_list_buckets(server, connection, url, upload_data, upload_data_size);
+        } else if (strcmp(url, S3_PATH_CACHE_STATS) == 0) {
+            // Object cache counters
+            return handle_cache_stats(server, connection, url, upload_data, upload_data_size);
+        } else if (strcmp(url, S3_PATH_METRICS) == 0) {
+            // Prometheus metrics
+            return handle_metrics(server, connection);
         } else if (strcmp(url, S3_PATH_LIST_OBJECTS) == 0) {
             // List objects in bucket
             return handle_list_objects(server, connection, url, upload_data, upload_data_size);
         } else if (strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
             // Get object
-            return handle_get_object(server, connection, url, upload_data, upload_data_size);
+            return handle_get_object(server, connection, ctx);
         }
     } else if (strcmp(method, "PUT") == 0) {
         if (strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
             // Put object (only process when we have all data)
             return handle_put_object(server, connection, ctx, upload_data, upload_data_size);
         }
+    } else if (strcmp(method, "POST") == 0) {
+        if (strcmp(url, S3_PATH_LIST_OBJECTS) == 0 && has_argument(connection, "delete")) {
+            // Delete several objects
+            return handle_delete_objects(server, connection, ctx);
+        } else if (strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
+            const char *upload_id = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND,
+                                                                "uploadId");
+            if (upload_id) {
+                // Complete multipart upload
+                return handle_complete_upload(server, connection, ctx, upload_id);
+            } else if (has_argument(connection, "uploads")) {
+                // Create multipart upload
+                return handle_create_upload(server, connection, ctx);
+            }
+        }
     } else if (strcmp(method, "DELETE") == 0) {
         if (strncmp(url, S3_PATH_OBJECT_PREFIX, strlen(S3_PATH_OBJECT_PREFIX)) == 0) {
+            const char *upload_id = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND,
+                                                                "uploadId");
+            if (upload_id) {
+                // Abort multipart upload
+                return handle_abort_upload(server, connection, url, upload_id);
+            }
+            
             // Delete object
             return handle_delete_object(server, connection, url, upload_data, upload_data_size);
         }
@@ -161,319 +695,1882 @@ request_handler(void *cls, struct MHD_Connection *connection,
     
     // Method not allowed or path not found
     const char *not_found = "Not Found";
-    struct MHD_Response *response = MHD_create_response_from_buffer(
+    struct MHD_Response *response = buffer_response(
         strlen(not_found), (void *)not_found, MHD_RESPMEM_PERSISTENT);
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
+    int ret = queue_response(connection, MHD_HTTP_NOT_FOUND, response);
     MHD_destroy_response(response);
     
     return ret;
 }
 
+// Main request handler callback
+static enum MHD_Result
+request_handler(void *cls, struct MHD_Connection *connection,
+                const char *url, const char *method,
+                const char *version, const char *upload_data,
+                size_t *upload_data_size, void **con_cls)
+{
+    HttpServer *server = (HttpServer *)cls;
+    
+    current_request = *con_cls;
+    
+    enum MHD_Result ret = dispatch_request(server, connection, url, method,
+                                           upload_data, upload_data_size, con_cls);
+    
+    current_request = NULL;
+    
+    return ret;
+}
+
 // Handle list buckets (GET /)
 static int handle_list_buckets(HttpServer *server, struct MHD_Connection *connection, 
                                const char *url, const char *upload_data, size_t *upload_data_size)
 {
-    S3Result *result = pg_client_list_buckets(server->pg_client);
+    // Every shard has the same buckets
+    PgPool *pool = server->shards[0].pool;
+    PgClient *client = request_checkout(pool);
+    if (!client) {
+        return queue_unavailable(connection);
+    }
+    
+    S3Result *result = pg_client_list_buckets(client);
+    request_checkin(pool, client);
+    
     if (!result || result->status != S3_SUCCESS) {
         const char *error = "Internal Server Error";
         if (result && result->error_message) {
             error = result->error_message;
         }
         
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
+        struct MHD_Response *response = buffer_response(
+            strlen(error), (void *)error, MHD_RESPMEM_MUST_COPY);
         
-        int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
+        int ret = queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
         MHD_destroy_response(response);
         
         if (result) s3_result_free(result);
         return ret;
     }
     
-    struct MHD_Response *response = MHD_create_response_from_buffer(
+    struct MHD_Response *response = buffer_response(
         result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
     
     MHD_add_response_header(response, "Content-Type", result->content_type);
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
     
     s3_result_free(result);
     return ret;
 }
 
-// Handle list objects (GET /public)
-static int handle_list_objects(HttpServer *server, struct MHD_Connection *connection, 
-                               const char *url, const char *upload_data, size_t *upload_data_size)
+// Queue a plain-text error response
+static int queue_error(struct MHD_Connection *connection, unsigned int status_code,
+                       const char *message)
 {
-    // Get prefix parameter if present
-    const char *prefix = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "prefix");
+    struct MHD_Response *response = buffer_response(
+        strlen(message), (void *)message, MHD_RESPMEM_MUST_COPY);
+    if (!response) {
+        return MHD_NO;
+    }
     
-    S3Result *result = pg_client_list_objects(server->pg_client, "public");
-    if (!result || result->status != S3_SUCCESS) {
-        const char *error = "Internal Server Error";
-        if (result && result->error_message) {
+    int ret = queue_response(connection, status_code, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Queue the error of a failed operation: 404 for a missing object or
+// upload, 413 for an object too large to store, 400 for a request the API
+// rejected, 500 otherwise
+static int queue_result_error(struct MHD_Connection *connection, const S3Result *result)
+{
+    unsigned int status_code = MHD_HTTP_INTERNAL_SERVER_ERROR;
+    const char *error = "Internal Server Error";
+    
+    if (result) {
+        if (result->status == S3_ERROR_NOT_FOUND) {
+            status_code = MHD_HTTP_NOT_FOUND;
+        } else if (result->status == S3_ERROR_TOO_LARGE) {
+            status_code = MHD_HTTP_PAYLOAD_TOO_LARGE;
+        } else if (result->status == S3_ERROR_INVALID_INPUT) {
+            status_code = MHD_HTTP_BAD_REQUEST;
+        }
+        if (result->error_message) {
             error = result->error_message;
         }
-        
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
-        
-        int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
-        
-        if (result) s3_result_free(result);
-        return ret;
     }
     
-    // Apply prefix filter if needed
-    if (prefix && *prefix && result->data) {
-        // Simple JSON parsing to filter by prefix
-        // In a real implementation, use a JSON library
-        char *json = (char*)result->data;
-        char *filtered = malloc(result->data_size);
-        if (!filtered) {
-            s3_result_free(result);
-            const char *error = "Memory allocation failed";
-            struct MHD_Response *response = MHD_create_response_from_buffer(
-                strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
-            
-            int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-            MHD_destroy_response(response);
-            return ret;
-        }
-        
-        // Start with opening bracket
-        strcpy(filtered, "[");
-        size_t pos = 1;
+    return queue_error(connection, status_code, error);
+}
+
+// Encode listing entries until at least `want` bytes are pending or the
+// listing is complete, then add the closing part of the document
+static int list_stream_fill(ListStream *stream, size_t want)
+{
+    while (!stream->finished && stream->out.length < want) {
+        S3ListEntry entry;
+        int rc = s3_list_next(stream->list, &entry);
         
-        // Find objects in JSON array
-        char *obj_start = strchr(json, '{');
-        int count = 0;
+        if (rc < 0) {
+            return -1;
+        }
         
-        while (obj_start) {
-            // Find end of this object
-            char *obj_end = strchr(obj_start, '}');
-            if (!obj_end) break;
-            
-            // Extract key from this object
-            char *key_start = strstr(obj_start, "\"Key\":\"");
-            if (!key_start || key_start > obj_end) {
-                // Move to next object
-                obj_start = strchr(obj_end, '{');
-                continue;
+        if (rc > 0) {
+            if (stream->xml) {
+                // S3 lists all <Contents> before the <CommonPrefixes>;
+                // a page holds at most 1000 entries, so buffering is bounded
+                s3_list_entry_write_xml(entry.is_prefix ? &stream->prefixes : &stream->out, &entry);
+            } else {
+                if (stream->entries > 0) {
+                    text_buffer_append_str(&stream->out, ",");
+                }
+                s3_list_entry_write_json(&stream->out, &entry);
             }
-            
-            key_start += 7; // Skip "Key":"
-            char *key_end = strchr(key_start, '\"');
-            if (!key_end || key_end > obj_end) {
-                // Move to next object
-                obj_start = strchr(obj_end, '{');
-                continue;
+            stream->entries++;
+            continue;
+        }
+        
+        if (stream->xml) {
+            text_buffer_append(&stream->out, stream->prefixes.data ? stream->prefixes.data : "",
+                               stream->prefixes.length);
+            if (stream->prefixes.failed) {
+                return -1;
             }
             
-            // Check if key starts with prefix
-            size_t prefix_len = strlen(prefix);
-            size_t key_len = key_end - key_start;
-            if (key_len >= prefix_len && strncmp(key_start, prefix, prefix_len) == 0) {
-                // Include this object in filtered result
-                if (count > 0) {
-                    filtered[pos++] = ',';
+            const char *last_key = s3_list_last_key(stream->list);
+            text_buffer_printf(&stream->out, "<KeyCount>%d</KeyCount><IsTruncated>%s</IsTruncated>",
+                               stream->entries, last_key ? "true" : "false");
+            if (last_key) {
+                char *next_token = s3_list_token_encode(last_key);
+                if (!next_token) {
+                    return -1;
                 }
-                
-                // Copy the object
-                size_t obj_len = obj_end - obj_start + 1;
-                strncpy(filtered + pos, obj_start, obj_len);
-                pos += obj_len;
-                count++;
+                text_buffer_printf(&stream->out, "<NextContinuationToken>%s</NextContinuationToken>",
+                                   next_token);
+                free(next_token);
             }
-            
-            // Move to next object
-            obj_start = strchr(obj_end, '{');
+            text_buffer_append_str(&stream->out, "</ListBucketResult>");
+        } else {
+            text_buffer_append_str(&stream->out, "]");
         }
-        
-        // Close the array
-        filtered[pos++] = ']';
-        filtered[pos] = '\0';
-        
-        // Create response from filtered data
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            pos, filtered, MHD_RESPMEM_MUST_FREE);
-        
-        MHD_add_response_header(response, "Content-Type", result->content_type);
-        
-        int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-        MHD_destroy_response(response);
-        
+        stream->finished = 1;
+    }
+    
+    return stream->out.failed ? -1 : 0;
+}
+
+// Produce the next block of a streamed listing
+static ssize_t list_stream_read(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    ListStream *stream = (ListStream *)cls;
+    
+    // Encoding is cheap next to fetching the rows
+    uint64_t started = http_metrics_now();
+    int filled = list_stream_fill(stream, max);
+    stream->metrics.database_ns += http_metrics_now() - started;
+    if (filled != 0) {
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    
+    if (stream->out.length == 0) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    
+    size_t n = stream->out.length < max ? stream->out.length : max;
+    memcpy(buf, stream->out.data, n);
+    text_buffer_consume(&stream->out, n);
+    stream->metrics.sent += n;
+    
+    return (ssize_t)n;
+}
+
+// Finish a streamed listing and give its connections back
+static void list_stream_free(void *cls)
+{
+    ListStream *stream = (ListStream *)cls;
+    if (!stream) {
+        return;
+    }
+    
+    http_metrics_finish(&stream->metrics);
+    s3_list_close(stream->list);
+    for (int i = 0; i < stream->connection_count; i++) {
+        pg_pool_checkin(stream->pools[i], stream->clients[i]);
+    }
+    free(stream->pools);
+    free(stream->clients);
+    text_buffer_free(&stream->out);
+    text_buffer_free(&stream->prefixes);
+    free(stream);
+}
+
+// Handle list objects (GET /public)
+//
+// Rows are encoded as MHD asks for more body, so a listing starts
+// responding immediately and uses constant memory however many keys it
+// covers. With list-type=2 the body is a ListObjectsV2 XML document (at
+// most 1000 keys). Otherwise it is a JSON array, of every matching key
+// unless max-keys asks for a page; common prefixes appear as
+// {"Prefix": ...} entries.
+static int handle_list_objects(HttpServer *server, struct MHD_Connection *connection, 
+                               const char *url, const char *upload_data, size_t *upload_data_size)
+{
+    const char *list_type = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "list-type");
+    const char *prefix = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "prefix");
+    const char *start_after = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "start-after");
+    const char *token = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "continuation-token");
+    const char *max_keys_arg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "max-keys");
+    const char *delimiter = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "delimiter");
+    int xml = list_type && strcmp(list_type, "2") == 0;
+    
+    S3ListOptions options = {prefix, start_after, xml ? S3_LIST_MAX_KEYS : S3_LIST_UNLIMITED, delimiter};
+    
+    if (max_keys_arg) {
+        char *end;
+        long max_keys = strtol(max_keys_arg, &end, 10);
+        if (*max_keys_arg == '\0' || *end != '\0' || max_keys < 0) {
+            return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Invalid max-keys");
+        }
+        options.max_keys = max_keys < S3_LIST_MAX_KEYS ? (int)max_keys : S3_LIST_MAX_KEYS;
+    }
+    
+    // The continuation token wins over start-after, as in S3
+    char *token_key = NULL;
+    if (token) {
+        token_key = s3_list_token_decode(token);
+        if (!token_key) {
+            return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Invalid continuation-token");
+        }
+        options.start_after = token_key;
+    }
+    
+    ListStream *stream = (ListStream *)calloc(1, sizeof(ListStream));
+    if (stream) {
+        stream->pools = (PgPool **)calloc(server->shard_count, sizeof(PgPool *));
+        stream->clients = (PgClient **)calloc(server->shard_count, sizeof(PgClient *));
+    }
+    if (!stream || !stream->pools || !stream->clients) {
+        free(token_key);
+        list_stream_free(stream);
+        return MHD_NO;
+    }
+    stream->connection_count = server->shard_count;
+    stream->xml = xml;
+    
+    // Listings may trail writes by the standbys' replay lag. With several
+    // shards, each one's primary lists its keys and the pages are merged.
+    database_begin();
+    int checked_out = 1;
+    if (server->shard_count == 1) {
+        stream->clients[0] = checkout_for_read(server, NULL, &stream->pools[0]);
+        checked_out = stream->clients[0] != NULL;
+        if (checked_out) {
+            // The stream checks it back in; its span ends with this one
+            database_end();
+        }
+    } else {
+        for (int i = 0; i < server->shard_count && checked_out; i++) {
+            stream->pools[i] = server->shards[i].pool;
+            stream->clients[i] = pg_pool_checkout(stream->pools[i], HTTP_POOL_CHECKOUT_TIMEOUT_MS);
+            checked_out = stream->clients[i] != NULL;
+        }
+    }
+    if (!checked_out) {
+        free(token_key);
+        list_stream_free(stream);
+        database_end();
+        return queue_unavailable(connection);
+    }
+    
+    S3Result *result = pg_shards_list_merged(stream->clients, stream->connection_count,
+                                             "public", &options, &stream->list);
+    free(token_key);
+    database_end();
+    
+    if (!result || result->status != S3_SUCCESS) {
+        list_stream_free(stream);
+        
+        unsigned int status_code = result && result->status == S3_ERROR_INVALID_INPUT ?
+                                   MHD_HTTP_BAD_REQUEST : MHD_HTTP_INTERNAL_SERVER_ERROR;
+        int ret = queue_error(connection, status_code,
+                              result && result->error_message ? result->error_message
+                                                              : "Internal Server Error");
         s3_result_free(result);
         return ret;
     }
+    s3_result_free(result);
+    
+    if (xml) {
+        text_buffer_append_str(&stream->out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                               "<ListBucketResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">"
+                               "<Name>public</Name><Prefix>");
+        text_buffer_append_xml(&stream->out, prefix ? prefix : "");
+        text_buffer_printf(&stream->out, "</Prefix><MaxKeys>%d</MaxKeys>", options.max_keys);
+        if (token) {
+            text_buffer_append_str(&stream->out, "<ContinuationToken>");
+            text_buffer_append_xml(&stream->out, token);
+            text_buffer_append_str(&stream->out, "</ContinuationToken>");
+        }
+        if (start_after) {
+            text_buffer_append_str(&stream->out, "<StartAfter>");
+            text_buffer_append_xml(&stream->out, start_after);
+            text_buffer_append_str(&stream->out, "</StartAfter>");
+        }
+        if (delimiter) {
+            text_buffer_append_str(&stream->out, "<Delimiter>");
+            text_buffer_append_xml(&stream->out, delimiter);
+            text_buffer_append_str(&stream->out, "</Delimiter>");
+        }
+    } else {
+        text_buffer_append_str(&stream->out, "[");
+    }
+    
+    struct MHD_Response *response;
+    
+    if (!xml && options.max_keys != S3_LIST_UNLIMITED) {
+        // A JSON page reports the next token in a header, which has to be
+        // known before the body; the page is small, so encode it up front
+        database_begin();
+        int filled = list_stream_fill(stream, SIZE_MAX);
+        database_end();
+        if (filled != 0) {
+            list_stream_free(stream);
+            return queue_error(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, "Failed to list objects");
+        }
+        
+        const char *last_key = s3_list_last_key(stream->list);
+        char *next_token = last_key ? s3_list_token_encode(last_key) : NULL;
+        
+        response = buffer_response(
+            stream->out.length, stream->out.data, MHD_RESPMEM_MUST_COPY);
+        list_stream_free(stream);
+        if (!response) {
+            free(next_token);
+            return MHD_NO;
+        }
+        
+        if (next_token) {
+            MHD_add_response_header(response, "X-Pgs3-Next-Continuation-Token", next_token);
+            free(next_token);
+        }
+    } else {
+        response = MHD_create_response_from_callback(
+            MHD_SIZE_UNKNOWN, HTTP_STREAM_BLOCK_SIZE, &list_stream_read, stream, &list_stream_free);
+        if (!response) {
+            list_stream_free(stream);
+            return MHD_NO;
+        }
+        stream_request_metrics(&stream->metrics);
+    }
+    
+    MHD_add_response_header(response, "Content-Type", xml ? "application/xml" : "application/json");
+    
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Produce the next block of a streamed object
+static ssize_t object_stream_read(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    ObjectStream *stream = (ObjectStream *)cls;
+    
+    uint64_t started = http_metrics_now();
+    stream->reader->offset = stream->start + (size_t)pos;
+    
+    ssize_t n;
+    if (s3_reader_needs_fetch(stream->reader)) {
+        PgClient *client = pg_pool_checkout(stream->pool, HTTP_POOL_CHECKOUT_TIMEOUT_MS);
+        if (!client) {
+            return MHD_CONTENT_READER_END_WITH_ERROR;
+        }
+        n = pg_client_attach_reader(client, stream->reader) == 0 ?
+            s3_reader_read(stream->reader, buf, max) : -1;
+        s3_reader_attach(stream->reader, NULL);
+        pg_pool_checkin(stream->pool, client);
+    } else {
+        n = s3_reader_read(stream->reader, buf, max);
+    }
+    stream->metrics.database_ns += http_metrics_now() - started;
+    
+    if (n < 0) {
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    if (n == 0) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    
+    stream->metrics.sent += (uint64_t)n;
+    return n;
+}
+
+// Finish a streamed object
+static void object_stream_free(void *cls)
+{
+    ObjectStream *stream = (ObjectStream *)cls;
+    
+    http_metrics_finish(&stream->metrics);
+    s3_reader_close(stream->reader);
+    free(stream);
+}
+
+// Parse a "Range: bytes=..." header against an object size. Returns 1 with
+// the range filled in, 0 to serve the whole object (several ranges or a
+// malformed header, which RFC 9110 lets us ignore) and -1 if unsatisfiable.
+static int parse_range(const char *header, size_t size, size_t *offset, size_t *length)
+{
+    if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',')) {
+        return 0;
+    }
+    
+    const char *spec = header + 6;
+    const char *dash = strchr(spec, '-');
+    if (!dash) {
+        return 0;
+    }
+    
+    char *end;
+    if (dash == spec) {
+        // Suffix range: the last N bytes
+        if (!isdigit((unsigned char)dash[1])) {
+            return 0;
+        }
+        unsigned long long suffix = strtoull(dash + 1, &end, 10);
+        if (*end != '\0') {
+            return 0;
+        }
+        if (suffix == 0 || size == 0) {
+            return -1;
+        }
+        *offset = suffix >= size ? 0 : size - (size_t)suffix;
+        *length = size - *offset;
+        return 1;
+    }
+    
+    if (!isdigit((unsigned char)spec[0])) {
+        return 0;
+    }
+    unsigned long long first = strtoull(spec, &end, 10);
+    if (end != dash) {
+        return 0;
+    }
+    
+    unsigned long long last = ULLONG_MAX;
+    if (dash[1] != '\0') {
+        if (!isdigit((unsigned char)dash[1])) {
+            return 0;
+        }
+        last = strtoull(dash + 1, &end, 10);
+        if (*end != '\0' || last < first) {
+            return 0;
+        }
+    }
+    
+    if (first >= size) {
+        return -1;
+    }
+    if (last >= size) {
+        last = size - 1;
+    }
+    
+    *offset = (size_t)first;
+    *length = (size_t)(last - first + 1);
+    return 1;
+}
+
+// Format a timestamp as an HTTP date (RFC 9110 IMF-fixdate)
+static void format_http_date(time_t when, char *buf, size_t size)
+{
+    static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    
+    // Spelled out rather than strftime so the locale cannot change the names
+    snprintf(buf, size, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             days[tm.tm_wday], tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900,
+             tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+// Parse an IMF-fixdate. Returns 0 on success, -1 for anything else,
+// in which case the header is ignored as RFC 9110 requires.
+static int parse_http_date(const char *value, time_t *when)
+{
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    
+    if (sscanf(value, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &tm.tm_mday, month,
+               &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return -1;
+    }
+    
+    const char *found = strstr(months, month);
+    if (!found || strlen(month) != 3 || (found - months) % 3 != 0) {
+        return -1;
+    }
+    tm.tm_mon = (int)(found - months) / 3;
+    tm.tm_year -= 1900;
+    
+    *when = timegm(&tm);
+    return *when == (time_t)-1 ? -1 : 0;
+}
+
+// Check an If-None-Match list ("*" or comma-separated, possibly weak,
+// entity tags) against an object's ETag using weak comparison
+static int etag_matches(const char *header, const char *etag)
+{
+    size_t etag_length = strlen(etag);
+    const char *p = header;
+    
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '*') {
+            return 1;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if (*p != '"') {
+            break;
+        }
+        
+        const char *close = strchr(p + 1, '"');
+        if (!close) {
+            break;
+        }
+        if (etag_length > 0 && (size_t)(close - p - 1) == etag_length &&
+            strncmp(p + 1, etag, etag_length) == 0) {
+            return 1;
+        }
+        p = close + 1;
+    }
+    
+    return 0;
+}
+
+// Add the validators of an object to a response
+static void add_validator_headers(struct MHD_Response *response, const S3ObjectInfo *info)
+{
+    char header[64];
+    
+    if (info->etag[0]) {
+        snprintf(header, sizeof(header), "\"%s\"", info->etag);
+        MHD_add_response_header(response, "ETag", header);
+    }
+    format_http_date(info->last_modified, header, sizeof(header));
+    MHD_add_response_header(response, "Last-Modified", header);
+}
+
+// Check the request's preconditions against an object. If-Modified-Since
+// only counts when If-None-Match is absent.
+static int is_not_modified(struct MHD_Connection *connection, const S3ObjectInfo *info)
+{
+    const char *if_none_match = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                            "If-None-Match");
+    if (if_none_match) {
+        return etag_matches(if_none_match, info->etag);
+    }
+    
+    const char *if_modified_since = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                                "If-Modified-Since");
+    time_t since;
+    return if_modified_since && parse_http_date(if_modified_since, &since) == 0 &&
+           info->last_modified <= since;
+}
+
+// Queue a 304 carrying the object's validators
+static int queue_not_modified(struct MHD_Connection *connection, const S3ObjectInfo *info)
+{
+    struct MHD_Response *response = buffer_response(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    add_validator_headers(response, info);
+    
+    int ret = queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Queue a 416 for a Range that lies outside the object
+static int queue_range_not_satisfiable(struct MHD_Connection *connection, size_t size)
+{
+    char content_range[64];
+    snprintf(content_range, sizeof(content_range), "bytes */%zu", size);
+    
+    struct MHD_Response *response = buffer_response(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (!response) {
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, "Content-Range", content_range);
+    
+    int ret = queue_response(connection, MHD_HTTP_RANGE_NOT_SATISFIABLE, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Answer a conditional GET/HEAD with 304 from metadata alone. Returns 1 if
+// a response was queued (*ret holds the MHD result), 0 to serve normally.
+static int handle_not_modified(HttpServer *server, struct MHD_Connection *connection,
+                               PgClient *client, const char *key, int *ret)
+{
+    if (!MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match") &&
+        !MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-Modified-Since")) {
+        return 0;
+    }
+    
+    S3ObjectInfo info;
+    S3Result *result = pg_client_stat_object(client, "public", key, &info);
+    if (!result || result->status != S3_SUCCESS) {
+        // Let the normal path report the error
+        s3_result_free(result);
+        return 0;
+    }
+    s3_result_free(result);
+    
+    int not_modified = is_not_modified(connection, &info);
+    if (not_modified) {
+        *ret = queue_not_modified(connection, &info);
+    }
+    
+    s3_object_info_clear(&info);
+    return not_modified;
+}
+
+// Body callback of header-only responses. MHD never calls it for HEAD;
+// the response only exists to carry the object's Content-Length.
+static ssize_t no_body_read(void *cls, uint64_t pos, char *buf, size_t max)
+{
+    return MHD_CONTENT_READER_END_WITH_ERROR;
+}
+
+// Label a body sent as stored in compressed form. Caches have to key it on
+// Accept-Encoding, since clients that do not take it get the decoded bytes.
+static void add_encoding_headers(struct MHD_Response *response, const char *content_encoding)
+{
+    if (content_encoding[0]) {
+        MHD_add_response_header(response, "Content-Encoding", content_encoding);
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    }
+}
+
+// Answer a GET/HEAD for an object whose content is in memory, with the
+// same conditional and Range handling as the database path. With no data,
+// only the headers are produced, which is all a HEAD needs.
+static int queue_object(struct MHD_Connection *connection, const S3ObjectInfo *info,
+                        const unsigned char *data)
+{
+    if (is_not_modified(connection, info)) {
+        return queue_not_modified(connection, info);
+    }
+    
+    unsigned int status_code = MHD_HTTP_OK;
+    size_t offset = 0;
+    size_t length = info->size;
+    
+    const char *range = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Range");
+    if (range) {
+        int parsed = parse_range(range, info->size, &offset, &length);
+        if (parsed < 0) {
+            return queue_range_not_satisfiable(connection, info->size);
+        }
+        if (parsed > 0) {
+            status_code = MHD_HTTP_PARTIAL_CONTENT;
+        }
+    }
+    
+    struct MHD_Response *response;
+    if (data) {
+        response = buffer_response(length, (void *)(data + offset), MHD_RESPMEM_MUST_COPY);
+    } else {
+        response = MHD_create_response_from_callback(length, HTTP_STREAM_BLOCK_SIZE,
+                                                     &no_body_read, NULL, NULL);
+    }
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    if (info->content_type) {
+        MHD_add_response_header(response, "Content-Type", info->content_type);
+    }
+    add_encoding_headers(response, info->content_encoding);
+    MHD_add_response_header(response, "Accept-Ranges", "bytes");
+    add_validator_headers(response, info);
+    
+    if (status_code == MHD_HTTP_PARTIAL_CONTENT) {
+        char content_range[96];
+        snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu",
+                 offset, offset + length - 1, info->size);
+        MHD_add_response_header(response, "Content-Range", content_range);
+    }
+    
+    int ret = queue_response(connection, status_code, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// Answer a resumed GET from the result of its statement on the event loop.
+// Returns 1 if a response was queued (*ret holds the MHD result), 0 if the
+// content was not in the result, or the standby that ran it failed, and it
+// has to be read through a pool. Only rows read on the primary go into the
+// cache: once a key's write pin expires, a standby lagging further behind
+// would otherwise cache the replaced version until the next write.
+static int answer_async_get(HttpServer *server, struct MHD_Connection *connection,
+                            RequestContext *ctx, const char *key, const char *accept_encoding,
+                            int *ret)
+{
+    PGresult *res = take_async_result(ctx);
+    if (!res && ctx->replica) {
+        // The standby went away: ask the primary or another standby
+        replica_failed(ctx->replica);
+        return 0;
+    }
+    if (!res) {
+        *ret = queue_unavailable(connection);
+        return 1;
+    }
+    
+    S3ObjectReader *reader;
+    S3Result *result = s3_reader_from_result(res, accept_encoding, &reader);
+    if (ctx->replica && is_replica_failure(result)) {
+        // The standby failed the statement: leave it out and ask the primary
+        replica_failed(ctx->replica);
+        ctx->primary_only = 1;
+        s3_result_free(result);
+        return 0;
+    }
+    if (!result || result->status != S3_SUCCESS) {
+        *ret = queue_result_error(connection, result);
+        s3_result_free(result);
+        return 1;
+    }
+    s3_result_free(result);
+    
+    const void *data = s3_reader_prefetched_data(reader);
+    if (!data) {
+        s3_reader_close(reader);
+        return 0;
+    }
+    
+    S3ObjectInfo info = {reader->content_type, reader->size, reader->last_modified, "", ""};
+    memcpy(info.etag, reader->etag, sizeof(info.etag));
+    memcpy(info.content_encoding, reader->content_encoding, sizeof(info.content_encoding));
+    
+    if (ctx->cache && !ctx->replica && reader->size <= HTTP_PREFETCH_LIMIT) {
+        object_cache_insert(ctx->cache, key, ctx->generation, &info, data);
+    }
+    
+    // The validators are at hand, so conditional requests cost no extra query
+    *ret = queue_object(connection, &info, data);
+    s3_reader_close(reader);
+    return 1;
+}
+
+// Handle get object (GET /public/<key>)
+static int handle_get_object(HttpServer *server, struct MHD_Connection *connection, 
+                             RequestContext *ctx)
+{
+    // Extract key from URL (skip "/public/")
+    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
+    int ret;
+    
+    // Compressed content goes out as stored to clients that take it; Range
+    // offsets always refer to the decoded bytes
+    const char *range = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Range");
+    const char *accept_encoding = range ? NULL :
+        MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept-Encoding");
+    
+    if (ctx->async_state == HTTP_ASYNC_DONE &&
+        answer_async_get(server, connection, ctx, key, accept_encoding, &ret)) {
+        return ret;
+    }
+    
+    // Hot objects are answered without touching the database
+    ObjectCache *cache = active_cache(server);
+    uint64_t generation = 0;
+    if (cache) {
+        ObjectCacheEntry *entry = object_cache_lookup(cache, key);
+        if (entry && (!entry->info.content_encoding[0] ||
+                      compression_accepts(accept_encoding, entry->info.content_encoding))) {
+            ret = queue_object(connection, &entry->info, entry->data);
+            object_cache_release(entry);
+            return ret;
+        }
+        if (entry) {
+            object_cache_release(entry);
+        }
+        generation = object_cache_generation(cache, key);
+    }
+    
+    // Without a Range, one statement usually answers the request, so let
+    // the event loop run it. Ranges need a pooled connection to stream.
+    PgAsync *async = shard_for(server, key)->async;
+    if (async && ctx->async_state == HTTP_ASYNC_NONE && !range) {
+        ctx->cache = cache;
+        ctx->generation = generation;
+        ctx->replica = choose_replica(server, key);
+        
+        char limit[32];
+        snprintf(limit, sizeof(limit), "%d", HTTP_PREFETCH_LIMIT);
+        const char *params[2] = {key, limit};
+        return suspend_for_query(ctx->replica ? ctx->replica->async : async,
+                                 connection, ctx, S3_STMT_GET_OBJECT, 2, params, 1);
+    }
+    
+    PgPool *pool;
+    PgClient *client;
+    S3ObjectReader *reader = NULL;
+    S3Result *result;
+    for (;;) {
+        client = ctx->primary_only ? checkout_primary(server, key, &pool) :
+                                     checkout_for_read(server, key, &pool);
+        if (!client) {
+            return queue_unavailable(connection);
+        }
+        
+        if (handle_not_modified(server, connection, client, key, &ret)) {
+            request_checkin(pool, client);
+            return ret;
+        }
+        
+        // Range requests fetch only the requested bytes, so skip the prefetch
+        result = pg_client_open_object(client, "public", key, range ? 0 : HTTP_PREFETCH_LIMIT,
+                                       accept_encoding, &reader);
+        
+        // A standby that fails the read is left out and the primary retried
+        HttpReplica *replica = replica_of_pool(server, pool);
+        if (!replica || !is_replica_failure(result)) {
+            break;
+        }
+        replica_failed(replica);
+        s3_result_free(result);
+        request_checkin(pool, client);
+        ctx->primary_only = 1;
+    }
+    
+    // Standbys may lag behind an expired write pin; only cache the primary
+    if (pool != shard_for(server, key)->pool) {
+        cache = NULL;
+    }
+    
+    if (!result) {
+        request_checkin(pool, client);
+        
+        const char *error = "Internal Server Error";
+        struct MHD_Response *response = buffer_response(
+            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
+        
+        ret = queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+    
+    if (result->status != S3_SUCCESS) {
+        request_checkin(pool, client);
+        
+        int status_code = MHD_HTTP_INTERNAL_SERVER_ERROR;
+        
+        // Map S3 error to HTTP status
+        if (result->status == S3_ERROR_NOT_FOUND) {
+            status_code = MHD_HTTP_NOT_FOUND;
+        } else if (result->status == S3_ERROR_PERMISSION) {
+            status_code = MHD_HTTP_FORBIDDEN;
+        }
+        
+        const char *error = result->error_message ? result->error_message : "Error";
+        struct MHD_Response *response = buffer_response(
+            strlen(error), (void *)error, MHD_RESPMEM_MUST_COPY);
+        
+        ret = queue_response(connection, status_code, response);
+        MHD_destroy_response(response);
+        
+        s3_result_free(result);
+        return ret;
+    }
+    s3_result_free(result);
+    
+    unsigned int status_code = MHD_HTTP_OK;
+    char content_range[96];
+    struct MHD_Response *response;
+    
+    if (range) {
+        size_t offset, length;
+        int parsed = parse_range(range, reader->size, &offset, &length);
+        
+        if (parsed < 0) {
+            size_t size = reader->size;
+            s3_reader_close(reader);
+            request_checkin(pool, client);
+            return queue_range_not_satisfiable(connection, size);
+        }
+        
+        if (parsed > 0) {
+            s3_reader_set_range(reader, offset, length);
+            snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu",
+                     offset, offset + length - 1, reader->size);
+            status_code = MHD_HTTP_PARTIAL_CONTENT;
+        }
+    }
+    
+    // Validators, copied out because small objects close the reader early
+    char etag[S3_ETAG_SIZE + 2] = "";
+    if (reader->etag[0]) {
+        snprintf(etag, sizeof(etag), "\"%s\"", reader->etag);
+    }
+    char last_modified[64];
+    format_http_date(reader->last_modified, last_modified, sizeof(last_modified));
+    
+    const void *data = s3_reader_prefetched_data(reader);
+    
+    if (data) {
+        // Small object: already in memory, keep a copy for the next request
+        // (compressed objects are decoded in full, so bound them here too)
+        if (cache && !range && reader->size <= HTTP_PREFETCH_LIMIT) {
+            S3ObjectInfo info = {reader->content_type, reader->size, reader->last_modified, "", ""};
+            memcpy(info.etag, reader->etag, sizeof(info.etag));
+            memcpy(info.content_encoding, reader->content_encoding, sizeof(info.content_encoding));
+            object_cache_insert(cache, key, generation, &info, data);
+        }
+        
+        // Release the connection right away
+        response = buffer_response(
+            reader->end - reader->offset, (char *)data + reader->offset, MHD_RESPMEM_MUST_COPY);
+        if (response && reader->content_type) {
+            MHD_add_response_header(response, "Content-Type", reader->content_type);
+        }
+        if (response) {
+            add_encoding_headers(response, reader->content_encoding);
+        }
+        s3_reader_close(reader);
+        request_checkin(pool, client);
+    } else {
+        // Large object: stream it, giving the connection back between pieces
+        s3_reader_attach(reader, NULL);
+        request_checkin(pool, client);
+        
+        ObjectStream *stream = (ObjectStream *)malloc(sizeof(ObjectStream));
+        if (!stream) {
+            s3_reader_close(reader);
+            return MHD_NO;
+        }
+        stream->pool = pool;
+        stream->reader = reader;
+        stream->start = reader->offset;
+        stream->metrics.active = 0;
+        
+        response = MHD_create_response_from_callback(
+            reader->end - reader->offset, HTTP_STREAM_BLOCK_SIZE,
+            &object_stream_read, stream, &object_stream_free);
+        if (!response) {
+            object_stream_free(stream);
+            return MHD_NO;
+        }
+        stream_request_metrics(&stream->metrics);
+        if (reader->content_type) {
+            MHD_add_response_header(response, "Content-Type", reader->content_type);
+        }
+    }
+    
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    MHD_add_response_header(response, "Accept-Ranges", "bytes");
+    MHD_add_response_header(response, "Last-Modified", last_modified);
+    if (etag[0]) {
+        MHD_add_response_header(response, "ETag", etag);
+    }
+    if (status_code == MHD_HTTP_PARTIAL_CONTENT) {
+        MHD_add_response_header(response, "Content-Range", content_range);
+    }
+    
+    ret = queue_response(connection, status_code, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Handle head object (HEAD /public/<key>). Answered from the metadata
+// columns alone, so neither the content nor its TOAST pages are read.
+static int handle_head_object(HttpServer *server, struct MHD_Connection *connection, 
+                              RequestContext *ctx)
+{
+    // Extract key from URL (skip "/public/")
+    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
+    int ret;
+    
+    S3ObjectInfo info = {0};
+    S3Result *result = NULL;
+    
+    if (ctx->async_state == HTTP_ASYNC_DONE) {
+        // Resumed: the statement ran on the event loop
+        PGresult *res = take_async_result(ctx);
+        if (res) {
+            result = s3_stat_from_result(res, &info);
+            PQclear(res);
+            if (ctx->replica && is_replica_failure(result)) {
+                // The standby failed the statement: leave it out and ask the primary
+                replica_failed(ctx->replica);
+                ctx->primary_only = 1;
+                s3_object_info_clear(&info);
+                s3_result_free(result);
+                result = NULL;
+            }
+        } else if (ctx->replica) {
+            // The standby went away: ask the primary or another standby
+            replica_failed(ctx->replica);
+        } else {
+            return queue_unavailable(connection);
+        }
+    }
+    
+    if (!result) {
+        ObjectCache *cache = active_cache(server);
+        if (cache) {
+            // A compressed entry's size is not that of the object
+            ObjectCacheEntry *entry = object_cache_lookup(cache, key);
+            if (entry && !entry->info.content_encoding[0]) {
+                ret = queue_object(connection, &entry->info, NULL);
+                object_cache_release(entry);
+                return ret;
+            }
+            if (entry) {
+                object_cache_release(entry);
+            }
+        }
+        
+        PgAsync *async = shard_for(server, key)->async;
+        if (async && ctx->async_state == HTTP_ASYNC_NONE) {
+            ctx->replica = choose_replica(server, key);
+            const char *params[1] = {key};
+            return suspend_for_query(ctx->replica ? ctx->replica->async : async,
+                                     connection, ctx, S3_STMT_STAT_OBJECT, 1, params, 0);
+        }
+        
+        for (;;) {
+            PgPool *pool;
+            PgClient *client = ctx->primary_only ? checkout_primary(server, key, &pool) :
+                                                   checkout_for_read(server, key, &pool);
+            if (!client) {
+                return queue_unavailable(connection);
+            }
+            
+            result = pg_client_stat_object(client, "public", key, &info);
+            request_checkin(pool, client);
+            
+            // A standby that fails the read is left out and the primary retried
+            HttpReplica *replica = replica_of_pool(server, pool);
+            if (!replica || !is_replica_failure(result)) {
+                break;
+            }
+            replica_failed(replica);
+            s3_object_info_clear(&info);
+            s3_result_free(result);
+            ctx->primary_only = 1;
+        }
+    }
+    
+    if (!result || result->status != S3_SUCCESS) {
+        unsigned int status_code = MHD_HTTP_INTERNAL_SERVER_ERROR;
+        if (result && result->status == S3_ERROR_NOT_FOUND) {
+            status_code = MHD_HTTP_NOT_FOUND;
+        } else if (result && result->status == S3_ERROR_PERMISSION) {
+            status_code = MHD_HTTP_FORBIDDEN;
+        }
+        
+        // HEAD responses carry no body, the status says it all
+        s3_result_free(result);
+        return queue_error(connection, status_code, "");
+    }
+    s3_result_free(result);
+    
+    ret = queue_object(connection, &info, NULL);
+    s3_object_info_clear(&info);
+    
+    return ret;
+}
+
+// Handle put object (PUT /public/<key>)
+static int handle_put_object(HttpServer *server, struct MHD_Connection *connection, 
+                             RequestContext *ctx, const char *upload_data, size_t *upload_data_size)
+{
+    if (!ctx->upload) {
+        return queue_unavailable(connection);
+    }
+    
+    // The body is complete, so this is the object's (or part's) ETag
+    char etag[S3_ETAG_SIZE + 2];
+    etag[0] = '"';
+    s3_upload_etag(ctx->upload, etag + 1);
+    strcat(etag, "\"");
+    int part = ctx->upload->upload_id != NULL;
+    
+    // An inline upload gets its connection only now
+    if (!ctx->client) {
+        ctx->client = request_checkout(ctx->pool);
+        if (!ctx->client) {
+            return queue_unavailable(connection);
+        }
+        if (pg_client_attach_upload(ctx->client, ctx->upload) != 0) {
+            request_checkin(ctx->pool, ctx->client);
+            ctx->client = NULL;
+            return queue_unavailable(connection);
+        }
+    } else {
+        database_begin();
+    }
+    
+    // Flush the last chunk and commit the object
+    S3Result *result = s3_upload_finish(ctx->upload);
+    ctx->upload = NULL;
+    request_checkin(ctx->pool, ctx->client);
+    ctx->client = NULL;
+    
+    if (!part) {
+        object_written(server, ctx->url + strlen(S3_PATH_OBJECT_PREFIX));
+    }
+    
+    if (!result || result->status != S3_SUCCESS) {
+        int ret = queue_result_error(connection, result);
+        if (result) s3_result_free(result);
+        return ret;
+    }
+    
+    struct MHD_Response *response = buffer_response(
+        result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
+    
+    MHD_add_response_header(response, "Content-Type", result->content_type);
+    MHD_add_response_header(response, "ETag", etag);
+    
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    
+    s3_result_free(result);
+    return ret;
+}
+
+// Handle delete object (DELETE /public/<key>)
+static int handle_delete_object(HttpServer *server, struct MHD_Connection *connection, 
+                                const char *url, const char *upload_data, size_t *upload_data_size)
+{
+    // Extract key from URL (skip "/public/")
+    const char *key = url + strlen(S3_PATH_OBJECT_PREFIX);
+    
+    PgPool *pool = shard_for(server, key)->pool;
+    PgClient *client = request_checkout(pool);
+    if (!client) {
+        return queue_unavailable(connection);
+    }
+    
+    S3Result *result = pg_client_delete_object(client, "public", key);
+    request_checkin(pool, client);
+    
+    object_written(server, key);
+    
+    if (!result || result->status != S3_SUCCESS) {
+        const char *error = "Internal Server Error";
+        if (result && result->error_message) {
+            error = result->error_message;
+        }
+        
+        struct MHD_Response *response = buffer_response(
+            strlen(error), (void *)error, MHD_RESPMEM_MUST_COPY);
+        
+        int ret = queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
+        MHD_destroy_response(response);
+        
+        if (result) s3_result_free(result);
+        return ret;
+    }
     
-    // No prefix filter, return all objects
-    struct MHD_Response *response = MHD_create_response_from_buffer(
+    struct MHD_Response *response = buffer_response(
         result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
     
     MHD_add_response_header(response, "Content-Type", result->content_type);
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
     
     s3_result_free(result);
     return ret;
 }
 
-// Handle get object (GET /public/<key>)
-static int handle_get_object(HttpServer *server, struct MHD_Connection *connection, 
-                             const char *url, const char *upload_data, size_t *upload_data_size)
+// Handle create multipart upload (POST /public/<key>?uploads)
+static int handle_create_upload(HttpServer *server, struct MHD_Connection *connection, 
+                                RequestContext *ctx)
 {
     // Extract key from URL (skip "/public/")
-    const char *key = url + strlen(S3_PATH_OBJECT_PREFIX);
+    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
     
-    S3Result *result = pg_client_get_object(server->pg_client, "public", key);
-    if (!result) {
-        const char *error = "Internal Server Error";
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
-        
-        int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
-        return ret;
+    PgPool *pool = shard_for(server, key)->pool;
+    PgClient *client = request_checkout(pool);
+    if (!client) {
+        return queue_unavailable(connection);
     }
     
-    if (result->status != S3_SUCCESS) {
-        int status_code = MHD_HTTP_INTERNAL_SERVER_ERROR;
-        
-        // Map S3 error to HTTP status
-        if (result->status == S3_ERROR_NOT_FOUND) {
-            status_code = MHD_HTTP_NOT_FOUND;
-        } else if (result->status == S3_ERROR_PERMISSION) {
-            status_code = MHD_HTTP_FORBIDDEN;
-        }
-        
-        const char *error = result->error_message ? result->error_message : "Error";
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
-        
-        int ret = MHD_queue_response(connection, status_code, response);
-        MHD_destroy_response(response);
-        
-        s3_result_free(result);
+    S3Result *result = pg_client_create_upload(client, "public", key, ctx->content_type);
+    request_checkin(pool, client);
+    
+    if (!result || result->status != S3_SUCCESS) {
+        int ret = queue_result_error(connection, result);
+        if (result) s3_result_free(result);
         return ret;
     }
     
-    struct MHD_Response *response = MHD_create_response_from_buffer(
+    struct MHD_Response *response = buffer_response(
         result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
     
-    if (result->content_type) {
-        MHD_add_response_header(response, "Content-Type", result->content_type);
-    }
+    MHD_add_response_header(response, "Content-Type", result->content_type);
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
     
     s3_result_free(result);
     return ret;
 }
 
-// Handle put object (PUT /public/<key>)
-static int handle_put_object(HttpServer *server, struct MHD_Connection *connection, 
-                             RequestContext *ctx, const char *upload_data, size_t *upload_data_size)
+// Find the text of the next <name>...</name> element between start and end
+static const char *xml_element(const char *start, const char *end, const char *name,
+                               size_t *length)
 {
-    // Extract key from URL (skip "/public/")
-    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
+    char open[32], close[32];
+    snprintf(open, sizeof(open), "<%s>", name);
+    snprintf(close, sizeof(close), "</%s>", name);
     
-    // Put the object
-    S3Result *result = pg_client_put_object(
-        server->pg_client, "public", key, ctx->data, ctx->size, ctx->content_type);
+    const char *value = strstr(start, open);
+    if (!value || value >= end) {
+        return NULL;
+    }
+    value += strlen(open);
     
-    if (!result || result->status != S3_SUCCESS) {
-        const char *error = "Internal Server Error";
-        if (result && result->error_message) {
-            error = result->error_message;
+    const char *value_end = strstr(value, close);
+    if (!value_end || value_end > end) {
+        return NULL;
+    }
+    
+    *length = value_end - value;
+    return value;
+}
+
+// Parse the <Part> list of a CompleteMultipartUpload document. ETags may be
+// quoted literally or as &quot; entities.
+static int parse_completed_parts(const char *xml, S3CompletedPart **parts)
+{
+    int count = 0;
+    int capacity = 0;
+    *parts = NULL;
+    
+    const char *part = xml;
+    while ((part = strstr(part, "<Part>")) != NULL) {
+        const char *part_end = strstr(part, "</Part>");
+        if (!part_end) {
+            break;
         }
         
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
+        size_t number_length, etag_length;
+        const char *number = xml_element(part, part_end, "PartNumber", &number_length);
+        const char *etag = xml_element(part, part_end, "ETag", &etag_length);
+        if (!number || !etag || count == S3_MULTIPART_MAX_PARTS) {
+            free(*parts);
+            *parts = NULL;
+            return -1;
+        }
         
-        int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            S3CompletedPart *grown = realloc(*parts, capacity * sizeof(S3CompletedPart));
+            if (!grown) {
+                free(*parts);
+                *parts = NULL;
+                return -1;
+            }
+            *parts = grown;
+        }
+        
+        S3CompletedPart *completed = &(*parts)[count++];
+        completed->part_number = atoi(number);
         
+        if (etag_length >= 12 && strncmp(etag, "&quot;", 6) == 0 &&
+            strncmp(etag + etag_length - 6, "&quot;", 6) == 0) {
+            etag += 6;
+            etag_length -= 12;
+        } else if (etag_length >= 2 && etag[0] == '"' && etag[etag_length - 1] == '"') {
+            etag += 1;
+            etag_length -= 2;
+        }
+        if (etag_length >= sizeof(completed->etag)) {
+            etag_length = sizeof(completed->etag) - 1;
+        }
+        memcpy(completed->etag, etag, etag_length);
+        completed->etag[etag_length] = '\0';
+        
+        part = part_end;
+    }
+    
+    return count;
+}
+
+// Handle complete multipart upload (POST /public/<key>?uploadId=<id>)
+static int handle_complete_upload(HttpServer *server, struct MHD_Connection *connection, 
+                                  RequestContext *ctx, const char *upload_id)
+{
+    if (ctx->body.failed) {
+        return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Request body too large");
+    }
+    
+    S3CompletedPart *parts;
+    int part_count = parse_completed_parts(ctx->body.data ? ctx->body.data : "", &parts);
+    if (part_count <= 0) {
+        free(parts);
+        return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Malformed CompleteMultipartUpload document");
+    }
+    
+    // Extract key from URL (skip "/public/")
+    const char *key = ctx->url + strlen(S3_PATH_OBJECT_PREFIX);
+    
+    PgPool *pool = shard_for(server, key)->pool;
+    PgClient *client = request_checkout(pool);
+    if (!client) {
+        free(parts);
+        return queue_unavailable(connection);
+    }
+    
+    S3Result *result = pg_client_complete_upload(client, "public", key, upload_id, parts, part_count);
+    request_checkin(pool, client);
+    free(parts);
+    
+    object_written(server, key);
+    
+    if (!result || result->status != S3_SUCCESS) {
+        int ret = queue_result_error(connection, result);
         if (result) s3_result_free(result);
         return ret;
     }
     
-    struct MHD_Response *response = MHD_create_response_from_buffer(
+    struct MHD_Response *response = buffer_response(
         result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
     
     MHD_add_response_header(response, "Content-Type", result->content_type);
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
     
     s3_result_free(result);
     return ret;
 }
 
-// Handle delete object (DELETE /public/<key>)
-static int handle_delete_object(HttpServer *server, struct MHD_Connection *connection, 
-                                const char *url, const char *upload_data, size_t *upload_data_size)
+// Handle abort multipart upload (DELETE /public/<key>?uploadId=<id>)
+static int handle_abort_upload(HttpServer *server, struct MHD_Connection *connection, 
+                               const char *url, const char *upload_id)
 {
     // Extract key from URL (skip "/public/")
     const char *key = url + strlen(S3_PATH_OBJECT_PREFIX);
     
-    S3Result *result = pg_client_delete_object(server->pg_client, "public", key);
+    PgPool *pool = shard_for(server, key)->pool;
+    PgClient *client = request_checkout(pool);
+    if (!client) {
+        return queue_unavailable(connection);
+    }
+    
+    S3Result *result = pg_client_abort_upload(client, "public", key, upload_id);
+    request_checkin(pool, client);
+    
     if (!result || result->status != S3_SUCCESS) {
-        const char *error = "Internal Server Error";
-        if (result && result->error_message) {
-            error = result->error_message;
+        int ret = queue_result_error(connection, result);
+        if (result) s3_result_free(result);
+        return ret;
+    }
+    s3_result_free(result);
+    
+    struct MHD_Response *response = buffer_response(0, NULL, MHD_RESPMEM_PERSISTENT);
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    int ret = queue_response(connection, MHD_HTTP_NO_CONTENT, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Decode the entities of XML text into a new string: the five predefined
+// ones and numeric character references
+static char *xml_unescape(const char *text, size_t length)
+{
+    static const struct {
+        const char *entity;
+        char c;
+    } entities[] = {
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}
+    };
+    
+    // Decoding never makes the text longer
+    char *out = malloc(length + 1);
+    if (!out) {
+        return NULL;
+    }
+    
+    const char *end = text + length;
+    size_t n = 0;
+    while (text < end) {
+        if (*text != '&') {
+            out[n++] = *text++;
+            continue;
         }
         
-        struct MHD_Response *response = MHD_create_response_from_buffer(
-            strlen(error), (void *)error, MHD_RESPMEM_PERSISTENT);
+        size_t i;
+        for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+            size_t entity_length = strlen(entities[i].entity);
+            if ((size_t)(end - text) >= entity_length &&
+                strncmp(text, entities[i].entity, entity_length) == 0) {
+                out[n++] = entities[i].c;
+                text += entity_length;
+                break;
+            }
+        }
+        if (i < sizeof(entities) / sizeof(entities[0])) {
+            continue;
+        }
         
-        int ret = MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-        MHD_destroy_response(response);
+        // &#NNN; or &#xHHH;, written back as UTF-8
+        const char *semicolon = memchr(text, ';', end - text);
+        if (semicolon && end - text > 2 && text[1] == '#') {
+            char *digits_end;
+            unsigned long cp = text[2] == 'x' ? strtoul(text + 3, &digits_end, 16)
+                                              : strtoul(text + 2, &digits_end, 10);
+            if (digits_end == semicolon && cp > 0 && cp <= 0x10FFFF) {
+                if (cp < 0x80) {
+                    out[n++] = (char)cp;
+                } else if (cp < 0x800) {
+                    out[n++] = (char)(0xC0 | (cp >> 6));
+                    out[n++] = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    out[n++] = (char)(0xE0 | (cp >> 12));
+                    out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    out[n++] = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    out[n++] = (char)(0xF0 | (cp >> 18));
+                    out[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    out[n++] = (char)(0x80 | (cp & 0x3F));
+                }
+                text = semicolon + 1;
+                continue;
+            }
+        }
         
-        if (result) s3_result_free(result);
+        out[n++] = *text++;
+    }
+    out[n] = '\0';
+    
+    return out;
+}
+
+// Parse the keys of a Delete document; returns the key count or -1
+static int parse_delete_keys(const char *xml, char ***keys, int *quiet)
+{
+    size_t length;
+    const char *value = xml_element(xml, xml + strlen(xml), "Quiet", &length);
+    *quiet = value && length == 4 && strncasecmp(value, "true", 4) == 0;
+    
+    *keys = calloc(S3_DELETE_MAX_KEYS, sizeof(char *));
+    if (!*keys) {
+        return -1;
+    }
+    
+    int count = 0;
+    const char *object = xml;
+    while ((object = strstr(object, "<Object>")) != NULL) {
+        const char *object_end = strstr(object, "</Object>");
+        const char *key = object_end ? xml_element(object, object_end, "Key", &length) : NULL;
+        if (!key || count == S3_DELETE_MAX_KEYS ||
+            !((*keys)[count++] = xml_unescape(key, length))) {
+            for (int i = 0; i < count; i++) {
+                free((*keys)[i]);
+            }
+            free(*keys);
+            *keys = NULL;
+            return -1;
+        }
+        
+        object = object_end;
+    }
+    
+    return count;
+}
+
+// Report keys that were not deleted in a DeleteResult document
+static void append_delete_errors(TextBuffer *xml, char **keys, int key_count, const int *shards,
+                                 int first_shard, const char *code, const char *message)
+{
+    for (int i = 0; i < key_count; i++) {
+        if (shards[i] < first_shard) {
+            continue;
+        }
+        text_buffer_append_str(xml, "<Error><Key>");
+        text_buffer_append_xml(xml, keys[i]);
+        text_buffer_append_str(xml, "</Key><Code>");
+        text_buffer_append_str(xml, code);
+        text_buffer_append_str(xml, "</Code><Message>");
+        text_buffer_append_xml(xml, message);
+        text_buffer_append_str(xml, "</Message></Error>");
+    }
+}
+
+// Handle delete objects (POST /public?delete)
+static int handle_delete_objects(HttpServer *server, struct MHD_Connection *connection, 
+                                 RequestContext *ctx)
+{
+    if (ctx->body.failed) {
+        return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Request body too large");
+    }
+    
+    char **keys;
+    int quiet;
+    int key_count = parse_delete_keys(ctx->body.data ? ctx->body.data : "", &keys, &quiet);
+    if (key_count <= 0) {
+        if (keys) free(keys);
+        return queue_error(connection, MHD_HTTP_BAD_REQUEST, "Malformed Delete document");
+    }
+    
+    // Each shard deletes its own keys in one statement; the entries of
+    // their DeleteResult documents are joined into one
+    const char **shard_keys = (const char **)malloc(key_count * sizeof(const char *));
+    int *key_shards = (int *)malloc(key_count * sizeof(int));
+    if (!shard_keys || !key_shards) {
+        free(shard_keys);
+        free(key_shards);
+        for (int i = 0; i < key_count; i++) {
+            free(keys[i]);
+        }
+        free(keys);
+        return MHD_NO;
+    }
+    for (int i = 0; i < key_count; i++) {
+        key_shards[i] = pg_shard_ring_lookup(&server->ring, keys[i]);
+    }
+    
+    TextBuffer xml = {0};
+    text_buffer_append_str(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                           "<DeleteResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">");
+    int unavailable = 0;
+    int failed = 0;
+    int committed = 0;          // shards whose deletions went through
+    int shard;
+    S3Result *failure = NULL;
+    
+    for (shard = 0; shard < server->shard_count; shard++) {
+        int count = 0;
+        for (int i = 0; i < key_count; i++) {
+            if (key_shards[i] == shard) {
+                shard_keys[count++] = keys[i];
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+        
+        PgPool *pool = server->shards[shard].pool;
+        PgClient *client = request_checkout(pool);
+        if (!client) {
+            unavailable = 1;
+            break;
+        }
+        S3Result *result = pg_client_delete_objects(client, "public", shard_keys, count, quiet);
+        request_checkin(pool, client);
+        
+        for (int i = 0; i < count; i++) {
+            object_written(server, shard_keys[i]);
+        }
+        
+        if (!result || result->status != S3_SUCCESS) {
+            failed = 1;
+            failure = result;
+            break;
+        }
+        
+        // Keep what lies between the opening and closing DeleteResult tags
+        const char *open = strstr(result->data, "<DeleteResult");
+        const char *entries = open ? strchr(open, '>') : NULL;
+        const char *close = strstr(result->data, "</DeleteResult>");
+        if (entries && close && close > entries) {
+            text_buffer_append(&xml, entries + 1, (size_t)(close - entries - 1));
+        }
+        s3_result_free(result);
+        committed++;
+    }
+    
+    // Earlier shards have committed their deletions, so report what
+    // happened to every key, as S3 does, rather than failing the request
+    if (committed > 0 && unavailable) {
+        append_delete_errors(&xml, keys, key_count, key_shards, shard,
+                             "ServiceUnavailable", "Database unavailable");
+        unavailable = 0;
+    } else if (committed > 0 && failed) {
+        append_delete_errors(&xml, keys, key_count, key_shards, shard, "InternalError",
+                             failure && failure->error_message ? failure->error_message :
+                                                                 "Internal Server Error");
+        s3_result_free(failure);
+        failure = NULL;
+        failed = 0;
+    }
+    text_buffer_append_str(&xml, "</DeleteResult>");
+    
+    free(shard_keys);
+    free(key_shards);
+    for (int i = 0; i < key_count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    
+    if (unavailable) {
+        text_buffer_free(&xml);
+        return queue_unavailable(connection);
+    }
+    
+    if (failed || xml.failed) {
+        text_buffer_free(&xml);
+        int ret = queue_result_error(connection, failure);
+        if (failure) s3_result_free(failure);
         return ret;
     }
     
-    struct MHD_Response *response = MHD_create_response_from_buffer(
-        result->data_size, result->data, MHD_RESPMEM_MUST_COPY);
+    struct MHD_Response *response = buffer_response(
+        xml.length, xml.data, MHD_RESPMEM_MUST_COPY);
+    text_buffer_free(&xml);
     
-    MHD_add_response_header(response, "Content-Type", result->content_type);
+    MHD_add_response_header(response, "Content-Type", "application/xml");
     
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Handle cache statistics (GET /_pgs3/cache)
+static int handle_cache_stats(HttpServer *server, struct MHD_Connection *connection, 
+                              const char *url, const char *upload_data, size_t *upload_data_size)
+{
+    if (!server->cache) {
+        return queue_error(connection, MHD_HTTP_NOT_FOUND, "Object cache disabled");
+    }
+    
+    ObjectCacheStats stats;
+    object_cache_stats(server->cache, &stats);
+    
+    int listening = 1;
+    unsigned long notifications = 0;
+    for (int i = 0; i < server->shard_count; i++) {
+        listening &= pg_listener_is_listening(server->shards[i].listener);
+        notifications += server->shards[i].listener->notifications;
+    }
+    
+    char body[512];
+    snprintf(body, sizeof(body),
+             "{\"capacity\":%zu,\"entries\":%zu,\"bytes\":%zu,\"hits\":%lu,\"misses\":%lu,"
+             "\"insertions\":%lu,\"evictions\":%lu,\"invalidations\":%lu,"
+             "\"listening\":%s,\"notifications\":%lu}",
+             stats.capacity, stats.entries, stats.bytes, stats.hits, stats.misses,
+             stats.insertions, stats.evictions, stats.invalidations,
+             listening ? "true" : "false", notifications);
+    
+    struct MHD_Response *response = buffer_response(
+        strlen(body), body, MHD_RESPMEM_MUST_COPY);
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    MHD_add_response_header(response, "Content-Type", "application/json");
+    
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    
+    return ret;
+}
+
+// Handle Prometheus metrics (GET /metrics). Request counters are summed
+// over the worker threads here, so recording them never takes a lock.
+static int handle_metrics(HttpServer *server, struct MHD_Connection *connection)
+{
+    TextBuffer out = {0};
+    http_metrics_render(server->metrics, &out);
+    
+    text_buffer_append_str(&out, "# HELP pgs3_db_connections Pooled PostgreSQL connections\n"
+                           "# TYPE pgs3_db_connections gauge\n");
+    for (int i = 0; i < server->shard_count; i++) {
+        text_buffer_printf(&out, "pgs3_db_connections{shard=\"%d\"} %d\n",
+                           i, server->shards[i].pool->size);
+    }
+    text_buffer_append_str(&out, "# HELP pgs3_db_connections_in_use Pooled connections checked out\n"
+                           "# TYPE pgs3_db_connections_in_use gauge\n");
+    for (int i = 0; i < server->shard_count; i++) {
+        text_buffer_printf(&out, "pgs3_db_connections_in_use{shard=\"%d\"} %d\n",
+                           i, pg_pool_in_use(server->shards[i].pool));
+    }
+    text_buffer_append_str(&out, "# HELP pgs3_db_async_outstanding Statements queued or running "
+                           "on the event loop\n"
+                           "# TYPE pgs3_db_async_outstanding gauge\n");
+    for (int i = 0; i < server->shard_count; i++) {
+        text_buffer_printf(&out, "pgs3_db_async_outstanding{shard=\"%d\"} %d\n",
+                           i, pg_async_outstanding(server->shards[i].async));
+    }
+    
+    if (server->cache) {
+        ObjectCacheStats stats;
+        object_cache_stats(server->cache, &stats);
+        text_buffer_printf(&out, "# HELP pgs3_cache_hits_total Object cache hits\n"
+                           "# TYPE pgs3_cache_hits_total counter\n"
+                           "pgs3_cache_hits_total %lu\n"
+                           "# HELP pgs3_cache_misses_total Object cache misses\n"
+                           "# TYPE pgs3_cache_misses_total counter\n"
+                           "pgs3_cache_misses_total %lu\n"
+                           "# HELP pgs3_cache_bytes Bytes held by the object cache\n"
+                           "# TYPE pgs3_cache_bytes gauge\n"
+                           "pgs3_cache_bytes %zu\n",
+                           stats.hits, stats.misses, stats.bytes);
+    }
+    
+    if (out.failed) {
+        text_buffer_free(&out);
+        return MHD_NO;
+    }
+    
+    struct MHD_Response *response = buffer_response(out.length, out.data, MHD_RESPMEM_MUST_COPY);
+    text_buffer_free(&out);
+    if (!response) {
+        return MHD_NO;
+    }
+    
+    MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4");
+    
+    int ret = queue_response(connection, MHD_HTTP_OK, response);
     MHD_destroy_response(response);
     
-    s3_result_free(result);
     return ret;
 }
 
 /**
  * Initialize HTTP server
  * 
- * @param port port to listen on
- * @param pg_conninfo PostgreSQL connection string
+ * @param config server configuration (port, conninfo, threads, pool size, cache size,
+ *               upload expiry, async connections, replicas, shards)
  * @return pointer to HttpServer structure or NULL if error
  */
-HttpServer *http_server_init(int port, const char *pg_conninfo) {
+HttpServer *http_server_init(const Config *config) {
+    if (!config) {
+        return NULL;
+    }
+    
     HttpServer *server = (HttpServer *)malloc(sizeof(HttpServer));
     if (!server) {
         return NULL;
     }
     
-    server->port = port;
+    server->port = config->http_port;
+    server->threads = config->http_threads;
+    server->thread_per_connection = config->thread_per_connection;
     server->daemon = NULL;
+    server->shards = NULL;
+    server->shard_count = 0;
+    server->cache = NULL;
+    server->replicas = NULL;
+    server->replica_count = 0;
+    server->replica_cursor = 0;
+    server->pins = NULL;
+    server->metrics = NULL;
+    server->upload_expiry = (long)config->upload_expiry_hours * 3600;
+    
+    // Without PGS3_SHARDS the one database holds every key
+    const char *const *conninfos = config->shard_count > 0 ? (const char *const *)config->shards
+                                                           : (const char *const *)&config->pg_conninfo;
+    int shard_count = config->shard_count > 0 ? config->shard_count : 1;
     
-    // Initialize PostgreSQL client
-    server->pg_client = pg_client_init(pg_conninfo);
-    if (!server->pg_client) {
-        free(server);
+    memset(&server->ring, 0, sizeof(server->ring));
+    server->shards = (HttpShard *)calloc(shard_count, sizeof(HttpShard));
+    server->metrics = http_metrics_create();
+    if (!server->shards || !server->metrics || pg_shard_ring_init(&server->ring, shard_count) != 0) {
+        http_server_free(server);
         return NULL;
     }
     
+    // Initialize a PostgreSQL connection pool per shard; every shard must be up
+    for (int i = 0; i < shard_count; i++) {
+        HttpShard *shard = &server->shards[server->shard_count];
+        shard->pool = pg_pool_create(conninfos[i], config->pg_pool_size);
+        if (!shard->pool) {
+            if (shard_count > 1) {
+                fprintf(stderr, "Could not connect to shard %d\n", i + 1);
+            }
+            http_server_free(server);
+            return NULL;
+        }
+        server->shard_count++;
+        
+        // A thread per connection has nothing to gain from the event loop
+        if (config->async_connections > 0 && !config->thread_per_connection) {
+            shard->async = pg_async_start(conninfos[i], (int)config->async_connections);
+            if (!shard->async) {
+                fprintf(stderr, "Async queries disabled on shard %d: could not open a connection\n",
+                        i + 1);
+            }
+        }
+    }
+    
+    // Standbys serve the reads; one that cannot be reached now is left out
+    if (config->replica_count > 0 && server->shard_count > 1) {
+        fprintf(stderr, "Replicas not used: they cannot be combined with shards\n");
+    } else if (config->replica_count > 0) {
+        server->replicas = (HttpReplica *)calloc(config->replica_count, sizeof(HttpReplica));
+    }
+    for (int i = 0; server->replicas && i < config->replica_count; i++) {
+        HttpReplica *replica = &server->replicas[server->replica_count];
+        
+        replica->pool = pg_pool_create(config->replicas[i], config->pg_pool_size);
+        if (replica->pool && server->shards[0].async) {
+            replica->async = pg_async_start(config->replicas[i], (int)config->async_connections);
+            if (!replica->async) {
+                pg_pool_free(replica->pool);
+                replica->pool = NULL;
+            }
+        }
+        if (!replica->pool) {
+            fprintf(stderr, "Replica %d not used: could not connect\n", i + 1);
+            continue;
+        }
+        server->replica_count++;
+    }
+    if (server->replica_count > 0) {
+        server->pins = write_pins_create((long)config->read_after_write_ms);
+    }
+    
+    // The pool bootstrapped the schema, so the notify trigger exists by now.
+    // Besides the cache, notifications pin keys other servers wrote.
+    if (config->cache_size > 0) {
+        server->cache = object_cache_create(config->cache_size);
+    }
+    int listening = 1;
+    for (int i = 0; (server->cache || server->pins) && i < server->shard_count; i++) {
+        server->shards[i].listener = pg_listener_start(conninfos[i], S3_NOTIFY_CHANNEL,
+                                                       &object_changed_callback, server);
+        listening &= server->shards[i].listener != NULL;
+    }
+    if (server->cache && !listening) {
+        fprintf(stderr, "Object cache disabled: could not start the invalidation listener\n");
+        object_cache_free(server->cache);
+        server->cache = NULL;
+    } else if (server->pins && !listening) {
+        fprintf(stderr, "Only writes through this server pin keys to the primary: "
+                "could not start the notification listener\n");
+    }
+    
     return server;
 }
 
@@ -488,23 +2585,78 @@ int http_server_run(HttpServer *server) {
         return -1;
     }
     
-    // Start HTTP daemon
-    server->daemon = MHD_start_daemon(
-        MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_ERROR_LOG,
-        server->port, NULL, NULL,
-        &request_handler, server,
-        MHD_OPTION_NOTIFY_COMPLETED, request_completed_callback, NULL,
-        MHD_OPTION_END);
+    int async_connections = 0;
+    for (int i = 0; i < server->shard_count; i++) {
+        if (server->shards[i].async) {
+            async_connections += server->shards[i].async->size;
+        }
+    }
+    
+    // Start HTTP daemon; MHD_USE_AUTO picks epoll where available
+    if (server->thread_per_connection) {
+        server->daemon = MHD_start_daemon(
+            MHD_USE_THREAD_PER_CONNECTION | MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_ERROR_LOG,
+            server->port, NULL, NULL,
+            &request_handler, server,
+            MHD_OPTION_NOTIFY_COMPLETED, request_completed_callback, server,
+            MHD_OPTION_END);
+    } else {
+        server->daemon = MHD_start_daemon(
+            MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_ERROR_LOG |
+            (async_connections > 0 ? MHD_ALLOW_SUSPEND_RESUME : 0),
+            server->port, NULL, NULL,
+            &request_handler, server,
+            MHD_OPTION_NOTIFY_COMPLETED, request_completed_callback, server,
+            MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)(server->threads > 1 ? server->threads : 1),
+            MHD_OPTION_END);
+    }
     
     if (!server->daemon) {
         return -1;
     }
     
-    printf("HTTP server listening on port %d\n", server->port);
+    if (server->thread_per_connection) {
+        printf("HTTP server listening on port %d (thread per connection, %d database connections)\n",
+               server->port, server->shards[0].pool->size);
+    } else {
+        printf("HTTP server listening on port %d (%u threads, %d database connections)\n",
+               server->port, server->threads, server->shards[0].pool->size);
+    }
+    if (server->shard_count > 1) {
+        printf("Shards: %d databases, each with its own connections\n", server->shard_count);
+    }
+    if (async_connections > 0) {
+        printf("Async GET/HEAD: %d non-blocking database connections\n", async_connections);
+    }
+    if (server->cache) {
+        printf("Object cache: %zu MB\n", server->cache->capacity / (1024 * 1024));
+    }
+    if (server->replica_count > 0) {
+        printf("Reads: %d hot standbys, keys read from the primary for %ld ms after a write\n",
+               server->replica_count, server->pins ? server->pins->window_ms : 0L);
+    }
     
     // This is a blocking call - the server will run until stopped
     // In a real implementation, we would use signals to handle graceful shutdown
+    time_t next_expiry = time(NULL);
     while (1) {
+        // Abandoned multipart uploads would otherwise keep their parts forever
+        if (server->upload_expiry > 0 && time(NULL) >= next_expiry) {
+            next_expiry = time(NULL) + HTTP_UPLOAD_EXPIRY_INTERVAL_SECONDS;
+            
+            for (int i = 0; i < server->shard_count; i++) {
+                PgPool *pool = server->shards[i].pool;
+                PgClient *client = pg_pool_checkout(pool, HTTP_POOL_CHECKOUT_TIMEOUT_MS);
+                if (client) {
+                    long removed = pg_client_expire_uploads(client, server->upload_expiry);
+                    pg_pool_checkin(pool, client);
+                    if (removed > 0) {
+                        printf("Dropped %ld expired multipart uploads\n", removed);
+                    }
+                }
+            }
+        }
+        
         sleep(1);
     }
     
@@ -521,13 +2673,35 @@ void http_server_free(HttpServer *server) {
         return;
     }
     
+    // Fails the statements still pending, which resumes their requests
+    for (int i = 0; i < server->shard_count; i++) {
+        pg_async_stop(server->shards[i].async);
+    }
+    for (int i = 0; i < server->replica_count; i++) {
+        pg_async_stop(server->replicas[i].async);
+    }
+    
     if (server->daemon) {
         MHD_stop_daemon(server->daemon);
     }
     
-    if (server->pg_client) {
-        pg_client_free(server->pg_client);
+    for (int i = 0; i < server->shard_count; i++) {
+        pg_listener_stop(server->shards[i].listener);
+    }
+    object_cache_free(server->cache);
+    write_pins_free(server->pins);
+    http_metrics_free(server->metrics);
+    
+    for (int i = 0; i < server->replica_count; i++) {
+        pg_pool_free(server->replicas[i].pool);
+    }
+    free(server->replicas);
+    
+    for (int i = 0; i < server->shard_count; i++) {
+        pg_pool_free(server->shards[i].pool);
     }
+    free(server->shards);
+    pg_shard_ring_free(&server->ring);
     
     free(server);
 } 
\ No newline at end of file
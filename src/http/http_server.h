@@ -3,22 +3,54 @@
 
 #include <stdlib.h>
 #include <microhttpd.h>
-#include "../pg/pg_client.h"
+#include "../common/config.h"
+#include "../pg/pg_pool.h"
+#include "../pg/pg_async.h"
+#include "../pg/pg_listener.h"
+#include "../pg/pg_shards.h"
+#include "http_metrics.h"
+#include "object_cache.h"
+#include "write_pins.h"
+
+// Database holding the objects whose keys hash to it
+typedef struct {
+    PgPool *pool;
+    PgAsync *async;             // runs GET/HEAD lookups off the worker threads, NULL when disabled
+    PgListener *listener;       // invalidates the cache on writes by any server
+} HttpShard;
+
+// Hot standby serving reads
+typedef struct {
+    PgPool *pool;
+    PgAsync *async;             // NULL when async is disabled
+    time_t down_until;          // skipped after a failed checkout until then; atomic
+} HttpReplica;
 
 typedef struct HttpServer {
     struct MHD_Daemon *daemon;
-    PgClient *pg_client;
+    HttpShard *shards;          // one per database, the first also serves bucket requests
+    int shard_count;
+    PgShardRing ring;           // assigns keys to shards
+    ObjectCache *cache;         // NULL when disabled
+    HttpReplica *replicas;      // standbys of the only shard sharing its reads, none if NULL
+    int replica_count;
+    unsigned int replica_cursor;    // rotates ties between equally loaded standbys
+    WritePins *pins;            // keys read from the primary for now, NULL to never pin
+    HttpMetrics *metrics;       // request counters and latencies served on /metrics
+    long upload_expiry;         // seconds before unfinished multipart uploads go, 0 never
     int port;
+    unsigned int threads;
+    int thread_per_connection;
 } HttpServer;
 
 /**
  * Initialize HTTP server
  * 
- * @param port port to listen on
- * @param pg_conninfo PostgreSQL connection string
+ * @param config server configuration (port, conninfo, threads, pool size, cache size,
+ *               upload expiry, async connections, replicas, shards)
  * @return pointer to HttpServer structure or NULL if error
  */
-HttpServer *http_server_init(int port, const char *pg_conninfo);
+HttpServer *http_server_init(const Config *config);
 
 /**
  * Run HTTP server (blocking call)
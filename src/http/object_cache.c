@@ -0,0 +1,417 @@
+#include "object_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Initial hash buckets per shard; the table doubles as it fills
+#define OBJECT_CACHE_INITIAL_BUCKETS 64
+
+/**
+ * Hash a key (64-bit FNV-1a)
+ * 
+ * @param key NUL-terminated key
+ * @return hash value
+ */
+static uint64_t hash_key(const char *key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    
+    return hash;
+}
+
+/**
+ * Pick the shard for a hash; the low bits index the buckets, so use the top
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param hash key hash
+ * @return shard
+ */
+static ObjectCacheShard *shard_for(ObjectCache *cache, uint64_t hash) {
+    return &cache->shards[(hash >> 56) % OBJECT_CACHE_SHARDS];
+}
+
+/**
+ * Free an entry whose last reference is gone
+ * 
+ * @param entry cache entry
+ */
+static void entry_free(ObjectCacheEntry *entry) {
+    s3_object_info_clear(&entry->info);
+    free(entry);
+}
+
+/**
+ * Find an entry in a shard; caller holds the shard lock
+ * 
+ * @param shard cache shard
+ * @param key object key
+ * @param hash key hash
+ * @return address of the link pointing at the entry, or at the chain end
+ */
+static ObjectCacheEntry **find_link(ObjectCacheShard *shard, const char *key, uint64_t hash) {
+    ObjectCacheEntry **link = &shard->buckets[hash & (shard->bucket_count - 1)];
+    
+    while (*link && ((*link)->hash != hash || strcmp((*link)->key, key) != 0)) {
+        link = &(*link)->hash_next;
+    }
+    
+    return link;
+}
+
+/**
+ * Detach an entry from the LRU list; caller holds the shard lock
+ * 
+ * @param shard cache shard
+ * @param entry cache entry
+ */
+static void lru_unlink(ObjectCacheShard *shard, ObjectCacheEntry *entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        shard->lru_head = entry->lru_next;
+    }
+    
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        shard->lru_tail = entry->lru_prev;
+    }
+    
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+/**
+ * Make an entry the most recently used; caller holds the shard lock
+ * 
+ * @param shard cache shard
+ * @param entry cache entry, not on the list
+ */
+static void lru_push_front(ObjectCacheShard *shard, ObjectCacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = entry;
+    } else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+/**
+ * Take an entry out of a shard and drop the cache's reference; caller
+ * holds the shard lock
+ * 
+ * @param shard cache shard
+ * @param entry cache entry
+ */
+static void shard_remove(ObjectCacheShard *shard, ObjectCacheEntry *entry) {
+    ObjectCacheEntry **link = find_link(shard, entry->key, entry->hash);
+    *link = entry->hash_next;
+    lru_unlink(shard, entry);
+    
+    shard->entries--;
+    shard->bytes -= entry->charge;
+    
+    object_cache_release(entry);
+}
+
+/**
+ * Double the bucket array once chains get long; caller holds the shard lock.
+ * Failing to grow only makes lookups slower.
+ * 
+ * @param shard cache shard
+ */
+static void shard_grow(ObjectCacheShard *shard) {
+    size_t count = shard->bucket_count * 2;
+    ObjectCacheEntry **buckets = (ObjectCacheEntry **)calloc(count, sizeof(ObjectCacheEntry *));
+    if (!buckets) {
+        return;
+    }
+    
+    for (size_t i = 0; i < shard->bucket_count; i++) {
+        ObjectCacheEntry *entry = shard->buckets[i];
+        while (entry) {
+            ObjectCacheEntry *next = entry->hash_next;
+            ObjectCacheEntry **head = &buckets[entry->hash & (count - 1)];
+            entry->hash_next = *head;
+            *head = entry;
+            entry = next;
+        }
+    }
+    
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_count = count;
+}
+
+/**
+ * Create a cache
+ * 
+ * @param capacity memory budget in bytes, split evenly across the shards
+ * @return pointer to ObjectCache structure or NULL if error
+ */
+ObjectCache *object_cache_create(size_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    
+    ObjectCache *cache = (ObjectCache *)calloc(1, sizeof(ObjectCache));
+    if (!cache) {
+        return NULL;
+    }
+    
+    cache->capacity = capacity;
+    cache->shard_capacity = capacity / OBJECT_CACHE_SHARDS;
+    
+    for (int i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+        ObjectCacheShard *shard = &cache->shards[i];
+        shard->buckets = (ObjectCacheEntry **)calloc(OBJECT_CACHE_INITIAL_BUCKETS,
+                                                     sizeof(ObjectCacheEntry *));
+        if (!shard->buckets) {
+            object_cache_free(cache);
+            return NULL;
+        }
+        shard->bucket_count = OBJECT_CACHE_INITIAL_BUCKETS;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    
+    return cache;
+}
+
+/**
+ * Look an object up
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @return entry (release with object_cache_release) or NULL on a miss
+ */
+ObjectCacheEntry *object_cache_lookup(ObjectCache *cache, const char *key) {
+    uint64_t hash = hash_key(key);
+    ObjectCacheShard *shard = shard_for(cache, hash);
+    
+    pthread_mutex_lock(&shard->lock);
+    
+    ObjectCacheEntry *entry = *find_link(shard, key, hash);
+    if (entry) {
+        lru_unlink(shard, entry);
+        lru_push_front(shard, entry);
+        __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+        shard->hits++;
+    } else {
+        shard->misses++;
+    }
+    
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+/**
+ * Drop a reference obtained from object_cache_lookup
+ * 
+ * @param entry cache entry
+ */
+void object_cache_release(ObjectCacheEntry *entry) {
+    if (entry && __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        entry_free(entry);
+    }
+}
+
+/**
+ * Read the generation of the shard holding a key
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @return current generation
+ */
+uint64_t object_cache_generation(ObjectCache *cache, const char *key) {
+    ObjectCacheShard *shard = shard_for(cache, hash_key(key));
+    
+    pthread_mutex_lock(&shard->lock);
+    uint64_t generation = shard->generation;
+    pthread_mutex_unlock(&shard->lock);
+    
+    return generation;
+}
+
+/**
+ * Store an object, evicting least recently used ones to make room
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @param generation value of object_cache_generation before the read
+ * @param info object metadata
+ * @param data object content, info->size bytes
+ * @return 0 if stored, -1 if stale, too large or out of memory
+ */
+int object_cache_insert(ObjectCache *cache, const char *key, uint64_t generation,
+                        const S3ObjectInfo *info, const void *data) {
+    size_t key_length = strlen(key);
+    size_t charge = sizeof(ObjectCacheEntry) + key_length + 1 + info->size +
+                    (info->content_type ? strlen(info->content_type) + 1 : 0);
+    
+    // One object may not take more than a quarter of its shard
+    if (charge > cache->shard_capacity / 4) {
+        return -1;
+    }
+    
+    // Key and content share the entry's allocation
+    ObjectCacheEntry *entry = (ObjectCacheEntry *)malloc(sizeof(ObjectCacheEntry) +
+                                                         key_length + 1 + info->size);
+    if (!entry) {
+        return -1;
+    }
+    
+    memset(entry, 0, sizeof(ObjectCacheEntry));
+    entry->hash = hash_key(key);
+    entry->refs = 1;
+    entry->charge = charge;
+    entry->key = (char *)(entry + 1);
+    memcpy(entry->key, key, key_length + 1);
+    entry->data = (unsigned char *)entry->key + key_length + 1;
+    memcpy(entry->data, data, info->size);
+    entry->info = *info;
+    entry->info.content_type = info->content_type ? strdup(info->content_type) : NULL;
+    
+    if (info->content_type && !entry->info.content_type) {
+        free(entry);
+        return -1;
+    }
+    
+    ObjectCacheShard *shard = shard_for(cache, entry->hash);
+    pthread_mutex_lock(&shard->lock);
+    
+    // Invalidated while the caller was reading: this copy may be stale
+    if (shard->generation != generation) {
+        pthread_mutex_unlock(&shard->lock);
+        entry_free(entry);
+        return -1;
+    }
+    
+    ObjectCacheEntry *existing = *find_link(shard, key, entry->hash);
+    if (existing) {
+        shard_remove(shard, existing);
+    }
+    
+    while (shard->lru_tail && shard->bytes + charge > cache->shard_capacity) {
+        shard_remove(shard, shard->lru_tail);
+        shard->evictions++;
+    }
+    
+    ObjectCacheEntry **head = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+    entry->hash_next = *head;
+    *head = entry;
+    lru_push_front(shard, entry);
+    
+    shard->entries++;
+    shard->bytes += charge;
+    shard->insertions++;
+    
+    if (shard->entries > shard->bucket_count) {
+        shard_grow(shard);
+    }
+    
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+/**
+ * Forget an object that was written or deleted
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ */
+void object_cache_invalidate(ObjectCache *cache, const char *key) {
+    uint64_t hash = hash_key(key);
+    ObjectCacheShard *shard = shard_for(cache, hash);
+    
+    pthread_mutex_lock(&shard->lock);
+    
+    // Reads already in flight must not store what they fetched
+    shard->generation++;
+    
+    ObjectCacheEntry *entry = *find_link(shard, key, hash);
+    if (entry) {
+        shard_remove(shard, entry);
+        shard->invalidations++;
+    }
+    
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Forget every object
+ * 
+ * @param cache pointer to ObjectCache structure
+ */
+void object_cache_clear(ObjectCache *cache) {
+    for (int i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+        ObjectCacheShard *shard = &cache->shards[i];
+        
+        pthread_mutex_lock(&shard->lock);
+        
+        shard->generation++;
+        while (shard->lru_head) {
+            shard_remove(shard, shard->lru_head);
+            shard->invalidations++;
+        }
+        
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * Collect the counters
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param stats receives the totals
+ */
+void object_cache_stats(ObjectCache *cache, ObjectCacheStats *stats) {
+    memset(stats, 0, sizeof(ObjectCacheStats));
+    stats->capacity = cache->capacity;
+    
+    for (int i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+        ObjectCacheShard *shard = &cache->shards[i];
+        
+        pthread_mutex_lock(&shard->lock);
+        stats->entries += shard->entries;
+        stats->bytes += shard->bytes;
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->insertions += shard->insertions;
+        stats->evictions += shard->evictions;
+        stats->invalidations += shard->invalidations;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * Free the cache; entries still referenced stay alive until released
+ * 
+ * @param cache pointer to ObjectCache structure
+ */
+void object_cache_free(ObjectCache *cache) {
+    if (!cache) {
+        return;
+    }
+    
+    for (int i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+        ObjectCacheShard *shard = &cache->shards[i];
+        if (!shard->buckets) {
+            continue;
+        }
+        
+        while (shard->lru_head) {
+            shard_remove(shard, shard->lru_head);
+        }
+        
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    
+    free(cache);
+}
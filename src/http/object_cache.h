@@ -0,0 +1,141 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../pg/s3_api.h"
+
+// Independent LRU shards; a key always lives in the same one
+#define OBJECT_CACHE_SHARDS 16
+
+// Cached object. Immutable once inserted and kept alive by its references,
+// so a hit can be used after the shard lock is released.
+typedef struct ObjectCacheEntry {
+    struct ObjectCacheEntry *hash_next;
+    struct ObjectCacheEntry *lru_prev;     // towards most recently used
+    struct ObjectCacheEntry *lru_next;     // towards least recently used
+    uint64_t hash;
+    int refs;                   // the cache's own plus one per lookup
+    size_t charge;              // bytes counted against the budget
+    char *key;
+    S3ObjectInfo info;
+    unsigned char *data;        // info.size bytes
+} ObjectCacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    ObjectCacheEntry **buckets;
+    size_t bucket_count;        // power of two
+    ObjectCacheEntry *lru_head; // most recently used
+    ObjectCacheEntry *lru_tail; // next to evict
+    size_t entries;
+    size_t bytes;
+    uint64_t generation;        // bumped by every invalidation in this shard
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long insertions;
+    unsigned long evictions;
+    unsigned long invalidations;
+} ObjectCacheShard;
+
+// Size-bounded cache of small objects keyed by path
+typedef struct ObjectCache {
+    size_t capacity;            // total budget in bytes
+    size_t shard_capacity;
+    ObjectCacheShard shards[OBJECT_CACHE_SHARDS];
+} ObjectCache;
+
+// Counters summed over all shards
+typedef struct {
+    size_t capacity;
+    size_t entries;
+    size_t bytes;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long insertions;
+    unsigned long evictions;
+    unsigned long invalidations;
+} ObjectCacheStats;
+
+/**
+ * Create a cache
+ * 
+ * @param capacity memory budget in bytes, split evenly across the shards
+ * @return pointer to ObjectCache structure or NULL if error
+ */
+ObjectCache *object_cache_create(size_t capacity);
+
+/**
+ * Look an object up
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @return entry (release with object_cache_release) or NULL on a miss
+ */
+ObjectCacheEntry *object_cache_lookup(ObjectCache *cache, const char *key);
+
+/**
+ * Drop a reference obtained from object_cache_lookup
+ * 
+ * @param entry cache entry
+ */
+void object_cache_release(ObjectCacheEntry *entry);
+
+/**
+ * Read the generation of the shard holding a key
+ * 
+ * Take it before reading the object from the database and hand it to
+ * object_cache_insert, which then refuses to store a copy that an
+ * invalidation may have superseded in between.
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @return current generation
+ */
+uint64_t object_cache_generation(ObjectCache *cache, const char *key);
+
+/**
+ * Store an object, evicting least recently used ones to make room
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ * @param generation value of object_cache_generation before the read
+ * @param info object metadata
+ * @param data object content, info->size bytes
+ * @return 0 if stored, -1 if stale, too large or out of memory
+ */
+int object_cache_insert(ObjectCache *cache, const char *key, uint64_t generation,
+                        const S3ObjectInfo *info, const void *data);
+
+/**
+ * Forget an object that was written or deleted
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param key object key
+ */
+void object_cache_invalidate(ObjectCache *cache, const char *key);
+
+/**
+ * Forget every object
+ * 
+ * @param cache pointer to ObjectCache structure
+ */
+void object_cache_clear(ObjectCache *cache);
+
+/**
+ * Collect the counters
+ * 
+ * @param cache pointer to ObjectCache structure
+ * @param stats receives the totals
+ */
+void object_cache_stats(ObjectCache *cache, ObjectCacheStats *stats);
+
+/**
+ * Free the cache; entries still referenced stay alive until released
+ * 
+ * @param cache pointer to ObjectCache structure
+ */
+void object_cache_free(ObjectCache *cache);
+
+#endif /* OBJECT_CACHE_H */
@@ -0,0 +1,121 @@
+#include "write_pins.h"
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Read the monotonic clock
+ * 
+ * @return milliseconds since an arbitrary point
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Hash a key to its slot (64-bit FNV-1a)
+ * 
+ * @param key NUL-terminated key
+ * @return slot index
+ */
+static size_t slot_for(const char *key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    
+    return (size_t)(hash % WRITE_PINS_SLOTS);
+}
+
+/**
+ * Move an expiry time forward, never back
+ * 
+ * @param until expiry to update
+ * @param value new expiry
+ */
+static void extend(uint64_t *until, uint64_t value) {
+    uint64_t current = __atomic_load_n(until, __ATOMIC_RELAXED);
+    while (current < value &&
+           !__atomic_compare_exchange_n(until, &current, value, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * Create an empty set of pins
+ * 
+ * @param window_ms how long a write pins its key
+ * @return pointer to WritePins structure or NULL if error
+ */
+WritePins *write_pins_create(long window_ms) {
+    if (window_ms <= 0) {
+        return NULL;
+    }
+    
+    WritePins *pins = (WritePins *)calloc(1, sizeof(WritePins));
+    if (!pins) {
+        return NULL;
+    }
+    
+    pins->window_ms = window_ms;
+    return pins;
+}
+
+/**
+ * Pin a key that was just written or deleted
+ * 
+ * @param pins pointer to WritePins structure
+ * @param key object key
+ */
+void write_pins_add(WritePins *pins, const char *key) {
+    if (!pins || !key) {
+        return;
+    }
+    
+    extend(&pins->until[slot_for(key)], now_ms() + (uint64_t)pins->window_ms);
+}
+
+/**
+ * Pin every key, for when it is not known what changed
+ * 
+ * @param pins pointer to WritePins structure
+ */
+void write_pins_add_all(WritePins *pins) {
+    if (!pins) {
+        return;
+    }
+    
+    extend(&pins->all_until, now_ms() + (uint64_t)pins->window_ms);
+}
+
+/**
+ * Check whether reads must go to the primary
+ * 
+ * @param pins pointer to WritePins structure
+ * @param key object key, NULL for reads spanning many keys such as listings
+ * @return 1 if pinned, 0 otherwise
+ */
+int write_pins_contains(WritePins *pins, const char *key) {
+    if (!pins) {
+        return 0;
+    }
+    
+    uint64_t now = now_ms();
+    if (__atomic_load_n(&pins->all_until, __ATOMIC_ACQUIRE) > now) {
+        return 1;
+    }
+    
+    return key && __atomic_load_n(&pins->until[slot_for(key)], __ATOMIC_ACQUIRE) > now;
+}
+
+/**
+ * Free the pins
+ * 
+ * @param pins pointer to WritePins structure
+ */
+void write_pins_free(WritePins *pins) {
+    free(pins);
+}
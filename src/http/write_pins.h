@@ -0,0 +1,58 @@
+#ifndef WRITE_PINS_H
+#define WRITE_PINS_H
+
+#include <stdint.h>
+
+// Hash slots; keys sharing a slot pin each other, which only costs a
+// primary read
+#define WRITE_PINS_SLOTS 4096
+
+// Keys written recently, whose reads go to the primary until replicas
+// have caught up. Only expiry times are kept, no keys, so it never
+// allocates after creation and needs no lock.
+typedef struct WritePins {
+    long window_ms;             // how long a write pins its key
+    uint64_t all_until;         // every key is pinned until then
+    uint64_t until[WRITE_PINS_SLOTS];   // per slot, in monotonic ms
+} WritePins;
+
+/**
+ * Create an empty set of pins
+ * 
+ * @param window_ms how long a write pins its key
+ * @return pointer to WritePins structure or NULL if error
+ */
+WritePins *write_pins_create(long window_ms);
+
+/**
+ * Pin a key that was just written or deleted
+ * 
+ * @param pins pointer to WritePins structure
+ * @param key object key
+ */
+void write_pins_add(WritePins *pins, const char *key);
+
+/**
+ * Pin every key, for when it is not known what changed
+ * 
+ * @param pins pointer to WritePins structure
+ */
+void write_pins_add_all(WritePins *pins);
+
+/**
+ * Check whether reads must go to the primary
+ * 
+ * @param pins pointer to WritePins structure
+ * @param key object key, NULL for reads spanning many keys such as listings
+ * @return 1 if pinned, 0 otherwise
+ */
+int write_pins_contains(WritePins *pins, const char *key);
+
+/**
+ * Free the pins
+ * 
+ * @param pins pointer to WritePins structure
+ */
+void write_pins_free(WritePins *pins);
+
+#endif /* WRITE_PINS_H */
@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common/config.h"
+#include "common/content_type.h"
 #include "pg/pg_client.h"
+#include "pg/pg_bench.h"
+#include "pg/pg_shards.h"
+#include "pg/pg_transfer.h"
 #include "http/http_server.h"
 
 void print_help() {
@@ -9,10 +21,29 @@ void print_help() {
     printf("Usage: pgs3 <command> [options]\n\n");
     printf("Commands:\n");
     printf("  ls [prefix]             List objects in the public bucket, optionally with prefix\n");
-    printf("  get <key>               Get object from public bucket\n");
-    printf("  put <key>               Put object from stdin into public bucket\n");
+    printf("  get <key> [--out PATH]  Get object from public bucket to stdout or a file\n");
+    printf("  put <key> [--file PATH] Put object from stdin or a file into public bucket\n");
     printf("  delete <key>            Delete object from public bucket\n");
+    printf("  import <dir> [prefix]   Load every file under a directory into the public\n");
+    printf("                          bucket, keyed by prefix + relative path\n");
+    printf("  cp <src> <dst> [-j N]   Copy a local file or directory to s3://public/<prefix>,\n");
+    printf("                          or the objects under s3://public/<prefix> to a local\n");
+    printf("                          directory, over N connections (default: 4)\n");
+    printf("  mirror <src> <dst> [-j N]\n");
+    printf("                          Like cp, but skip files whose content already matches\n");
+    printf("  rm-prefix <prefix> [--batch N]\n");
+    printf("                          Delete every object under a prefix, N per transaction\n");
+    printf("  rebalance [--dry-run]   Move objects to the database PGS3_SHARDS assigns them,\n");
+    printf("                          after appending databases to it\n");
     printf("  serve [port]            Start HTTP server (default port: 9000)\n");
+    printf("  bench [--count N] [--size BYTES]\n");
+    printf("                          Compare sequential and pipelined put/get/delete\n");
+    printf("  migrate [--layout inline|chunked] [--chunk-size BYTES] [--compress TYPES|none]\n");
+    printf("          [--rewrite-compressed]\n");
+    printf("                          Create or upgrade the S3 schema, optionally choosing\n");
+    printf("                          how new objects are stored and which content types\n");
+    printf("                          (e.g. \"text/*,application/json\") are gzipped, or\n");
+    printf("                          uncompressing content stored before schema version 3\n");
     printf("\n");
     printf("Environment variables:\n");
     printf("  PGHOST                  PostgreSQL host (default: localhost)\n");
@@ -21,6 +52,166 @@ void print_help() {
     printf("  PGUSER                  PostgreSQL user (default: postgres)\n");
     printf("  PGPASSWORD              PostgreSQL password (default: postgres)\n");
     printf("  PGCONNSTRING            Full PostgreSQL connection string (overrides other variables)\n");
+    printf("  PGS3_HTTP_THREADS       HTTP worker threads, 0 for thread-per-connection (default: CPUs)\n");
+    printf("  PGS3_POOL_SIZE          PostgreSQL connections used by serve (default: thread count)\n");
+    printf("  PGS3_CACHE_SIZE         Object cache of serve in MB, 0 to disable (default: 64)\n");
+    printf("  PGS3_UPLOAD_EXPIRY      Hours before serve drops unfinished multipart uploads,\n");
+    printf("                          0 to keep them (default: 24)\n");
+    printf("  PGS3_ASYNC_CONNECTIONS  Non-blocking connections serving GET/HEAD without\n");
+    printf("                          blocking a worker thread, 0 to disable (default: 0)\n");
+    printf("  PGS3_SHARDS             Connection strings, separated by ';', of databases the\n");
+    printf("                          objects are spread over by key hash; replaces the\n");
+    printf("                          variables above. Only ever append to the list\n");
+    printf("  PGS3_REPLICAS           Hot standby connection strings, separated by ';', that\n");
+    printf("                          serve GET, HEAD and listings for serve\n");
+    printf("  PGS3_READ_AFTER_WRITE_MS  Milliseconds a key written through serve is read from\n");
+    printf("                          the primary, 0 never (default: 1000)\n");
+}
+
+// Block size for streaming put and get
+#define CLI_BLOCK_SIZE (1024 * 1024)
+
+// Store the content of fd: mapped when it is a non-empty regular file,
+// which saves reading it into a buffer of our own; streamed in blocks
+// otherwise. libpq still copies every parameter into its output buffer,
+// so an inline put needs memory for the whole file either way, while a
+// chunked one needs about one chunk.
+static S3Result *put_from_fd(PgClient *client, const char *key, int fd, const char *content_type) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            S3Result *result = pg_client_put_object(client, "public", key, map,
+                                                    (size_t)st.st_size, content_type);
+            munmap(map, (size_t)st.st_size);
+            return result;
+        }
+    }
+    
+    // Pipes, empty files and anything mmap refuses
+    S3Upload *upload = pg_client_begin_upload(client, "public", key, content_type);
+    char *block = malloc(CLI_BLOCK_SIZE);
+    if (!upload || !block) {
+        s3_upload_abort(upload);
+        free(block);
+        return NULL;
+    }
+    
+    ssize_t n;
+    while ((n = read(fd, block, CLI_BLOCK_SIZE)) > 0) {
+        if (s3_upload_write(upload, block, (size_t)n) != 0) {
+            break;
+        }
+    }
+    free(block);
+    
+    if (n < 0) {
+        s3_upload_abort(upload);
+        S3Result *result = s3_result_create();
+        if (result) {
+            s3_result_set_error(result, S3_ERROR_EXECUTION, strerror(errno));
+        }
+        return result;
+    }
+    
+    return s3_upload_finish(upload);
+}
+
+// Write an object to out as it is read, one chunk or 1 MB slice at a time
+static S3Result *get_to_stream(PgClient *client, const char *key, FILE *out) {
+    S3ObjectReader *reader = NULL;
+    S3Result *result = pg_client_open_object(client, "public", key, CLI_BLOCK_SIZE, NULL, &reader);
+    if (!result || result->status != S3_SUCCESS) {
+        return result;
+    }
+    
+    char *block = malloc(CLI_BLOCK_SIZE);
+    if (!block) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        s3_reader_close(reader);
+        return result;
+    }
+    
+    ssize_t n;
+    while ((n = s3_reader_read(reader, block, CLI_BLOCK_SIZE)) > 0) {
+        if (fwrite(block, 1, (size_t)n, out) != (size_t)n) {
+            s3_result_set_error(result, S3_ERROR_EXECUTION, strerror(errno));
+            break;
+        }
+    }
+    if (n < 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(client->conn));
+    }
+    if (fflush(out) != 0 && result->status == S3_SUCCESS) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, strerror(errno));
+    }
+    
+    free(block);
+    s3_reader_close(reader);
+    return result;
+}
+
+// Directory import in progress, for the progress line
+typedef struct ImportWalk {
+    S3Import *import;
+    struct timespec started;
+    struct timespec reported;
+} ImportWalk;
+
+static double seconds_since(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void print_import_progress(ImportWalk *walk, const char *end) {
+    long files = walk->import->files + walk->import->batch_files;
+    size_t bytes = walk->import->bytes + walk->import->batch_bytes;
+    double elapsed = seconds_since(&walk->started);
+    fprintf(stderr, "\rImported %ld files (%.1f MB), %.0f files/s%s", files,
+            bytes / (1024.0 * 1024.0), elapsed > 0 ? files / elapsed : 0.0, end);
+    clock_gettime(CLOCK_MONOTONIC, &walk->reported);
+}
+
+// Import the regular files under dir, keyed by key_prefix + their relative path
+static int import_directory(ImportWalk *walk, const char *dir, const char *key_prefix) {
+    char message[4200];
+    DIR *d = opendir(dir);
+    if (!d) {
+        snprintf(message, sizeof(message), "Cannot open %s: %s", dir, strerror(errno));
+        return s3_import_fail(walk->import, message);
+    }
+    
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        
+        char path[4096];
+        char key[4096];
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path) ||
+            snprintf(key, sizeof(key), "%s%s", key_prefix, entry->d_name) >= (int)sizeof(key) - 1) {
+            snprintf(message, sizeof(message), "Path too long: %s/%s", dir, entry->d_name);
+            rc = s3_import_fail(walk->import, message);
+        } else if (stat(path, &st) != 0) {
+            // Dangling symlinks and files removed during the walk
+        } else if (S_ISDIR(st.st_mode)) {
+            strcat(key, "/");
+            rc = import_directory(walk, path, key);
+        } else if (S_ISREG(st.st_mode)) {
+            rc = s3_import_file(walk->import, key, path, content_type_for_key(key));
+            if (rc == 0 && seconds_since(&walk->reported) >= 1.0) {
+                print_import_progress(walk, "");
+            }
+        }
+    }
+    
+    closedir(d);
+    return rc;
 }
 
 int main(int argc, char *argv[]) {
@@ -67,8 +258,25 @@ int main(int argc, char *argv[]) {
             }
         }
         
+        // Server settings: port and conninfo from above, the rest from PGS3_*
+        Config *config = config_init();
+        if (!config) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return 1;
+        }
+        
+        free(config->pg_conninfo);
+        config->pg_conninfo = strdup(conninfo);
+        config->http_port = port;
+        
+        if (!config->pg_conninfo || config_load_env(config) != 0) {
+            config_free(config);
+            return 1;
+        }
+        
         // Start HTTP server
-        HttpServer *server = http_server_init(port, conninfo);
+        HttpServer *server = http_server_init(config);
+        config_free(config);
         if (!server) {
             fprintf(stderr, "Failed to initialize HTTP server\n");
             return 1;
@@ -86,27 +294,141 @@ int main(int argc, char *argv[]) {
         return result;
     }
     
-    // Initialize PostgreSQL client
-    PgClient *client = pg_client_init(conninfo);
-    if (!client) {
+    // Connect to every database holding objects: those in PGS3_SHARDS, if
+    // set, or the one described above
+    char **shard_conninfos = NULL;
+    int shard_count = 0;
+    const char *shards_env = getenv("PGS3_SHARDS");
+    if (shards_env && config_add_conninfos(&shard_conninfos, &shard_count, shards_env) != 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+    
+    const char *single[1] = {conninfo};
+    PgShards *shards = shard_count > 0 ?
+        pg_shards_connect((const char *const *)shard_conninfos, shard_count) :
+        pg_shards_connect(single, 1);
+    config_free_conninfos(shard_conninfos, shard_count);
+    if (!shards) {
         fprintf(stderr, "Failed to connect to PostgreSQL\n");
         return 1;
     }
-
+    
+    // Commands not about a particular key use the first database
+    PgClient *client = shards->clients[0];
+    
     int result = 0;
-
+    
     // Process command
-    if (strcmp(argv[1], "ls") == 0) {
-        // Handle ls command
-        // Можно указать префикс как аргумент
-        if (argc > 2) {
-            printf("Listing objects with prefix: %s\n", argv[2]);
-            // В будущей версии здесь будет фильтрация по префиксу
+    if (strcmp(argv[1], "migrate") == 0) {
+        // pg_client_init already applied any pending migrations
+        S3StorageSettings settings;
+        if (s3_schema_load_settings(client->conn, &settings) != 0) {
+            pg_shards_free(shards);
+            return 1;
         }
         
-        S3Result *s3_result = pg_client_list_objects(client, "public");
+        int changed = 0;
+        int rewrite = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--rewrite-compressed") == 0) {
+                rewrite = 1;
+            } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+                i++;
+                if (strcmp(argv[i], "inline") == 0) {
+                    settings.layout = S3_LAYOUT_INLINE;
+                } else if (strcmp(argv[i], "chunked") == 0) {
+                    settings.layout = S3_LAYOUT_CHUNKED;
+                } else {
+                    fprintf(stderr, "Unknown layout: %s\n", argv[i]);
+                    pg_shards_free(shards);
+                    return 1;
+                }
+                changed = 1;
+            } else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc) {
+                long long chunk_size = atoll(argv[++i]);
+                if (chunk_size <= 0 || chunk_size > 256LL * 1024 * 1024) {
+                    fprintf(stderr, "Invalid chunk size: %s\n", argv[i]);
+                    pg_shards_free(shards);
+                    return 1;
+                }
+                settings.chunk_size = (size_t)chunk_size;
+                changed = 1;
+            } else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+                i++;
+                const char *types = strcmp(argv[i], "none") == 0 ? "" : argv[i];
+                if (strlen(types) >= sizeof(settings.compress_types)) {
+                    fprintf(stderr, "Compression policy too long: %s\n", argv[i]);
+                    pg_shards_free(shards);
+                    return 1;
+                }
+                snprintf(settings.compress_types, sizeof(settings.compress_types), "%s", types);
+                changed = 1;
+            } else {
+                fprintf(stderr, "Usage: pgs3 migrate [--layout inline|chunked] [--chunk-size BYTES] "
+                        "[--compress TYPES|none] [--rewrite-compressed]\n");
+                pg_shards_free(shards);
+                return 1;
+            }
+        }
+        
+        // Every database stores new objects the same way
+        for (int i = 0; changed && i < shards->count; i++) {
+            if (s3_schema_save_settings(shards->clients[i]->conn, &settings) != 0) {
+                pg_shards_free(shards);
+                return 1;
+            }
+        }
+        
+        // Objects written before migration 3 may still be TOAST-compressed
+        for (int i = 0; rewrite && i < shards->count; i++) {
+            long rewritten = s3_schema_rewrite_compressed(shards->clients[i]->conn);
+            if (rewritten < 0) {
+                pg_shards_free(shards);
+                return 1;
+            }
+            printf("Rewrote %ld compressed objects\n", rewritten);
+        }
+        
+        printf("S3 schema is at version %d\n", client->schema_version);
+        if (settings.layout == S3_LAYOUT_CHUNKED) {
+            printf("New objects are stored chunked (%zu byte chunks)\n", settings.chunk_size);
+        } else {
+            printf("New objects are stored inline\n");
+        }
+        if (settings.compress_types[0]) {
+            printf("Inline objects of type %s are stored gzipped\n", settings.compress_types);
+        } else {
+            printf("Objects are stored uncompressed\n");
+        }
+    } else if (strcmp(argv[1], "ls") == 0) {
+        // Handle ls command, optionally limited to a key prefix; entries are
+        // printed as they arrive so long listings use constant memory
+        S3ListOptions options = {argc > 2 ? argv[2] : NULL, NULL, S3_LIST_UNLIMITED, NULL};
+        S3ListStream *stream = NULL;
+        S3Result *s3_result = pg_shards_list_open(shards, "public", &options, &stream);
         if (s3_result && s3_result->status == S3_SUCCESS) {
-            printf("%s\n", (char*)s3_result->data);
+            TextBuffer line = {0};
+            S3ListEntry entry;
+            int rc;
+            
+            fputs("[", stdout);
+            for (int i = 0; (rc = s3_list_next(stream, &entry)) > 0; i++) {
+                if (i > 0) {
+                    fputs(",", stdout);
+                }
+                s3_list_entry_write_json(&line, &entry);
+                fwrite(line.data, 1, line.length, stdout);
+                text_buffer_consume(&line, line.length);
+            }
+            fputs("]\n", stdout);
+            text_buffer_free(&line);
+            s3_list_close(stream);
+            
+            if (rc < 0) {
+                fprintf(stderr, "Failed to list objects\n");
+                result = 1;
+            }
         } else {
             fprintf(stderr, "Failed to list objects\n");
             if (s3_result && s3_result->error_message) {
@@ -118,113 +440,70 @@ int main(int argc, char *argv[]) {
             s3_result_free(s3_result);
         }
     } else if (strcmp(argv[1], "get") == 0) {
-        if (argc < 3) {
-            fprintf(stderr, "Usage: pgs3 get <key>\n");
-            pg_client_free(client);
+        if ((argc != 3 && argc != 5) || (argc == 5 && strcmp(argv[3], "--out") != 0)) {
+            fprintf(stderr, "Usage: pgs3 get <key> [--out PATH]\n");
+            pg_shards_free(shards);
             return 1;
         }
         
-        // Always use the 'public' bucket
-        S3Result *result = pg_client_get_object(client, "public", argv[2]);
-        if (result) {
-            if (result->status == S3_SUCCESS) {
-                // Write content to stdout
-                fwrite(result->data, 1, result->data_size, stdout);
-            } else {
-                fprintf(stderr, "Error: %s\n", result->error_message ? result->error_message : "Unknown error");
-            }
-            s3_result_free(result);
-        } else {
-            fprintf(stderr, "Failed to execute command\n");
-            pg_client_free(client);
+        FILE *out = stdout;
+        if (argc == 5 && !(out = fopen(argv[4], "wb"))) {
+            fprintf(stderr, "Cannot open %s: %s\n", argv[4], strerror(errno));
+            pg_shards_free(shards);
             return 1;
         }
+        
+        // Always use the 'public' bucket
+        S3Result *s3_result = get_to_stream(pg_shards_client(shards, argv[2]), argv[2], out);
+        if (out != stdout && fclose(out) != 0 && s3_result && s3_result->status == S3_SUCCESS) {
+            s3_result_set_error(s3_result, S3_ERROR_EXECUTION, strerror(errno));
+        }
+        if (!s3_result || s3_result->status != S3_SUCCESS) {
+            fprintf(stderr, "Error: %s\n", s3_result && s3_result->error_message ?
+                    s3_result->error_message : "Unknown error");
+            result = 1;
+        }
+        s3_result_free(s3_result);
     } else if (strcmp(argv[1], "put") == 0) {
-        if (argc < 3) {
-            fprintf(stderr, "Usage: pgs3 put <key>\n");
-            pg_client_free(client);
+        if ((argc != 3 && argc != 5) || (argc == 5 && strcmp(argv[3], "--file") != 0)) {
+            fprintf(stderr, "Usage: pgs3 put <key> [--file PATH]\n");
+            pg_shards_free(shards);
             return 1;
         }
         
-        // Read data from stdin
-        size_t size = 0;
-        size_t capacity = 1024;
-        char *data = malloc(capacity);
-        if (!data) {
-            fprintf(stderr, "Failed to allocate memory\n");
-            pg_client_free(client);
+        int fd = argc == 5 ? open(argv[4], O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", argv[4], strerror(errno));
+            pg_shards_free(shards);
             return 1;
         }
         
-        int c;
-        while ((c = getchar()) != EOF) {
-            if (size >= capacity) {
-                capacity *= 2;
-                char *new_data = realloc(data, capacity);
-                if (!new_data) {
-                    fprintf(stderr, "Failed to allocate memory\n");
-                    free(data);
-                    pg_client_free(client);
-                    return 1;
-                }
-                data = new_data;
-            }
-            data[size++] = c;
-        }
-        
         // Try to determine content type from key
-        const char *content_type = "application/octet-stream";
-        char *ext = strrchr(argv[2], '.');
-        if (ext) {
-            ext++; // Skip the dot
-            if (strcasecmp(ext, "txt") == 0) {
-                content_type = "text/plain";
-            } else if (strcasecmp(ext, "html") == 0 || strcasecmp(ext, "htm") == 0) {
-                content_type = "text/html";
-            } else if (strcasecmp(ext, "css") == 0) {
-                content_type = "text/css";
-            } else if (strcasecmp(ext, "js") == 0) {
-                content_type = "application/javascript";
-            } else if (strcasecmp(ext, "json") == 0) {
-                content_type = "application/json";
-            } else if (strcasecmp(ext, "xml") == 0) {
-                content_type = "application/xml";
-            } else if (strcasecmp(ext, "png") == 0) {
-                content_type = "image/png";
-            } else if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0) {
-                content_type = "image/jpeg";
-            } else if (strcasecmp(ext, "gif") == 0) {
-                content_type = "image/gif";
-            } else if (strcasecmp(ext, "pdf") == 0) {
-                content_type = "application/pdf";
-            }
-        }
+        const char *content_type = content_type_for_key(argv[2]);
         
         // Always use the 'public' bucket
-        S3Result *result = pg_client_put_object(client, "public", argv[2], data, size, content_type);
-        free(data);
+        S3Result *s3_result = put_from_fd(pg_shards_client(shards, argv[2]), argv[2], fd, content_type);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
         
-        if (result) {
-            if (result->status == S3_SUCCESS) {
-                printf("%.*s\n", (int)result->data_size, (char*)result->data);
-            } else {
-                fprintf(stderr, "Error: %s\n", result->error_message ? result->error_message : "Unknown error");
-            }
-            s3_result_free(result);
+        if (s3_result && s3_result->status == S3_SUCCESS) {
+            printf("%.*s\n", (int)s3_result->data_size, (char*)s3_result->data);
         } else {
-            fprintf(stderr, "Failed to execute command\n");
-            pg_client_free(client);
-            return 1;
+            fprintf(stderr, "Error: %s\n", s3_result && s3_result->error_message ?
+                    s3_result->error_message : "Unknown error");
+            result = 1;
         }
+        s3_result_free(s3_result);
     } else if (strcmp(argv[1], "delete") == 0) {
         if (argc < 3) {
             fprintf(stderr, "Usage: pgs3 delete <key>\n");
-            pg_client_free(client);
+            pg_shards_free(shards);
             return 1;
         }
         
         // Always use the 'public' bucket
-        S3Result *result = pg_client_delete_object(client, "public", argv[2]);
+        S3Result *result = pg_client_delete_object(pg_shards_client(shards, argv[2]), "public", argv[2]);
         if (result) {
             if (result->status == S3_SUCCESS) {
                 printf("Object deleted successfully\n");
@@ -234,16 +513,172 @@ int main(int argc, char *argv[]) {
             s3_result_free(result);
         } else {
             fprintf(stderr, "Failed to execute command\n");
-            pg_client_free(client);
+            pg_shards_free(shards);
+            return 1;
+        }
+    } else if (strcmp(argv[1], "bench") == 0) {
+        int count = 1000;
+        long long size = 1024;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+                count = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+                size = atoll(argv[++i]);
+            } else {
+                count = 0;
+                break;
+            }
+        }
+        if (count <= 0 || size <= 0) {
+            fprintf(stderr, "Usage: pgs3 bench [--count N] [--size BYTES]\n");
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        result = pg_bench_run(client, count, (size_t)size) == 0 ? 0 : 1;
+    } else if ((strcmp(argv[1], "import") == 0 || strcmp(argv[1], "cp") == 0 ||
+                strcmp(argv[1], "mirror") == 0) && shards->count > 1) {
+        // Their batches and worker connections all go to one database
+        fprintf(stderr, "%s does not support PGS3_SHARDS yet; use put or copy into each database\n",
+                argv[1]);
+        result = 1;
+    } else if (strcmp(argv[1], "import") == 0) {
+        if (argc < 3 || argc > 4) {
+            fprintf(stderr, "Usage: pgs3 import <dir> [prefix]\n");
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        ImportWalk walk = {pg_client_begin_import(client), {0, 0}, {0, 0}};
+        if (!walk.import) {
+            fprintf(stderr, "Failed to execute command\n");
+            pg_shards_free(shards);
             return 1;
         }
+        clock_gettime(CLOCK_MONOTONIC, &walk.started);
+        walk.reported = walk.started;
+        
+        // Errors end the walk and fail the import; s3_import_finish
+        // reports the first one
+        import_directory(&walk, argv[2], argc > 3 ? argv[3] : "");
+        
+        // Batches committed before a failure stay imported
+        ImportWalk summary = walk;
+        S3Import counts = *walk.import;
+        summary.import = &counts;
+        S3Result *s3_result = s3_import_finish(walk.import);
+        if (s3_result && s3_result->status == S3_SUCCESS) {
+            print_import_progress(&summary, "\n");
+        } else {
+            counts.batch_files = 0;
+            counts.batch_bytes = 0;
+            print_import_progress(&summary, "\n");
+            fprintf(stderr, "Error: %s\n", s3_result && s3_result->error_message ?
+                    s3_result->error_message : "Unknown error");
+            result = 1;
+        }
+        s3_result_free(s3_result);
+    } else if (strcmp(argv[1], "cp") == 0 || strcmp(argv[1], "mirror") == 0) {
+        int workers = 4;
+        if (argc == 6 && strcmp(argv[4], "-j") == 0) {
+            workers = atoi(argv[5]);
+        }
+        
+        // Exactly one side names the bucket
+        const char *remote = "s3://public/";
+        size_t remote_length = strlen(remote);
+        int upload = argc > 3 && strncmp(argv[3], remote, remote_length) == 0;
+        int download = argc > 3 && strncmp(argv[2], remote, remote_length) == 0;
+        if ((argc != 4 && argc != 6) || workers <= 0 || upload == download) {
+            fprintf(stderr, "Usage: pgs3 %s <dir|file> s3://public/<prefix> [-j N]\n", argv[1]);
+            fprintf(stderr, "       pgs3 %s s3://public/<prefix> <dir> [-j N]\n", argv[1]);
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        PgTransfer *transfer = pg_transfer_create(conninfo,
+                                                  upload ? PG_TRANSFER_UPLOAD : PG_TRANSFER_DOWNLOAD,
+                                                  strcmp(argv[1], "mirror") == 0);
+        if (!transfer) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        int rc;
+        if (download) {
+            rc = pg_transfer_add_prefix(transfer, client, argv[2] + remote_length, argv[3]);
+        } else {
+            const char *prefix = argv[3] + remote_length;
+            struct stat st;
+            if (stat(argv[2], &st) != 0) {
+                fprintf(stderr, "Cannot open %s\n", argv[2]);
+                rc = -1;
+            } else if (S_ISDIR(st.st_mode)) {
+                rc = pg_transfer_add_directory(transfer, argv[2], prefix);
+            } else if (!prefix[0] || prefix[strlen(prefix) - 1] == '/') {
+                // A single file keeps its name under a prefix ending in '/'
+                const char *slash = strrchr(argv[2], '/');
+                char key[4096];
+                snprintf(key, sizeof(key), "%s%s", prefix, slash ? slash + 1 : argv[2]);
+                rc = pg_transfer_add(transfer, key, argv[2]);
+            } else {
+                rc = pg_transfer_add(transfer, prefix, argv[2]);
+            }
+        }
+        
+        // The workers open their own connections
+        if (rc == 0) {
+            rc = pg_transfer_run(transfer, workers);
+        }
+        result = rc == 0 ? 0 : 1;
+        pg_transfer_free(transfer);
+    } else if (strcmp(argv[1], "rm-prefix") == 0) {
+        int batch_size = 0;
+        if (argc == 5 && strcmp(argv[3], "--batch") == 0) {
+            batch_size = atoi(argv[4]);
+        }
+        if ((argc != 3 && argc != 5) || batch_size < 0 || !argv[2][0]) {
+            fprintf(stderr, "Usage: pgs3 rm-prefix <prefix> [--batch N]\n");
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        // Batches commit one by one, so a failure keeps what was deleted
+        long deleted = 0;
+        S3Result *s3_result = pg_shards_delete_prefix(shards, "public", argv[2], batch_size, &deleted);
+        printf("Deleted %ld objects\n", deleted);
+        if (!s3_result || s3_result->status != S3_SUCCESS) {
+            fprintf(stderr, "Error: %s\n", s3_result && s3_result->error_message ?
+                    s3_result->error_message : "Unknown error");
+            result = 1;
+        }
+        s3_result_free(s3_result);
+    } else if (strcmp(argv[1], "rebalance") == 0) {
+        int dry_run = argc == 3 && strcmp(argv[2], "--dry-run") == 0;
+        if (argc > 3 || (argc == 3 && !dry_run)) {
+            fprintf(stderr, "Usage: pgs3 rebalance [--dry-run]\n");
+            pg_shards_free(shards);
+            return 1;
+        }
+        
+        // Objects move one at a time, so an interrupted run keeps its progress
+        long moved = 0;
+        S3Result *s3_result = pg_shards_rebalance(shards, dry_run, &moved);
+        printf(dry_run ? "%ld objects to move\n" : "Moved %ld objects\n", moved);
+        if (!s3_result || s3_result->status != S3_SUCCESS) {
+            fprintf(stderr, "Error: %s\n", s3_result && s3_result->error_message ?
+                    s3_result->error_message : "Unknown error");
+            result = 1;
+        }
+        s3_result_free(s3_result);
     } else {
         fprintf(stderr, "Unknown command: %s\n", argv[1]);
         print_help();
-        pg_client_free(client);
+        pg_shards_free(shards);
         return 1;
     }
     
-    pg_client_free(client);
+    pg_shards_free(shards);
     return result;
 } 
\ No newline at end of file
@@ -0,0 +1,526 @@
+#include "pg_async.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// What the oldest statement in flight on a connection returns next: its
+// result, the NULL that ends it, then its sync point
+enum {
+    STAGE_RESULT,
+    STAGE_END,
+    STAGE_SYNC
+};
+
+/**
+ * Deliver a statement's result, or its failure, to the caller
+ * 
+ * @param async pointer to PgAsync structure
+ * @param query statement
+ * @param res result handed over to the callback, NULL if the statement failed
+ */
+static void deliver(PgAsync *async, PgAsyncQuery *query, PGresult *res) {
+    if (!query->callback) {
+        PQclear(res);
+        return;
+    }
+    
+    if (res) {
+        async->completed++;
+    } else {
+        async->failed++;
+    }
+    __atomic_sub_fetch(&async->outstanding, 1, __ATOMIC_RELAXED);
+    
+    PgAsyncCallback callback = query->callback;
+    query->callback = NULL;
+    callback(query->arg, res);
+}
+
+/**
+ * Open one connection and switch it to non-blocking pipeline mode
+ * 
+ * @param async pointer to PgAsync structure
+ * @param connection connection slot
+ * @return 0 on success, -1 on error
+ */
+static int open_connection(PgAsync *async, PgAsyncConnection *connection) {
+    PgClient *client = pg_client_init(async->conninfo);
+    if (!client) {
+        connection->retry_at = time(NULL) + PG_ASYNC_RETRY_SECONDS;
+        return -1;
+    }
+    
+    if (!PQenterPipelineMode(client->conn) || PQsetnonblocking(client->conn, 1) != 0) {
+        fprintf(stderr, "Failed to make connection asynchronous: %s", PQerrorMessage(client->conn));
+        pg_client_free(client);
+        connection->retry_at = time(NULL) + PG_ASYNC_RETRY_SECONDS;
+        return -1;
+    }
+    
+    connection->client = client;
+    connection->stage = STAGE_RESULT;
+    connection->writing = 0;
+    return 0;
+}
+
+/**
+ * Close a connection that broke and fail the statements in flight on it
+ * 
+ * @param async pointer to PgAsync structure
+ * @param connection connection slot
+ */
+static void close_connection(PgAsync *async, PgAsyncConnection *connection) {
+    if (connection->client && PQstatus(connection->client->conn) != CONNECTION_OK) {
+        fprintf(stderr, "Async connection lost: %s", PQerrorMessage(connection->client->conn));
+    }
+    
+    while (connection->head) {
+        PgAsyncQuery *query = connection->head;
+        connection->head = query->next;
+        deliver(async, query, NULL);
+        free(query);
+    }
+    connection->tail = NULL;
+    connection->in_flight = 0;
+    
+    pg_client_free(connection->client);
+    connection->client = NULL;
+    connection->retry_at = time(NULL) + PG_ASYNC_RETRY_SECONDS;
+}
+
+/**
+ * Hand buffered output to the socket
+ * 
+ * @param async pointer to PgAsync structure
+ * @param connection connection slot
+ */
+static void flush_connection(PgAsync *async, PgAsyncConnection *connection) {
+    int rc = PQflush(connection->client->conn);
+    if (rc < 0) {
+        close_connection(async, connection);
+        return;
+    }
+    
+    // The rest goes out when poll reports the socket writable
+    connection->writing = rc == 1;
+}
+
+/**
+ * Send a statement followed by its own sync point
+ * 
+ * @param async pointer to PgAsync structure
+ * @param connection connected slot with room for another statement
+ * @param query statement
+ */
+static void send_query(PgAsync *async, PgAsyncConnection *connection, PgAsyncQuery *query) {
+    query->next = NULL;
+    if (connection->tail) {
+        connection->tail->next = query;
+    } else {
+        connection->head = query;
+    }
+    connection->tail = query;
+    connection->in_flight++;
+    
+    PGconn *conn = connection->client->conn;
+    if (!PQsendQueryPrepared(conn, s3_statement_name(query->statement), query->n_params,
+                             query->values, NULL, NULL, query->result_format) ||
+        !PQpipelineSync(conn)) {
+        close_connection(async, connection);
+        return;
+    }
+    
+    flush_connection(async, connection);
+}
+
+/**
+ * Read what arrived on a connection and deliver the completed results
+ * 
+ * @param async pointer to PgAsync structure
+ * @param connection connected slot
+ */
+static void read_connection(PgAsync *async, PgAsyncConnection *connection) {
+    PGconn *conn = connection->client->conn;
+    if (!PQconsumeInput(conn)) {
+        close_connection(async, connection);
+        return;
+    }
+    
+    // PQgetResult only blocks while PQisBusy says so
+    while (connection->head && !PQisBusy(conn)) {
+        PGresult *res = PQgetResult(conn);
+        
+        if (connection->stage == STAGE_RESULT) {
+            if (!res) {
+                close_connection(async, connection);
+                return;
+            }
+            deliver(async, connection->head, res);
+            connection->stage = STAGE_END;
+        } else if (connection->stage == STAGE_END) {
+            if (res) {
+                PQclear(res);
+                continue;
+            }
+            connection->stage = STAGE_SYNC;
+        } else {
+            ExecStatusType status = PQresultStatus(res);
+            PQclear(res);
+            if (status != PGRES_PIPELINE_SYNC) {
+                close_connection(async, connection);
+                return;
+            }
+            
+            PgAsyncQuery *query = connection->head;
+            connection->head = query->next;
+            if (!connection->head) {
+                connection->tail = NULL;
+            }
+            connection->in_flight--;
+            connection->stage = STAGE_RESULT;
+            free(query);
+        }
+    }
+}
+
+/**
+ * Re-open dropped connections whose back-off has passed
+ * 
+ * Connecting blocks the loop, which is why attempts are spaced out.
+ * 
+ * @param async pointer to PgAsync structure
+ */
+static void reconnect_due(PgAsync *async) {
+    time_t now = time(NULL);
+    
+    for (int i = 0; i < async->size; i++) {
+        PgAsyncConnection *connection = &async->connections[i];
+        if (!connection->client && now >= connection->retry_at &&
+            open_connection(async, connection) == 0) {
+            async->reconnects++;
+        }
+    }
+}
+
+/**
+ * Move queued statements onto the least loaded connections
+ * 
+ * @param async pointer to PgAsync structure
+ */
+static void dispatch(PgAsync *async) {
+    while (1) {
+        PgAsyncConnection *target = NULL;
+        int connected = 0;
+        for (int i = 0; i < async->size; i++) {
+            PgAsyncConnection *connection = &async->connections[i];
+            if (!connection->client) {
+                continue;
+            }
+            connected = 1;
+            if (connection->in_flight < PG_ASYNC_MAX_IN_FLIGHT &&
+                (!target || connection->in_flight < target->in_flight)) {
+                target = connection;
+            }
+        }
+        
+        // Every connection busy: the rest waits for results to come back
+        if (!target && connected) {
+            return;
+        }
+        
+        pthread_mutex_lock(&async->lock);
+        PgAsyncQuery *query = async->queue_head;
+        if (query) {
+            async->queue_head = query->next;
+            if (!async->queue_head) {
+                async->queue_tail = NULL;
+            }
+            async->queued--;
+        }
+        pthread_mutex_unlock(&async->lock);
+        
+        if (!query) {
+            return;
+        }
+        
+        // With no connection at all, callers are better off failing fast
+        if (!target) {
+            deliver(async, query, NULL);
+            free(query);
+            continue;
+        }
+        
+        send_query(async, target, query);
+    }
+}
+
+/**
+ * Empty the wake-up pipe
+ * 
+ * @param async pointer to PgAsync structure
+ */
+static void drain_wake(PgAsync *async) {
+    char buffer[64];
+    while (read(async->wake[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+/**
+ * Event loop thread: send, wait and deliver until stopped
+ * 
+ * @param arg pointer to PgAsync structure
+ * @return NULL
+ */
+static void *async_main(void *arg) {
+    PgAsync *async = (PgAsync *)arg;
+    
+    // Slot 0 is the wake-up pipe; slot i + 1 maps to connection map[i]
+    struct pollfd *fds = calloc(async->size + 1, sizeof(struct pollfd));
+    int *map = calloc(async->size, sizeof(int));
+    
+    while (fds && map) {
+        pthread_mutex_lock(&async->lock);
+        int stopping = async->stopping;
+        pthread_mutex_unlock(&async->lock);
+        if (stopping) {
+            break;
+        }
+        
+        reconnect_due(async);
+        dispatch(async);
+        
+        fds[0].fd = async->wake[0];
+        fds[0].events = POLLIN;
+        int count = 0;
+        for (int i = 0; i < async->size; i++) {
+            PgAsyncConnection *connection = &async->connections[i];
+            if (!connection->client) {
+                continue;
+            }
+            fds[count + 1].fd = PQsocket(connection->client->conn);
+            fds[count + 1].events = POLLIN | (connection->writing ? POLLOUT : 0);
+            fds[count + 1].revents = 0;
+            map[count++] = i;
+        }
+        
+        if (poll(fds, count + 1, PG_ASYNC_POLL_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            drain_wake(async);
+        }
+        
+        for (int i = 0; i < count; i++) {
+            PgAsyncConnection *connection = &async->connections[map[i]];
+            short revents = fds[i + 1].revents;
+            if (connection->client && (revents & POLLOUT)) {
+                flush_connection(async, connection);
+            }
+            if (connection->client && (revents & (POLLIN | POLLERR | POLLHUP))) {
+                read_connection(async, connection);
+            }
+        }
+    }
+    
+    free(fds);
+    free(map);
+    
+    // Nobody will send what is left, so fail it
+    for (int i = 0; i < async->size; i++) {
+        close_connection(async, &async->connections[i]);
+    }
+    
+    pthread_mutex_lock(&async->lock);
+    PgAsyncQuery *query = async->queue_head;
+    async->queue_head = NULL;
+    async->queue_tail = NULL;
+    async->queued = 0;
+    async->stopping = 1;
+    pthread_mutex_unlock(&async->lock);
+    
+    while (query) {
+        PgAsyncQuery *next = query->next;
+        deliver(async, query, NULL);
+        free(query);
+        query = next;
+    }
+    
+    return NULL;
+}
+
+/**
+ * Open the connections and start the event loop
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param connections number of connections
+ * @return pointer to PgAsync structure or NULL if no connection could be opened
+ */
+PgAsync *pg_async_start(const char *conninfo, int connections) {
+    if (!conninfo || connections <= 0) {
+        return NULL;
+    }
+    
+    PgAsync *async = (PgAsync *)calloc(1, sizeof(PgAsync));
+    if (!async) {
+        return NULL;
+    }
+    
+    async->size = connections;
+    async->wake[0] = -1;
+    async->wake[1] = -1;
+    async->conninfo = strdup(conninfo);
+    async->connections = calloc(connections, sizeof(PgAsyncConnection));
+    if (!async->conninfo || !async->connections || pipe(async->wake) != 0) {
+        goto fail;
+    }
+    fcntl(async->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(async->wake[1], F_SETFL, O_NONBLOCK);
+    
+    int opened = 0;
+    for (int i = 0; i < connections; i++) {
+        if (open_connection(async, &async->connections[i]) == 0) {
+            opened++;
+        }
+    }
+    if (opened == 0) {
+        goto fail;
+    }
+    
+    pthread_mutex_init(&async->lock, NULL);
+    if (pthread_create(&async->thread, NULL, async_main, async) != 0) {
+        pthread_mutex_destroy(&async->lock);
+        goto fail;
+    }
+    
+    return async;
+
+fail:
+    if (async->connections) {
+        for (int i = 0; i < connections; i++) {
+            pg_client_free(async->connections[i].client);
+        }
+    }
+    if (async->wake[0] >= 0) {
+        close(async->wake[0]);
+        close(async->wake[1]);
+    }
+    free(async->connections);
+    free(async->conninfo);
+    free(async);
+    return NULL;
+}
+
+/**
+ * Queue a prepared statement with text parameters
+ * 
+ * @param async pointer to PgAsync structure
+ * @param statement statement to run
+ * @param n_params number of parameters, at most PG_ASYNC_MAX_PARAMS
+ * @param values parameter values
+ * @param result_format 0 for text results, 1 for binary
+ * @param callback function receiving the result
+ * @param arg passed through to the callback
+ * @return 0 if queued, -1 if the queue is full, the loop is stopping or on memory error
+ */
+int pg_async_submit(PgAsync *async, S3StatementId statement, int n_params,
+                    const char *const *values, int result_format,
+                    PgAsyncCallback callback, void *arg) {
+    if (!async || !callback || n_params < 0 || n_params > PG_ASYNC_MAX_PARAMS) {
+        return -1;
+    }
+    
+    size_t text_size = 0;
+    for (int i = 0; i < n_params; i++) {
+        text_size += values[i] ? strlen(values[i]) + 1 : 0;
+    }
+    
+    PgAsyncQuery *query = (PgAsyncQuery *)malloc(sizeof(PgAsyncQuery) + text_size);
+    if (!query) {
+        return -1;
+    }
+    
+    query->next = NULL;
+    query->statement = statement;
+    query->n_params = n_params;
+    query->result_format = result_format;
+    query->callback = callback;
+    query->arg = arg;
+    
+    char *text = query->text;
+    for (int i = 0; i < n_params; i++) {
+        query->values[i] = NULL;
+        if (values[i]) {
+            size_t length = strlen(values[i]) + 1;
+            memcpy(text, values[i], length);
+            query->values[i] = text;
+            text += length;
+        }
+    }
+    
+    pthread_mutex_lock(&async->lock);
+    if (async->stopping || async->queued >= PG_ASYNC_MAX_QUEUED) {
+        pthread_mutex_unlock(&async->lock);
+        free(query);
+        return -1;
+    }
+    if (async->queue_tail) {
+        async->queue_tail->next = query;
+    } else {
+        async->queue_head = query;
+    }
+    async->queue_tail = query;
+    async->queued++;
+    async->submitted++;
+    __atomic_add_fetch(&async->outstanding, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&async->lock);
+    
+    // A full pipe already has a wake-up pending
+    if (write(async->wake[1], "", 1) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+    
+    return 0;
+}
+
+/**
+ * Count the statements waiting for their callback
+ * 
+ * @param async pointer to PgAsync structure
+ * @return statements queued or in flight
+ */
+int pg_async_outstanding(PgAsync *async) {
+    return async ? __atomic_load_n(&async->outstanding, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * Stop the event loop and close the connections
+ * 
+ * @param async pointer to PgAsync structure
+ */
+void pg_async_stop(PgAsync *async) {
+    if (!async) {
+        return;
+    }
+    
+    pthread_mutex_lock(&async->lock);
+    async->stopping = 1;
+    pthread_mutex_unlock(&async->lock);
+    if (write(async->wake[1], "", 1) < 0 && errno != EAGAIN) {
+        perror("write");
+    }
+    
+    pthread_join(async->thread, NULL);
+    pthread_mutex_destroy(&async->lock);
+    
+    close(async->wake[0]);
+    close(async->wake[1]);
+    free(async->connections);
+    free(async->conninfo);
+    free(async);
+}
@@ -0,0 +1,133 @@
+#ifndef PG_ASYNC_H
+#define PG_ASYNC_H
+
+#include <pthread.h>
+#include <time.h>
+#include <libpq-fe.h>
+#include "pg_client.h"
+#include "s3_statements.h"
+
+// Statements in flight on one connection; further ones wait in the queue
+#define PG_ASYNC_MAX_IN_FLIGHT 64
+
+// Statements waiting for a connection before submissions are refused
+#define PG_ASYNC_MAX_QUEUED 10000
+
+// Parameters a submitted statement may have
+#define PG_ASYNC_MAX_PARAMS 4
+
+// Wait between attempts to re-open a dropped connection
+#define PG_ASYNC_RETRY_SECONDS 1
+
+// Longest wait for socket events, so dropped connections get retried
+#define PG_ASYNC_POLL_MS 500
+
+/**
+ * Called on the event loop thread when a statement completes. res is NULL
+ * if it could not run (no connection, or the loop is stopping); otherwise
+ * the callback owns it and must PQclear it. Callbacks must not block, as
+ * every other statement waits for them.
+ */
+typedef void (*PgAsyncCallback)(void *arg, PGresult *res);
+
+// Statement waiting to be sent or for its result
+typedef struct PgAsyncQuery {
+    struct PgAsyncQuery *next;
+    S3StatementId statement;
+    int n_params;
+    const char *values[PG_ASYNC_MAX_PARAMS];    // point into text, NULL for SQL NULL
+    int result_format;
+    PgAsyncCallback callback;   // NULL once the result was delivered
+    void *arg;
+    char text[];                // copies of the parameter values
+} PgAsyncQuery;
+
+// One non-blocking connection in pipeline mode
+typedef struct PgAsyncConnection {
+    PgClient *client;           // NULL while disconnected
+    PgAsyncQuery *head;         // in flight, oldest first
+    PgAsyncQuery *tail;
+    int in_flight;
+    int stage;                  // what the oldest statement returns next
+    int writing;                // output is waiting for the socket to drain
+    time_t retry_at;            // next connection attempt while disconnected
+} PgAsyncConnection;
+
+/**
+ * Event loop running prepared statements on non-blocking connections
+ * 
+ * Callers hand a statement over with pg_async_submit and return at once.
+ * One thread sends the statements on the least loaded of a few pipelined
+ * connections, waits on all their sockets together and calls back as the
+ * results arrive, so thousands of requests can wait on the database
+ * without holding a thread or a connection each.
+ */
+typedef struct PgAsync {
+    char *conninfo;
+    int size;                   // number of connections
+    PgAsyncConnection *connections;
+    pthread_t thread;
+    pthread_mutex_t lock;       // guards the queue and stopping
+    PgAsyncQuery *queue_head;   // submitted, not sent yet
+    PgAsyncQuery *queue_tail;
+    int queued;
+    int wake[2];                // pipe that interrupts the loop's wait
+    int stopping;
+    int outstanding;            // submitted, not called back yet; atomic
+    unsigned long submitted;
+    unsigned long completed;    // results delivered
+    unsigned long failed;       // statements that could not run
+    unsigned long reconnects;   // connections re-opened after dropping
+} PgAsync;
+
+/**
+ * Open the connections and start the event loop
+ * 
+ * Connections that cannot be opened now are retried by the loop.
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param connections number of connections
+ * @return pointer to PgAsync structure or NULL if no connection could be opened
+ */
+PgAsync *pg_async_start(const char *conninfo, int connections);
+
+/**
+ * Queue a prepared statement with text parameters
+ * 
+ * The values are copied, so they need not outlive the call. The callback
+ * may run before this function returns.
+ * 
+ * @param async pointer to PgAsync structure
+ * @param statement statement to run
+ * @param n_params number of parameters, at most PG_ASYNC_MAX_PARAMS
+ * @param values parameter values
+ * @param result_format 0 for text results, 1 for binary
+ * @param callback function receiving the result
+ * @param arg passed through to the callback
+ * @return 0 if queued, -1 if the queue is full, the loop is stopping or on memory error
+ */
+int pg_async_submit(PgAsync *async, S3StatementId statement, int n_params,
+                    const char *const *values, int result_format,
+                    PgAsyncCallback callback, void *arg);
+
+/**
+ * Count the statements waiting for their callback
+ * 
+ * Safe to call from any thread, without taking the queue lock.
+ * 
+ * @param async pointer to PgAsync structure
+ * @return statements queued or in flight
+ */
+int pg_async_outstanding(PgAsync *async);
+
+/**
+ * Stop the event loop and close the connections
+ * 
+ * Statements still queued or in flight are called back with a NULL result
+ * before this returns.
+ * 
+ * @param async pointer to PgAsync structure
+ */
+void pg_async_stop(PgAsync *async);
+
+#endif /* PG_ASYNC_H */
@@ -0,0 +1,132 @@
+#include "pg_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Put a connection into pipeline mode
+ * 
+ * @param conn idle PostgreSQL connection, used exclusively until pg_batch_end
+ * @param window statements in flight at most, 0 for PG_BATCH_DEFAULT_WINDOW
+ * @param callback function receiving the results
+ * @param arg passed through to the callback
+ * @return pointer to PgBatch structure or NULL if error
+ */
+PgBatch *pg_batch_begin(PGconn *conn, int window, PgBatchCallback callback, void *arg) {
+    if (!conn || !callback || window < 0) {
+        return NULL;
+    }
+    
+    PgBatch *batch = (PgBatch *)calloc(1, sizeof(PgBatch));
+    if (!batch) {
+        return NULL;
+    }
+    
+    if (!PQenterPipelineMode(conn)) {
+        fprintf(stderr, "Failed to enter pipeline mode: %s", PQerrorMessage(conn));
+        free(batch);
+        return NULL;
+    }
+    
+    batch->conn = conn;
+    batch->callback = callback;
+    batch->arg = arg;
+    batch->window = window ? window : PG_BATCH_DEFAULT_WINDOW;
+    
+    return batch;
+}
+
+/**
+ * Deliver the result of the oldest statement in flight
+ * 
+ * @param batch pointer to PgBatch structure
+ */
+static void collect_one(PgBatch *batch) {
+    int index = batch->collected++;
+    
+    if (batch->failed) {
+        batch->callback(batch->arg, index, NULL);
+        return;
+    }
+    
+    // The statement's result, the NULL that ends it, then its sync point
+    PGresult *res = PQgetResult(batch->conn);
+    if (!res || PQstatus(batch->conn) != CONNECTION_OK) {
+        batch->failed = 1;
+        PQclear(res);
+        batch->callback(batch->arg, index, NULL);
+        return;
+    }
+    
+    PGresult *extra;
+    while ((extra = PQgetResult(batch->conn)) != NULL) {
+        PQclear(extra);
+    }
+    
+    batch->callback(batch->arg, index, res);
+    PQclear(res);
+    
+    PGresult *sync = PQgetResult(batch->conn);
+    if (PQresultStatus(sync) != PGRES_PIPELINE_SYNC) {
+        batch->failed = 1;
+    }
+    PQclear(sync);
+}
+
+/**
+ * Queue a prepared statement
+ * 
+ * @param batch pointer to PgBatch structure
+ * @param statement statement to run
+ * @param n_params number of parameters
+ * @param values parameter values
+ * @param lengths lengths of binary parameters, NULL if all are text
+ * @param formats 1 for binary parameters, NULL if all are text
+ * @param result_format 0 for text results, 1 for binary
+ * @return index passed to the callback, -1 if the statement could not be sent
+ */
+int pg_batch_queue(PgBatch *batch, S3StatementId statement, int n_params,
+                   const char *const *values, const int *lengths, const int *formats,
+                   int result_format) {
+    if (!batch || batch->failed) {
+        return -1;
+    }
+    
+    if (batch->queued - batch->collected >= batch->window) {
+        collect_one(batch);
+    }
+    
+    // The sync also flushes, so the server starts on it right away
+    if (!PQsendQueryPrepared(batch->conn, s3_statement_name(statement), n_params,
+                             values, lengths, formats, result_format) ||
+        !PQpipelineSync(batch->conn)) {
+        fprintf(stderr, "Failed to queue statement: %s", PQerrorMessage(batch->conn));
+        batch->failed = 1;
+        return -1;
+    }
+    
+    return batch->queued++;
+}
+
+/**
+ * Deliver the outstanding results, leave pipeline mode and free the batch
+ * 
+ * @param batch pointer to PgBatch structure
+ * @return 0 on success, -1 if the connection failed
+ */
+int pg_batch_end(PgBatch *batch) {
+    if (!batch) {
+        return -1;
+    }
+    
+    while (batch->collected < batch->queued) {
+        collect_one(batch);
+    }
+    
+    int failed = batch->failed;
+    if (!PQexitPipelineMode(batch->conn)) {
+        failed = 1;
+    }
+    
+    free(batch);
+    return failed ? -1 : 0;
+}
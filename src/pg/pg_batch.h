@@ -0,0 +1,70 @@
+#ifndef PG_BATCH_H
+#define PG_BATCH_H
+
+#include <libpq-fe.h>
+#include "s3_statements.h"
+
+// Statements in flight before results are collected by default; bounds
+// the memory held in socket and libpq buffers on both sides
+#define PG_BATCH_DEFAULT_WINDOW 256
+
+/**
+ * Called with the result of every queued statement, in queue order. res is
+ * NULL when the connection failed before the statement completed. The
+ * result is cleared after the callback returns.
+ */
+typedef void (*PgBatchCallback)(void *arg, int index, const PGresult *res);
+
+// Prepared statements sent back to back in libpq pipeline mode
+typedef struct PgBatch {
+    PGconn *conn;
+    PgBatchCallback callback;
+    void *arg;
+    int window;             // statements in flight before collecting results
+    int queued;             // statements sent so far; the next index
+    int collected;          // results delivered so far
+    int failed;             // the connection broke; later results are lost
+} PgBatch;
+
+/**
+ * Put a connection into pipeline mode
+ * 
+ * Every statement is followed by its own sync point, so each runs in its
+ * own implicit transaction and an error affects only that statement.
+ * 
+ * @param conn idle PostgreSQL connection, used exclusively until pg_batch_end
+ * @param window statements in flight at most, 0 for PG_BATCH_DEFAULT_WINDOW
+ * @param callback function receiving the results
+ * @param arg passed through to the callback
+ * @return pointer to PgBatch structure or NULL if error
+ */
+PgBatch *pg_batch_begin(PGconn *conn, int window, PgBatchCallback callback, void *arg);
+
+/**
+ * Queue a prepared statement
+ * 
+ * Returns without waiting for the result unless the window is full, in
+ * which case the oldest results are delivered first.
+ * 
+ * @param batch pointer to PgBatch structure
+ * @param statement statement to run
+ * @param n_params number of parameters
+ * @param values parameter values
+ * @param lengths lengths of binary parameters, NULL if all are text
+ * @param formats 1 for binary parameters, NULL if all are text
+ * @param result_format 0 for text results, 1 for binary
+ * @return index passed to the callback, -1 if the statement could not be sent
+ */
+int pg_batch_queue(PgBatch *batch, S3StatementId statement, int n_params,
+                   const char *const *values, const int *lengths, const int *formats,
+                   int result_format);
+
+/**
+ * Deliver the outstanding results, leave pipeline mode and free the batch
+ * 
+ * @param batch pointer to PgBatch structure
+ * @return 0 on success, -1 if the connection failed
+ */
+int pg_batch_end(PgBatch *batch);
+
+#endif /* PG_BATCH_H */
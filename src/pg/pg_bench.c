@@ -0,0 +1,167 @@
+#include "pg_bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Empty queries timed to estimate the round trip
+#define PG_BENCH_RTT_SAMPLES 20
+
+/**
+ * Read a monotonic clock
+ * 
+ * @return seconds
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Free a set of results and check that all of them succeeded
+ * 
+ * @param results results to free
+ * @param count number of results
+ * @return 0 if all succeeded, -1 otherwise
+ */
+static int release_results(S3Result **results, int count) {
+    int failed = 0;
+    
+    for (int i = 0; i < count; i++) {
+        if (!results[i] || results[i]->status != S3_SUCCESS) {
+            if (!failed) {
+                fprintf(stderr, "Benchmark operation failed: %s\n",
+                        results[i] && results[i]->error_message ? results[i]->error_message
+                                                                : "Unknown error");
+            }
+            failed = 1;
+        }
+        s3_result_free(results[i]);
+        results[i] = NULL;
+    }
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Print one line of the results table
+ * 
+ * @param operation operation name
+ * @param count objects handled by each run
+ * @param sequential seconds taken one request at a time
+ * @param batched seconds taken batched
+ */
+static void print_row(const char *operation, int count, double sequential, double batched) {
+    printf("%-10s %12.0f %12.0f %9.1fx\n", operation, count / sequential, count / batched,
+           sequential / batched);
+}
+
+/**
+ * Compare sequential and pipelined object operations
+ * 
+ * @param client PostgreSQL client
+ * @param count number of objects
+ * @param size object size in bytes
+ * @return 0 on success, -1 if an operation failed
+ */
+int pg_bench_run(PgClient *client, int count, size_t size) {
+    if (!client || count <= 0 || size == 0 || pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    char (*keys)[64] = calloc(count, sizeof(*keys));
+    const char **key_list = calloc(count, sizeof(char *));
+    S3PutItem *items = calloc(count, sizeof(S3PutItem));
+    S3Result **results = calloc(count, sizeof(S3Result *));
+    unsigned char *payload = malloc(size);
+    if (!keys || !key_list || !items || !results || !payload) {
+        free(keys);
+        free(key_list);
+        free(items);
+        free(results);
+        free(payload);
+        return -1;
+    }
+    
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = (unsigned char)('a' + i % 26);
+    }
+    for (int i = 0; i < count; i++) {
+        snprintf(keys[i], sizeof(keys[i]), PG_BENCH_PREFIX "%08d", i);
+        key_list[i] = keys[i];
+        items[i] = (S3PutItem){keys[i], payload, size, "application/octet-stream"};
+    }
+    
+    // Round trip of an empty query
+    double start = now_seconds();
+    for (int i = 0; i < PG_BENCH_RTT_SAMPLES; i++) {
+        PQclear(PQexec(client->conn, ""));
+    }
+    double rtt = (now_seconds() - start) / PG_BENCH_RTT_SAMPLES;
+    
+    printf("%d objects of %zu bytes, round trip %.3f ms (at most %.0f sequential ops/s)\n\n",
+           count, size, rtt * 1000, 1 / rtt);
+    printf("%-10s %12s %12s %10s\n", "operation", "sequential", "batched", "speedup");
+    
+    int failed = 0;
+    double sequential, batched;
+    
+    // Put
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        results[i] = pg_client_put_object(client, "public", keys[i], payload, size,
+                                          "application/octet-stream");
+    }
+    sequential = now_seconds() - start;
+    failed |= release_results(results, count);
+    
+    start = now_seconds();
+    pg_client_put_objects(client, "public", items, count, results);
+    batched = now_seconds() - start;
+    failed |= release_results(results, count);
+    print_row("put", count, sequential, batched);
+    
+    // Get
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        results[i] = pg_client_get_object(client, "public", keys[i]);
+    }
+    sequential = now_seconds() - start;
+    failed |= release_results(results, count);
+    
+    start = now_seconds();
+    pg_client_get_objects(client, "public", key_list, count, results);
+    batched = now_seconds() - start;
+    failed |= release_results(results, count);
+    print_row("get", count, sequential, batched);
+    
+    // Delete; the batched run is one set-based statement per 1000 keys
+    start = now_seconds();
+    for (int i = 0; i < count; i++) {
+        results[i] = pg_client_delete_object(client, "public", keys[i]);
+    }
+    sequential = now_seconds() - start;
+    failed |= release_results(results, count);
+    
+    pg_client_put_objects(client, "public", items, count, results);
+    failed |= release_results(results, count);
+    
+    start = now_seconds();
+    int batches = 0;
+    for (int i = 0; i < count; i += S3_DELETE_MAX_KEYS) {
+        int n = count - i < S3_DELETE_MAX_KEYS ? count - i : S3_DELETE_MAX_KEYS;
+        results[batches++] = pg_client_delete_objects(client, "public", key_list + i, n, 1);
+    }
+    batched = now_seconds() - start;
+    failed |= release_results(results, batches);
+    print_row("delete", count, sequential, batched);
+    
+    free(keys);
+    free(key_list);
+    free(items);
+    free(results);
+    free(payload);
+    
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef PG_BENCH_H
+#define PG_BENCH_H
+
+#include <stddef.h>
+#include "pg_client.h"
+
+// Key prefix of the objects written by the benchmark
+#define PG_BENCH_PREFIX "_pgs3_bench/"
+
+/**
+ * Compare sequential and pipelined object operations
+ * 
+ * Measures the connection's round-trip time, then puts, gets and deletes
+ * count objects of size bytes one request at a time and batched, and
+ * prints the throughput of each. Sequential throughput is bounded by
+ * 1/RTT; pipelined throughput is not, so the gap widens as RTT grows.
+ * 
+ * @param client PostgreSQL client
+ * @param count number of objects
+ * @param size object size in bytes
+ * @return 0 on success, -1 if an operation failed
+ */
+int pg_bench_run(PgClient *client, int count, size_t size);
+
+#endif /* PG_BENCH_H */
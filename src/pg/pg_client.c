@@ -1,10 +1,14 @@
 #include "pg_client.h"
+#include "s3_statements.h"
 #include <string.h>
 #include <stdio.h>
 
 /**
  * Initialize PostgreSQL client
  * 
+ * Connects, brings the S3 schema up to date and prepares the S3
+ * statements, so request paths never need to run DDL or re-plan SQL.
+ * 
  * @param conninfo PostgreSQL connection string
  * @return pointer to PgClient structure or NULL if error
  */
@@ -20,6 +24,11 @@ PgClient *pg_client_init(const char *conninfo) {
     
     client->conninfo = strdup(conninfo);
     client->conn = PQconnectdb(conninfo);
+    client->schema_version = 0;
+    client->chunk_size = 0;
+    client->compress_types = NULL;
+    client->prepare_count = 0;
+    client->reprepare_count = 0;
     
     if (PQstatus(client->conn) != CONNECTION_OK) {
         fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(client->conn));
@@ -27,9 +36,94 @@ PgClient *pg_client_init(const char *conninfo) {
         return NULL;
     }
     
+    // One-time schema bootstrap; a no-op lookup when already current
+    if (s3_schema_migrate(client->conn) < 0) {
+        fprintf(stderr, "Failed to bootstrap S3 schema\n");
+        pg_client_free(client);
+        return NULL;
+    }
+    
+    client->schema_version = s3_schema_get_version(client->conn);
+    
+    if (pg_client_load_settings(client) != 0) {
+        pg_client_free(client);
+        return NULL;
+    }
+    
+    if (s3_statements_prepare(client->conn) != 0) {
+        pg_client_free(client);
+        return NULL;
+    }
+    client->prepare_count++;
+    
     return client;
 }
 
+/**
+ * Re-read the storage layout from s3.settings
+ * 
+ * @param client pointer to PgClient structure
+ * @return 0 on success, -1 on error
+ */
+int pg_client_load_settings(PgClient *client) {
+    if (!client || !client->conn) {
+        return -1;
+    }
+    
+    S3StorageSettings settings;
+    if (s3_schema_load_settings(client->conn, &settings) != 0) {
+        return -1;
+    }
+    
+    client->chunk_size = settings.layout == S3_LAYOUT_CHUNKED ? settings.chunk_size : 0;
+    
+    free(client->compress_types);
+    client->compress_types = NULL;
+    if (settings.compress_types[0]) {
+        client->compress_types = strdup(settings.compress_types);
+        if (!client->compress_types) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Make sure the client has a usable session
+ * 
+ * @param client pointer to PgClient structure
+ * @return 0 if the connection is usable, -1 otherwise
+ */
+int pg_client_ensure_connection(PgClient *client) {
+    if (!client || !client->conn) {
+        return -1;
+    }
+    
+    if (PQstatus(client->conn) == CONNECTION_OK) {
+        return 0;
+    }
+    
+    // Prepared statements die with the session, so a reset needs a re-prepare
+    PQreset(client->conn);
+    if (PQstatus(client->conn) != CONNECTION_OK) {
+        fprintf(stderr, "Reconnect to database failed: %s\n", PQerrorMessage(client->conn));
+        return -1;
+    }
+    
+    if (s3_statements_prepare(client->conn) != 0) {
+        // Drop the session so the next call retries from scratch
+        PQreset(client->conn);
+        return -1;
+    }
+    
+    client->prepare_count++;
+    client->reprepare_count++;
+    fprintf(stderr, "Reconnected to database (re-prepare #%lu)\n", client->reprepare_count);
+    
+    return 0;
+}
+
 /**
  * Free PostgreSQL client resources
  * 
@@ -48,6 +142,7 @@ void pg_client_free(PgClient *client) {
         free(client->conninfo);
     }
     
+    free(client->compress_types);
     free(client);
 }
 
@@ -72,14 +167,41 @@ S3Result* pg_client_list_buckets(PgClient *client) {
  * 
  * @param client PostgreSQL client
  * @param bucket bucket name
- * @return S3Result with object data or NULL on error
+ * @param prefix only list keys starting with this (NULL for all)
+ * @return S3Result with a JSON array of objects or NULL on error
  */
-S3Result* pg_client_list_objects(PgClient *client, const char *bucket) {
+S3Result* pg_client_list_objects(PgClient *client, const char *bucket, const char *prefix) {
     if (!client || !client->conn || !bucket) {
         return NULL;
     }
     
-    return s3_api_list_objects(client->conn, bucket);
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_list_objects(client->conn, bucket, prefix);
+}
+
+/**
+ * Open a listing that returns its entries one row at a time
+ * 
+ * @param client PostgreSQL client, busy until the stream is closed
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_list_open(PgClient *client, const char *bucket, const S3ListOptions *options,
+                              S3ListStream **stream) {
+    if (!client || !client->conn || !bucket || !stream) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_list_open(client->conn, bucket, options, stream);
 }
 
 /**
@@ -95,9 +217,58 @@ S3Result* pg_client_get_object(PgClient *client, const char *bucket, const char
         return NULL;
     }
     
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
     return s3_api_get_object(client->conn, bucket, key);
 }
 
+/**
+ * Open an object for incremental reading
+ * 
+ * @param client PostgreSQL client, busy until the reader is closed
+ * @param bucket bucket name
+ * @param key object key
+ * @param prefetch_limit largest inline object to fetch in the first round trip
+ * @param accept_encoding encodings the caller takes compressed content in, NULL to decode
+ * @param reader receives the reader on success
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_open_object(PgClient *client, const char *bucket, const char *key,
+                                size_t prefetch_limit, const char *accept_encoding,
+                                S3ObjectReader **reader) {
+    if (!client || !client->conn || !bucket || !key || !reader) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_reader_open(client->conn, bucket, key, prefetch_limit, accept_encoding, reader);
+}
+
+/**
+ * Continue reading an object on this client
+ * 
+ * @param client PostgreSQL client, busy until the reader is detached or closed
+ * @param reader reader detached from its previous client with s3_reader_attach
+ * @return 0 on success, -1 if the connection is unusable
+ */
+int pg_client_attach_reader(PgClient *client, S3ObjectReader *reader) {
+    if (!client || !client->conn || !reader) {
+        return -1;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    s3_reader_attach(reader, client->conn);
+    return 0;
+}
+
 /**
  * Put object in bucket
  * 
@@ -115,7 +286,263 @@ S3Result* pg_client_put_object(PgClient *client, const char *bucket, const char
         return NULL;
     }
     
-    return s3_api_put_object(client->conn, bucket, key, data, size, content_type);
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_put_object(client->conn, bucket, key, data, size, content_type,
+                             client->chunk_size, client->compress_types);
+}
+
+/**
+ * Get several objects with pipelined round trips
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param count number of keys
+ * @param results receives one S3Result per key
+ * @return 0 if every object was read, -1 otherwise
+ */
+int pg_client_get_objects(PgClient *client, const char *bucket, const char *const *keys,
+                          int count, S3Result **results) {
+    for (int i = 0; i < count; i++) {
+        results[i] = NULL;
+    }
+    
+    if (!client || !client->conn || !bucket || !keys) {
+        return -1;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    return s3_api_get_objects(client->conn, bucket, keys, count, results);
+}
+
+/**
+ * Put several objects with pipelined round trips, using the client's layout
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param items objects to store
+ * @param count number of objects
+ * @param results receives one S3Result per object
+ * @return 0 if every object was stored, -1 otherwise
+ */
+int pg_client_put_objects(PgClient *client, const char *bucket, const S3PutItem *items,
+                          int count, S3Result **results) {
+    for (int i = 0; i < count; i++) {
+        results[i] = NULL;
+    }
+    
+    if (!client || !client->conn || !bucket || !items) {
+        return -1;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    return s3_api_put_objects(client->conn, bucket, items, count, client->chunk_size,
+                              client->compress_types, results);
+}
+
+/**
+ * Get object metadata without reading its content
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_stat_object(PgClient *client, const char *bucket, const char *key,
+                                S3ObjectInfo *info) {
+    if (!client || !client->conn || !bucket || !key || !info) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_stat_object(client->conn, bucket, key, info);
+}
+
+/**
+ * Start a streaming upload using the client's storage layout
+ * 
+ * @param client PostgreSQL client, busy until the upload finishes or aborts
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type
+ * @return upload handle or NULL on error
+ */
+S3Upload* pg_client_begin_upload(PgClient *client, const char *bucket, const char *key,
+                                 const char *content_type) {
+    if (!client || !client->conn || !bucket || !key) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_upload_begin(client->conn, bucket, key, content_type, client->chunk_size,
+                           client->compress_types);
+}
+
+/**
+ * Finish a detached inline upload on this client
+ * 
+ * @param client PostgreSQL client, busy until the upload finishes or aborts
+ * @param upload upload released by s3_upload_detach
+ * @return 0 on success, -1 if the connection is unusable
+ */
+int pg_client_attach_upload(PgClient *client, S3Upload *upload) {
+    if (!client || !client->conn || !upload) {
+        return -1;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    s3_upload_attach(upload, client->conn, client->compress_types);
+    return 0;
+}
+
+/**
+ * Start a bulk import into the public bucket using the client's storage layout
+ * 
+ * @param client PostgreSQL client, busy until the import finishes or aborts
+ * @return import handle or NULL on error
+ */
+S3Import* pg_client_begin_import(PgClient *client) {
+    if (!client || !client->conn) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_import_begin(client->conn, client->chunk_size);
+}
+
+/**
+ * Start a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type of the finished object
+ * @return S3Result with an InitiateMultipartUploadResult document or NULL on error
+ */
+S3Result* pg_client_create_upload(PgClient *client, const char *bucket, const char *key,
+                                  const char *content_type) {
+    if (!client || !client->conn || !bucket || !key) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_create_upload(client->conn, bucket, key, content_type);
+}
+
+/**
+ * Start uploading one part of a multipart upload
+ * 
+ * @param client PostgreSQL client, busy until the part finishes or aborts
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @param part_number part number
+ * @return upload handle or NULL on error
+ */
+S3Upload* pg_client_begin_part_upload(PgClient *client, const char *bucket, const char *key,
+                                      const char *upload_id, int part_number) {
+    if (!client || !client->conn || !bucket || !key || !upload_id) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    // The assembled object is chunked, so the parts are too
+    size_t chunk_size = client->chunk_size ? client->chunk_size : S3_DEFAULT_CHUNK_SIZE;
+    return s3_upload_begin_part(client->conn, bucket, key, upload_id, part_number, chunk_size);
+}
+
+/**
+ * Complete a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @param parts parts in ascending part number order
+ * @param part_count number of parts
+ * @return S3Result with a CompleteMultipartUploadResult document or NULL on error
+ */
+S3Result* pg_client_complete_upload(PgClient *client, const char *bucket, const char *key,
+                                    const char *upload_id, const S3CompletedPart *parts,
+                                    int part_count) {
+    if (!client || !client->conn || !bucket || !key || !upload_id) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_complete_upload(client->conn, bucket, key, upload_id, parts, part_count);
+}
+
+/**
+ * Abort a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_abort_upload(PgClient *client, const char *bucket, const char *key,
+                                 const char *upload_id) {
+    if (!client || !client->conn || !bucket || !key || !upload_id) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_abort_upload(client->conn, bucket, key, upload_id);
+}
+
+/**
+ * Drop multipart uploads that were started too long ago
+ * 
+ * @param client PostgreSQL client
+ * @param max_age_seconds age after which an unfinished upload is abandoned
+ * @return number of uploads removed, -1 on error
+ */
+long pg_client_expire_uploads(PgClient *client, long max_age_seconds) {
+    if (!client || !client->conn) {
+        return -1;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return -1;
+    }
+    
+    return s3_api_expire_uploads(client->conn, max_age_seconds);
 }
 
 /**
@@ -131,5 +558,57 @@ S3Result* pg_client_delete_object(PgClient *client, const char *bucket, const ch
         return NULL;
     }
     
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
     return s3_api_delete_object(client->conn, bucket, key);
-} 
\ No newline at end of file
+}
+
+/**
+ * Delete several objects with one statement
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param key_count number of keys, at most S3_DELETE_MAX_KEYS
+ * @param quiet report only the keys that could not be deleted
+ * @return S3Result with a DeleteResult document or NULL on error
+ */
+S3Result* pg_client_delete_objects(PgClient *client, const char *bucket, const char *const *keys,
+                                   int key_count, int quiet) {
+    if (!client || !client->conn || !bucket || !keys) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_delete_objects(client->conn, bucket, keys, key_count, quiet);
+}
+
+/**
+ * Delete every object under a prefix in short batched transactions
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for the default
+ * @param deleted receives the number of objects removed
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_delete_prefix(PgClient *client, const char *bucket, const char *prefix,
+                                  int batch_size, long *deleted) {
+    *deleted = 0;
+    
+    if (!client || !client->conn || !bucket || !prefix) {
+        return NULL;
+    }
+    
+    if (pg_client_ensure_connection(client) != 0) {
+        return NULL;
+    }
+    
+    return s3_api_delete_prefix(client->conn, bucket, prefix, batch_size, deleted);
+}
\ No newline at end of file
@@ -4,22 +4,51 @@
 #include <stdlib.h>
 #include <libpq-fe.h>
 #include "s3_api.h"
+#include "s3_import.h"
+#include "s3_schema.h"
 
 // PostgreSQL client structure
 typedef struct PgClient {
     char *conninfo;
     PGconn *conn;
+    int schema_version;
+    size_t chunk_size;              // chunk size for new objects, 0 = inline layout
+    char *compress_types;           // content types stored compressed, NULL for none
+    unsigned long prepare_count;    // sessions the statement registry was prepared on
+    unsigned long reprepare_count;  // of those, re-prepares after a reconnect
 } PgClient;
 
 // PostgreSQL client functions
 /**
  * Initialize PostgreSQL client
  * 
+ * Connects, brings the S3 schema up to date and prepares the S3
+ * statements, so request paths never need to run DDL or re-plan SQL.
+ * 
  * @param conninfo PostgreSQL connection string
  * @return pointer to PgClient structure or NULL if error
  */
 PgClient *pg_client_init(const char *conninfo);
 
+/**
+ * Re-read the storage layout from s3.settings
+ * 
+ * @param client pointer to PgClient structure
+ * @return 0 on success, -1 on error
+ */
+int pg_client_load_settings(PgClient *client);
+
+/**
+ * Make sure the client has a usable session
+ * 
+ * Resets a broken connection and re-prepares the S3 statements on the new
+ * session. Called before every S3 operation.
+ * 
+ * @param client pointer to PgClient structure
+ * @return 0 if the connection is usable, -1 otherwise
+ */
+int pg_client_ensure_connection(PgClient *client);
+
 /**
  * Free PostgreSQL client resources
  * 
@@ -41,9 +70,22 @@ S3Result* pg_client_list_buckets(PgClient *client);
  * 
  * @param client PostgreSQL client
  * @param bucket bucket name
- * @return S3Result with object data or NULL on error
+ * @param prefix only list keys starting with this (NULL for all)
+ * @return S3Result with a JSON array of objects or NULL on error
+ */
+S3Result* pg_client_list_objects(PgClient *client, const char *bucket, const char *prefix);
+
+/**
+ * Open a listing that returns its entries one row at a time
+ * 
+ * @param client PostgreSQL client, busy until the stream is closed
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
  */
-S3Result* pg_client_list_objects(PgClient *client, const char *bucket);
+S3Result* pg_client_list_open(PgClient *client, const char *bucket, const S3ListOptions *options,
+                              S3ListStream **stream);
 
 /**
  * Get object from bucket
@@ -55,6 +97,30 @@ S3Result* pg_client_list_objects(PgClient *client, const char *bucket);
  */
 S3Result* pg_client_get_object(PgClient *client, const char *bucket, const char *key);
 
+/**
+ * Open an object for incremental reading
+ * 
+ * @param client PostgreSQL client, busy until the reader is closed
+ * @param bucket bucket name
+ * @param key object key
+ * @param prefetch_limit largest inline object to fetch in the first round trip
+ * @param accept_encoding encodings the caller takes compressed content in, NULL to decode
+ * @param reader receives the reader on success
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_open_object(PgClient *client, const char *bucket, const char *key,
+                                size_t prefetch_limit, const char *accept_encoding,
+                                S3ObjectReader **reader);
+
+/**
+ * Continue reading an object on this client
+ * 
+ * @param client PostgreSQL client, busy until the reader is detached or closed
+ * @param reader reader detached from its previous client with s3_reader_attach
+ * @return 0 on success, -1 if the connection is unusable
+ */
+int pg_client_attach_reader(PgClient *client, S3ObjectReader *reader);
+
 /**
  * Put object in bucket
  * 
@@ -69,6 +135,136 @@ S3Result* pg_client_get_object(PgClient *client, const char *bucket, const char
 S3Result* pg_client_put_object(PgClient *client, const char *bucket, const char *key,
                              const void *data, size_t size, const char *content_type);
 
+/**
+ * Get several objects with pipelined round trips
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param count number of keys
+ * @param results receives one S3Result per key
+ * @return 0 if every object was read, -1 otherwise
+ */
+int pg_client_get_objects(PgClient *client, const char *bucket, const char *const *keys,
+                          int count, S3Result **results);
+
+/**
+ * Put several objects with pipelined round trips, using the client's layout
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param items objects to store
+ * @param count number of objects
+ * @param results receives one S3Result per object
+ * @return 0 if every object was stored, -1 otherwise
+ */
+int pg_client_put_objects(PgClient *client, const char *bucket, const S3PutItem *items,
+                          int count, S3Result **results);
+
+/**
+ * Get object metadata without reading its content
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_stat_object(PgClient *client, const char *bucket, const char *key,
+                                S3ObjectInfo *info);
+
+/**
+ * Start a streaming upload using the client's storage layout
+ * 
+ * @param client PostgreSQL client, busy until the upload finishes or aborts
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type
+ * @return upload handle or NULL on error
+ */
+S3Upload* pg_client_begin_upload(PgClient *client, const char *bucket, const char *key,
+                                 const char *content_type);
+
+/**
+ * Finish a detached inline upload on this client
+ * 
+ * @param client PostgreSQL client, busy until the upload finishes or aborts
+ * @param upload upload released by s3_upload_detach
+ * @return 0 on success, -1 if the connection is unusable
+ */
+int pg_client_attach_upload(PgClient *client, S3Upload *upload);
+
+/**
+ * Start a bulk import into the public bucket using the client's storage layout
+ * 
+ * @param client PostgreSQL client, busy until the import finishes or aborts
+ * @return import handle or NULL on error
+ */
+S3Import* pg_client_begin_import(PgClient *client);
+
+/**
+ * Start a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type of the finished object
+ * @return S3Result with an InitiateMultipartUploadResult document or NULL on error
+ */
+S3Result* pg_client_create_upload(PgClient *client, const char *bucket, const char *key,
+                                  const char *content_type);
+
+/**
+ * Start uploading one part of a multipart upload
+ * 
+ * Parts are always stored chunked, whatever the client's layout.
+ * 
+ * @param client PostgreSQL client, busy until the part finishes or aborts
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @param part_number part number
+ * @return upload handle or NULL on error
+ */
+S3Upload* pg_client_begin_part_upload(PgClient *client, const char *bucket, const char *key,
+                                      const char *upload_id, int part_number);
+
+/**
+ * Complete a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @param parts parts in ascending part number order
+ * @param part_count number of parts
+ * @return S3Result with a CompleteMultipartUploadResult document or NULL on error
+ */
+S3Result* pg_client_complete_upload(PgClient *client, const char *bucket, const char *key,
+                                    const char *upload_id, const S3CompletedPart *parts,
+                                    int part_count);
+
+/**
+ * Abort a multipart upload
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_abort_upload(PgClient *client, const char *bucket, const char *key,
+                                 const char *upload_id);
+
+/**
+ * Drop multipart uploads that were started too long ago
+ * 
+ * @param client PostgreSQL client
+ * @param max_age_seconds age after which an unfinished upload is abandoned
+ * @return number of uploads removed, -1 on error
+ */
+long pg_client_expire_uploads(PgClient *client, long max_age_seconds);
+
 /**
  * Delete object from bucket
  * 
@@ -79,4 +275,30 @@ S3Result* pg_client_put_object(PgClient *client, const char *bucket, const char
  */
 S3Result* pg_client_delete_object(PgClient *client, const char *bucket, const char *key);
 
+/**
+ * Delete several objects with one statement
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param key_count number of keys, at most S3_DELETE_MAX_KEYS
+ * @param quiet report only the keys that could not be deleted
+ * @return S3Result with a DeleteResult document or NULL on error
+ */
+S3Result* pg_client_delete_objects(PgClient *client, const char *bucket, const char *const *keys,
+                                   int key_count, int quiet);
+
+/**
+ * Delete every object under a prefix in short batched transactions
+ * 
+ * @param client PostgreSQL client
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for the default
+ * @param deleted receives the number of objects removed
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_client_delete_prefix(PgClient *client, const char *bucket, const char *prefix,
+                                  int batch_size, long *deleted);
+
 #endif /* PG_CLIENT_H */ 
\ No newline at end of file
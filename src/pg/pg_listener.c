@@ -0,0 +1,188 @@
+#include "pg_listener.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+// How often the thread wakes up to check for pg_listener_stop
+#define PG_LISTENER_POLL_MS 500
+
+// Wait between attempts to re-open a dropped session
+#define PG_LISTENER_RETRY_SECONDS 1
+
+/**
+ * Open a session and subscribe to the channel
+ * 
+ * @param listener pointer to PgListener structure
+ * @return connection or NULL on error
+ */
+static PGconn *listener_connect(PgListener *listener) {
+    PGconn *conn = PQconnectdb(listener->conninfo);
+    if (PQstatus(conn) != CONNECTION_OK) {
+        fprintf(stderr, "Listener connection failed: %s\n", PQerrorMessage(conn));
+        PQfinish(conn);
+        return NULL;
+    }
+    
+    char *channel = PQescapeIdentifier(conn, listener->channel, strlen(listener->channel));
+    if (!channel) {
+        PQfinish(conn);
+        return NULL;
+    }
+    
+    char sql[256];
+    snprintf(sql, sizeof(sql), "LISTEN %s;", channel);
+    PQfreemem(channel);
+    
+    PGresult *res = PQexec(conn, sql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        fprintf(stderr, "LISTEN failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        PQfinish(conn);
+        return NULL;
+    }
+    
+    PQclear(res);
+    return conn;
+}
+
+/**
+ * Wait for the socket to become readable
+ * 
+ * @param conn PostgreSQL connection
+ * @param timeout_ms longest wait
+ * @return 1 if readable, 0 on timeout, -1 on error
+ */
+static int wait_readable(PGconn *conn, int timeout_ms) {
+    int sock = PQsocket(conn);
+    if (sock < 0) {
+        return -1;
+    }
+    
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    int ready = select(sock + 1, &readable, NULL, NULL, &timeout);
+    
+    return ready < 0 ? -1 : ready > 0;
+}
+
+/**
+ * Listener thread: deliver notifications until stopped
+ * 
+ * @param arg pointer to PgListener structure
+ * @return NULL
+ */
+static void *listener_main(void *arg) {
+    PgListener *listener = (PgListener *)arg;
+    PGconn *conn = NULL;
+    int sessions = 0;
+    
+    while (!__atomic_load_n(&listener->stopping, __ATOMIC_ACQUIRE)) {
+        if (!conn) {
+            conn = listener_connect(listener);
+            if (!conn) {
+                sleep(PG_LISTENER_RETRY_SECONDS);
+                continue;
+            }
+            
+            if (sessions++ > 0) {
+                listener->reconnects++;
+            }
+            
+            // Whatever happened while we were not listening is unknown
+            listener->callback(listener->arg, NULL);
+            __atomic_store_n(&listener->listening, 1, __ATOMIC_RELEASE);
+        }
+        
+        int ready = wait_readable(conn, PG_LISTENER_POLL_MS);
+        if (ready == 0) {
+            continue;
+        }
+        
+        if (ready < 0 || !PQconsumeInput(conn)) {
+            fprintf(stderr, "Listener connection lost: %s", PQerrorMessage(conn));
+            __atomic_store_n(&listener->listening, 0, __ATOMIC_RELEASE);
+            PQfinish(conn);
+            conn = NULL;
+            continue;
+        }
+        
+        PGnotify *notify;
+        while ((notify = PQnotifies(conn)) != NULL) {
+            listener->notifications++;
+            listener->callback(listener->arg, notify->extra);
+            PQfreemem(notify);
+        }
+    }
+    
+    PQfinish(conn);
+    return NULL;
+}
+
+/**
+ * Start listening on a channel
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param channel channel name
+ * @param callback function receiving the payloads
+ * @param arg passed through to the callback
+ * @return pointer to PgListener structure or NULL if error
+ */
+PgListener *pg_listener_start(const char *conninfo, const char *channel,
+                              PgNotifyCallback callback, void *arg) {
+    if (!conninfo || !channel || !callback) {
+        return NULL;
+    }
+    
+    PgListener *listener = (PgListener *)calloc(1, sizeof(PgListener));
+    if (!listener) {
+        return NULL;
+    }
+    
+    listener->conninfo = strdup(conninfo);
+    listener->channel = strdup(channel);
+    listener->callback = callback;
+    listener->arg = arg;
+    
+    if (!listener->conninfo || !listener->channel ||
+        pthread_create(&listener->thread, NULL, listener_main, listener) != 0) {
+        free(listener->conninfo);
+        free(listener->channel);
+        free(listener);
+        return NULL;
+    }
+    
+    return listener;
+}
+
+/**
+ * Check whether notifications are currently being received
+ * 
+ * @param listener pointer to PgListener structure
+ * @return 1 if subscribed, 0 otherwise
+ */
+int pg_listener_is_listening(PgListener *listener) {
+    return listener && __atomic_load_n(&listener->listening, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Stop listening and free the listener
+ * 
+ * @param listener pointer to PgListener structure
+ */
+void pg_listener_stop(PgListener *listener) {
+    if (!listener) {
+        return;
+    }
+    
+    __atomic_store_n(&listener->stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(listener->thread, NULL);
+    
+    free(listener->conninfo);
+    free(listener->channel);
+    free(listener);
+}
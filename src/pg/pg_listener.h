@@ -0,0 +1,62 @@
+#ifndef PG_LISTENER_H
+#define PG_LISTENER_H
+
+#include <pthread.h>
+#include <libpq-fe.h>
+
+/**
+ * Called on the listener thread for every notification. A NULL payload
+ * means notifications may have been missed (the session was just opened
+ * or re-opened), so anything derived from them should be reset.
+ */
+typedef void (*PgNotifyCallback)(void *arg, const char *payload);
+
+// Background LISTEN session on its own connection
+typedef struct PgListener {
+    char *conninfo;
+    char *channel;
+    PgNotifyCallback callback;
+    void *arg;
+    pthread_t thread;
+    int stopping;                   // set by pg_listener_stop, read by the thread
+    int listening;                  // a session is subscribed right now
+    unsigned long notifications;    // payloads delivered
+    unsigned long reconnects;       // sessions opened after the first
+} PgListener;
+
+/**
+ * Start listening on a channel
+ * 
+ * The session is opened on a dedicated thread, outside the connection
+ * pool, and re-opened with a short back-off whenever it drops.
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param channel channel name
+ * @param callback function receiving the payloads
+ * @param arg passed through to the callback
+ * @return pointer to PgListener structure or NULL if error
+ */
+PgListener *pg_listener_start(const char *conninfo, const char *channel,
+                              PgNotifyCallback callback, void *arg);
+
+/**
+ * Check whether notifications are currently being received
+ * 
+ * While this is false changes can go unnoticed, so state derived from
+ * the notifications should not be trusted.
+ * 
+ * @param listener pointer to PgListener structure
+ * @return 1 if subscribed, 0 otherwise
+ */
+int pg_listener_is_listening(PgListener *listener);
+
+/**
+ * Stop listening and free the listener
+ * 
+ * Returns once the thread has exited; no callback runs afterwards.
+ * 
+ * @param listener pointer to PgListener structure
+ */
+void pg_listener_stop(PgListener *listener);
+
+#endif /* PG_LISTENER_H */
@@ -0,0 +1,214 @@
+#include "pg_pool.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Create a connection pool
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param size maximum number of connections
+ * @return pointer to PgPool structure or NULL if error
+ */
+PgPool *pg_pool_create(const char *conninfo, int size) {
+    if (!conninfo || size <= 0) {
+        return NULL;
+    }
+    
+    PgPool *pool = (PgPool *)calloc(1, sizeof(PgPool));
+    if (!pool) {
+        return NULL;
+    }
+    
+    pool->conninfo = strdup(conninfo);
+    pool->size = size;
+    pool->idle = (PgClient **)calloc(size, sizeof(PgClient *));
+    pool->idle_since = (time_t *)calloc(size, sizeof(time_t));
+    
+    if (!pool->conninfo || !pool->idle || !pool->idle_since) {
+        free(pool->conninfo);
+        free(pool->idle);
+        free(pool->idle_since);
+        free(pool);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+    
+    // Fail fast on a bad conninfo and run the schema bootstrap once
+    PgClient *client = pg_client_init(conninfo);
+    if (!client) {
+        pg_pool_free(pool);
+        return NULL;
+    }
+    
+    pool->idle[pool->idle_count] = client;
+    pool->idle_since[pool->idle_count] = time(NULL);
+    pool->idle_count++;
+    pool->created = 1;
+    
+    return pool;
+}
+
+/**
+ * Verify that an idle connection still works
+ * 
+ * @param client pooled client
+ * @param idle_since time the client was checked in
+ * @return 0 if the connection is usable, -1 otherwise
+ */
+static int health_check(PgClient *client, time_t idle_since) {
+    if (time(NULL) - idle_since >= PG_POOL_HEALTH_CHECK_INTERVAL) {
+        // An empty query is the cheapest round trip; it notices dead sockets
+        PGresult *res = PQexec(client->conn, "");
+        PQclear(res);
+    }
+    
+    return pg_client_ensure_connection(client);
+}
+
+/**
+ * Check a connection out of the pool
+ * 
+ * @param pool pointer to PgPool structure
+ * @param timeout_ms how long to wait for a free connection, negative waits forever
+ * @return usable client or NULL on timeout or if no connection could be established
+ */
+PgClient *pg_pool_checkout(PgPool *pool, int timeout_ms) {
+    if (!pool) {
+        return NULL;
+    }
+    
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    
+    if (pool->idle_count == 0 && pool->created >= pool->size) {
+        pool->waits++;
+        while (pool->idle_count == 0 && pool->created >= pool->size) {
+            if (timeout_ms < 0) {
+                pthread_cond_wait(&pool->available, &pool->lock);
+            } else if (pthread_cond_timedwait(&pool->available, &pool->lock, &deadline) != 0 &&
+                       pool->idle_count == 0 && pool->created >= pool->size) {
+                pool->timeouts++;
+                pthread_mutex_unlock(&pool->lock);
+                return NULL;
+            }
+        }
+    }
+    
+    PgClient *client = NULL;
+    time_t idle_since = 0;
+    
+    if (pool->idle_count > 0) {
+        pool->idle_count--;
+        client = pool->idle[pool->idle_count];
+        idle_since = pool->idle_since[pool->idle_count];
+    } else {
+        // Reserve a slot and connect outside the lock
+        pool->created++;
+    }
+    
+    pthread_mutex_unlock(&pool->lock);
+    
+    int ok;
+    if (client) {
+        ok = health_check(client, idle_since) == 0;
+    } else {
+        client = pg_client_init(pool->conninfo);
+        ok = client != NULL;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    if (ok) {
+        pool->checkouts++;
+    } else {
+        // Give the slot back so a later checkout can try again
+        pool->failed_health_checks++;
+        if (client) {
+            pg_client_free(client);
+            client = NULL;
+        }
+        pool->created--;
+        pthread_cond_signal(&pool->available);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    
+    return client;
+}
+
+/**
+ * Return a connection to the pool
+ * 
+ * @param pool pointer to PgPool structure
+ * @param client client obtained from pg_pool_checkout
+ */
+void pg_pool_checkin(PgPool *pool, PgClient *client) {
+    if (!pool || !client) {
+        return;
+    }
+    
+    // Never hand out a session stuck in a transaction
+    if (PQtransactionStatus(client->conn) != PQTRANS_IDLE &&
+        PQstatus(client->conn) == CONNECTION_OK) {
+        PGresult *res = PQexec(client->conn, "ROLLBACK;");
+        PQclear(res);
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->idle[pool->idle_count] = client;
+    pool->idle_since[pool->idle_count] = time(NULL);
+    pool->idle_count++;
+    pthread_cond_signal(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Count the connections checked out right now
+ * 
+ * @param pool pointer to PgPool structure
+ * @return connections in use, including ones being opened
+ */
+int pg_pool_in_use(PgPool *pool) {
+    if (!pool) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    int in_use = pool->created - pool->idle_count;
+    pthread_mutex_unlock(&pool->lock);
+    
+    return in_use;
+}
+
+/**
+ * Free pool resources and close all idle connections
+ * 
+ * @param pool pointer to PgPool structure
+ */
+void pg_pool_free(PgPool *pool) {
+    if (!pool) {
+        return;
+    }
+    
+    for (int i = 0; i < pool->idle_count; i++) {
+        pg_client_free(pool->idle[i]);
+    }
+    
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->available);
+    
+    free(pool->idle);
+    free(pool->idle_since);
+    free(pool->conninfo);
+    free(pool);
+}
@@ -0,0 +1,74 @@
+#ifndef PG_POOL_H
+#define PG_POOL_H
+
+#include <pthread.h>
+#include <time.h>
+#include "pg_client.h"
+
+// Idle time after which a pooled connection is pinged before reuse
+#define PG_POOL_HEALTH_CHECK_INTERVAL 30
+
+// Bounded pool of PostgreSQL clients shared by request threads
+typedef struct PgPool {
+    char *conninfo;
+    int size;                 // maximum number of connections
+    int created;              // connections opened so far
+    int idle_count;           // entries in idle[]
+    PgClient **idle;          // stack of connections ready for checkout
+    time_t *idle_since;       // when each idle connection was checked in
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    unsigned long checkouts;  // successful checkouts
+    unsigned long waits;      // checkouts that had to wait for a connection
+    unsigned long timeouts;   // checkouts that gave up waiting
+    unsigned long failed_health_checks;
+} PgPool;
+
+/**
+ * Create a connection pool
+ * 
+ * Opens one connection up front (which also bootstraps the schema) and
+ * the rest lazily as demand grows.
+ * 
+ * @param conninfo PostgreSQL connection string
+ * @param size maximum number of connections
+ * @return pointer to PgPool structure or NULL if error
+ */
+PgPool *pg_pool_create(const char *conninfo, int size);
+
+/**
+ * Check a connection out of the pool
+ * 
+ * Waits while all connections are in use. Connections that sat idle for a
+ * while are health-checked first and reconnected if they went away.
+ * 
+ * @param pool pointer to PgPool structure
+ * @param timeout_ms how long to wait for a free connection, negative waits forever
+ * @return usable client or NULL on timeout or if no connection could be established
+ */
+PgClient *pg_pool_checkout(PgPool *pool, int timeout_ms);
+
+/**
+ * Return a connection to the pool
+ * 
+ * @param pool pointer to PgPool structure
+ * @param client client obtained from pg_pool_checkout
+ */
+void pg_pool_checkin(PgPool *pool, PgClient *client);
+
+/**
+ * Count the connections checked out right now
+ * 
+ * @param pool pointer to PgPool structure
+ * @return connections in use, including ones being opened
+ */
+int pg_pool_in_use(PgPool *pool);
+
+/**
+ * Free pool resources and close all idle connections
+ * 
+ * @param pool pointer to PgPool structure
+ */
+void pg_pool_free(PgPool *pool);
+
+#endif /* PG_POOL_H */
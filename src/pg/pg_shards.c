@@ -0,0 +1,491 @@
+#include "pg_shards.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Hash a string onto the ring (64-bit FNV-1a, then a finalizer so that
+ * similar keys land far apart)
+ * 
+ * @param text NUL-terminated string
+ * @return hash value
+ */
+static uint64_t ring_hash(const char *text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    
+    return hash;
+}
+
+/**
+ * Build the ring for a number of backends
+ * 
+ * @param ring ring to initialize
+ * @param count number of backends
+ * @return 0 on success, -1 on error
+ */
+int pg_shard_ring_init(PgShardRing *ring, int count) {
+    memset(ring, 0, sizeof(PgShardRing));
+    if (count <= 0) {
+        return -1;
+    }
+    
+    int point_count = count * PG_SHARDS_RING_POINTS;
+    ring->points = (uint64_t *)malloc(point_count * sizeof(uint64_t));
+    ring->owners = (int *)malloc(point_count * sizeof(int));
+    if (!ring->points || !ring->owners) {
+        pg_shard_ring_free(ring);
+        return -1;
+    }
+    
+    // Insertion sort: a few thousand points, built once
+    for (int shard = 0; shard < count; shard++) {
+        for (int i = 0; i < PG_SHARDS_RING_POINTS; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "shard-%d-%d", shard, i);
+            uint64_t hash = ring_hash(name);
+            
+            int at = ring->point_count++;
+            while (at > 0 && ring->points[at - 1] > hash) {
+                ring->points[at] = ring->points[at - 1];
+                ring->owners[at] = ring->owners[at - 1];
+                at--;
+            }
+            ring->points[at] = hash;
+            ring->owners[at] = shard;
+        }
+    }
+    
+    ring->count = count;
+    return 0;
+}
+
+/**
+ * Find the backend owning a key: the one with the first point at or after
+ * the key's hash, wrapping around
+ * 
+ * @param ring initialized ring
+ * @param key object key
+ * @return backend index
+ */
+int pg_shard_ring_lookup(const PgShardRing *ring, const char *key) {
+    if (ring->count <= 1) {
+        return 0;
+    }
+    
+    uint64_t hash = ring_hash(key);
+    int low = 0;
+    int high = ring->point_count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (ring->points[middle] < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return ring->owners[low < ring->point_count ? low : 0];
+}
+
+/**
+ * Free the ring's points
+ * 
+ * @param ring ring to clear
+ */
+void pg_shard_ring_free(PgShardRing *ring) {
+    free(ring->points);
+    free(ring->owners);
+    memset(ring, 0, sizeof(PgShardRing));
+}
+
+/**
+ * Connect to every backend
+ * 
+ * @param conninfos PostgreSQL connection strings, in ring order
+ * @param count number of backends
+ * @return pointer to PgShards structure or NULL if a backend could not be reached
+ */
+PgShards *pg_shards_connect(const char *const *conninfos, int count) {
+    if (!conninfos || count <= 0) {
+        return NULL;
+    }
+    
+    PgShards *shards = (PgShards *)calloc(1, sizeof(PgShards));
+    if (!shards) {
+        return NULL;
+    }
+    
+    shards->clients = (PgClient **)calloc(count, sizeof(PgClient *));
+    if (!shards->clients || pg_shard_ring_init(&shards->ring, count) != 0) {
+        pg_shards_free(shards);
+        return NULL;
+    }
+    
+    // Every key must have a home, so one missing backend fails them all
+    for (int i = 0; i < count; i++) {
+        shards->clients[i] = pg_client_init(conninfos[i]);
+        shards->count++;
+        if (!shards->clients[i]) {
+            fprintf(stderr, "Failed to connect to shard %d\n", i + 1);
+            pg_shards_free(shards);
+            return NULL;
+        }
+    }
+    
+    return shards;
+}
+
+/**
+ * Get the client of the backend owning a key
+ * 
+ * @param shards pointer to PgShards structure
+ * @param key object key
+ * @return client to run the key's operations on
+ */
+PgClient *pg_shards_client(PgShards *shards, const char *key) {
+    return shards->clients[pg_shard_ring_lookup(&shards->ring, key)];
+}
+
+/**
+ * Open the same listing on several connections and merge the results
+ * 
+ * @param clients one client per backend, each busy until the stream is closed
+ * @param count number of clients
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_list_merged(PgClient *const *clients, int count, const char *bucket,
+                                const S3ListOptions *options, S3ListStream **stream) {
+    if (!clients || count <= 0 || !stream) {
+        return NULL;
+    }
+    
+    if (count == 1) {
+        return pg_client_list_open(clients[0], bucket, options, stream);
+    }
+    
+    S3ListStream **parts = (S3ListStream **)calloc(count, sizeof(S3ListStream *));
+    if (!parts) {
+        return NULL;
+    }
+    
+    // Every backend gets the whole request: any of them may hold the page
+    for (int i = 0; i < count; i++) {
+        S3Result *result = pg_client_list_open(clients[i], bucket, options, &parts[i]);
+        if (!result || result->status != S3_SUCCESS) {
+            for (int j = 0; j < i; j++) {
+                s3_list_close(parts[j]);
+            }
+            free(parts);
+            return result;
+        }
+        s3_result_free(result);
+    }
+    
+    // Same clamping as s3_list_open
+    int max_keys = options ? options->max_keys : S3_LIST_MAX_KEYS;
+    if (max_keys != S3_LIST_UNLIMITED && (max_keys < 0 || max_keys > S3_LIST_MAX_KEYS)) {
+        max_keys = S3_LIST_MAX_KEYS;
+    }
+    
+    S3Result *result = s3_list_merge(parts, count, max_keys, stream);
+    free(parts);
+    return result;
+}
+
+/**
+ * Open a listing over every backend
+ * 
+ * @param shards pointer to PgShards structure
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_list_open(PgShards *shards, const char *bucket, const S3ListOptions *options,
+                              S3ListStream **stream) {
+    if (!shards) {
+        return NULL;
+    }
+    
+    return pg_shards_list_merged(shards->clients, shards->count, bucket, options, stream);
+}
+
+/**
+ * Delete every object under a prefix on every backend
+ * 
+ * @param shards pointer to PgShards structure
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for the default
+ * @param deleted receives the number of objects removed
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_delete_prefix(PgShards *shards, const char *bucket, const char *prefix,
+                                  int batch_size, long *deleted) {
+    *deleted = 0;
+    
+    S3Result *result = NULL;
+    for (int i = 0; i < shards->count; i++) {
+        long shard_deleted = 0;
+        s3_result_free(result);
+        result = pg_client_delete_prefix(shards->clients[i], bucket, prefix, batch_size,
+                                         &shard_deleted);
+        *deleted += shard_deleted;
+        if (!result || result->status != S3_SUCCESS) {
+            break;
+        }
+    }
+    
+    return result;
+}
+
+// Validators of the source copy, read after its content so an overwrite
+// in between is noticed ($2 is the ETag the content was read under)
+#define PG_SHARDS_SOURCE_VALIDATORS_SQL \
+    "SELECT etag, last_modified::text FROM s3.objects " \
+    "WHERE path = $1 AND etag IS NOT DISTINCT FROM $2::text;"
+
+// Give the moved copy the source's validators, unless something else has
+// replaced it since ($4 is the ETag the move stored)
+#define PG_SHARDS_KEEP_VALIDATORS_SQL \
+    "UPDATE s3.objects SET etag = coalesce($2::text, etag), last_modified = $3::timestamptz " \
+    "WHERE path = $1 AND etag = $4;"
+
+/**
+ * Copy the ETag and modification time of a moved object from its source
+ * 
+ * The copy is stored like a new upload, which would reset both and turn
+ * multipart ETags into plain MD5s, so clients would see every moved
+ * object as changed.
+ * 
+ * @param source client of the backend holding the object
+ * @param target client of the backend the object was copied to
+ * @param key object key
+ * @param read_etag ETag the content was read under, empty if none
+ * @param stored_etag ETag the copy was stored with
+ * @return S3Result with status or NULL on error
+ */
+static S3Result *keep_validators(PgClient *source, PgClient *target, const char *key,
+                                 const char *read_etag, const char *stored_etag) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        return NULL;
+    }
+    
+    const char *source_params[2] = {key, read_etag[0] ? read_etag : NULL};
+    PGresult *res = PQexecParams(source->conn, PG_SHARDS_SOURCE_VALIDATORS_SQL,
+                                 2, NULL, source_params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        PQclear(res);
+        return result;
+    }
+    if (PQntuples(res) != 1) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Object changed while it was moved");
+        PQclear(res);
+        return result;
+    }
+    
+    const char *target_params[4] = {key, PQgetisnull(res, 0, 0) ? NULL : PQgetvalue(res, 0, 0),
+                                    PQgetvalue(res, 0, 1), stored_etag};
+    PGresult *update = PQexecParams(target->conn, PG_SHARDS_KEEP_VALIDATORS_SQL,
+                                    4, NULL, target_params, NULL, NULL, 0);
+    if (PQresultStatus(update) != PGRES_COMMAND_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQresultErrorMessage(update));
+    }
+    PQclear(update);
+    PQclear(res);
+    
+    return result;
+}
+
+/**
+ * Copy one object to its new backend and delete it from the old one
+ * 
+ * @param source client of the backend holding the object
+ * @param target client of the backend owning the key now
+ * @param key object key
+ * @param block scratch buffer of PG_SHARDS_BLOCK_SIZE bytes
+ * @return S3Result with status or NULL on error
+ */
+static S3Result *move_object(PgClient *source, PgClient *target, const char *key, char *block) {
+    // A copy already on the target was written under the new ring and wins
+    S3ObjectInfo info = {0};
+    S3Result *result = pg_client_stat_object(target, "public", key, &info);
+    if (!result || (result->status != S3_SUCCESS && result->status != S3_ERROR_NOT_FOUND)) {
+        return result;
+    }
+    int present = result->status == S3_SUCCESS;
+    s3_object_info_clear(&info);
+    s3_result_free(result);
+    
+    if (!present) {
+        S3ObjectReader *reader = NULL;
+        result = pg_client_open_object(source, "public", key, PG_SHARDS_BLOCK_SIZE, NULL, &reader);
+        if (!result || result->status != S3_SUCCESS) {
+            return result;
+        }
+        s3_result_free(result);
+        
+        // The content is decoded on the way, so the target applies its own
+        // compression policy
+        S3Upload *upload = pg_client_begin_upload(target, "public", key, reader->content_type);
+        if (!upload) {
+            s3_reader_close(reader);
+            return NULL;
+        }
+        s3_upload_reserve(upload, reader->size);
+        
+        ssize_t n;
+        while ((n = s3_reader_read(reader, block, PG_SHARDS_BLOCK_SIZE)) > 0) {
+            if (s3_upload_write(upload, block, (size_t)n) != 0) {
+                break;
+            }
+        }
+        char read_etag[S3_ETAG_SIZE];
+        memcpy(read_etag, reader->etag, sizeof(read_etag));
+        s3_reader_close(reader);
+        
+        if (n < 0) {
+            s3_upload_abort(upload);
+            result = s3_result_create();
+            if (result) {
+                s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(source->conn));
+            }
+            return result;
+        }
+        
+        char stored_etag[S3_ETAG_SIZE];
+        s3_upload_etag(upload, stored_etag);
+        result = s3_upload_finish(upload);
+        if (!result || result->status != S3_SUCCESS) {
+            return result;
+        }
+        s3_result_free(result);
+        
+        result = keep_validators(source, target, key, read_etag, stored_etag);
+        if (!result || result->status != S3_SUCCESS) {
+            return result;
+        }
+        s3_result_free(result);
+    }
+    
+    return pg_client_delete_object(source, "public", key);
+}
+
+/**
+ * Move the misplaced objects of one backend
+ * 
+ * @param shards pointer to PgShards structure
+ * @param shard backend to scan
+ * @param dry_run count the objects to move without moving them
+ * @param block scratch buffer of PG_SHARDS_BLOCK_SIZE bytes
+ * @param moved incremented per object moved (or to move)
+ * @return S3Result with status or NULL on error
+ */
+static S3Result *rebalance_shard(PgShards *shards, int shard, int dry_run, char *block,
+                                 long *moved) {
+    // The listing keeps its own session busy while objects move on the others
+    PgClient *lister = pg_client_init(shards->clients[shard]->conninfo);
+    if (!lister) {
+        return NULL;
+    }
+    
+    S3ListOptions options = {NULL, NULL, S3_LIST_UNLIMITED, NULL};
+    S3ListStream *list = NULL;
+    S3Result *result = pg_client_list_open(lister, "public", &options, &list);
+    if (!result || result->status != S3_SUCCESS) {
+        pg_client_free(lister);
+        return result;
+    }
+    
+    S3ListEntry entry;
+    int rc;
+    while ((rc = s3_list_next(list, &entry)) > 0) {
+        int owner = pg_shard_ring_lookup(&shards->ring, entry.key);
+        if (owner == shard) {
+            continue;
+        }
+        
+        if (!dry_run) {
+            S3Result *moved_result = move_object(shards->clients[shard], shards->clients[owner],
+                                                 entry.key, block);
+            if (!moved_result || moved_result->status != S3_SUCCESS) {
+                s3_result_free(result);
+                result = moved_result;
+                break;
+            }
+            s3_result_free(moved_result);
+        }
+        (*moved)++;
+    }
+    if (rc < 0 && result && result->status == S3_SUCCESS) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to list objects");
+    }
+    
+    s3_list_close(list);
+    pg_client_free(lister);
+    return result;
+}
+
+/**
+ * Move every object to the backend the ring assigns it
+ * 
+ * @param shards pointer to PgShards structure
+ * @param dry_run count the objects to move without moving them
+ * @param moved receives the number of objects moved (or to move)
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_rebalance(PgShards *shards, int dry_run, long *moved) {
+    *moved = 0;
+    
+    char *block = (char *)malloc(PG_SHARDS_BLOCK_SIZE);
+    if (!shards || !block) {
+        free(block);
+        return NULL;
+    }
+    
+    S3Result *result = NULL;
+    for (int i = 0; i < shards->count; i++) {
+        s3_result_free(result);
+        result = rebalance_shard(shards, i, dry_run, block, moved);
+        if (!result || result->status != S3_SUCCESS) {
+            break;
+        }
+    }
+    
+    free(block);
+    return result;
+}
+
+/**
+ * Close every backend connection
+ * 
+ * @param shards pointer to PgShards structure
+ */
+void pg_shards_free(PgShards *shards) {
+    if (!shards) {
+        return;
+    }
+    
+    for (int i = 0; i < shards->count; i++) {
+        pg_client_free(shards->clients[i]);
+    }
+    free(shards->clients);
+    pg_shard_ring_free(&shards->ring);
+    free(shards);
+}
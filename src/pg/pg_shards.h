@@ -0,0 +1,143 @@
+#ifndef PG_SHARDS_H
+#define PG_SHARDS_H
+
+#include <stdint.h>
+#include "pg_client.h"
+
+// Points each backend places on the hash ring; more of them even out the
+// share of keys each backend gets
+#define PG_SHARDS_RING_POINTS 160
+
+// Block size used to move object content between backends
+#define PG_SHARDS_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * Consistent hash ring assigning keys to backends
+ * 
+ * A backend's points depend only on its position in the list, so
+ * appending a backend takes an even share of keys from each existing one
+ * and moves no key between the others. Backends must therefore only ever
+ * be added at the end.
+ */
+typedef struct PgShardRing {
+    int count;                  // backends
+    int point_count;
+    uint64_t *points;           // hashes, ascending
+    int *owners;                // backend of each point
+} PgShardRing;
+
+/**
+ * Objects spread over several PostgreSQL databases by key
+ * 
+ * Each key lives in exactly one backend, chosen by the ring, so object
+ * operations go to a single connection. Listings query every backend and
+ * merge the sorted results.
+ */
+typedef struct PgShards {
+    PgShardRing ring;
+    int count;
+    PgClient **clients;         // one per backend, in ring order
+} PgShards;
+
+/**
+ * Build the ring for a number of backends
+ * 
+ * @param ring ring to initialize
+ * @param count number of backends
+ * @return 0 on success, -1 on error
+ */
+int pg_shard_ring_init(PgShardRing *ring, int count);
+
+/**
+ * Find the backend owning a key
+ * 
+ * @param ring initialized ring
+ * @param key object key
+ * @return backend index
+ */
+int pg_shard_ring_lookup(const PgShardRing *ring, const char *key);
+
+/**
+ * Free the ring's points
+ * 
+ * @param ring ring to clear
+ */
+void pg_shard_ring_free(PgShardRing *ring);
+
+/**
+ * Connect to every backend
+ * 
+ * @param conninfos PostgreSQL connection strings, in ring order
+ * @param count number of backends
+ * @return pointer to PgShards structure or NULL if a backend could not be reached
+ */
+PgShards *pg_shards_connect(const char *const *conninfos, int count);
+
+/**
+ * Get the client of the backend owning a key
+ * 
+ * @param shards pointer to PgShards structure
+ * @param key object key
+ * @return client to run the key's operations on
+ */
+PgClient *pg_shards_client(PgShards *shards, const char *key);
+
+/**
+ * Open the same listing on several connections and merge the results
+ * 
+ * @param clients one client per backend, each busy until the stream is closed
+ * @param count number of clients
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_list_merged(PgClient *const *clients, int count, const char *bucket,
+                                const S3ListOptions *options, S3ListStream **stream);
+
+/**
+ * Open a listing over every backend
+ * 
+ * @param shards pointer to PgShards structure
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success; close with s3_list_close
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_list_open(PgShards *shards, const char *bucket, const S3ListOptions *options,
+                              S3ListStream **stream);
+
+/**
+ * Delete every object under a prefix on every backend
+ * 
+ * @param shards pointer to PgShards structure
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for the default
+ * @param deleted receives the number of objects removed
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_delete_prefix(PgShards *shards, const char *bucket, const char *prefix,
+                                  int batch_size, long *deleted);
+
+/**
+ * Move every object to the backend the ring assigns it
+ * 
+ * Run after appending backends. A key that already exists on its new
+ * backend was written there since, so only the stale copy is deleted.
+ * 
+ * @param shards pointer to PgShards structure
+ * @param dry_run count the objects to move without moving them
+ * @param moved receives the number of objects moved (or to move)
+ * @return S3Result with status or NULL on error
+ */
+S3Result* pg_shards_rebalance(PgShards *shards, int dry_run, long *moved);
+
+/**
+ * Close every backend connection
+ * 
+ * @param shards pointer to PgShards structure
+ */
+void pg_shards_free(PgShards *shards);
+
+#endif /* PG_SHARDS_H */
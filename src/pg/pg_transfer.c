@@ -0,0 +1,654 @@
+#include "pg_transfer.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../common/content_type.h"
+
+// Outcome of one attempt at a job
+typedef enum {
+    JOB_COPIED,
+    JOB_SKIPPED,
+    JOB_FAILED,
+    JOB_RETRY               // the connection failed; worth another attempt
+} JobOutcome;
+
+/**
+ * Read a monotonic clock
+ * 
+ * @return seconds
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Create an empty transfer
+ * 
+ * @param conninfo PostgreSQL connection string used by every worker
+ * @param direction upload or download
+ * @param skip_unchanged skip files whose content already matches
+ * @return pointer to PgTransfer structure or NULL on memory error
+ */
+PgTransfer *pg_transfer_create(const char *conninfo, PgTransferDirection direction,
+                               int skip_unchanged) {
+    if (!conninfo) {
+        return NULL;
+    }
+    
+    PgTransfer *transfer = (PgTransfer *)calloc(1, sizeof(PgTransfer));
+    if (!transfer) {
+        return NULL;
+    }
+    
+    transfer->conninfo = strdup(conninfo);
+    if (!transfer->conninfo) {
+        free(transfer);
+        return NULL;
+    }
+    
+    transfer->direction = direction;
+    transfer->skip_unchanged = skip_unchanged;
+    pthread_mutex_init(&transfer->lock, NULL);
+    pthread_cond_init(&transfer->finished, NULL);
+    
+    return transfer;
+}
+
+/**
+ * Queue one file
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param key object key
+ * @param path local file
+ * @return 0 on success, -1 on memory error
+ */
+int pg_transfer_add(PgTransfer *transfer, const char *key, const char *path) {
+    if (!transfer || !key || !path) {
+        return -1;
+    }
+    
+    if (transfer->count == transfer->capacity) {
+        int capacity = transfer->capacity ? transfer->capacity * 2 : 256;
+        PgTransferJob *jobs = realloc(transfer->jobs, capacity * sizeof(PgTransferJob));
+        if (!jobs) {
+            return -1;
+        }
+        transfer->jobs = jobs;
+        transfer->capacity = capacity;
+    }
+    
+    PgTransferJob *job = &transfer->jobs[transfer->count];
+    job->key = strdup(key);
+    job->path = strdup(path);
+    if (!job->key || !job->path) {
+        free(job->key);
+        free(job->path);
+        return -1;
+    }
+    
+    transfer->count++;
+    return 0;
+}
+
+/**
+ * Queue the regular files under a directory for upload
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param dir local directory, walked recursively
+ * @param key_prefix prepended to each file's path relative to dir
+ * @return 0 on success, -1 on error
+ */
+int pg_transfer_add_directory(PgTransfer *transfer, const char *dir, const char *key_prefix) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Cannot open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        
+        char path[4096];
+        char key[4096];
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path) ||
+            snprintf(key, sizeof(key), "%s%s", key_prefix, entry->d_name) >= (int)sizeof(key) - 1) {
+            fprintf(stderr, "Path too long: %s/%s\n", dir, entry->d_name);
+            rc = -1;
+        } else if (stat(path, &st) != 0) {
+            // Dangling symlinks and files removed during the walk
+        } else if (S_ISDIR(st.st_mode)) {
+            strcat(key, "/");
+            rc = pg_transfer_add_directory(transfer, path, key);
+        } else if (S_ISREG(st.st_mode)) {
+            rc = pg_transfer_add(transfer, key, path);
+        }
+    }
+    
+    closedir(d);
+    return rc;
+}
+
+/**
+ * Check that a prefix-relative key stays inside the target directory
+ * 
+ * @param relative key with the prefix removed
+ * @return 1 if safe, 0 if it has an absolute path or ".." component
+ */
+static int is_safe_relative_path(const char *relative) {
+    if (relative[0] == '/') {
+        return 0;
+    }
+    
+    for (const char *segment = relative; segment; ) {
+        const char *slash = strchr(segment, '/');
+        size_t length = slash ? (size_t)(slash - segment) : strlen(segment);
+        if (length == 2 && segment[0] == '.' && segment[1] == '.') {
+            return 0;
+        }
+        segment = slash ? slash + 1 : NULL;
+    }
+    
+    return 1;
+}
+
+/**
+ * Queue the objects under a prefix for download
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param client PostgreSQL client used for the listing
+ * @param prefix key prefix
+ * @param dir local directory receiving prefix-relative paths
+ * @return 0 on success, -1 on error
+ */
+int pg_transfer_add_prefix(PgTransfer *transfer, PgClient *client, const char *prefix,
+                           const char *dir) {
+    if (!transfer || !client || !prefix || !dir) {
+        return -1;
+    }
+    
+    S3ListOptions options = {prefix, NULL, S3_LIST_UNLIMITED, NULL};
+    S3ListStream *stream = NULL;
+    S3Result *result = pg_client_list_open(client, "public", &options, &stream);
+    if (!result || result->status != S3_SUCCESS) {
+        fprintf(stderr, "Error: %s\n", result && result->error_message ?
+                result->error_message : "Unknown error");
+        s3_result_free(result);
+        return -1;
+    }
+    s3_result_free(result);
+    
+    // Listed in full before the workers start, so the listing connection
+    // is free again and the job count is known for progress reporting
+    int rc = 0;
+    int status;
+    S3ListEntry entry;
+    size_t prefix_length = strlen(prefix);
+    while (rc == 0 && (status = s3_list_next(stream, &entry)) > 0) {
+        const char *relative = entry.key + prefix_length;
+        if (!is_safe_relative_path(relative)) {
+            fprintf(stderr, "Skipping %s: path leaves %s\n", entry.key, dir);
+            continue;
+        }
+        
+        char path[4096];
+        if (snprintf(path, sizeof(path), "%s%s%s", dir, relative[0] ? "/" : "",
+                     relative) >= (int)sizeof(path)) {
+            fprintf(stderr, "Path too long for %s\n", entry.key);
+            rc = -1;
+        } else {
+            rc = pg_transfer_add(transfer, entry.key, path);
+        }
+    }
+    if (rc == 0 && status < 0) {
+        fprintf(stderr, "Listing failed: %s", PQerrorMessage(client->conn));
+        rc = -1;
+    }
+    
+    s3_list_close(stream);
+    return rc;
+}
+
+/**
+ * Decide whether a failed operation should be retried
+ * 
+ * @param client client the operation ran on
+ * @param result operation result, NULL if no session could be established
+ * @return 1 if the failure came from the connection, 0 otherwise
+ */
+static int is_transient(PgClient *client, const S3Result *result) {
+    return !result || result->status == S3_ERROR_CONNECTION ||
+           PQstatus(client->conn) != CONNECTION_OK;
+}
+
+/**
+ * Copy an error message into a job's error buffer
+ * 
+ * @param error destination buffer
+ * @param size buffer size
+ * @param result failed result, may be NULL
+ */
+static void set_job_error(char *error, size_t size, const S3Result *result) {
+    snprintf(error, size, "%s", result && result->error_message ? result->error_message
+                                                                 : "Connection lost");
+}
+
+/**
+ * Check whether a local file holds exactly an object's content
+ * 
+ * @param fd open file, read from its current position and rewound
+ * @param file_size file size
+ * @param size object size
+ * @param etag object ETag, empty if unknown
+ * @param block scratch buffer of PG_TRANSFER_BLOCK_SIZE bytes
+ * @return 1 if sizes and MD5 match, 0 otherwise
+ */
+static int file_matches(int fd, size_t file_size, size_t size, const char *etag, char *block) {
+    // Multipart ETags are not content MD5s and never match
+    if (!etag[0] || file_size != size || strlen(etag) != MD5_HEX_LENGTH) {
+        return 0;
+    }
+    
+    Md5Context md5;
+    md5_init(&md5);
+    ssize_t n;
+    while ((n = read(fd, block, PG_TRANSFER_BLOCK_SIZE)) > 0) {
+        md5_update(&md5, block, (size_t)n);
+    }
+    lseek(fd, 0, SEEK_SET);
+    if (n < 0) {
+        return 0;
+    }
+    
+    char hex[MD5_HEX_LENGTH + 1];
+    md5_final_hex(&md5, hex);
+    return strcmp(hex, etag) == 0;
+}
+
+/**
+ * Upload one file
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param client worker's PostgreSQL client
+ * @param job job to run
+ * @param block scratch buffer of PG_TRANSFER_BLOCK_SIZE bytes
+ * @param bytes receives the bytes copied
+ * @param error receives the error message
+ * @param error_size error buffer size
+ * @return outcome of the attempt
+ */
+static JobOutcome upload_file(PgTransfer *transfer, PgClient *client, const PgTransferJob *job,
+                              char *block, size_t *bytes, char *error, size_t error_size) {
+    int fd = open(job->path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        snprintf(error, error_size, "%s: %s", job->path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return JOB_FAILED;
+    }
+    
+    if (transfer->skip_unchanged) {
+        S3ObjectInfo info = {0};
+        S3Result *result = pg_client_stat_object(client, "public", job->key, &info);
+        int unchanged = 0;
+        if (result && result->status == S3_SUCCESS) {
+            unchanged = file_matches(fd, (size_t)st.st_size, info.size, info.etag, block);
+            s3_object_info_clear(&info);
+        } else if (!result || result->status != S3_ERROR_NOT_FOUND) {
+            set_job_error(error, error_size, result);
+            JobOutcome outcome = is_transient(client, result) ? JOB_RETRY : JOB_FAILED;
+            s3_result_free(result);
+            close(fd);
+            return outcome;
+        }
+        s3_result_free(result);
+        
+        if (unchanged) {
+            close(fd);
+            return JOB_SKIPPED;
+        }
+    }
+    
+    S3Upload *upload = pg_client_begin_upload(client, "public", job->key,
+                                              content_type_for_key(job->key));
+    if (!upload) {
+        set_job_error(error, error_size, NULL);
+        close(fd);
+        return JOB_RETRY;
+    }
+    s3_upload_reserve(upload, (size_t)st.st_size);
+    
+    ssize_t n;
+    while ((n = read(fd, block, PG_TRANSFER_BLOCK_SIZE)) > 0) {
+        if (s3_upload_write(upload, block, (size_t)n) != 0) {
+            break;
+        }
+    }
+    int read_errno = errno;
+    close(fd);
+    
+    if (n < 0) {
+        s3_upload_abort(upload);
+        snprintf(error, error_size, "%s: %s", job->path, strerror(read_errno));
+        return JOB_FAILED;
+    }
+    
+    size_t size = upload->size;
+    S3Result *result = s3_upload_finish(upload);
+    JobOutcome outcome = JOB_COPIED;
+    if (result && result->status == S3_SUCCESS) {
+        *bytes = size;
+    } else {
+        set_job_error(error, error_size, result);
+        outcome = is_transient(client, result) ? JOB_RETRY : JOB_FAILED;
+    }
+    s3_result_free(result);
+    
+    return outcome;
+}
+
+/**
+ * Create the missing parent directories of a path
+ * 
+ * @param path file path
+ * @return 0 on success, -1 on error
+ */
+static int make_parent_dirs(const char *path) {
+    char buffer[4096];
+    if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer)) {
+        return -1;
+    }
+    
+    for (char *slash = strchr(buffer + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(buffer, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        *slash = '/';
+    }
+    
+    return 0;
+}
+
+/**
+ * Download one object
+ * 
+ * The content goes to a temporary file next to the target, renamed into
+ * place once complete, so an interrupted copy never leaves a truncated file.
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param client worker's PostgreSQL client
+ * @param job job to run
+ * @param block scratch buffer of PG_TRANSFER_BLOCK_SIZE bytes
+ * @param bytes receives the bytes copied
+ * @param error receives the error message
+ * @param error_size error buffer size
+ * @return outcome of the attempt
+ */
+static JobOutcome download_object(PgTransfer *transfer, PgClient *client, const PgTransferJob *job,
+                                  char *block, size_t *bytes, char *error, size_t error_size) {
+    S3ObjectReader *reader = NULL;
+    S3Result *result = pg_client_open_object(client, "public", job->key, PG_TRANSFER_BLOCK_SIZE,
+                                             NULL, &reader);
+    if (!result || result->status != S3_SUCCESS) {
+        set_job_error(error, error_size, result);
+        JobOutcome outcome = is_transient(client, result) ? JOB_RETRY : JOB_FAILED;
+        s3_result_free(result);
+        return outcome;
+    }
+    s3_result_free(result);
+    
+    if (transfer->skip_unchanged) {
+        int fd = open(job->path, O_RDONLY);
+        struct stat st;
+        int unchanged = fd >= 0 && fstat(fd, &st) == 0 &&
+                        file_matches(fd, (size_t)st.st_size, reader->size, reader->etag, block);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (unchanged) {
+            s3_reader_close(reader);
+            return JOB_SKIPPED;
+        }
+    }
+    
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.pgs3-part", job->path) >= (int)sizeof(temp_path) ||
+        make_parent_dirs(job->path) != 0) {
+        snprintf(error, error_size, "%s: cannot create directory", job->path);
+        s3_reader_close(reader);
+        return JOB_FAILED;
+    }
+    
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        snprintf(error, error_size, "%s: %s", temp_path, strerror(errno));
+        s3_reader_close(reader);
+        return JOB_FAILED;
+    }
+    
+    JobOutcome outcome = JOB_COPIED;
+    size_t copied = 0;
+    ssize_t n;
+    while ((n = s3_reader_read(reader, block, PG_TRANSFER_BLOCK_SIZE)) > 0) {
+        for (ssize_t written = 0; written < n; ) {
+            ssize_t w = write(fd, block + written, (size_t)(n - written));
+            if (w < 0) {
+                snprintf(error, error_size, "%s: %s", temp_path, strerror(errno));
+                outcome = JOB_FAILED;
+                break;
+            }
+            written += w;
+        }
+        if (outcome != JOB_COPIED) {
+            break;
+        }
+        copied += (size_t)n;
+    }
+    if (outcome == JOB_COPIED && n < 0) {
+        snprintf(error, error_size, "Read failed: %s", PQerrorMessage(client->conn));
+        outcome = PQstatus(client->conn) != CONNECTION_OK ? JOB_RETRY : JOB_FAILED;
+    }
+    s3_reader_close(reader);
+    
+    if (close(fd) != 0 && outcome == JOB_COPIED) {
+        snprintf(error, error_size, "%s: %s", temp_path, strerror(errno));
+        outcome = JOB_FAILED;
+    }
+    if (outcome == JOB_COPIED && rename(temp_path, job->path) != 0) {
+        snprintf(error, error_size, "%s: %s", job->path, strerror(errno));
+        outcome = JOB_FAILED;
+    }
+    if (outcome != JOB_COPIED) {
+        unlink(temp_path);
+        return outcome;
+    }
+    
+    *bytes = copied;
+    return JOB_COPIED;
+}
+
+/**
+ * Run one job, retrying while the connection is at fault
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param client worker's PostgreSQL client
+ * @param job job to run
+ * @param block scratch buffer of PG_TRANSFER_BLOCK_SIZE bytes
+ */
+static void run_job(PgTransfer *transfer, PgClient *client, const PgTransferJob *job,
+                    char *block) {
+    char error[512] = {0};
+    size_t bytes = 0;
+    JobOutcome outcome;
+    
+    for (int attempt = 1; ; attempt++) {
+        outcome = transfer->direction == PG_TRANSFER_UPLOAD
+                      ? upload_file(transfer, client, job, block, &bytes, error, sizeof(error))
+                      : download_object(transfer, client, job, block, &bytes, error, sizeof(error));
+        if (outcome != JOB_RETRY || attempt == PG_TRANSFER_MAX_ATTEMPTS) {
+            break;
+        }
+        
+        pthread_mutex_lock(&transfer->lock);
+        transfer->retries++;
+        pthread_mutex_unlock(&transfer->lock);
+        
+        // The next pg_client call reconnects
+        long delay_ms = (long)PG_TRANSFER_RETRY_DELAY_MS << (attempt - 1);
+        struct timespec delay = {delay_ms / 1000, (delay_ms % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+    }
+    
+    pthread_mutex_lock(&transfer->lock);
+    if (outcome == JOB_COPIED) {
+        transfer->copied++;
+        transfer->bytes += bytes;
+    } else if (outcome == JOB_SKIPPED) {
+        transfer->skipped++;
+    } else {
+        transfer->failed++;
+        fprintf(stderr, "\nFailed %s: %s\n", job->key, error);
+    }
+    pthread_mutex_unlock(&transfer->lock);
+}
+
+/**
+ * Worker thread: take jobs from the queue until it is empty
+ * 
+ * @param arg pointer to PgTransfer structure
+ * @return NULL
+ */
+static void *transfer_worker(void *arg) {
+    PgTransfer *transfer = (PgTransfer *)arg;
+    PgClient *client = pg_client_init(transfer->conninfo);
+    char *block = malloc(PG_TRANSFER_BLOCK_SIZE);
+    
+    // A worker that cannot connect leaves its share to the others
+    while (client && block) {
+        pthread_mutex_lock(&transfer->lock);
+        int index = transfer->next < transfer->count ? transfer->next++ : -1;
+        pthread_mutex_unlock(&transfer->lock);
+        if (index < 0) {
+            break;
+        }
+        
+        run_job(transfer, client, &transfer->jobs[index], block);
+    }
+    
+    free(block);
+    pg_client_free(client);
+    
+    pthread_mutex_lock(&transfer->lock);
+    transfer->running--;
+    pthread_cond_signal(&transfer->finished);
+    pthread_mutex_unlock(&transfer->lock);
+    
+    return NULL;
+}
+
+/**
+ * Print the progress line; the caller holds the lock
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param elapsed seconds since the transfer started
+ * @param end text after the line
+ */
+static void print_progress(const PgTransfer *transfer, double elapsed, const char *end) {
+    double mb = transfer->bytes / (1024.0 * 1024.0);
+    long done = transfer->copied + transfer->skipped;
+    fprintf(stderr, "\r%ld/%d files, %.1f MB, %.1f MB/s, %.0f files/s%s", done, transfer->count,
+            mb, elapsed > 0 ? mb / elapsed : 0.0, elapsed > 0 ? done / elapsed : 0.0, end);
+}
+
+/**
+ * Run the queued jobs and print progress and totals to stderr
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param workers number of worker threads, each with its own connection
+ * @return 0 if every job succeeded or was skipped, -1 otherwise
+ */
+int pg_transfer_run(PgTransfer *transfer, int workers) {
+    if (!transfer || workers <= 0) {
+        return -1;
+    }
+    
+    if (workers > transfer->count) {
+        workers = transfer->count;
+    }
+    
+    pthread_t *threads = calloc(workers > 0 ? workers : 1, sizeof(pthread_t));
+    if (!threads) {
+        return -1;
+    }
+    
+    double started = now_seconds();
+    int created = 0;
+    pthread_mutex_lock(&transfer->lock);
+    for (; created < workers; created++) {
+        if (pthread_create(&threads[created], NULL, transfer_worker, transfer) != 0) {
+            fprintf(stderr, "Failed to start worker thread\n");
+            break;
+        }
+        transfer->running++;
+    }
+    
+    while (transfer->running > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        if (pthread_cond_timedwait(&transfer->finished, &transfer->lock, &deadline) == ETIMEDOUT) {
+            print_progress(transfer, now_seconds() - started, "");
+        }
+    }
+    pthread_mutex_unlock(&transfer->lock);
+    
+    for (int i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    
+    // Jobs nobody picked up because no worker could connect
+    transfer->failed += transfer->count - transfer->next;
+    
+    print_progress(transfer, now_seconds() - started, "\n");
+    fprintf(stderr, "%ld copied, %ld unchanged, %ld failed, %ld retries\n", transfer->copied,
+            transfer->skipped, transfer->failed, transfer->retries);
+    
+    return transfer->failed ? -1 : 0;
+}
+
+/**
+ * Free a transfer and its jobs
+ * 
+ * @param transfer pointer to PgTransfer structure
+ */
+void pg_transfer_free(PgTransfer *transfer) {
+    if (!transfer) {
+        return;
+    }
+    
+    for (int i = 0; i < transfer->count; i++) {
+        free(transfer->jobs[i].key);
+        free(transfer->jobs[i].path);
+    }
+    free(transfer->jobs);
+    free(transfer->conninfo);
+    pthread_mutex_destroy(&transfer->lock);
+    pthread_cond_destroy(&transfer->finished);
+    free(transfer);
+}
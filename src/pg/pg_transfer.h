@@ -0,0 +1,118 @@
+#ifndef PG_TRANSFER_H
+#define PG_TRANSFER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "pg_client.h"
+
+// Attempts per file when the connection goes away mid-transfer
+#define PG_TRANSFER_MAX_ATTEMPTS 4
+
+// Delay before the first retry; doubles with every further attempt
+#define PG_TRANSFER_RETRY_DELAY_MS 200
+
+// Block size used to move file and object content
+#define PG_TRANSFER_BLOCK_SIZE (1024 * 1024)
+
+typedef enum {
+    PG_TRANSFER_UPLOAD,     // local files to objects
+    PG_TRANSFER_DOWNLOAD    // objects to local files
+} PgTransferDirection;
+
+// One file to copy
+typedef struct PgTransferJob {
+    char *key;
+    char *path;
+} PgTransferJob;
+
+/**
+ * Bulk copy between local files and the public bucket
+ * 
+ * Jobs are queued up front and then pulled from the shared queue by a pool
+ * of worker threads, each with its own PostgreSQL connection, so
+ * throughput grows with the number of connections until the database or
+ * the disk saturates. A job that fails because its connection went away
+ * is retried on a fresh session with exponential backoff; any other error
+ * fails only that job.
+ */
+typedef struct PgTransfer {
+    char *conninfo;
+    PgTransferDirection direction;
+    int skip_unchanged;     // mirror: skip files whose MD5 equals the object's ETag
+    PgTransferJob *jobs;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;    // signalled when a worker exits
+    int next;               // next job to hand out
+    int running;            // workers still running
+    long copied;
+    long skipped;
+    long failed;
+    long retries;
+    size_t bytes;           // content bytes copied
+} PgTransfer;
+
+/**
+ * Create an empty transfer
+ * 
+ * @param conninfo PostgreSQL connection string used by every worker
+ * @param direction upload or download
+ * @param skip_unchanged skip files whose content already matches
+ * @return pointer to PgTransfer structure or NULL on memory error
+ */
+PgTransfer *pg_transfer_create(const char *conninfo, PgTransferDirection direction,
+                               int skip_unchanged);
+
+/**
+ * Queue one file
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param key object key
+ * @param path local file
+ * @return 0 on success, -1 on memory error
+ */
+int pg_transfer_add(PgTransfer *transfer, const char *key, const char *path);
+
+/**
+ * Queue the regular files under a directory for upload
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param dir local directory, walked recursively
+ * @param key_prefix prepended to each file's path relative to dir
+ * @return 0 on success, -1 on error
+ */
+int pg_transfer_add_directory(PgTransfer *transfer, const char *dir, const char *key_prefix);
+
+/**
+ * Queue the objects under a prefix for download
+ * 
+ * An object whose key equals the prefix is written to dir itself. Keys
+ * that would escape dir are skipped with a warning.
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param client PostgreSQL client used for the listing
+ * @param prefix key prefix
+ * @param dir local directory receiving prefix-relative paths
+ * @return 0 on success, -1 on error
+ */
+int pg_transfer_add_prefix(PgTransfer *transfer, PgClient *client, const char *prefix,
+                           const char *dir);
+
+/**
+ * Run the queued jobs and print progress and totals to stderr
+ * 
+ * @param transfer pointer to PgTransfer structure
+ * @param workers number of worker threads, each with its own connection
+ * @return 0 if every job succeeded or was skipped, -1 otherwise
+ */
+int pg_transfer_run(PgTransfer *transfer, int workers);
+
+/**
+ * Free a transfer and its jobs
+ * 
+ * @param transfer pointer to PgTransfer structure
+ */
+void pg_transfer_free(PgTransfer *transfer);
+
+#endif /* PG_TRANSFER_H */
@@ -1,6 +1,19 @@
 #include "s3_api.h"
+#include "s3_statements.h"
+#include "pg_batch.h"
+#include "../common/compression.h"
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+
+// State of the next entry of each part of a merged listing
+enum {
+    LIST_HEAD_NEEDED,       // the last one was returned, fetch another
+    LIST_HEAD_READY,
+    LIST_HEAD_EXHAUSTED
+};
 
 /**
  * Create a new S3Result
@@ -70,118 +83,201 @@ void s3_result_set_error(S3Result *result, S3StatusEnum status, const char *mess
 }
 
 /**
- * Helper function to check PG connection and execute a query
+ * List all buckets
  * 
  * @param conn PostgreSQL connection
- * @param query SQL query
- * @return PGresult or NULL on error
+ * @return S3Result with bucket data
  */
-static PGresult* execute_query(PGconn *conn, const char *query) {
-    if (!conn || !query) {
+S3Result* s3_api_list_buckets(PGconn *conn) {
+    S3Result *result = s3_result_create();
+    if (!result) {
         return NULL;
     }
     
-    if (PQstatus(conn) != CONNECTION_OK) {
-        return NULL;
+    if (!conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+        return result;
     }
     
-    PGresult *res = PQexec(conn, query);
-    if (PQresultStatus(res) != PGRES_TUPLES_OK && PQresultStatus(res) != PGRES_COMMAND_OK) {
+    // We only support a single bucket named "public"
+    const char *buckets_json = "["
+        "{\"Name\":\"public\",\"CreationDate\":\"2023-01-01T00:00:00.000Z\"}"
+    "]";
+    
+    result->data = strdup(buckets_json);
+    result->data_size = strlen(buckets_json);
+    result->content_type = strdup("application/json");
+    
+    return result;
+}
+
+/**
+ * Discard every pending result of an asynchronous query
+ * 
+ * @param conn PostgreSQL connection
+ */
+static void drain_results(PGconn *conn) {
+    PGresult *res;
+    while ((res = PQgetResult(conn)) != NULL) {
         PQclear(res);
-        return NULL;
     }
-    
-    return res;
 }
 
 /**
- * Ensure S3 schema and tables exist in the database
+ * Check the connection, bucket and key shared by the multi-step calls
  * 
  * @param conn PostgreSQL connection
- * @return 0 on success, -1 on error
+ * @param bucket bucket name
+ * @param key object key
+ * @param result S3Result receiving errors
+ * @return 0 if valid, -1 otherwise
  */
-static int ensure_s3_schema(PGconn *conn) {
+static int check_target(PGconn *conn, const char *bucket, const char *key, S3Result *result) {
     if (!conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
         return -1;
     }
     
-    // Create schema if not exists
-    const char *create_schema = 
-        "CREATE SCHEMA IF NOT EXISTS s3;";
-    
-    PGresult *res = execute_query(conn, create_schema);
-    if (!res) {
+    if (!bucket || !key) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name and key are required");
         return -1;
     }
-    PQclear(res);
     
-    // Create objects table if not exists
-    const char *create_objects = 
-        "CREATE TABLE IF NOT EXISTS s3.objects ("
-        "   path TEXT PRIMARY KEY,"
-        "   content BYTEA NOT NULL,"
-        "   content_type TEXT NOT NULL,"
-        "   size BIGINT NOT NULL,"
-        "   last_modified TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
-        ");";
-    
-    res = execute_query(conn, create_objects);
-    if (!res) {
+    // Check if the bucket is "public" (the only supported bucket)
+    if (strcmp(bucket, "public") != 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
         return -1;
     }
-    PQclear(res);
     
     return 0;
 }
 
 /**
- * List all buckets
+ * Compute the smallest string greater than every string starting with a prefix
  * 
- * @param conn PostgreSQL connection
- * @return S3Result with bucket data
+ * Increments the last code point of the (UTF-8) prefix, dropping trailing
+ * U+10FFFF characters that cannot be incremented.
+ * 
+ * @param prefix non-empty key prefix
+ * @return bound (free with free()) or NULL if no bound exists
  */
-S3Result* s3_api_list_buckets(PGconn *conn) {
-    S3Result *result = s3_result_create();
-    if (!result) {
+static char *prefix_upper_bound(const char *prefix) {
+    char *bound = strdup(prefix);
+    if (!bound) {
         return NULL;
     }
     
-    if (!conn) {
-        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
-        return result;
+    size_t length = strlen(bound);
+    while (length > 0) {
+        // Find the first byte of the last character
+        size_t start = length - 1;
+        while (start > 0 && ((unsigned char)bound[start] & 0xC0) == 0x80) {
+            start--;
+        }
+        
+        unsigned char *c = (unsigned char *)bound + start;
+        size_t width = length - start;
+        unsigned long cp;
+        if (width == 1 && c[0] < 0x80) {
+            cp = c[0];
+        } else if (width == 2 && (c[0] & 0xE0) == 0xC0) {
+            cp = ((c[0] & 0x1FUL) << 6) | (c[1] & 0x3F);
+        } else if (width == 3 && (c[0] & 0xF0) == 0xE0) {
+            cp = ((c[0] & 0x0FUL) << 12) | ((c[1] & 0x3FUL) << 6) | (c[2] & 0x3F);
+        } else if (width == 4 && (c[0] & 0xF8) == 0xF0) {
+            cp = ((c[0] & 0x07UL) << 18) | ((c[1] & 0x3FUL) << 12) |
+                 ((c[2] & 0x3FUL) << 6) | (c[3] & 0x3F);
+        } else {
+            // Not UTF-8; fall back to incrementing the last byte
+            start = length - 1;
+            c = (unsigned char *)bound + start;
+            if (c[0] < 0xFF) {
+                c[0]++;
+                bound[length] = '\0';
+                return bound;
+            }
+            length = start;
+            continue;
+        }
+        
+        if (cp >= 0x10FFFF) {
+            length = start;
+            continue;
+        }
+        
+        cp++;
+        if (cp == 0xD800) {
+            cp = 0xE000;    // skip the surrogate range
+        }
+        
+        // The incremented character may need one more byte (at most 4)
+        char *grown = realloc(bound, start + 5);
+        if (!grown) {
+            free(bound);
+            return NULL;
+        }
+        bound = grown;
+        c = (unsigned char *)bound + start;
+        
+        if (cp < 0x80) {
+            c[0] = (unsigned char)cp;
+            length = start + 1;
+        } else if (cp < 0x800) {
+            c[0] = (unsigned char)(0xC0 | (cp >> 6));
+            c[1] = (unsigned char)(0x80 | (cp & 0x3F));
+            length = start + 2;
+        } else if (cp < 0x10000) {
+            c[0] = (unsigned char)(0xE0 | (cp >> 12));
+            c[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            c[2] = (unsigned char)(0x80 | (cp & 0x3F));
+            length = start + 3;
+        } else {
+            c[0] = (unsigned char)(0xF0 | (cp >> 18));
+            c[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+            c[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            c[3] = (unsigned char)(0x80 | (cp & 0x3F));
+            length = start + 4;
+        }
+        bound[length] = '\0';
+        return bound;
     }
     
-    // We only support a single bucket named "public"
-    const char *buckets_json = "["
-        "{\"Name\":\"public\",\"CreationDate\":\"2023-01-01T00:00:00.000Z\"}"
-    "]";
-    
-    result->data = strdup(buckets_json);
-    result->data_size = strlen(buckets_json);
-    result->content_type = strdup("application/json");
-    
-    return result;
+    free(bound);
+    return NULL;
 }
 
 /**
- * List objects in a bucket
+ * Open a listing that returns its entries one row at a time
  * 
- * @param conn PostgreSQL connection
+ * Keys come back in byte order from an index range scan, so the cost
+ * depends on the number of entries read rather than the number of objects.
+ * With a delimiter, keys sharing a common prefix are rolled up in SQL and
+ * each group costs a single index probe. Rows are received in single-row
+ * mode, so memory stays constant however long the listing is.
+ * 
+ * @param conn PostgreSQL connection, busy until the stream is closed
  * @param bucket bucket name
- * @return S3Result with object data
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success
+ * @return S3Result with status
  */
-S3Result* s3_api_list_objects(PGconn *conn, const char *bucket) {
+S3Result* s3_list_open(PGconn *conn, const char *bucket, const S3ListOptions *options,
+                       S3ListStream **stream) {
     S3Result *result = s3_result_create();
     if (!result) {
         return NULL;
     }
     
+    if (stream) {
+        *stream = NULL;
+    }
+    
     if (!conn) {
         s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
         return result;
     }
     
-    if (!bucket) {
+    if (!bucket || !stream) {
         s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name is required");
         return result;
     }
@@ -192,280 +288,2371 @@ S3Result* s3_api_list_objects(PGconn *conn, const char *bucket) {
         return result;
     }
     
-    // Ensure schema and tables exist
-    if (ensure_s3_schema(conn) != 0) {
-        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to ensure schema");
-        return result;
+    const char *prefix = options && options->prefix ? options->prefix : "";
+    const char *start_after = options && options->start_after ? options->start_after : "";
+    int max_keys = options ? options->max_keys : S3_LIST_MAX_KEYS;
+    if (max_keys != S3_LIST_UNLIMITED && (max_keys < 0 || max_keys > S3_LIST_MAX_KEYS)) {
+        max_keys = S3_LIST_MAX_KEYS;
     }
     
-    // Query objects from database
-    const char *query = 
-        "SELECT path, size, to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod "
-        "FROM s3.objects "
-        "ORDER BY path;";
+    // One extra row tells whether another page follows
+    char limit_str[16];
+    snprintf(limit_str, sizeof(limit_str), "%d", max_keys == S3_LIST_UNLIMITED ? INT_MAX : max_keys + 1);
+    
+    const char *delimiter = options && options->delimiter && options->delimiter[0] ?
+                            options->delimiter : NULL;
+    char *upper = prefix[0] ? prefix_upper_bound(prefix) : NULL;
+    int sent;
+    
+    if (delimiter) {
+        // The successor of the delimiter is where the walk resumes after a group
+        char *delimiter_upper = prefix_upper_bound(delimiter);
+        if (!delimiter_upper) {
+            s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Unsupported delimiter");
+            free(upper);
+            return result;
+        }
+        
+        const char *params[6] = {start_after, prefix, limit_str, delimiter, delimiter_upper, upper};
+        S3StatementId statement = upper ? S3_STMT_LIST_DELIMITED_PREFIX : S3_STMT_LIST_DELIMITED;
+        sent = PQsendQueryPrepared(conn, s3_statement_name(statement),
+                                   upper ? 6 : 5, params, NULL, NULL, 0);
+        free(delimiter_upper);
+    } else {
+        const char *params[4] = {start_after, prefix, limit_str, upper};
+        S3StatementId statement = upper ? S3_STMT_LIST_PREFIX : S3_STMT_LIST_OBJECTS;
+        sent = PQsendQueryPrepared(conn, s3_statement_name(statement),
+                                   upper ? 4 : 3, params, NULL, NULL, 0);
+    }
+    free(upper);
     
-    PGresult *res = execute_query(conn, query);
-    if (!res) {
+    if (!sent || !PQsetSingleRowMode(conn)) {
         s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to query objects");
+        drain_results(conn);
         return result;
     }
     
-    int rows = PQntuples(res);
-    if (rows == 0) {
-        // No objects found, return empty array
-        const char *empty_json = "[]";
-        result->data = strdup(empty_json);
-        result->data_size = strlen(empty_json);
-        result->content_type = strdup("application/json");
-        PQclear(res);
+    S3ListStream *s = (S3ListStream *)calloc(1, sizeof(S3ListStream));
+    if (!s) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        drain_results(conn);
         return result;
     }
+    s->conn = conn;
+    s->max_keys = max_keys;
     
-    // Allocate a buffer for the JSON result
-    // Initial size, will be expanded if needed
-    size_t buffer_size = 1024;
-    char *buffer = (char *)malloc(buffer_size);
-    if (!buffer) {
-        PQclear(res);
-        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+    *stream = s;
+    return result;
+}
+
+/**
+ * Merge listings of the same request on several databases into one
+ * 
+ * @param parts open listings, closed with the merged one (also on error)
+ * @param part_count number of parts
+ * @param max_keys page size the parts were opened with, or S3_LIST_UNLIMITED
+ * @param stream receives the merged stream on success
+ * @return S3Result with status
+ */
+S3Result* s3_list_merge(S3ListStream **parts, int part_count, int max_keys,
+                        S3ListStream **stream) {
+    S3Result *result = s3_result_create();
+    S3ListStream *s = (S3ListStream *)calloc(1, sizeof(S3ListStream));
+    
+    if (s) {
+        s->parts = (S3ListStream **)calloc(part_count, sizeof(S3ListStream *));
+        s->heads = (S3ListEntry *)calloc(part_count, sizeof(S3ListEntry));
+        s->head_states = (int *)calloc(part_count, sizeof(int));
+    }
+    
+    if (!result || !s || !s->parts || !s->heads || !s->head_states) {
+        if (s) {
+            free(s->parts);
+            free(s->heads);
+            free(s->head_states);
+            free(s);
+        }
+        for (int i = 0; i < part_count; i++) {
+            s3_list_close(parts[i]);
+        }
+        if (result) {
+            s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        }
         return result;
     }
     
-    // Start with opening bracket
-    strcpy(buffer, "[");
-    size_t buffer_pos = 1;
+    // Every head starts as LIST_HEAD_NEEDED
+    memcpy(s->parts, parts, part_count * sizeof(S3ListStream *));
+    s->part_count = part_count;
+    s->max_keys = max_keys;
     
-    for (int i = 0; i < rows; i++) {
-        const char *path = PQgetvalue(res, i, 0);
-        const char *size = PQgetvalue(res, i, 1);
-        const char *lastmod = PQgetvalue(res, i, 2);
+    *stream = s;
+    return result;
+}
+
+/**
+ * Read the next entry of a merged listing
+ * 
+ * @param stream merged listing
+ * @param entry receives pointers valid until the next call or close
+ * @return 1 with an entry, 0 at the end, -1 on error
+ */
+static int list_merge_next(S3ListStream *stream, S3ListEntry *entry) {
+    while (!stream->done) {
+        int best = -1;
+        
+        for (int i = 0; i < stream->part_count; i++) {
+            if (stream->head_states[i] == LIST_HEAD_NEEDED) {
+                int rc = s3_list_next(stream->parts[i], &stream->heads[i]);
+                if (rc < 0) {
+                    stream->done = 1;
+                    return -1;
+                }
+                if (rc == 0 && stream->parts[i]->is_truncated) {
+                    // This part's next page may hold keys that sort before
+                    // the other parts' heads, so the merged page ends here
+                    stream->is_truncated = 1;
+                    stream->done = 1;
+                    return 0;
+                }
+                stream->head_states[i] = rc > 0 ? LIST_HEAD_READY : LIST_HEAD_EXHAUSTED;
+            }
+            
+            if (stream->head_states[i] == LIST_HEAD_READY &&
+                (best < 0 || strcmp(stream->heads[i].key, stream->heads[best].key) < 0)) {
+                best = i;
+            }
+        }
+        
+        if (best < 0) {
+            stream->done = 1;
+            return 0;
+        }
+        if (stream->max_keys != S3_LIST_UNLIMITED && stream->count == stream->max_keys) {
+            stream->is_truncated = 1;
+            stream->done = 1;
+            return 0;
+        }
         
-        // Format JSON for this object
-        char obj_json[512];
-        snprintf(obj_json, sizeof(obj_json), 
-                "%s{\"Key\":\"%s\",\"Size\":%s,\"LastModified\":\"%s\"}",
-                (i > 0) ? "," : "", path, size, lastmod);
+        // The entry stays valid until its part is read again, on the next call
+        stream->head_states[best] = LIST_HEAD_NEEDED;
+        const char *key = stream->heads[best].key;
         
-        size_t obj_len = strlen(obj_json);
+        // A common prefix, or a key caught mid-move between databases, may
+        // come from several parts
+        if (stream->last_key && strcmp(stream->last_key, key) == 0) {
+            continue;
+        }
         
-        // Check if we need to expand the buffer
-        if (buffer_pos + obj_len + 2 > buffer_size) {
-            buffer_size *= 2;
-            char *new_buffer = (char *)realloc(buffer, buffer_size);
-            if (!new_buffer) {
-                free(buffer);
-                PQclear(res);
-                s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
-                return result;
+        size_t length = strlen(key) + 1;
+        if (length > stream->last_key_capacity) {
+            char *copy = (char *)realloc(stream->last_key, length);
+            if (!copy) {
+                stream->done = 1;
+                return -1;
             }
-            buffer = new_buffer;
+            stream->last_key = copy;
+            stream->last_key_capacity = length;
         }
+        memcpy(stream->last_key, key, length);
         
-        // Append this object to the JSON
-        strcpy(buffer + buffer_pos, obj_json);
-        buffer_pos += obj_len;
+        stream->count++;
+        *entry = stream->heads[best];
+        return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Read the next entry of a listing
+ * 
+ * @param stream open listing
+ * @param entry receives pointers valid until the next call or close
+ * @return 1 with an entry, 0 at the end, -1 on error
+ */
+int s3_list_next(S3ListStream *stream, S3ListEntry *entry) {
+    if (!stream || !entry) {
+        return -1;
     }
     
-    // Close the JSON array
-    strcpy(buffer + buffer_pos, "]");
-    buffer_pos += 1;
+    if (stream->parts) {
+        return list_merge_next(stream, entry);
+    }
     
-    result->data = buffer;
-    result->data_size = buffer_pos;
-    result->content_type = strdup("application/json");
+    if (stream->done) {
+        return 0;
+    }
+    
+    PGresult *res = PQgetResult(stream->conn);
+    
+    if (PQresultStatus(res) == PGRES_SINGLE_TUPLE) {
+        if (stream->max_keys != S3_LIST_UNLIMITED && stream->count == stream->max_keys) {
+            // The extra row: there is another page, and it is not ours
+            PQclear(res);
+            stream->is_truncated = 1;
+            stream->done = 1;
+            drain_results(stream->conn);
+            return 0;
+        }
+        
+        // The previous row stays alive until now so its key can name the next page
+        if (stream->row) {
+            PQclear(stream->row);
+        }
+        stream->row = res;
+        stream->count++;
+        
+        entry->key = PQgetvalue(res, 0, 0);
+        entry->size = PQgetvalue(res, 0, 1);
+        entry->last_modified = PQgetvalue(res, 0, 2);
+        entry->etag = PQgetisnull(res, 0, 3) ? NULL : PQgetvalue(res, 0, 3);
+        
+        // Only delimited listings have the is_prefix column
+        entry->is_prefix = PQnfields(res) > 4 && PQgetvalue(res, 0, 4)[0] == 't';
+        return 1;
+    }
     
+    int ok = PQresultStatus(res) == PGRES_TUPLES_OK;
     PQclear(res);
-    return result;
+    stream->done = 1;
+    drain_results(stream->conn);
+    
+    return ok ? 0 : -1;
 }
 
 /**
- * Get object from bucket
+ * Get the key or common prefix a truncated listing continues after
  * 
- * @param conn PostgreSQL connection
- * @param bucket bucket name
- * @param key object key
- * @return S3Result with object data
+ * @param stream listing that returned 0 from s3_list_next
+ * @return last entry of the page, or NULL if the listing is complete
  */
-S3Result* s3_api_get_object(PGconn *conn, const char *bucket, const char *key) {
-    S3Result *result = s3_result_create();
-    if (!result) {
-        return NULL;
+const char* s3_list_last_key(const S3ListStream *stream) {
+    if (stream && stream->parts) {
+        return stream->is_truncated ? stream->last_key : NULL;
     }
     
-    if (!conn) {
-        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
-        return result;
+    if (!stream || !stream->is_truncated || !stream->row) {
+        return NULL;
     }
     
-    if (!bucket || !key) {
-        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name and key are required");
-        return result;
+    return PQgetvalue(stream->row, 0, 0);
+}
+
+/**
+ * Close a listing, cancelling the query if it has not been read to the end
+ * 
+ * @param stream listing to close
+ */
+void s3_list_close(S3ListStream *stream) {
+    if (!stream) {
+        return;
     }
     
-    // Check if the bucket is "public" (the only supported bucket)
-    if (strcmp(bucket, "public") != 0) {
-        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
-        return result;
+    if (stream->parts) {
+        for (int i = 0; i < stream->part_count; i++) {
+            s3_list_close(stream->parts[i]);
+        }
+        free(stream->parts);
+        free(stream->heads);
+        free(stream->head_states);
+        free(stream->last_key);
+        free(stream);
+        return;
     }
     
-    // Ensure schema and tables exist
-    if (ensure_s3_schema(conn) != 0) {
-        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to ensure schema");
-        return result;
+    if (!stream->done) {
+        // The rest of an unbounded listing may be large; stop the server
+        // instead of reading and discarding it
+        PGcancel *cancel = PQgetCancel(stream->conn);
+        if (cancel) {
+            char error[256];
+            PQcancel(cancel, error, sizeof(error));
+            PQfreeCancel(cancel);
+        }
+        drain_results(stream->conn);
     }
     
-    // Query object from database
-    const char *query_template = 
-        "SELECT content, content_type FROM s3.objects WHERE path = $1;";
+    if (stream->row) {
+        PQclear(stream->row);
+    }
+    free(stream);
+}
+
+/**
+ * Append an entry as a JSON object
+ * 
+ * @param out output buffer
+ * @param entry listed object
+ */
+void s3_list_entry_write_json(TextBuffer *out, const S3ListEntry *entry) {
+    if (entry->is_prefix) {
+        text_buffer_append_str(out, "{\"Prefix\":\"");
+        text_buffer_append_json(out, entry->key);
+        text_buffer_append_str(out, "\"}");
+        return;
+    }
     
-    // Prepare parameters
-    const char *params[1] = {key};
+    text_buffer_append_str(out, "{\"Key\":\"");
+    text_buffer_append_json(out, entry->key);
+    text_buffer_printf(out, "\",\"Size\":%s,\"LastModified\":\"%s\"", entry->size, entry->last_modified);
+    if (entry->etag) {
+        text_buffer_printf(out, ",\"ETag\":\"\\\"%s\\\"\"", entry->etag);
+    }
+    text_buffer_append_str(out, "}");
+}
+
+/**
+ * Append an entry as a ListObjectsV2 <Contents> or <CommonPrefixes> element
+ * 
+ * @param out output buffer
+ * @param entry listed object
+ */
+void s3_list_entry_write_xml(TextBuffer *out, const S3ListEntry *entry) {
+    if (entry->is_prefix) {
+        text_buffer_append_str(out, "<CommonPrefixes><Prefix>");
+        text_buffer_append_xml(out, entry->key);
+        text_buffer_append_str(out, "</Prefix></CommonPrefixes>");
+        return;
+    }
     
-    // Execute parameterized query
-    PGresult *res = PQexecParams(conn, query_template, 1, NULL, params, NULL, NULL, 0);
-    if (!res || PQresultStatus(res) != PGRES_TUPLES_OK) {
-        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to query object");
-        if (res) PQclear(res);
-        return result;
+    text_buffer_append_str(out, "<Contents><Key>");
+    text_buffer_append_xml(out, entry->key);
+    text_buffer_printf(out, "</Key><LastModified>%s</LastModified>", entry->last_modified);
+    if (entry->etag) {
+        text_buffer_printf(out, "<ETag>&quot;%s&quot;</ETag>", entry->etag);
     }
+    text_buffer_printf(out, "<Size>%s</Size><StorageClass>STANDARD</StorageClass></Contents>",
+                       entry->size);
+}
+
+/**
+ * Encode a key as an opaque continuation token
+ * 
+ * @param key last key of a page
+ * @return token (free with free()) or NULL on allocation failure
+ */
+char* s3_list_token_encode(const char *key) {
+    static const char digits[] = "0123456789abcdef";
+    size_t length = strlen(key);
     
-    if (PQntuples(res) == 0) {
-        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Object not found");
-        PQclear(res);
-        return result;
+    char *token = malloc(length * 2 + 1);
+    if (!token) {
+        return NULL;
     }
     
-    // Get content and content type
-    size_t content_size;
-    unsigned char *content = PQunescapeBytea(
-        (unsigned char *)PQgetvalue(res, 0, 0), 
-        &content_size
-    );
+    for (size_t i = 0; i < length; i++) {
+        token[i * 2] = digits[(unsigned char)key[i] >> 4];
+        token[i * 2 + 1] = digits[(unsigned char)key[i] & 0x0F];
+    }
+    token[length * 2] = '\0';
     
-    if (!content) {
-        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to unescape content");
-        PQclear(res);
-        return result;
+    return token;
+}
+
+/**
+ * Decode a continuation token
+ * 
+ * @param token token from s3_list_token_encode
+ * @return key to continue after (free with free()) or NULL if the token is malformed
+ */
+char* s3_list_token_decode(const char *token) {
+    size_t length = strlen(token);
+    if (length % 2 != 0) {
+        return NULL;
     }
     
-    const char *content_type = PQgetvalue(res, 0, 1);
+    char *key = malloc(length / 2 + 1);
+    if (!key) {
+        return NULL;
+    }
     
-    result->data = content;
-    result->data_size = content_size;
-    result->content_type = strdup(content_type);
+    for (size_t i = 0; i < length / 2; i++) {
+        int value = 0;
+        for (int j = 0; j < 2; j++) {
+            char c = token[i * 2 + j];
+            int digit = isdigit((unsigned char)c) ? c - '0' :
+                        (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+            if (digit < 0) {
+                free(key);
+                return NULL;
+            }
+            value = value * 16 + digit;
+        }
+        
+        // Keys are text and never contain NUL
+        if (value == 0) {
+            free(key);
+            return NULL;
+        }
+        key[i] = (char)value;
+    }
+    key[length / 2] = '\0';
     
-    PQclear(res);
-    return result;
+    return key;
 }
 
 /**
- * Put object in bucket
+ * List objects in a bucket
+ * 
+ * Collects the whole listing into one JSON array. Use s3_list_open to
+ * process long listings in constant memory.
  * 
  * @param conn PostgreSQL connection
  * @param bucket bucket name
- * @param key object key
- * @param data object data
- * @param size data size
- * @param content_type content type
- * @return S3Result with status
+ * @param prefix only list keys starting with this (NULL for all)
+ * @return S3Result with a JSON array of objects
  */
-S3Result* s3_api_put_object(PGconn *conn, const char *bucket, const char *key,
-                          const void *data, size_t size, const char *content_type) {
-    S3Result *result = s3_result_create();
-    if (!result) {
-        return NULL;
-    }
-    
-    if (!conn) {
-        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
-        return result;
-    }
+S3Result* s3_api_list_objects(PGconn *conn, const char *bucket, const char *prefix) {
+    S3ListOptions options = {prefix, NULL, S3_LIST_UNLIMITED, NULL};
+    S3ListStream *stream;
     
-    if (!bucket || !key || !data || size == 0) {
-        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name, key, and data are required");
+    S3Result *result = s3_list_open(conn, bucket, &options, &stream);
+    if (!result || result->status != S3_SUCCESS) {
         return result;
     }
     
-    // Default content type if not provided
-    if (!content_type) {
-        content_type = "application/octet-stream";
-    }
+    TextBuffer out = {0};
+    S3ListEntry entry;
+    int rc;
     
-    // Check if the bucket is "public" (the only supported bucket)
-    if (strcmp(bucket, "public") != 0) {
-        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
-        return result;
+    text_buffer_append_str(&out, "[");
+    for (int i = 0; (rc = s3_list_next(stream, &entry)) > 0; i++) {
+        if (i > 0) {
+            text_buffer_append_str(&out, ",");
+        }
+        s3_list_entry_write_json(&out, &entry);
     }
+    text_buffer_append_str(&out, "]");
+    s3_list_close(stream);
     
-    // Ensure schema and tables exist
-    if (ensure_s3_schema(conn) != 0) {
-        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to ensure schema");
+    if (rc < 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to query objects");
+        text_buffer_free(&out);
         return result;
     }
     
-    // Escape binary data for SQL
-    size_t escaped_size;
-    unsigned char *escaped_data = PQescapeBytea(data, size, &escaped_size);
-    if (!escaped_data) {
-        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to escape data");
+    size_t size = out.length;
+    result->data = text_buffer_detach(&out);
+    if (!result->data) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
         return result;
     }
+    result->data_size = size;
+    result->content_type = strdup("application/json");
     
-    // Prepare query parameters
-    const char *params[4];
-    params[0] = key;
-    params[1] = (const char *)escaped_data;
-    params[2] = content_type;
+    return result;
+}
+
+/**
+ * Execute a transaction control or other row-less statement
+ * 
+ * @param conn PostgreSQL connection
+ * @param sql SQL text
+ * @return 0 on success, -1 on error
+ */
+static int exec_command(PGconn *conn, const char *sql) {
+    PGresult *res = PQexec(conn, sql);
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Read a binary-format int8 column
+ * 
+ * @param res query result in binary format
+ * @param row row number
+ * @param col column number
+ * @return column value
+ */
+static long long get_binary_int64(const PGresult *res, int row, int col) {
+    const unsigned char *value = (const unsigned char *)PQgetvalue(res, row, col);
+    unsigned long long n = 0;
+    
+    // Network byte order
+    for (int i = 0; i < 8; i++) {
+        n = (n << 8) | value[i];
+    }
+    
+    return (long long)n;
+}
+
+/**
+ * Decompress stored content
+ * 
+ * @param encoding content encoding recorded with the object
+ * @param data stored content
+ * @param size stored size
+ * @param decoded_size object size
+ * @param decoded receives the malloc'd content on success
+ * @return 0 on success, -1 for an unknown encoding, corrupt data or no memory
+ */
+static int decode_content(const char *encoding, const void *data, size_t size,
+                          size_t decoded_size, unsigned char **decoded) {
+    if (strcmp(encoding, COMPRESSION_GZIP) != 0) {
+        return -1;
+    }
+    
+    unsigned char *buffer = malloc(decoded_size > 0 ? decoded_size : 1);
+    if (!buffer || compression_gunzip(data, size, buffer, decoded_size) != 0) {
+        free(buffer);
+        return -1;
+    }
+    
+    *decoded = buffer;
+    return 0;
+}
+
+/**
+ * Fill a reader from the result of S3_STMT_GET_OBJECT
+ * 
+ * @param reader reader to fill
+ * @param res binary result, kept as the prefetched content or cleared
+ * @param accept_encoding encodings the caller can take as stored, may be NULL
+ * @param result S3Result receiving errors
+ * @return 0 if found, -1 otherwise
+ */
+static int reader_fill(S3ObjectReader *reader, PGresult *res, const char *accept_encoding,
+                       S3Result *result) {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to query object");
+        PQclear(res);
+        return -1;
+    }
+    
+    if (PQntuples(res) == 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Object not found");
+        PQclear(res);
+        return -1;
+    }
+    
+    // Binary format of a text column is the plain string
+    free(reader->content_type);
+    reader->content_type = strdup(PQgetvalue(res, 0, 1));
+    reader->chunked = PQgetvalue(res, 0, 2)[0] != 0;
+    snprintf(reader->object_id, sizeof(reader->object_id), "%lld", get_binary_int64(res, 0, 3));
+    reader->size = (size_t)get_binary_int64(res, 0, 4);
+    reader->end = reader->size;
+    reader->last_modified = (time_t)get_binary_int64(res, 0, 5);
+    snprintf(reader->etag, sizeof(reader->etag), "%s",
+             PQgetisnull(res, 0, 6) ? "" : PQgetvalue(res, 0, 6));
+    
+    if (reader->prefetched) {
+        PQclear(reader->prefetched);
+        reader->prefetched = NULL;
+    }
+    free(reader->decoded);
+    reader->decoded = NULL;
+    reader->content_encoding[0] = '\0';
+    
+    if (PQgetisnull(res, 0, 0)) {
+        PQclear(res);
+    } else if (PQgetisnull(res, 0, 7)) {
+        reader->prefetched = res;
+        reader->size = (size_t)PQgetlength(res, 0, 0);
+        reader->end = reader->size;
+    } else if (compression_accepts(accept_encoding, PQgetvalue(res, 0, 7))) {
+        // Compressed, and the caller takes it as stored
+        snprintf(reader->content_encoding, sizeof(reader->content_encoding), "%s",
+                 PQgetvalue(res, 0, 7));
+        reader->prefetched = res;
+        reader->size = (size_t)PQgetlength(res, 0, 0);
+        reader->end = reader->size;
+    } else {
+        int rc = decode_content(PQgetvalue(res, 0, 7), PQgetvalue(res, 0, 0),
+                                (size_t)PQgetlength(res, 0, 0), reader->size, &reader->decoded);
+        PQclear(res);
+        if (rc != 0) {
+            s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to decode object");
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/**
+ * Look an object up for reading
+ * 
+ * @param reader reader to fill
+ * @param key object key
+ * @param prefetch_limit largest inline object to fetch along with the metadata
+ * @param accept_encoding encodings the caller can take as stored, may be NULL
+ * @param result S3Result receiving errors
+ * @return 0 if found, -1 otherwise
+ */
+static int reader_lookup(S3ObjectReader *reader, const char *key, size_t prefetch_limit,
+                         const char *accept_encoding, S3Result *result) {
+    char limit_str[32];
+    snprintf(limit_str, sizeof(limit_str), "%zu", prefetch_limit > (size_t)LLONG_MAX ?
+             (size_t)LLONG_MAX : prefetch_limit);
+    const char *params[2] = {key, limit_str};
+    
+    // Binary results so the content arrives as raw bytes instead of hex text
+    PGresult *res = PQexecPrepared(reader->conn, s3_statement_name(S3_STMT_GET_OBJECT),
+                                   2, params, NULL, NULL, 1);
+    return reader_fill(reader, res, accept_encoding, result);
+}
+
+/**
+ * Fill object metadata from the result of S3_STMT_STAT_OBJECT
+ * 
+ * @param res text result
+ * @param info metadata to fill
+ * @param result S3Result receiving errors
+ */
+static void stat_fill(const PGresult *res, S3ObjectInfo *info, S3Result *result) {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to query object");
+        return;
+    }
+    
+    if (PQntuples(res) == 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Object not found");
+        return;
+    }
+    
+    info->size = (size_t)strtoull(PQgetvalue(res, 0, 0), NULL, 10);
+    info->content_type = strdup(PQgetvalue(res, 0, 1));
+    info->last_modified = (time_t)strtoll(PQgetvalue(res, 0, 2), NULL, 10);
+    snprintf(info->etag, sizeof(info->etag), "%s",
+             PQgetisnull(res, 0, 3) ? "" : PQgetvalue(res, 0, 3));
+}
+
+/**
+ * Get object metadata without reading its content
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status
+ */
+S3Result* s3_api_stat_object(PGconn *conn, const char *bucket, const char *key,
+                             S3ObjectInfo *info) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        return NULL;
+    }
+    
+    if (!conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+        return result;
+    }
+    
+    if (!bucket || !key || !info) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name and key are required");
+        return result;
+    }
+    
+    memset(info, 0, sizeof(*info));
+    
+    // Check if the bucket is "public" (the only supported bucket)
+    if (strcmp(bucket, "public") != 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
+        return result;
+    }
+    
+    const char *params[1] = {key};
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(S3_STMT_STAT_OBJECT),
+                                   1, params, NULL, NULL, 0);
+    stat_fill(res, info, result);
+    PQclear(res);
+    
+    return result;
+}
+
+/**
+ * Read object metadata from the result of S3_STMT_STAT_OBJECT run elsewhere
+ * 
+ * @param res text result of S3_STMT_STAT_OBJECT, left to the caller
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status or NULL on memory error
+ */
+S3Result* s3_stat_from_result(const PGresult *res, S3ObjectInfo *info) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        return NULL;
+    }
+    
+    memset(info, 0, sizeof(*info));
+    stat_fill(res, info, result);
+    return result;
+}
+
+/**
+ * Free the strings held by object metadata
+ * 
+ * @param info metadata filled by s3_api_stat_object
+ */
+void s3_object_info_clear(S3ObjectInfo *info) {
+    if (!info) {
+        return;
+    }
+    
+    free(info->content_type);
+    info->content_type = NULL;
+}
+
+/**
+ * Open an object for incremental reading
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param prefetch_limit largest inline object to fetch in the first round trip
+ * @param accept_encoding Accept-Encoding value of the client, NULL to always decode
+ * @param reader receives the reader on success
+ * @return S3Result with status
+ */
+S3Result* s3_reader_open(PGconn *conn, const char *bucket, const char *key,
+                         size_t prefetch_limit, const char *accept_encoding,
+                         S3ObjectReader **reader) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        return NULL;
+    }
+    
+    if (reader) {
+        *reader = NULL;
+    }
+    
+    if (!conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+        return result;
+    }
+    
+    if (!bucket || !key || !reader) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name and key are required");
+        return result;
+    }
+    
+    // Check if the bucket is "public" (the only supported bucket)
+    if (strcmp(bucket, "public") != 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
+        return result;
+    }
+    
+    S3ObjectReader *r = (S3ObjectReader *)calloc(1, sizeof(S3ObjectReader));
+    if (!r) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return result;
+    }
+    r->conn = conn;
+    
+    // Small inline objects come back in this single round trip, and so do
+    // compressed ones
+    if (reader_lookup(r, key, prefetch_limit, accept_encoding, result) != 0) {
+        s3_reader_close(r);
+        return result;
+    }
+    
+    *reader = r;
+    return result;
+}
+
+/**
+ * Open a reader on the result of S3_STMT_GET_OBJECT run elsewhere
+ * 
+ * @param res binary result of S3_STMT_GET_OBJECT, taken over by the call
+ * @param accept_encoding Accept-Encoding value of the client, NULL to always decode
+ * @param reader receives the reader on success
+ * @return S3Result with status or NULL on memory error
+ */
+S3Result* s3_reader_from_result(PGresult *res, const char *accept_encoding,
+                                S3ObjectReader **reader) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        PQclear(res);
+        return NULL;
+    }
+    
+    *reader = NULL;
+    
+    S3ObjectReader *r = (S3ObjectReader *)calloc(1, sizeof(S3ObjectReader));
+    if (!r) {
+        PQclear(res);
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return result;
+    }
+    
+    if (reader_fill(r, res, accept_encoding, result) != 0) {
+        s3_reader_close(r);
+        return result;
+    }
+    
+    *reader = r;
+    return result;
+}
+
+/**
+ * Fetch the bytes from an offset up to the end of its chunk or content window
+ * 
+ * Nothing past the reader's range end is requested.
+ * 
+ * @param reader open reader
+ * @param offset object offset to start at
+ * @return 0 on success, -1 on error
+ */
+static int reader_fetch_window(S3ObjectReader *reader, size_t offset) {
+    if (reader->window) {
+        PQclear(reader->window);
+        reader->window = NULL;
+    }
+    
+    // Each piece checks the ETag, so it comes from the version that was opened
+    char offset_str[32];
+    char length_str[32];
+    const char *params[4] = {reader->object_id, offset_str, length_str,
+                             reader->etag[0] ? reader->etag : NULL};
+    size_t wanted = reader->end - offset;
+    PGresult *res;
+    
+    if (reader->chunked) {
+        // The chunk itself bounds the slice
+        snprintf(offset_str, sizeof(offset_str), "%zu", offset);
+        snprintf(length_str, sizeof(length_str), "%zu", wanted > INT_MAX ? (size_t)INT_MAX : wanted);
+        res = PQexecPrepared(reader->conn, s3_statement_name(S3_STMT_GET_CHUNK),
+                             4, params, NULL, NULL, 1);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1 ||
+            (size_t)get_binary_int64(res, 0, 0) > offset) {
+            PQclear(res);
+            return -1;
+        }
+        reader->window_data_column = 1;
+    } else {
+        // substring() positions are 1-based
+        snprintf(offset_str, sizeof(offset_str), "%zu", offset + 1);
+        snprintf(length_str, sizeof(length_str), "%zu",
+                 wanted > S3_READ_WINDOW ? (size_t)S3_READ_WINDOW : wanted);
+        res = PQexecPrepared(reader->conn, s3_statement_name(S3_STMT_READ_WINDOW),
+                             4, params, NULL, NULL, 1);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+            PQclear(res);
+            return -1;
+        }
+        reader->window_data_column = 0;
+    }
+    reader->window_start = offset;
+    
+    size_t length = (size_t)PQgetlength(res, 0, reader->window_data_column);
+    if (reader->window_start > offset || reader->window_start + length <= offset) {
+        PQclear(res);
+        return -1;
+    }
+    
+    reader->window = res;
+    reader->window_length = length;
+    return 0;
+}
+
+/**
+ * Read the next bytes of an object
+ * 
+ * @param reader open reader
+ * @param buffer destination
+ * @param max buffer size
+ * @return bytes read, 0 at end of object, -1 on error
+ */
+ssize_t s3_reader_read(S3ObjectReader *reader, void *buffer, size_t max) {
+    if (!reader || !buffer) {
+        return -1;
+    }
+    
+    if (reader->offset >= reader->end || max == 0) {
+        return 0;
+    }
+    
+    size_t available = reader->end - reader->offset;
+    if (max > available) {
+        max = available;
+    }
+    
+    const char *source;
+    if (reader->decoded) {
+        source = (const char *)reader->decoded + reader->offset;
+    } else if (reader->prefetched) {
+        source = PQgetvalue(reader->prefetched, 0, 0) + reader->offset;
+    } else {
+        if (!reader->window || reader->offset < reader->window_start ||
+            reader->offset >= reader->window_start + reader->window_length) {
+            if (reader_fetch_window(reader, reader->offset) != 0) {
+                return -1;
+            }
+        }
+        
+        size_t in_window = reader->window_start + reader->window_length - reader->offset;
+        if (max > in_window) {
+            max = in_window;
+        }
+        source = PQgetvalue(reader->window, 0, reader->window_data_column) +
+                 (reader->offset - reader->window_start);
+    }
+    
+    memcpy(buffer, source, max);
+    reader->offset += max;
+    
+    return (ssize_t)max;
+}
+
+/**
+ * Restrict a reader to a byte range of the object
+ * 
+ * @param reader open reader
+ * @param offset first byte to read
+ * @param length number of bytes to read
+ * @return 0 on success, -1 if the range is outside the object
+ */
+int s3_reader_set_range(S3ObjectReader *reader, size_t offset, size_t length) {
+    if (!reader || offset > reader->size || length > reader->size - offset) {
+        return -1;
+    }
+    
+    reader->offset = offset;
+    reader->end = offset + length;
+    
+    return 0;
+}
+
+/**
+ * Get the whole content of a prefetched object without copying
+ * 
+ * @param reader open reader
+ * @return content (reader->size bytes) or NULL if the object is read piecewise
+ */
+const void* s3_reader_prefetched_data(const S3ObjectReader *reader) {
+    if (reader && reader->decoded) {
+        return reader->decoded;
+    }
+    
+    if (!reader || !reader->prefetched) {
+        return NULL;
+    }
+    
+    return PQgetvalue(reader->prefetched, 0, 0);
+}
+
+/**
+ * Check whether the next s3_reader_read has to query the database
+ * 
+ * @param reader open reader
+ * @return 1 if the bytes at the read offset still have to be fetched, 0 otherwise
+ */
+int s3_reader_needs_fetch(const S3ObjectReader *reader) {
+    if (!reader || reader->decoded || reader->prefetched || reader->offset >= reader->end) {
+        return 0;
+    }
+    
+    return !reader->window || reader->offset < reader->window_start ||
+           reader->offset >= reader->window_start + reader->window_length;
+}
+
+/**
+ * Switch the connection a reader fetches on
+ * 
+ * @param reader open reader
+ * @param conn PostgreSQL connection, NULL to release the current one
+ */
+void s3_reader_attach(S3ObjectReader *reader, PGconn *conn) {
+    if (reader) {
+        reader->conn = conn;
+    }
+}
+
+/**
+ * Close a reader
+ * 
+ * @param reader reader to close
+ */
+void s3_reader_close(S3ObjectReader *reader) {
+    if (!reader) {
+        return;
+    }
+    
+    if (reader->prefetched) {
+        PQclear(reader->prefetched);
+    }
+    
+    if (reader->window) {
+        PQclear(reader->window);
+    }
+    
+    free(reader->decoded);
+    free(reader->content_type);
+    free(reader);
+}
+
+/**
+ * Get object from bucket
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @return S3Result with object data
+ */
+S3Result* s3_api_get_object(PGconn *conn, const char *bucket, const char *key) {
+    S3ObjectReader *reader;
+    S3Result *result = s3_reader_open(conn, bucket, key, SIZE_MAX, NULL, &reader);
+    if (!result || result->status != S3_SUCCESS) {
+        return result;
+    }
+    
+    unsigned char *content = malloc(reader->size > 0 ? reader->size : 1);
+    if (!content) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        s3_reader_close(reader);
+        return result;
+    }
+    
+    // Inline objects arrive with the lookup; chunked ones one chunk per round trip
+    size_t offset = 0;
+    while (offset < reader->size) {
+        ssize_t n = s3_reader_read(reader, content + offset, reader->size - offset);
+        if (n <= 0) {
+            s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to read object");
+            free(content);
+            s3_reader_close(reader);
+            return result;
+        }
+        offset += (size_t)n;
+    }
+    
+    result->data = content;
+    result->data_size = reader->size;
+    result->content_type = strdup(reader->content_type);
+    
+    s3_reader_close(reader);
+    return result;
+}
+
+/**
+ * Objects of a batched get
+ */
+typedef struct {
+    S3Result **results;
+    int deferred;           // objects left to read piecewise
+} GetBatch;
+
+/**
+ * Take one lookup result of a batched get
+ * 
+ * @param arg pointer to GetBatch structure
+ * @param index key index
+ * @param res S3_STMT_GET_OBJECT result, NULL if lost
+ */
+static void get_batch_result(void *arg, int index, const PGresult *res) {
+    GetBatch *batch = (GetBatch *)arg;
+    S3Result *result = batch->results[index];
+    
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION,
+                            res ? PQresultErrorMessage(res) : "Connection lost");
+    } else if (PQntuples(res) == 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Object not found");
+    } else if (PQgetisnull(res, 0, 0)) {
+        // Chunked: read after the pipeline; data stays NULL until then
+        batch->deferred++;
+    } else if (!PQgetisnull(res, 0, 7)) {
+        // Compressed: decoded right here, the whole value is at hand
+        size_t size = (size_t)get_binary_int64(res, 0, 4);
+        unsigned char *decoded = NULL;
+        if (decode_content(PQgetvalue(res, 0, 7), PQgetvalue(res, 0, 0),
+                           (size_t)PQgetlength(res, 0, 0), size, &decoded) != 0) {
+            s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to decode object");
+            return;
+        }
+        result->data = decoded;
+        result->data_size = size;
+        result->content_type = strdup(PQgetvalue(res, 0, 1));
+        if (!result->content_type) {
+            s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        }
+    } else {
+        size_t size = (size_t)PQgetlength(res, 0, 0);
+        result->data = malloc(size > 0 ? size : 1);
+        result->content_type = strdup(PQgetvalue(res, 0, 1));
+        if (!result->data || !result->content_type) {
+            s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+            return;
+        }
+        memcpy(result->data, PQgetvalue(res, 0, 0), size);
+        result->data_size = size;
+    }
+}
+
+/**
+ * Get several objects without waiting on each round trip
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param count number of keys
+ * @param results receives one S3Result per key, as from s3_api_get_object
+ * @return 0 if every object was read, -1 otherwise
+ */
+int s3_api_get_objects(PGconn *conn, const char *bucket, const char *const *keys, int count,
+                       S3Result **results) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        results[i] = s3_result_create();
+        if (!results[i] || check_target(conn, bucket, keys[i], results[i]) != 0) {
+            failed = 1;
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    
+    GetBatch get = {results, 0};
+    PgBatch *batch = pg_batch_begin(conn, 0, &get_batch_result, &get);
+    if (!batch) {
+        for (int i = 0; i < count; i++) {
+            s3_result_set_error(results[i], S3_ERROR_CONNECTION, "Failed to start pipeline");
+        }
+        return -1;
+    }
+    
+    // Every inline object comes back whole with its lookup
+    char limit_str[32];
+    snprintf(limit_str, sizeof(limit_str), "%lld", LLONG_MAX);
+    for (int i = 0; i < count; i++) {
+        const char *params[2] = {keys[i], limit_str};
+        if (pg_batch_queue(batch, S3_STMT_GET_OBJECT, 2, params, NULL, NULL, 1) < 0) {
+            for (int j = i; j < count; j++) {
+                s3_result_set_error(results[j], S3_ERROR_CONNECTION, "Connection lost");
+            }
+            break;
+        }
+    }
+    pg_batch_end(batch);
+    
+    for (int i = 0; i < count; i++) {
+        if (results[i]->status == S3_SUCCESS && !results[i]->data) {
+            s3_result_free(results[i]);
+            results[i] = s3_api_get_object(conn, bucket, keys[i]);
+        }
+        if (!results[i] || results[i]->status != S3_SUCCESS) {
+            failed = 1;
+        }
+    }
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Fill a put result with the ETag and last-modified time
+ * 
+ * @param result S3Result to fill
+ * @param etag hex content MD5
+ * @param lastmod last-modified timestamp
+ */
+static void set_put_response(S3Result *result, const char *etag, const char *lastmod) {
+    // S3 ETags include the double quotes
+    char json_response[256];
+    snprintf(json_response, sizeof(json_response), 
+            "{\"ETag\":\"\\\"%s\\\"\",\"LastModified\":\"%s\"}", 
+            etag, lastmod);
+    
+    result->data = strdup(json_response);
+    result->data_size = strlen(json_response);
+    result->content_type = strdup("application/json");
+}
+
+/**
+ * Compress content for storage when the policy covers it and it pays off
+ * 
+ * @param data content
+ * @param size content size
+ * @param content_type content type
+ * @param compress_types compression policy, NULL for none
+ * @param stored receives the malloc'd compressed content, or NULL
+ * @param stored_size receives the compressed size when compressed
+ * @return encoding to record, NULL to store the content as-is
+ */
+static const char *encode_content(const void *data, size_t size, const char *content_type,
+                                  const char *compress_types, unsigned char **stored,
+                                  size_t *stored_size) {
+    *stored = NULL;
+    
+    if (size > S3_COMPRESS_MAX_SIZE || !compression_type_matches(compress_types, content_type) ||
+        compression_gzip(data, size, stored, stored_size) != 0) {
+        return NULL;
+    }
+    
+    return COMPRESSION_GZIP;
+}
+
+/**
+ * Store an object inline in s3.objects.content
+ * 
+ * @param conn PostgreSQL connection
+ * @param key object key
+ * @param data object data
+ * @param size data size
+ * @param content_type content type
+ * @param compress_types compression policy, NULL for none
+ * @param etag hex content MD5
+ * @param result S3Result to fill
+ */
+static void store_inline_object(PGconn *conn, const char *key, const void *data, size_t size,
+                                const char *content_type, const char *compress_types,
+                                const char *etag, S3Result *result) {
+    if (size > S3_INLINE_MAX_SIZE) {
+        s3_result_set_error(result, S3_ERROR_TOO_LARGE, "Object is too large");
+        return;
+    }
+    
+    unsigned char *compressed = NULL;
+    size_t stored_size = size;
+    const char *encoding = encode_content(data, size, content_type, compress_types,
+                                          &compressed, &stored_size);
+    
+    // Prepare query parameters; the content is sent in binary format so
+    // the payload goes over the wire as-is without bytea escaping
+    char size_str[32];
+    snprintf(size_str, sizeof(size_str), "%zu", size);
+    
+    const char *params[6] = {key, compressed ? (const char *)compressed : (const char *)data,
+                             content_type, size_str, etag, encoding};
+    int param_lengths[6] = {0, (int)stored_size, 0, 0, 0, 0};
+    int param_formats[6] = {0, 1, 0, 0, 0, 0};
+    
+    // Insert or update object
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(S3_STMT_PUT_OBJECT),
+                                   6, params, param_lengths, param_formats, 0);
+    free(compressed);
+    
+    if (!res || PQresultStatus(res) != PGRES_TUPLES_OK) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, 
+                            PQresultErrorMessage(res) ? PQresultErrorMessage(res) : "Failed to store object");
+        if (res) PQclear(res);
+        return;
+    }
+    
+    set_put_response(result, etag, PQgetvalue(res, 0, 0));
+    PQclear(res);
+}
+
+/**
+ * Wait for the chunk insert sent by the previous flush
+ * 
+ * @param upload upload in progress
+ * @return 0 on success, -1 on error
+ */
+static int collect_pending_chunk(S3Upload *upload) {
+    if (!upload->chunk_pending) {
+        return 0;
+    }
+    upload->chunk_pending = 0;
+    
+    int ok = 1;
+    PGresult *res;
+    while ((res = PQgetResult(upload->conn)) != NULL) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && ok) {
+            s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+            ok = 0;
+        }
+        PQclear(res);
+    }
+    
+    return ok ? 0 : -1;
+}
+
+/**
+ * Open the transaction of a chunked upload
+ * 
+ * An object upserts its header row and drops the chunks of any previous
+ * version. A part checks that its upload exists for this key and drops
+ * the chunks of any previous attempt at the same part.
+ * 
+ * @param upload upload in progress
+ * @return 0 on success, -1 on error
+ */
+static int upload_open_transaction(S3Upload *upload) {
+    PGconn *conn = upload->conn;
+    PGresult *res;
+    
+    if (exec_command(conn, "BEGIN;") != 0) {
+        s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQerrorMessage(conn));
+        return -1;
+    }
+    upload->in_transaction = 1;
+    
+    if (upload->upload_id) {
+        const char *check_params[2] = {upload->upload_id, upload->key};
+        res = PQexecPrepared(conn, s3_statement_name(S3_STMT_CHECK_UPLOAD),
+                             2, check_params, NULL, NULL, 0);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+            PQclear(res);
+            return -1;
+        }
+        if (PQntuples(res) == 0) {
+            s3_result_set_error(upload->result, S3_ERROR_NOT_FOUND, "NoSuchUpload");
+            PQclear(res);
+            return -1;
+        }
+        PQclear(res);
+        
+        char part_str[16];
+        snprintf(part_str, sizeof(part_str), "%d", upload->part_number);
+        const char *delete_params[2] = {upload->upload_id, part_str};
+        res = PQexecPrepared(conn, s3_statement_name(S3_STMT_DELETE_PART_CHUNKS),
+                             2, delete_params, NULL, NULL, 0);
+    } else {
+        const char *header_params[2] = {upload->key, upload->content_type};
+        res = PQexecPrepared(conn, s3_statement_name(S3_STMT_PUT_OBJECT_HEADER),
+                             2, header_params, NULL, NULL, 0);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+            s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+            PQclear(res);
+            return -1;
+        }
+        snprintf(upload->object_id, sizeof(upload->object_id), "%s", PQgetvalue(res, 0, 0));
+        PQclear(res);
+        
+        const char *delete_params[1] = {upload->object_id};
+        res = PQexecPrepared(conn, s3_statement_name(S3_STMT_DELETE_CHUNKS),
+                             1, delete_params, NULL, NULL, 0);
+    }
+    
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        PQclear(res);
+        return -1;
+    }
+    PQclear(res);
+    
+    return 0;
+}
+
+/**
+ * Write one chunk of a chunked upload
+ * 
+ * The first chunk opens the transaction.
+ * 
+ * @param upload upload in progress
+ * @param data chunk bytes
+ * @param size chunk size
+ * @return 0 on success, -1 on error
+ */
+static int flush_chunk(S3Upload *upload, const char *data, size_t size) {
+    PGconn *conn = upload->conn;
+    
+    if (collect_pending_chunk(upload) != 0) {
+        return -1;
+    }
+    
+    if (!upload->in_transaction && upload_open_transaction(upload) != 0) {
+        return -1;
+    }
+    
+    char seq_str[32];
+    snprintf(seq_str, sizeof(seq_str), "%zu", upload->flushed);
+    char part_str[16];
+    snprintf(part_str, sizeof(part_str), "%d", upload->part_number);
+    
+    // Objects: (object_id, seq, data); parts: (upload_id, part_number, seq, data)
+    const char *params[4] = {upload->object_id, seq_str, data};
+    int param_lengths[4] = {0, 0, (int)size};
+    int param_formats[4] = {0, 0, 1};
+    int n_params = 3;
+    S3StatementId statement = S3_STMT_PUT_CHUNK;
+    
+    if (upload->upload_id) {
+        params[0] = upload->upload_id;
+        params[1] = part_str;
+        params[2] = seq_str;
+        params[3] = data;
+        param_lengths[2] = 0;
+        param_lengths[3] = (int)size;
+        param_formats[2] = 0;
+        param_formats[3] = 1;
+        n_params = 4;
+        statement = S3_STMT_PUT_PART_CHUNK;
+    }
+    
+    // Send without waiting: the server stores this chunk while the caller
+    // collects the next one, and the result is picked up on the next call.
+    // libpq copies the parameters, so the caller may reuse its buffer.
+    if (!PQsendQueryPrepared(conn, s3_statement_name(statement),
+                             n_params, params, param_lengths, param_formats, 0)) {
+        s3_result_set_error(upload->result, S3_ERROR_EXECUTION, PQerrorMessage(conn));
+        return -1;
+    }
+    upload->chunk_pending = 1;
+    
+    upload->flushed += size;
+    return 0;
+}
+
+/**
+ * Start uploading an object
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none
+ * @return upload handle or NULL on memory error
+ */
+S3Upload* s3_upload_begin(PGconn *conn, const char *bucket, const char *key,
+                          const char *content_type, size_t chunk_size,
+                          const char *compress_types) {
+    S3Upload *upload = (S3Upload *)calloc(1, sizeof(S3Upload));
+    if (!upload) {
+        return NULL;
+    }
+    
+    upload->result = s3_result_create();
+    if (!upload->result) {
+        free(upload);
+        return NULL;
+    }
+    
+    upload->conn = conn;
+    upload->chunk_size = chunk_size;
+    upload->compress_types = compress_types;
+    md5_init(&upload->md5);
+    
+    // Default content type if not provided
+    if (!content_type) {
+        content_type = "application/octet-stream";
+    }
+    
+    if (!conn) {
+        s3_result_set_error(upload->result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+    } else if (!bucket || !key) {
+        s3_result_set_error(upload->result, S3_ERROR_INVALID_INPUT, "Bucket name and key are required");
+    } else if (strcmp(bucket, "public") != 0) {
+        // Check if the bucket is "public" (the only supported bucket)
+        s3_result_set_error(upload->result, S3_ERROR_NOT_FOUND, "Bucket not found");
+    } else if (chunk_size > INT_MAX) {
+        s3_result_set_error(upload->result, S3_ERROR_INVALID_INPUT, "Chunk size is too large");
+    } else {
+        upload->key = strdup(key);
+        upload->content_type = strdup(content_type);
+        if (!upload->key || !upload->content_type) {
+            s3_result_set_error(upload->result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        }
+    }
+    
+    return upload;
+}
+
+/**
+ * Size the upload buffer for an expected body size
+ * 
+ * Only inline uploads keep the whole body, so chunked uploads reserve at
+ * most one chunk. The expected size usually comes from a client, so no
+ * more than S3_UPLOAD_RESERVE_MAX is reserved up front either way. Purely
+ * an optimization; writes grow the buffer as needed.
+ * 
+ * @param upload upload in progress
+ * @param expected_size expected total size in bytes
+ */
+void s3_upload_reserve(S3Upload *upload, size_t expected_size) {
+    if (!upload || upload->result->status != S3_SUCCESS) {
+        return;
+    }
+    
+    if (upload->chunk_size > 0 && expected_size > upload->chunk_size) {
+        expected_size = upload->chunk_size;
+    }
+    if (expected_size > S3_UPLOAD_RESERVE_MAX) {
+        expected_size = S3_UPLOAD_RESERVE_MAX;
+    }
+    
+    if (expected_size <= upload->capacity) {
+        return;
+    }
+    
+    char *buffer = realloc(upload->buffer, expected_size);
+    if (buffer) {
+        upload->buffer = buffer;
+        upload->capacity = expected_size;
+    }
+}
+
+/**
+ * Append bytes to an upload
+ * 
+ * @param upload upload in progress
+ * @param data bytes to append
+ * @param size number of bytes
+ * @return 0 on success, -1 on error (details are reported by s3_upload_finish)
+ */
+int s3_upload_write(S3Upload *upload, const void *data, size_t size) {
+    if (!upload || upload->result->status != S3_SUCCESS) {
+        return -1;
+    }
+    
+    // Inline objects are buffered whole and stored as one bytea
+    if (upload->chunk_size == 0 && size > S3_INLINE_MAX_SIZE - upload->size) {
+        s3_result_set_error(upload->result, S3_ERROR_TOO_LARGE, "Object is too large");
+        return -1;
+    }
+    
+    const char *bytes = data;
+    md5_update(&upload->md5, data, size);
+    upload->size += size;
+    
+    while (size > 0) {
+        // A full buffer is only flushed once more data shows up, so objects
+        // of at most one chunk never leave the inline path
+        if (upload->chunk_size > 0 && upload->buffered == upload->chunk_size) {
+            if (flush_chunk(upload, upload->buffer, upload->buffered) != 0) {
+                return -1;
+            }
+            upload->buffered = 0;
+        }
+        
+        // Write whole chunks straight from the caller's memory
+        if (upload->chunk_size > 0 && upload->buffered == 0 && size > upload->chunk_size) {
+            if (flush_chunk(upload, bytes, upload->chunk_size) != 0) {
+                return -1;
+            }
+            bytes += upload->chunk_size;
+            size -= upload->chunk_size;
+            continue;
+        }
+        
+        size_t take = size;
+        if (upload->chunk_size > 0 && take > upload->chunk_size - upload->buffered) {
+            take = upload->chunk_size - upload->buffered;
+        }
+        
+        if (upload->buffered + take > upload->capacity) {
+            size_t capacity = upload->capacity == 0 ? 64 * 1024 : upload->capacity;
+            while (capacity < upload->buffered + take) {
+                capacity *= 2;
+            }
+            if (upload->chunk_size > 0 && capacity > upload->chunk_size) {
+                capacity = upload->chunk_size;
+            } else if (upload->chunk_size == 0 && capacity > S3_INLINE_MAX_SIZE) {
+                capacity = S3_INLINE_MAX_SIZE;
+            }
+            
+            char *buffer = realloc(upload->buffer, capacity);
+            if (!buffer) {
+                s3_result_set_error(upload->result, S3_ERROR_MEMORY, "Failed to allocate memory");
+                return -1;
+            }
+            upload->buffer = buffer;
+            upload->capacity = capacity;
+        }
+        
+        memcpy(upload->buffer + upload->buffered, bytes, take);
+        upload->buffered += take;
+        bytes += take;
+        size -= take;
+    }
+    
+    return 0;
+}
+
+/**
+ * Release the connection of an inline upload while its body arrives
+ * 
+ * @param upload upload in progress, with nothing written to the database yet
+ * @return 0 on success, -1 if the upload is chunked or already wrote chunks
+ */
+int s3_upload_detach(S3Upload *upload) {
+    if (!upload || upload->chunk_size > 0 || upload->in_transaction || upload->upload_id) {
+        return -1;
+    }
+    
+    upload->conn = NULL;
+    upload->compress_types = NULL;
+    return 0;
+}
+
+/**
+ * Give a detached upload the connection to finish on
+ * 
+ * @param upload upload released by s3_upload_detach
+ * @param conn PostgreSQL connection
+ * @param compress_types content types to store compressed, NULL for none
+ */
+void s3_upload_attach(S3Upload *upload, PGconn *conn, const char *compress_types) {
+    if (!upload) {
+        return;
+    }
+    
+    upload->conn = conn;
+    upload->compress_types = compress_types;
+}
+
+/**
+ * Release upload resources, rolling back unfinished work
+ * 
+ * @param upload upload in progress
+ */
+static void upload_free(S3Upload *upload) {
+    if (upload->chunk_pending) {
+        PGresult *res;
+        while ((res = PQgetResult(upload->conn)) != NULL) {
+            PQclear(res);
+        }
+    }
+    
+    if (upload->in_transaction) {
+        exec_command(upload->conn, "ROLLBACK;");
+    }
+    
+    free(upload->buffer);
+    free(upload->key);
+    free(upload->content_type);
+    free(upload->upload_id);
+    free(upload);
+}
+
+/**
+ * Get the ETag of everything written so far
+ * 
+ * @param upload upload in progress
+ * @param etag receives the hex content MD5
+ */
+void s3_upload_etag(const S3Upload *upload, char etag[S3_ETAG_SIZE]) {
+    // Finish a copy so the upload can keep hashing
+    Md5Context md5 = upload->md5;
+    md5_final_hex(&md5, etag);
+}
+
+/**
+ * Complete a part upload: write what is left and record the part
+ * 
+ * @param upload part upload in progress
+ * @param etag hex MD5 of the part
+ */
+static void finish_part(S3Upload *upload, const char *etag) {
+    S3Result *result = upload->result;
+    
+    // Even an empty part needs its transaction for the upload check
+    if (!upload->in_transaction && upload_open_transaction(upload) != 0) {
+        return;
+    }
+    if (upload->buffered > 0 && flush_chunk(upload, upload->buffer, upload->buffered) == 0) {
+        upload->buffered = 0;
+    }
+    collect_pending_chunk(upload);
+    
+    if (result->status != S3_SUCCESS) {
+        return;
+    }
+    
+    char part_str[16];
+    snprintf(part_str, sizeof(part_str), "%d", upload->part_number);
+    char size_str[32];
+    snprintf(size_str, sizeof(size_str), "%zu", upload->size);
+    const char *params[4] = {upload->upload_id, part_str, size_str, etag};
+    
+    PGresult *res = PQexecPrepared(upload->conn, s3_statement_name(S3_STMT_PUT_PART),
+                                   4, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+    } else if (exec_command(upload->conn, "COMMIT;") != 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(upload->conn));
+    } else {
+        set_put_response(result, etag, PQgetvalue(res, 0, 0));
+    }
+    upload->in_transaction = 0;
+    PQclear(res);
+}
+
+/**
+ * Complete an upload and store the object
+ * 
+ * @param upload upload in progress (freed by this call)
+ * @return S3Result with status
+ */
+S3Result* s3_upload_finish(S3Upload *upload) {
+    if (!upload) {
+        return NULL;
+    }
+    
+    S3Result *result = upload->result;
+    char etag[S3_ETAG_SIZE];
+    md5_final_hex(&upload->md5, etag);
+    
+    if (result->status == S3_SUCCESS && upload->size == 0 && !upload->upload_id) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name, key, and data are required");
+    } else if (result->status == S3_SUCCESS && !upload->conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+    }
+    
+    if (result->status == S3_SUCCESS && upload->upload_id) {
+        finish_part(upload, etag);
+    } else if (result->status == S3_SUCCESS && !upload->in_transaction) {
+        // Everything fit in one chunk (or the layout is inline)
+        store_inline_object(upload->conn, upload->key, upload->buffer, upload->buffered,
+                            upload->content_type, upload->compress_types, etag, result);
+    } else if (result->status == S3_SUCCESS) {
+        if (upload->buffered > 0 && flush_chunk(upload, upload->buffer, upload->buffered) == 0) {
+            upload->buffered = 0;
+        }
+        collect_pending_chunk(upload);
+        
+        if (result->status == S3_SUCCESS) {
+            char size_str[32];
+            snprintf(size_str, sizeof(size_str), "%zu", upload->size);
+            const char *params[3] = {upload->object_id, size_str, etag};
+            
+            PGresult *res = PQexecPrepared(upload->conn, s3_statement_name(S3_STMT_FINISH_OBJECT),
+                                           3, params, NULL, NULL, 0);
+            if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+                s3_result_set_error(result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+            } else if (exec_command(upload->conn, "COMMIT;") != 0) {
+                s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(upload->conn));
+            } else {
+                set_put_response(result, etag, PQgetvalue(res, 0, 0));
+            }
+            upload->in_transaction = 0;
+            PQclear(res);
+        }
+    }
+    
+    upload->result = NULL;
+    upload_free(upload);
+    
+    return result;
+}
+
+/**
+ * Abandon an upload, rolling back anything written so far
+ * 
+ * @param upload upload in progress (freed by this call)
+ */
+void s3_upload_abort(S3Upload *upload) {
+    if (!upload) {
+        return;
+    }
+    
+    s3_result_free(upload->result);
+    upload_free(upload);
+}
+
+/**
+ * Put object in bucket
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param data object data
+ * @param size data size
+ * @param content_type content type
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none
+ * @return S3Result with status
+ */
+S3Result* s3_api_put_object(PGconn *conn, const char *bucket, const char *key,
+                          const void *data, size_t size, const char *content_type,
+                          size_t chunk_size, const char *compress_types) {
+    if (!data || size == 0) {
+        S3Result *result = s3_result_create();
+        if (result) {
+            s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Bucket name, key, and data are required");
+        }
+        return result;
+    }
+    
+    S3Upload *upload = s3_upload_begin(conn, bucket, key, content_type, chunk_size,
+                                       compress_types);
+    if (!upload) {
+        return NULL;
+    }
+    
+    // Objects that fit in one chunk go straight from the caller's buffer
+    if (upload->result->status == S3_SUCCESS && (chunk_size == 0 || size <= chunk_size)) {
+        S3Result *result = upload->result;
+        upload->result = NULL;
+        
+        char etag[S3_ETAG_SIZE];
+        md5_update(&upload->md5, data, size);
+        md5_final_hex(&upload->md5, etag);
+        store_inline_object(conn, upload->key, data, size, upload->content_type, compress_types,
+                            etag, result);
+        upload_free(upload);
+        return result;
+    }
+    
+    s3_upload_write(upload, data, size);
+    return s3_upload_finish(upload);
+}
+
+/**
+ * Objects of a batched put
+ */
+typedef struct {
+    S3Result **results;
+    char (*etags)[S3_ETAG_SIZE];
+    int *items;             // item index of every queued statement
+} PutBatch;
+
+/**
+ * Take one upsert result of a batched put
+ * 
+ * @param arg pointer to PutBatch structure
+ * @param index statement index
+ * @param res S3_STMT_PUT_OBJECT result, NULL if lost
+ */
+static void put_batch_result(void *arg, int index, const PGresult *res) {
+    PutBatch *batch = (PutBatch *)arg;
+    int item = batch->items[index];
+    
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        s3_result_set_error(batch->results[item], S3_ERROR_EXECUTION,
+                            res ? PQresultErrorMessage(res) : "Connection lost");
+        return;
+    }
+    
+    set_put_response(batch->results[item], batch->etags[item], PQgetvalue(res, 0, 0));
+}
+
+/**
+ * Put several objects without waiting on each round trip
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param items objects to store
+ * @param count number of objects
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none
+ * @param results receives one S3Result per object, as from s3_api_put_object
+ * @return 0 if every object was stored, -1 otherwise
+ */
+int s3_api_put_objects(PGconn *conn, const char *bucket, const S3PutItem *items, int count,
+                       size_t chunk_size, const char *compress_types, S3Result **results) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        results[i] = s3_result_create();
+        if (!results[i] || check_target(conn, bucket, items[i].key, results[i]) != 0) {
+            failed = 1;
+        } else if (!items[i].data || items[i].size == 0 || items[i].size > INT_MAX) {
+            s3_result_set_error(results[i], S3_ERROR_INVALID_INPUT, "Data is required");
+        }
+    }
+    if (failed) {
+        return -1;
+    }
+    
+    PutBatch put = {results, calloc(count, S3_ETAG_SIZE), calloc(count, sizeof(int))};
+    PgBatch *batch = put.etags && put.items ? pg_batch_begin(conn, 0, &put_batch_result, &put) : NULL;
+    if (!batch) {
+        for (int i = 0; i < count; i++) {
+            s3_result_set_error(results[i], S3_ERROR_CONNECTION, "Failed to start pipeline");
+        }
+        free(put.etags);
+        free(put.items);
+        return -1;
+    }
+    
+    // Same upsert as a single inline put, with the content sent as binary
+    for (int i = 0; i < count; i++) {
+        const S3PutItem *item = &items[i];
+        if (results[i]->status != S3_SUCCESS || (chunk_size > 0 && item->size > chunk_size)) {
+            continue;
+        }
+        
+        Md5Context md5;
+        md5_init(&md5);
+        md5_update(&md5, item->data, item->size);
+        md5_final_hex(&md5, put.etags[i]);
+        
+        const char *content_type = item->content_type ? item->content_type
+                                                      : "application/octet-stream";
+        unsigned char *compressed = NULL;
+        size_t stored_size = item->size;
+        const char *encoding = encode_content(item->data, item->size, content_type,
+                                              compress_types, &compressed, &stored_size);
+        
+        char size_str[32];
+        snprintf(size_str, sizeof(size_str), "%zu", item->size);
+        const char *params[6] = {item->key,
+                                 compressed ? (const char *)compressed : (const char *)item->data,
+                                 content_type, size_str, put.etags[i], encoding};
+        int param_lengths[6] = {0, (int)stored_size, 0, 0, 0, 0};
+        int param_formats[6] = {0, 1, 0, 0, 0, 0};
+        
+        // Parameters are copied into the send buffer, so the content can go
+        int index = pg_batch_queue(batch, S3_STMT_PUT_OBJECT, 6, params, param_lengths,
+                                   param_formats, 0);
+        free(compressed);
+        if (index < 0) {
+            s3_result_set_error(results[i], S3_ERROR_CONNECTION, "Connection lost");
+            continue;
+        }
+        put.items[index] = i;
+    }
+    pg_batch_end(batch);
+    free(put.etags);
+    free(put.items);
+    
+    // Chunked objects need their own transaction of several statements
+    for (int i = 0; i < count; i++) {
+        if (results[i]->status == S3_SUCCESS && !results[i]->data) {
+            s3_result_free(results[i]);
+            results[i] = s3_api_put_object(conn, bucket, items[i].key, items[i].data,
+                                           items[i].size, items[i].content_type, chunk_size,
+                                           compress_types);
+        }
+        if (!results[i] || results[i]->status != S3_SUCCESS) {
+            failed = 1;
+        }
+    }
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Run one prepared statement of a multi-step operation
+ * 
+ * @param conn PostgreSQL connection
+ * @param id statement to run
+ * @param n_params number of text parameters
+ * @param params parameter values
+ * @param expected result status that means success
+ * @param result S3Result receiving errors
+ * @return query result (caller clears) or NULL with the error set
+ */
+static PGresult *exec_step(PGconn *conn, S3StatementId id, int n_params, const char *const *params,
+                           ExecStatusType expected, S3Result *result) {
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(id), n_params, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != expected) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        PQclear(res);
+        return NULL;
+    }
+    
+    return res;
+}
+
+/**
+ * Generate a random multipart upload id
+ * 
+ * @param upload_id receives S3_UPLOAD_ID_LENGTH hex digits
+ * @return 0 on success, -1 if no randomness is available
+ */
+static int generate_upload_id(char upload_id[S3_UPLOAD_ID_LENGTH + 1]) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char bytes[S3_UPLOAD_ID_LENGTH / 2];
+    
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (!random) {
+        return -1;
+    }
+    size_t n = fread(bytes, 1, sizeof(bytes), random);
+    fclose(random);
+    if (n != sizeof(bytes)) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        upload_id[i * 2] = digits[bytes[i] >> 4];
+        upload_id[i * 2 + 1] = digits[bytes[i] & 0x0F];
+    }
+    upload_id[S3_UPLOAD_ID_LENGTH] = '\0';
+    
+    return 0;
+}
+
+/**
+ * Decode a hex MD5
+ * 
+ * @param hex 32 hex digits
+ * @param digest receives the 16 bytes
+ * @return 0 on success, -1 if malformed
+ */
+static int decode_md5_hex(const char *hex, unsigned char digest[MD5_DIGEST_LENGTH]) {
+    if (strlen(hex) != MD5_HEX_LENGTH) {
+        return -1;
+    }
+    
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)hex[i * 2]) || !isxdigit((unsigned char)hex[i * 2 + 1]) ||
+            sscanf(hex + i * 2, "%2x", &byte) != 1) {
+            return -1;
+        }
+        digest[i] = (unsigned char)byte;
+    }
+    
+    return 0;
+}
+
+/**
+ * Hand a finished XML document over to a result
+ * 
+ * @param result S3Result to fill
+ * @param xml document, emptied by this call
+ */
+static void set_xml_response(S3Result *result, TextBuffer *xml) {
+    size_t length = xml->length;
+    
+    result->data = text_buffer_detach(xml);
+    if (!result->data) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return;
+    }
+    result->data_size = length;
+    result->content_type = strdup("application/xml");
+}
+
+/**
+ * Start a multipart upload
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type of the finished object
+ * @return S3Result with an InitiateMultipartUploadResult document
+ */
+S3Result* s3_api_create_upload(PGconn *conn, const char *bucket, const char *key,
+                               const char *content_type) {
+    S3Result *result = s3_result_create();
+    if (!result || check_target(conn, bucket, key, result) != 0) {
+        return result;
+    }
+    
+    char upload_id[S3_UPLOAD_ID_LENGTH + 1];
+    if (generate_upload_id(upload_id) != 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to generate an upload id");
+        return result;
+    }
+    
+    const char *params[3] = {upload_id, key, content_type ? content_type : "application/octet-stream"};
+    PGresult *res = exec_step(conn, S3_STMT_CREATE_UPLOAD, 3, params, PGRES_COMMAND_OK, result);
+    if (!res) {
+        return result;
+    }
+    PQclear(res);
+    
+    TextBuffer xml = {0};
+    text_buffer_append_str(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                                 "<InitiateMultipartUploadResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">"
+                                 "<Bucket>public</Bucket><Key>");
+    text_buffer_append_xml(&xml, key);
+    text_buffer_printf(&xml, "</Key><UploadId>%s</UploadId></InitiateMultipartUploadResult>", upload_id);
+    set_xml_response(result, &xml);
+    
+    return result;
+}
+
+/**
+ * Start uploading one part of a multipart upload
+ * 
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @param part_number part number, 1 to S3_MULTIPART_MAX_PARTS
+ * @param chunk_size size of the stored chunks
+ * @return upload handle (finish with s3_upload_finish) or NULL on memory error
+ */
+S3Upload* s3_upload_begin_part(PGconn *conn, const char *bucket, const char *key,
+                               const char *upload_id, int part_number, size_t chunk_size) {
+    S3Upload *upload = s3_upload_begin(conn, bucket, key, NULL, chunk_size, NULL);
+    if (!upload || upload->result->status != S3_SUCCESS) {
+        return upload;
+    }
+    
+    if (!upload_id || chunk_size == 0) {
+        s3_result_set_error(upload->result, S3_ERROR_INVALID_INPUT, "Upload id and chunk size are required");
+    } else if (part_number < 1 || part_number > S3_MULTIPART_MAX_PARTS) {
+        s3_result_set_error(upload->result, S3_ERROR_INVALID_INPUT, "Part number must be between 1 and 10000");
+    } else {
+        upload->upload_id = strdup(upload_id);
+        upload->part_number = part_number;
+        if (!upload->upload_id) {
+            s3_result_set_error(upload->result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        }
+    }
+    
+    return upload;
+}
+
+/**
+ * Check the requested parts against the stored ones
+ * 
+ * Sums the part sizes, computes the multipart ETag (MD5 of the binary part
+ * MD5s, then "-" and the part count, as S3 does) and builds the int[]
+ * literal of part numbers for S3_STMT_ASSEMBLE_PARTS.
+ * 
+ * @param res rows of S3_STMT_LIST_PARTS
+ * @param parts requested parts, ascending
+ * @param part_count number of requested parts
+ * @param size receives the object size
+ * @param etag receives the object ETag
+ * @param numbers receives the part number array literal
+ * @param result S3Result receiving errors
+ * @return 0 on success, -1 otherwise
+ */
+static int match_parts(const PGresult *res, const S3CompletedPart *parts, int part_count,
+                       size_t *size, char etag[S3_ETAG_SIZE], TextBuffer *numbers,
+                       S3Result *result) {
+    Md5Context md5;
+    md5_init(&md5);
+    *size = 0;
+    
+    int row = 0;
+    int rows = PQntuples(res);
+    
+    for (int i = 0; i < part_count; i++) {
+        while (row < rows && atoi(PQgetvalue(res, row, 0)) < parts[i].part_number) {
+            row++;
+        }
+        
+        unsigned char digest[MD5_DIGEST_LENGTH];
+        if (row == rows || atoi(PQgetvalue(res, row, 0)) != parts[i].part_number ||
+            strcasecmp(PQgetvalue(res, row, 2), parts[i].etag) != 0 ||
+            decode_md5_hex(PQgetvalue(res, row, 2), digest) != 0) {
+            char message[96];
+            snprintf(message, sizeof(message),
+                     "Part %d was not uploaded or its ETag does not match", parts[i].part_number);
+            s3_result_set_error(result, S3_ERROR_INVALID_INPUT, message);
+            return -1;
+        }
+        
+        *size += (size_t)strtoull(PQgetvalue(res, row, 1), NULL, 10);
+        md5_update(&md5, digest, sizeof(digest));
+        text_buffer_printf(numbers, "%c%d", i == 0 ? '{' : ',', parts[i].part_number);
+    }
+    text_buffer_append_str(numbers, "}");
+    
+    if (numbers->failed) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return -1;
+    }
+    
+    char hex[MD5_HEX_LENGTH + 1];
+    md5_final_hex(&md5, hex);
+    snprintf(etag, S3_ETAG_SIZE, "%s-%d", hex, part_count);
+    
+    return 0;
+}
+
+/**
+ * Complete a multipart upload, inside the transaction opened by the caller
+ * 
+ * @param conn PostgreSQL connection
+ * @param key object key
+ * @param upload_id multipart upload id
+ * @param parts requested parts, ascending
+ * @param part_count number of requested parts
+ * @param etag receives the object ETag
+ * @param result S3Result receiving errors
+ * @return 0 on success, -1 otherwise
+ */
+static int assemble_upload(PGconn *conn, const char *key, const char *upload_id,
+                           const S3CompletedPart *parts, int part_count,
+                           char etag[S3_ETAG_SIZE], S3Result *result) {
+    // Waits for parts still being written, then keeps them out
+    const char *lock_params[2] = {upload_id, key};
+    PGresult *res = exec_step(conn, S3_STMT_LOCK_UPLOAD, 2, lock_params, PGRES_TUPLES_OK, result);
+    if (!res) {
+        return -1;
+    }
+    if (PQntuples(res) == 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "No such upload");
+        PQclear(res);
+        return -1;
+    }
+    char *content_type = strdup(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    if (!content_type) {
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return -1;
+    }
+    
+    const char *list_params[1] = {upload_id};
+    res = exec_step(conn, S3_STMT_LIST_PARTS, 1, list_params, PGRES_TUPLES_OK, result);
+    if (!res) {
+        free(content_type);
+        return -1;
+    }
+    
+    size_t size;
+    TextBuffer numbers = {0};
+    int matched = match_parts(res, parts, part_count, &size, etag, &numbers, result);
+    PQclear(res);
+    if (matched != 0) {
+        free(content_type);
+        text_buffer_free(&numbers);
+        return -1;
+    }
+    
+    // Same header row as a streamed chunked upload
+    const char *header_params[2] = {key, content_type};
+    res = exec_step(conn, S3_STMT_PUT_OBJECT_HEADER, 2, header_params, PGRES_TUPLES_OK, result);
+    free(content_type);
+    if (!res) {
+        text_buffer_free(&numbers);
+        return -1;
+    }
+    char object_id[32];
+    snprintf(object_id, sizeof(object_id), "%s", PQgetvalue(res, 0, 0));
+    PQclear(res);
+    
+    const char *delete_params[1] = {object_id};
+    res = exec_step(conn, S3_STMT_DELETE_CHUNKS, 1, delete_params, PGRES_COMMAND_OK, result);
+    if (res) {
+        PQclear(res);
+        
+        const char *assemble_params[3] = {object_id, upload_id, numbers.data};
+        res = exec_step(conn, S3_STMT_ASSEMBLE_PARTS, 3, assemble_params, PGRES_COMMAND_OK, result);
+    }
+    text_buffer_free(&numbers);
+    if (!res) {
+        return -1;
+    }
+    PQclear(res);
     
     char size_str[32];
     snprintf(size_str, sizeof(size_str), "%zu", size);
-    params[3] = size_str;
+    const char *finish_params[3] = {object_id, size_str, etag};
+    res = exec_step(conn, S3_STMT_FINISH_OBJECT, 3, finish_params, PGRES_TUPLES_OK, result);
+    if (!res) {
+        return -1;
+    }
+    PQclear(res);
     
-    // Insert or update object
-    const char *query = 
-        "INSERT INTO s3.objects (path, content, content_type, size, last_modified) "
-        "VALUES ($1, $2, $3, $4, CURRENT_TIMESTAMP) "
-        "ON CONFLICT (path) DO UPDATE "
-        "SET content = $2, content_type = $3, size = $4, last_modified = CURRENT_TIMESTAMP "
-        "RETURNING to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod;";
+    res = exec_step(conn, S3_STMT_DELETE_UPLOAD, 2, lock_params, PGRES_TUPLES_OK, result);
+    if (!res) {
+        return -1;
+    }
+    PQclear(res);
+    
+    return 0;
+}
+
+/**
+ * Complete a multipart upload
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @param parts parts in ascending part number order
+ * @param part_count number of parts
+ * @return S3Result with a CompleteMultipartUploadResult document
+ */
+S3Result* s3_api_complete_upload(PGconn *conn, const char *bucket, const char *key,
+                                 const char *upload_id, const S3CompletedPart *parts,
+                                 int part_count) {
+    S3Result *result = s3_result_create();
+    if (!result || check_target(conn, bucket, key, result) != 0) {
+        return result;
+    }
     
-    // Execute parameterized query
-    PGresult *res = PQexecParams(conn, query, 4, NULL, params, NULL, NULL, 0);
-    PQfreemem(escaped_data);
+    if (!upload_id || !parts || part_count <= 0) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Upload id and at least one part are required");
+        return result;
+    }
     
-    if (!res || PQresultStatus(res) != PGRES_TUPLES_OK) {
-        s3_result_set_error(result, S3_ERROR_EXECUTION, 
-                            PQresultErrorMessage(res) ? PQresultErrorMessage(res) : "Failed to store object");
-        if (res) PQclear(res);
+    for (int i = 0; i < part_count; i++) {
+        if (parts[i].part_number < 1 || parts[i].part_number > S3_MULTIPART_MAX_PARTS ||
+            (i > 0 && parts[i].part_number <= parts[i - 1].part_number)) {
+            s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Parts must be listed in ascending order");
+            return result;
+        }
+    }
+    
+    if (exec_command(conn, "BEGIN;") != 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(conn));
         return result;
     }
     
-    // Get the ETag (we'll use the last-modified timestamp for now)
-    const char *lastmod = PQgetvalue(res, 0, 0);
+    char etag[S3_ETAG_SIZE];
+    if (assemble_upload(conn, key, upload_id, parts, part_count, etag, result) != 0) {
+        exec_command(conn, "ROLLBACK;");
+        return result;
+    }
     
-    // Calculate MD5 hash as ETag (simplified)
-    unsigned long hash = 5381;
-    const unsigned char *bytes = data;
-    for (size_t i = 0; i < size; i++) {
-        hash = ((hash << 5) + hash) + bytes[i];
+    if (exec_command(conn, "COMMIT;") != 0) {
+        s3_result_set_error(result, S3_ERROR_EXECUTION, PQerrorMessage(conn));
+        return result;
     }
     
-    char etag[32];
-    snprintf(etag, sizeof(etag), "\"%08lx\"", hash);
+    TextBuffer xml = {0};
+    text_buffer_append_str(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                                 "<CompleteMultipartUploadResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">"
+                                 "<Location>/public/");
+    text_buffer_append_xml(&xml, key);
+    text_buffer_append_str(&xml, "</Location><Bucket>public</Bucket><Key>");
+    text_buffer_append_xml(&xml, key);
+    text_buffer_printf(&xml, "</Key><ETag>&quot;%s&quot;</ETag></CompleteMultipartUploadResult>", etag);
+    set_xml_response(result, &xml);
     
-    char json_response[256];
-    snprintf(json_response, sizeof(json_response), 
-            "{\"ETag\":\"%s\",\"LastModified\":\"%s\"}", 
-            etag, lastmod);
+    return result;
+}
+
+/**
+ * Abort a multipart upload and drop its parts
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @return S3Result with status
+ */
+S3Result* s3_api_abort_upload(PGconn *conn, const char *bucket, const char *key,
+                              const char *upload_id) {
+    S3Result *result = s3_result_create();
+    if (!result || check_target(conn, bucket, key, result) != 0) {
+        return result;
+    }
     
-    result->data = strdup(json_response);
-    result->data_size = strlen(json_response);
-    result->content_type = strdup("application/json");
+    if (!upload_id) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Upload id is required");
+        return result;
+    }
+    
+    // Waits for part uploads in flight; their rows go with the upload
+    const char *params[2] = {upload_id, key};
+    PGresult *res = exec_step(conn, S3_STMT_DELETE_UPLOAD, 2, params, PGRES_TUPLES_OK, result);
+    if (!res) {
+        return result;
+    }
     
+    if (PQntuples(res) == 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "No such upload");
+    }
     PQclear(res);
+    
     return result;
 }
 
+/**
+ * Drop multipart uploads that were started too long ago
+ * 
+ * @param conn PostgreSQL connection
+ * @param max_age_seconds age after which an unfinished upload is abandoned
+ * @return number of uploads removed, -1 on error
+ */
+long s3_api_expire_uploads(PGconn *conn, long max_age_seconds) {
+    if (!conn) {
+        return -1;
+    }
+    
+    char age_str[32];
+    snprintf(age_str, sizeof(age_str), "%ld", max_age_seconds);
+    const char *params[1] = {age_str};
+    
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(S3_STMT_EXPIRE_UPLOADS),
+                                   1, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        PQclear(res);
+        return -1;
+    }
+    
+    long removed = atol(PQcmdTuples(res));
+    PQclear(res);
+    
+    return removed;
+}
+
 /**
  * Delete object from bucket
  * 
@@ -496,15 +2683,12 @@ S3Result* s3_api_delete_object(PGconn *conn, const char *bucket, const char *key
         return result;
     }
     
-    // Delete object from database
-    const char *query_template = 
-        "DELETE FROM s3.objects WHERE path = $1 RETURNING 1;";
-    
     // Prepare parameters
     const char *params[1] = {key};
     
-    // Execute parameterized query
-    PGresult *res = PQexecParams(conn, query_template, 1, NULL, params, NULL, NULL, 0);
+    // Delete object from database
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(S3_STMT_DELETE_OBJECT),
+                                   1, params, NULL, NULL, 0);
     if (!res) {
         s3_result_set_error(result, S3_ERROR_EXECUTION, "Failed to delete object");
         return result;
@@ -529,4 +2713,166 @@ S3Result* s3_api_delete_object(PGconn *conn, const char *bucket, const char *key
     result->content_type = strdup("application/json");
     
     return result;
-} 
\ No newline at end of file
+}
+
+/**
+ * Append a string as an element of a PostgreSQL array literal
+ * 
+ * @param buffer literal being built
+ * @param value element, quoted with " and \ escaped
+ */
+static void append_array_element(TextBuffer *buffer, const char *value) {
+    text_buffer_append(buffer, "\"", 1);
+    
+    const char *run = value;
+    for (const char *p = value; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            text_buffer_append(buffer, run, p - run);
+            text_buffer_append(buffer, "\\", 1);
+            run = p;
+        }
+    }
+    text_buffer_append_str(buffer, run);
+    
+    text_buffer_append(buffer, "\"", 1);
+}
+
+/**
+ * Delete several objects with one statement
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param key_count number of keys, at most S3_DELETE_MAX_KEYS
+ * @param quiet report only the keys that could not be deleted
+ * @return S3Result with a DeleteResult document
+ */
+S3Result* s3_api_delete_objects(PGconn *conn, const char *bucket, const char *const *keys,
+                                int key_count, int quiet) {
+    S3Result *result = s3_result_create();
+    if (!result) {
+        return NULL;
+    }
+    
+    if (!conn) {
+        s3_result_set_error(result, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+        return result;
+    }
+    
+    if (!bucket || !keys || key_count <= 0 || key_count > S3_DELETE_MAX_KEYS) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Between 1 and 1000 keys are required");
+        return result;
+    }
+    
+    // Check if the bucket is "public" (the only supported bucket)
+    if (strcmp(bucket, "public") != 0) {
+        s3_result_set_error(result, S3_ERROR_NOT_FOUND, "Bucket not found");
+        return result;
+    }
+    
+    TextBuffer array = {0};
+    text_buffer_append_str(&array, "{");
+    for (int i = 0; i < key_count; i++) {
+        if (i > 0) {
+            text_buffer_append_str(&array, ",");
+        }
+        append_array_element(&array, keys[i]);
+    }
+    text_buffer_append_str(&array, "}");
+    
+    if (array.failed) {
+        text_buffer_free(&array);
+        s3_result_set_error(result, S3_ERROR_MEMORY, "Failed to allocate memory");
+        return result;
+    }
+    
+    // All or nothing: either every key is gone or the statement failed for all
+    const char *params[1] = {array.data};
+    PGresult *res = PQexecPrepared(conn, s3_statement_name(S3_STMT_DELETE_OBJECTS),
+                                   1, params, NULL, NULL, 0);
+    text_buffer_free(&array);
+    
+    const char *error = NULL;
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        error = PQresultErrorMessage(res);
+    }
+    
+    TextBuffer xml = {0};
+    text_buffer_append_str(&xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                                 "<DeleteResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">");
+    for (int i = 0; i < key_count; i++) {
+        if (error) {
+            text_buffer_append_str(&xml, "<Error><Key>");
+            text_buffer_append_xml(&xml, keys[i]);
+            text_buffer_append_str(&xml, "</Key><Code>InternalError</Code><Message>");
+            text_buffer_append_xml(&xml, error);
+            text_buffer_append_str(&xml, "</Message></Error>");
+        } else if (!quiet) {
+            text_buffer_append_str(&xml, "<Deleted><Key>");
+            text_buffer_append_xml(&xml, keys[i]);
+            text_buffer_append_str(&xml, "</Key></Deleted>");
+        }
+    }
+    text_buffer_append_str(&xml, "</DeleteResult>");
+    PQclear(res);
+    
+    set_xml_response(result, &xml);
+    
+    return result;
+}
+
+/**
+ * Delete every object whose key starts with a prefix
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for S3_DELETE_PREFIX_BATCH
+ * @param deleted receives the number of objects removed, also on error
+ * @return S3Result with status
+ */
+S3Result* s3_api_delete_prefix(PGconn *conn, const char *bucket, const char *prefix,
+                               int batch_size, long *deleted) {
+    *deleted = 0;
+    
+    S3Result *result = s3_result_create();
+    if (!result || check_target(conn, bucket, prefix, result) != 0) {
+        return result;
+    }
+    
+    if (!prefix[0] || batch_size < 0) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "A non-empty prefix is required");
+        return result;
+    }
+    
+    char *upper = prefix_upper_bound(prefix);
+    if (!upper) {
+        s3_result_set_error(result, S3_ERROR_INVALID_INPUT, "Prefix has no upper bound");
+        return result;
+    }
+    
+    if (batch_size == 0) {
+        batch_size = S3_DELETE_PREFIX_BATCH;
+    }
+    char batch_str[16];
+    snprintf(batch_str, sizeof(batch_str), "%d", batch_size);
+    const char *params[3] = {prefix, upper, batch_str};
+    
+    // Each batch commits on its own; a short batch means nothing is left
+    long removed;
+    do {
+        PGresult *res = exec_step(conn, S3_STMT_DELETE_PREFIX_BATCH, 3, params,
+                                  PGRES_COMMAND_OK, result);
+        if (!res) {
+            break;
+        }
+        
+        removed = atol(PQcmdTuples(res));
+        *deleted += removed;
+        PQclear(res);
+    } while (removed == batch_size);
+    
+    free(upper);
+    
+    return result;
+}
\ No newline at end of file
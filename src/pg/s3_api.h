@@ -2,7 +2,49 @@
 #define S3_API_H
 
 #include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
 #include <libpq-fe.h>
+#include "../common/md5.h"
+#include "../common/text_buffer.h"
+
+// Bytes fetched per round trip when reading a large inline object
+#define S3_READ_WINDOW (1024 * 1024)
+
+// Largest (and default) number of keys in one listing page, as in S3
+#define S3_LIST_MAX_KEYS 1000
+
+// max_keys value for a listing that runs to the end of the bucket
+#define S3_LIST_UNLIMITED (-1)
+
+// Room for an ETag: hex MD5, "-" and a part count for multipart objects
+#define S3_ETAG_SIZE (MD5_HEX_LENGTH + 8)
+
+// Part numbers run from 1 to this, as in S3
+#define S3_MULTIPART_MAX_PARTS 10000
+
+// Hex digits of a multipart upload id
+#define S3_UPLOAD_ID_LENGTH 32
+
+// Most keys in one DeleteObjects request, as in S3
+#define S3_DELETE_MAX_KEYS 1000
+
+// Objects removed per transaction by a prefix delete
+#define S3_DELETE_PREFIX_BATCH 1000
+
+// Largest object stored compressed; compressed content is decoded whole
+#define S3_COMPRESS_MAX_SIZE (8 * 1024 * 1024)
+
+// Room for a content encoding name
+#define S3_ENCODING_SIZE 16
+
+// Largest inline object: PostgreSQL caps a bytea, and the message
+// carrying it, just under 1 GB
+#define S3_INLINE_MAX_SIZE ((size_t)1023 * 1024 * 1024)
+
+// Most memory an upload sets aside up front for its announced size; the
+// buffer grows past it only as the body actually arrives
+#define S3_UPLOAD_RESERVE_MAX (8 * 1024 * 1024)
 
 /**
  * S3 result status enum
@@ -14,7 +56,8 @@ typedef enum {
     S3_ERROR_NOT_FOUND,
     S3_ERROR_PERMISSION,
     S3_ERROR_INVALID_INPUT,
-    S3_ERROR_MEMORY
+    S3_ERROR_MEMORY,
+    S3_ERROR_TOO_LARGE
 } S3StatusEnum;
 
 /**
@@ -28,6 +71,139 @@ typedef struct S3Result {
     char *error_message;
 } S3Result;
 
+/**
+ * Object upload in progress
+ * 
+ * Collects the body of one object. With a chunk size set, every full chunk
+ * is written to s3.chunks inside a transaction as soon as more data
+ * arrives, so memory stays bounded by one chunk. Objects no larger than one
+ * chunk, and every object when the chunk size is 0, are stored inline.
+ * 
+ * A part of a multipart upload is collected the same way, except that its
+ * chunks always go to s3.multipart_chunks, however small the part is.
+ */
+typedef struct S3Upload {
+    PGconn *conn;
+    char *key;
+    char *content_type;
+    size_t chunk_size;      // 0 = inline layout
+    const char *compress_types; // content types stored compressed, NULL for none
+    size_t size;            // bytes accepted so far
+    size_t flushed;         // bytes written to s3.chunks
+    char *buffer;           // bytes not yet written
+    size_t buffered;
+    size_t capacity;
+    int in_transaction;     // set once the first chunk went out
+    int chunk_pending;      // last chunk insert sent, result not read yet
+    char object_id[32];     // header row id, valid once in_transaction
+    Md5Context md5;         // running content MD5 for the ETag
+    char *upload_id;        // multipart upload this part belongs to, NULL for objects
+    int part_number;
+    S3Result *result;       // first error, returned by s3_upload_finish
+} S3Upload;
+
+/**
+ * Object opened for incremental reading
+ * 
+ * Small inline objects are fetched together with their metadata. Anything
+ * larger is read one chunk (or one S3_READ_WINDOW slice of the inline
+ * content) per round trip, so memory use is bounded by one piece regardless
+ * of object size. Every piece is a statement of its own that only returns
+ * data while the object still has the ETag it was opened with, so no
+ * transaction stays open between pieces and an overwrite ends the read
+ * with an error instead of mixing versions. Only the bytes up to `end` are
+ * requested from the database.
+ */
+typedef struct S3ObjectReader {
+    PGconn *conn;
+    char *content_type;
+    size_t size;            // object size in bytes
+    int chunked;
+    char object_id[32];
+    size_t offset;          // next byte s3_reader_read returns
+    size_t end;             // end of the byte range being read (exclusive)
+    PGresult *prefetched;   // whole content of a small inline object
+    PGresult *window;       // current chunk or content slice
+    int window_data_column;
+    size_t window_start;    // object offset of the window's first byte
+    size_t window_length;
+    time_t last_modified;
+    char etag[S3_ETAG_SIZE];    // empty if the object predates ETags
+    char content_encoding[S3_ENCODING_SIZE];    // of the bytes read; empty when decoded
+    unsigned char *decoded;     // content of a compressed object, decompressed
+} S3ObjectReader;
+
+/**
+ * Listing request
+ */
+typedef struct S3ListOptions {
+    const char *prefix;         // only keys starting with this; NULL for all
+    const char *start_after;    // only keys after this one; NULL to start at the beginning
+    int max_keys;               // page size, at most S3_LIST_MAX_KEYS, or S3_LIST_UNLIMITED
+    const char *delimiter;      // roll keys up into common prefixes; NULL for a flat listing
+} S3ListOptions;
+
+/**
+ * Listing read one row at a time, in byte order of the keys
+ * 
+ * A merged listing runs no query itself: it interleaves the listings of
+ * several databases, each already in key order.
+ */
+typedef struct S3ListStream {
+    PGconn *conn;               // NULL for a merged listing
+    PGresult *row;              // last entry returned
+    int max_keys;
+    int count;                  // entries returned so far
+    int is_truncated;           // more keys follow the last entry
+    int done;                   // query finished, connection idle again
+    struct S3ListStream **parts;    // merged listings
+    int part_count;
+    struct S3ListEntry *heads;  // next entry of each part
+    int *head_states;           // whether each head is to fetch, ready or used up
+    char *last_key;             // copy of the entry returned last
+    size_t last_key_capacity;
+} S3ListStream;
+
+/**
+ * Listed object; strings point into the current row
+ */
+typedef struct S3ListEntry {
+    const char *key;
+    const char *size;
+    const char *last_modified;
+    const char *etag;           // hex MD5, NULL if the object predates ETags
+    int is_prefix;              // common prefix: only key is set
+} S3ListEntry;
+
+/**
+ * Object metadata, read without touching the content
+ */
+typedef struct S3ObjectInfo {
+    char *content_type;
+    size_t size;
+    time_t last_modified;
+    char etag[S3_ETAG_SIZE];    // empty if the object predates ETags
+    char content_encoding[S3_ENCODING_SIZE];    // of the content at hand, empty for identity
+} S3ObjectInfo;
+
+/**
+ * Part named in a CompleteMultipartUpload request
+ */
+typedef struct S3CompletedPart {
+    int part_number;
+    char etag[S3_ETAG_SIZE];    // as the client sent it, quotes removed
+} S3CompletedPart;
+
+/**
+ * Object written by a batched put
+ */
+typedef struct S3PutItem {
+    const char *key;
+    const void *data;
+    size_t size;
+    const char *content_type;   // NULL for application/octet-stream
+} S3PutItem;
+
 /**
  * Create a new S3Result
  * 
@@ -64,9 +240,93 @@ S3Result* s3_api_list_buckets(PGconn *conn);
  * 
  * @param conn PostgreSQL connection
  * @param bucket bucket name
- * @return S3Result with object data
+ * @param prefix only list keys starting with this (NULL for all)
+ * @return S3Result with a JSON array of objects
+ */
+S3Result* s3_api_list_objects(PGconn *conn, const char *bucket, const char *prefix);
+
+/**
+ * Open a listing that returns its entries one row at a time
+ * 
+ * @param conn PostgreSQL connection, busy until the stream is closed
+ * @param bucket bucket name
+ * @param options prefix, lower bound, page size and delimiter (NULL for defaults)
+ * @param stream receives the stream on success
+ * @return S3Result with status
+ */
+S3Result* s3_list_open(PGconn *conn, const char *bucket, const S3ListOptions *options,
+                       S3ListStream **stream);
+
+/**
+ * Merge listings of the same request on several databases into one
+ * 
+ * Entries come out in key order; a key or common prefix found in more
+ * than one part is returned once.
+ * 
+ * @param parts open listings, closed with the merged one (also on error)
+ * @param part_count number of parts
+ * @param max_keys page size the parts were opened with, or S3_LIST_UNLIMITED
+ * @param stream receives the merged stream on success
+ * @return S3Result with status
+ */
+S3Result* s3_list_merge(S3ListStream **parts, int part_count, int max_keys,
+                        S3ListStream **stream);
+
+/**
+ * Read the next entry of a listing
+ * 
+ * @param stream open listing
+ * @param entry receives pointers valid until the next call or close
+ * @return 1 with an entry, 0 at the end, -1 on error
  */
-S3Result* s3_api_list_objects(PGconn *conn, const char *bucket);
+int s3_list_next(S3ListStream *stream, S3ListEntry *entry);
+
+/**
+ * Get the key or common prefix a truncated listing continues after
+ * 
+ * @param stream listing that returned 0 from s3_list_next
+ * @return last entry of the page, or NULL if the listing is complete
+ */
+const char* s3_list_last_key(const S3ListStream *stream);
+
+/**
+ * Close a listing, cancelling the query if it has not been read to the end
+ * 
+ * @param stream listing to close
+ */
+void s3_list_close(S3ListStream *stream);
+
+/**
+ * Append an entry as a JSON object
+ * 
+ * @param out output buffer
+ * @param entry listed object
+ */
+void s3_list_entry_write_json(TextBuffer *out, const S3ListEntry *entry);
+
+/**
+ * Append an entry as a ListObjectsV2 <Contents> or <CommonPrefixes> element
+ * 
+ * @param out output buffer
+ * @param entry listed object
+ */
+void s3_list_entry_write_xml(TextBuffer *out, const S3ListEntry *entry);
+
+/**
+ * Encode a key as an opaque continuation token
+ * 
+ * @param key last key of a page
+ * @return token (free with free()) or NULL on allocation failure
+ */
+char* s3_list_token_encode(const char *key);
+
+/**
+ * Decode a continuation token
+ * 
+ * @param token token from s3_list_token_encode
+ * @return key to continue after (free with free()) or NULL if the token is malformed
+ */
+char* s3_list_token_decode(const char *token);
 
 /**
  * Get object from bucket
@@ -78,6 +338,124 @@ S3Result* s3_api_list_objects(PGconn *conn, const char *bucket);
  */
 S3Result* s3_api_get_object(PGconn *conn, const char *bucket, const char *key);
 
+/**
+ * Get object metadata without reading its content
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status
+ */
+S3Result* s3_api_stat_object(PGconn *conn, const char *bucket, const char *key,
+                             S3ObjectInfo *info);
+
+/**
+ * Read object metadata from the result of S3_STMT_STAT_OBJECT run elsewhere,
+ * for example on a pg_async connection
+ * 
+ * @param res text result of S3_STMT_STAT_OBJECT, left to the caller
+ * @param info receives the metadata on success; release with s3_object_info_clear
+ * @return S3Result with status or NULL on memory error
+ */
+S3Result* s3_stat_from_result(const PGresult *res, S3ObjectInfo *info);
+
+/**
+ * Free the strings held by object metadata
+ * 
+ * @param info metadata filled by s3_api_stat_object
+ */
+void s3_object_info_clear(S3ObjectInfo *info);
+
+/**
+ * Open an object for incremental reading
+ * 
+ * Compressed objects are read as stored, with content_encoding set and
+ * size the compressed size, when accept_encoding allows their encoding.
+ * Otherwise they are decompressed on open and read like any other object.
+ * 
+ * @param conn PostgreSQL connection, used exclusively until the reader is closed
+ * @param bucket bucket name
+ * @param key object key
+ * @param prefetch_limit largest inline object to fetch in the first round trip
+ * @param accept_encoding Accept-Encoding value of the client, NULL to always decode
+ * @param reader receives the reader on success
+ * @return S3Result with status
+ */
+S3Result* s3_reader_open(PGconn *conn, const char *bucket, const char *key,
+                         size_t prefetch_limit, const char *accept_encoding,
+                         S3ObjectReader **reader);
+
+/**
+ * Open a reader on the result of S3_STMT_GET_OBJECT run elsewhere, for
+ * example on a pg_async connection
+ * 
+ * The reader has no connection. If s3_reader_prefetched_data returns NULL
+ * for it, the content was not in the result and the object has to be
+ * opened with s3_reader_open instead.
+ * 
+ * @param res binary result of S3_STMT_GET_OBJECT, taken over by the call
+ * @param accept_encoding Accept-Encoding value of the client, NULL to always decode
+ * @param reader receives the reader on success
+ * @return S3Result with status or NULL on memory error
+ */
+S3Result* s3_reader_from_result(PGresult *res, const char *accept_encoding,
+                                S3ObjectReader **reader);
+
+/**
+ * Read the next bytes of an object
+ * 
+ * @param reader open reader
+ * @param buffer destination
+ * @param max buffer size
+ * @return bytes read, 0 at end of object, -1 on error
+ */
+ssize_t s3_reader_read(S3ObjectReader *reader, void *buffer, size_t max);
+
+/**
+ * Restrict a reader to a byte range of the object
+ * 
+ * @param reader open reader
+ * @param offset first byte to read
+ * @param length number of bytes to read
+ * @return 0 on success, -1 if the range is outside the object
+ */
+int s3_reader_set_range(S3ObjectReader *reader, size_t offset, size_t length);
+
+/**
+ * Get the whole content of a prefetched object without copying
+ * 
+ * @param reader open reader
+ * @return content (reader->size bytes) or NULL if the object is read piecewise
+ */
+const void* s3_reader_prefetched_data(const S3ObjectReader *reader);
+
+/**
+ * Check whether the next s3_reader_read has to query the database
+ * 
+ * @param reader open reader
+ * @return 1 if the bytes at the read offset still have to be fetched, 0 otherwise
+ */
+int s3_reader_needs_fetch(const S3ObjectReader *reader);
+
+/**
+ * Switch the connection a reader fetches on
+ * 
+ * Pieces are read in statements of their own, so a reader can give its
+ * connection back between them and continue on another one.
+ * 
+ * @param reader open reader
+ * @param conn PostgreSQL connection, NULL to release the current one
+ */
+void s3_reader_attach(S3ObjectReader *reader, PGconn *conn);
+
+/**
+ * Close a reader and end its snapshot
+ * 
+ * @param reader reader to close
+ */
+void s3_reader_close(S3ObjectReader *reader);
+
 /**
  * Put object in bucket
  * 
@@ -87,10 +465,200 @@ S3Result* s3_api_get_object(PGconn *conn, const char *bucket, const char *key);
  * @param data object data
  * @param size data size
  * @param content_type content type
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none
  * @return S3Result with status
  */
 S3Result* s3_api_put_object(PGconn *conn, const char *bucket, const char *key,
-                          const void *data, size_t size, const char *content_type);
+                          const void *data, size_t size, const char *content_type,
+                          size_t chunk_size, const char *compress_types);
+
+/**
+ * Get several objects without waiting on each round trip
+ * 
+ * Lookups are pipelined, and inline objects arrive with them; chunked
+ * objects are then read one by one as by s3_api_get_object.
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param count number of keys
+ * @param results receives one S3Result per key, as from s3_api_get_object
+ * @return 0 if every object was read, -1 otherwise
+ */
+int s3_api_get_objects(PGconn *conn, const char *bucket, const char *const *keys, int count,
+                       S3Result **results);
+
+/**
+ * Put several objects without waiting on each round trip
+ * 
+ * Objects stored inline are pipelined, each in its own transaction, so
+ * one failure does not affect the others; larger ones are then written
+ * one by one as by s3_api_put_object.
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param items objects to store
+ * @param count number of objects
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none
+ * @param results receives one S3Result per object, as from s3_api_put_object
+ * @return 0 if every object was stored, -1 otherwise
+ */
+int s3_api_put_objects(PGconn *conn, const char *bucket, const S3PutItem *items, int count,
+                       size_t chunk_size, const char *compress_types, S3Result **results);
+
+/**
+ * Start uploading an object
+ * 
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @param compress_types content types to store compressed, NULL for none;
+ *        must stay valid until the upload finishes
+ * @return upload handle or NULL on memory error
+ */
+S3Upload* s3_upload_begin(PGconn *conn, const char *bucket, const char *key,
+                          const char *content_type, size_t chunk_size,
+                          const char *compress_types);
+
+/**
+ * Size the upload buffer for an expected body size
+ * 
+ * At most S3_UPLOAD_RESERVE_MAX bytes are set aside, however large the
+ * expected size is.
+ * 
+ * @param upload upload in progress
+ * @param expected_size expected total size in bytes
+ */
+void s3_upload_reserve(S3Upload *upload, size_t expected_size);
+
+/**
+ * Release the connection of an inline upload while its body arrives
+ * 
+ * Inline objects only touch the database when they are finished, so the
+ * connection can go back to its pool until s3_upload_attach.
+ * 
+ * @param upload upload in progress, with nothing written to the database yet
+ * @return 0 on success, -1 if the upload is chunked or already wrote chunks
+ */
+int s3_upload_detach(S3Upload *upload);
+
+/**
+ * Give a detached upload the connection to finish on
+ * 
+ * @param upload upload released by s3_upload_detach
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param compress_types content types to store compressed, NULL for none;
+ *        must stay valid until the upload finishes
+ */
+void s3_upload_attach(S3Upload *upload, PGconn *conn, const char *compress_types);
+
+/**
+ * Append bytes to an upload
+ * 
+ * @param upload upload in progress
+ * @param data bytes to append
+ * @param size number of bytes
+ * @return 0 on success, -1 on error (details are reported by s3_upload_finish)
+ */
+int s3_upload_write(S3Upload *upload, const void *data, size_t size);
+
+/**
+ * Get the ETag of everything written so far
+ * 
+ * Lets a caller send the ETag header before the upload is finished.
+ * 
+ * @param upload upload in progress
+ * @param etag receives the hex content MD5
+ */
+void s3_upload_etag(const S3Upload *upload, char etag[S3_ETAG_SIZE]);
+
+/**
+ * Complete an upload and store the object
+ * 
+ * @param upload upload in progress (freed by this call)
+ * @return S3Result with status
+ */
+S3Result* s3_upload_finish(S3Upload *upload);
+
+/**
+ * Abandon an upload, rolling back anything written so far
+ * 
+ * @param upload upload in progress (freed by this call)
+ */
+void s3_upload_abort(S3Upload *upload);
+
+/**
+ * Start a multipart upload
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key
+ * @param content_type content type of the finished object
+ * @return S3Result with an InitiateMultipartUploadResult document
+ */
+S3Result* s3_api_create_upload(PGconn *conn, const char *bucket, const char *key,
+                               const char *content_type);
+
+/**
+ * Start uploading one part of a multipart upload
+ * 
+ * Parts are independent: each runs in its own transaction, so several can
+ * be uploaded at once over different connections. Uploading a part number
+ * again replaces it.
+ * 
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @param part_number part number, 1 to S3_MULTIPART_MAX_PARTS
+ * @param chunk_size size of the stored chunks
+ * @return upload handle (finish with s3_upload_finish) or NULL on memory error
+ */
+S3Upload* s3_upload_begin_part(PGconn *conn, const char *bucket, const char *key,
+                               const char *upload_id, int part_number, size_t chunk_size);
+
+/**
+ * Complete a multipart upload
+ * 
+ * Assembles the object from the listed parts inside the database, so no
+ * part data passes through the client, and removes the upload.
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @param parts parts in ascending part number order
+ * @param part_count number of parts
+ * @return S3Result with a CompleteMultipartUploadResult document
+ */
+S3Result* s3_api_complete_upload(PGconn *conn, const char *bucket, const char *key,
+                                 const char *upload_id, const S3CompletedPart *parts,
+                                 int part_count);
+
+/**
+ * Abort a multipart upload and drop its parts
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param key object key the upload was created for
+ * @param upload_id multipart upload id
+ * @return S3Result with status
+ */
+S3Result* s3_api_abort_upload(PGconn *conn, const char *bucket, const char *key,
+                              const char *upload_id);
+
+/**
+ * Drop multipart uploads that were started too long ago
+ * 
+ * @param conn PostgreSQL connection
+ * @param max_age_seconds age after which an unfinished upload is abandoned
+ * @return number of uploads removed, -1 on error
+ */
+long s3_api_expire_uploads(PGconn *conn, long max_age_seconds);
 
 /**
  * Delete object from bucket
@@ -102,4 +670,36 @@ S3Result* s3_api_put_object(PGconn *conn, const char *bucket, const char *key,
  */
 S3Result* s3_api_delete_object(PGconn *conn, const char *bucket, const char *key);
 
+/**
+ * Delete several objects with one statement
+ * 
+ * As in S3, keys that do not exist are reported as deleted.
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param keys object keys
+ * @param key_count number of keys, at most S3_DELETE_MAX_KEYS
+ * @param quiet report only the keys that could not be deleted
+ * @return S3Result with a DeleteResult document
+ */
+S3Result* s3_api_delete_objects(PGconn *conn, const char *bucket, const char *const *keys,
+                                int key_count, int quiet);
+
+/**
+ * Delete every object whose key starts with a prefix
+ * 
+ * Objects are removed in batches of batch_size, each in its own short
+ * transaction, so row locks are held briefly and an interrupted run keeps
+ * the progress it made.
+ * 
+ * @param conn PostgreSQL connection
+ * @param bucket bucket name
+ * @param prefix non-empty key prefix
+ * @param batch_size objects per transaction, 0 for S3_DELETE_PREFIX_BATCH
+ * @param deleted receives the number of objects removed, also on error
+ * @return S3Result with status
+ */
+S3Result* s3_api_delete_prefix(PGconn *conn, const char *bucket, const char *prefix,
+                               int batch_size, long *deleted);
+
 #endif /* S3_API_H */ 
\ No newline at end of file
@@ -0,0 +1,454 @@
+#include "s3_import.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+// Session-local staging table; emptied by every commit. These statements
+// are not in the prepared-statement registry because the table only
+// exists once an import has started.
+#define S3_IMPORT_CREATE_STAGING \
+    "CREATE TEMP TABLE IF NOT EXISTS pgs3_import (" \
+    "   path TEXT NOT NULL," \
+    "   content_type TEXT NOT NULL," \
+    "   size BIGINT NOT NULL," \
+    "   content BYTEA NOT NULL," \
+    "   etag TEXT NOT NULL" \
+    ") ON COMMIT DELETE ROWS;"
+
+#define S3_IMPORT_COPY \
+    "COPY pg_temp.pgs3_import (path, content_type, size, content, etag) " \
+    "FROM STDIN (FORMAT binary);"
+
+// Upsert a whole batch, like S3_STMT_PUT_OBJECT per row. A key staged
+// twice keeps the later file; chunks of overwritten chunked objects go.
+#define S3_IMPORT_MERGE \
+    "WITH staged AS (" \
+    "   SELECT DISTINCT ON (path) * FROM pg_temp.pgs3_import ORDER BY path, ctid DESC" \
+    "), old_chunks AS (" \
+    "   DELETE FROM s3.chunks c USING s3.objects o, staged s " \
+    "   WHERE c.object_id = o.id AND o.path = s.path AND o.chunked" \
+    ") " \
+    "INSERT INTO s3.objects (path, content, content_type, size, chunked, etag, last_modified) " \
+    "SELECT path, content, content_type, size, false, etag, CURRENT_TIMESTAMP FROM staged " \
+    "ON CONFLICT (path) DO UPDATE " \
+    "SET content = EXCLUDED.content, content_type = EXCLUDED.content_type, " \
+    "    size = EXCLUDED.size, chunked = false, etag = EXCLUDED.etag, " \
+    "    content_encoding = NULL, last_modified = CURRENT_TIMESTAMP;"
+
+// Binary COPY stream header: signature, flags, header extension length
+static const char copy_header[19] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+
+/**
+ * Record the first error of an import
+ * 
+ * @param import import in progress
+ * @param status error status
+ * @param message error message
+ * @return -1
+ */
+static int import_fail(S3Import *import, S3StatusEnum status, const char *message) {
+    if (import->result->status == S3_SUCCESS) {
+        s3_result_set_error(import->result, status, message);
+    }
+    
+    return -1;
+}
+
+/**
+ * Run a command that returns no rows
+ * 
+ * @param import import in progress
+ * @param sql command text
+ * @return 0 on success, -1 on error
+ */
+static int import_exec(S3Import *import, const char *sql) {
+    PGresult *res = PQexec(import->conn, sql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        import_fail(import, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        PQclear(res);
+        return -1;
+    }
+    
+    PQclear(res);
+    return 0;
+}
+
+/**
+ * Send bytes into the open COPY
+ * 
+ * @param import import in progress
+ * @param data bytes to send
+ * @param size number of bytes
+ * @return 0 on success, -1 on error
+ */
+static int copy_send(S3Import *import, const void *data, size_t size) {
+    if (PQputCopyData(import->conn, (const char *)data, (int)size) != 1) {
+        return import_fail(import, S3_ERROR_CONNECTION, PQerrorMessage(import->conn));
+    }
+    
+    return 0;
+}
+
+/**
+ * Send one COPY field: its length, then its bytes
+ * 
+ * @param import import in progress
+ * @param data field value
+ * @param size value length
+ * @return 0 on success, -1 on error
+ */
+static int copy_send_field(S3Import *import, const void *data, size_t size) {
+    uint32_t length = htonl((uint32_t)size);
+    
+    if (copy_send(import, &length, sizeof(length)) != 0) {
+        return -1;
+    }
+    
+    return copy_send(import, data, size);
+}
+
+/**
+ * Open a batch: a transaction with a COPY into the staging table
+ * 
+ * @param import import in progress
+ * @return 0 on success, -1 on error
+ */
+static int batch_open(S3Import *import) {
+    if (import_exec(import, "BEGIN;") != 0) {
+        return -1;
+    }
+    
+    PGresult *res = PQexec(import->conn, S3_IMPORT_COPY);
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        import_fail(import, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        PQclear(res);
+        import_exec(import, "ROLLBACK;");
+        return -1;
+    }
+    PQclear(res);
+    
+    import->in_copy = 1;
+    import->batch_files = 0;
+    import->batch_bytes = 0;
+    
+    return copy_send(import, copy_header, sizeof(copy_header));
+}
+
+/**
+ * Abort the COPY of the open batch and roll the batch back
+ * 
+ * @param import import in progress
+ */
+static void batch_rollback(S3Import *import) {
+    if (!import->in_copy) {
+        return;
+    }
+    import->in_copy = 0;
+    
+    PQputCopyEnd(import->conn, "import failed");
+    PGresult *res;
+    while ((res = PQgetResult(import->conn)) != NULL) {
+        PQclear(res);
+    }
+    PQclear(PQexec(import->conn, "ROLLBACK;"));
+}
+
+/**
+ * End the COPY of the open batch, merge it and commit
+ * 
+ * @param import import in progress
+ * @return 0 on success, -1 on error
+ */
+static int batch_commit(S3Import *import) {
+    if (!import->in_copy) {
+        return 0;
+    }
+    import->in_copy = 0;
+    
+    // File trailer: a tuple with field count -1
+    uint16_t trailer = htons(0xFFFF);
+    if (copy_send(import, &trailer, sizeof(trailer)) != 0 ||
+        PQputCopyEnd(import->conn, NULL) != 1) {
+        import_fail(import, S3_ERROR_CONNECTION, PQerrorMessage(import->conn));
+    }
+    
+    PGresult *res;
+    while ((res = PQgetResult(import->conn)) != NULL) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            import_fail(import, S3_ERROR_EXECUTION, PQresultErrorMessage(res));
+        }
+        PQclear(res);
+    }
+    
+    if (import->result->status != S3_SUCCESS || import_exec(import, S3_IMPORT_MERGE) != 0 ||
+        import_exec(import, "COMMIT;") != 0) {
+        import_exec(import, "ROLLBACK;");
+        return -1;
+    }
+    
+    import->files += import->batch_files;
+    import->bytes += import->batch_bytes;
+    return 0;
+}
+
+/**
+ * Import a file too large for the staging table as a chunked upload
+ * 
+ * @param import import in progress, between batches
+ * @param key object key
+ * @param fd open file
+ * @param content_type content type
+ * @return 0 on success, -1 on error
+ */
+static int import_chunked(S3Import *import, const char *key, int fd, const char *content_type) {
+    S3Upload *upload = s3_upload_begin(import->conn, "public", key, content_type,
+                                       import->chunk_size, NULL);
+    char *block = malloc(S3_IMPORT_READ_SIZE);
+    if (!upload || !block) {
+        s3_upload_abort(upload);
+        free(block);
+        return import_fail(import, S3_ERROR_MEMORY, "Failed to allocate memory");
+    }
+    
+    ssize_t n;
+    while ((n = read(fd, block, S3_IMPORT_READ_SIZE)) > 0) {
+        if (s3_upload_write(upload, block, (size_t)n) != 0) {
+            break;
+        }
+    }
+    free(block);
+    
+    if (n < 0) {
+        s3_upload_abort(upload);
+        return import_fail(import, S3_ERROR_EXECUTION, strerror(errno));
+    }
+    
+    size_t size = upload->size;
+    S3Result *result = s3_upload_finish(upload);
+    if (!result || result->status != S3_SUCCESS) {
+        import_fail(import, result ? result->status : S3_ERROR_MEMORY,
+                    result && result->error_message ? result->error_message : "Upload failed");
+        s3_result_free(result);
+        return -1;
+    }
+    s3_result_free(result);
+    
+    import->files++;
+    import->bytes += size;
+    return 0;
+}
+
+/**
+ * Start an import
+ * 
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @return import handle or NULL on memory error
+ */
+S3Import* s3_import_begin(PGconn *conn, size_t chunk_size) {
+    S3Import *import = (S3Import *)calloc(1, sizeof(S3Import));
+    if (!import) {
+        return NULL;
+    }
+    
+    import->result = s3_result_create();
+    if (!import->result) {
+        free(import);
+        return NULL;
+    }
+    
+    import->conn = conn;
+    import->chunk_size = chunk_size;
+    
+    if (!conn) {
+        import_fail(import, S3_ERROR_CONNECTION, "Invalid PostgreSQL connection");
+    } else {
+        import_exec(import, S3_IMPORT_CREATE_STAGING);
+    }
+    
+    return import;
+}
+
+/**
+ * Import one file
+ * 
+ * @param import import in progress
+ * @param key object key
+ * @param path local file to read
+ * @param content_type content type
+ * @return 0 on success, -1 on error
+ */
+int s3_import_file(S3Import *import, const char *key, const char *path,
+                   const char *content_type) {
+    if (!import || import->result->status != S3_SUCCESS) {
+        return -1;
+    }
+    
+    if (!content_type) {
+        content_type = "application/octet-stream";
+    }
+    
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        char message[512];
+        snprintf(message, sizeof(message), "%s: %s", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return import_fail(import, S3_ERROR_EXECUTION, message);
+    }
+    size_t size = (size_t)st.st_size;
+    
+    // Too big for one chunk: commit what is staged and stream it chunked
+    if (import->chunk_size > 0 && size > import->chunk_size) {
+        int rc = batch_commit(import) == 0 ? import_chunked(import, key, fd, content_type) : -1;
+        close(fd);
+        return rc;
+    }
+    
+    // Too big for a bytea (and for the 32-bit COPY field length): keep what
+    // is staged and stop before the file is sent
+    if (size > S3_INLINE_MAX_SIZE) {
+        close(fd);
+        if (batch_commit(import) != 0) {
+            return -1;
+        }
+        char message[512];
+        snprintf(message, sizeof(message), "%s: too large for the inline layout, "
+                 "use the chunked layout for files over 1 GB", path);
+        return import_fail(import, S3_ERROR_TOO_LARGE, message);
+    }
+    
+    if (import->in_copy && (import->batch_files >= S3_IMPORT_BATCH_FILES ||
+                            import->batch_bytes + size > S3_IMPORT_BATCH_BYTES)) {
+        if (batch_commit(import) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    if (!import->in_copy && batch_open(import) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    // Tuple: field count, then path, content_type, size, content, etag
+    uint16_t fields = htons(5);
+    uint32_t size_hi = htonl((uint32_t)((uint64_t)size >> 32));
+    uint32_t size_lo = htonl((uint32_t)size);
+    unsigned char size_field[8];
+    memcpy(size_field, &size_hi, 4);
+    memcpy(size_field + 4, &size_lo, 4);
+    
+    int rc = 0;
+    if (copy_send(import, &fields, sizeof(fields)) != 0 ||
+        copy_send_field(import, key, strlen(key)) != 0 ||
+        copy_send_field(import, content_type, strlen(content_type)) != 0 ||
+        copy_send_field(import, size_field, sizeof(size_field)) != 0) {
+        rc = -1;
+    }
+    
+    // The content goes out as it is read; the ETag follows it
+    uint32_t length = htonl((uint32_t)size);
+    char *block = rc == 0 ? malloc(S3_IMPORT_READ_SIZE) : NULL;
+    if (rc == 0 && (!block || copy_send(import, &length, sizeof(length)) != 0)) {
+        rc = block ? -1 : import_fail(import, S3_ERROR_MEMORY, "Failed to allocate memory");
+    }
+    
+    Md5Context md5;
+    md5_init(&md5);
+    size_t sent = 0;
+    while (rc == 0 && sent < size) {
+        size_t want = size - sent < S3_IMPORT_READ_SIZE ? size - sent : S3_IMPORT_READ_SIZE;
+        ssize_t n = read(fd, block, want);
+        if (n <= 0) {
+            // The file shrank under us; the COPY framing can't be repaired
+            char message[512];
+            snprintf(message, sizeof(message), "%s: %s", path,
+                     n < 0 ? strerror(errno) : "file changed while importing");
+            rc = import_fail(import, S3_ERROR_EXECUTION, message);
+            break;
+        }
+        md5_update(&md5, block, (size_t)n);
+        rc = copy_send(import, block, (size_t)n);
+        sent += (size_t)n;
+    }
+    free(block);
+    close(fd);
+    
+    if (rc == 0) {
+        char etag[MD5_HEX_LENGTH + 1];
+        md5_final_hex(&md5, etag);
+        rc = copy_send_field(import, etag, MD5_HEX_LENGTH);
+    }
+    
+    if (rc != 0) {
+        // Abort the COPY so the batch rolls back cleanly
+        batch_rollback(import);
+        return -1;
+    }
+    
+    import->batch_files++;
+    import->batch_bytes += size;
+    return 0;
+}
+
+/**
+ * Fail an import for a reason found by the caller
+ * 
+ * @param import import in progress
+ * @param message error message
+ * @return -1
+ */
+int s3_import_fail(S3Import *import, const char *message) {
+    if (!import) {
+        return -1;
+    }
+    
+    return import_fail(import, S3_ERROR_EXECUTION, message);
+}
+
+/**
+ * Commit the last batch
+ * 
+ * @param import import in progress (freed by this call)
+ * @return S3Result with status
+ */
+S3Result* s3_import_finish(S3Import *import) {
+    if (!import) {
+        return NULL;
+    }
+    
+    if (import->result->status == S3_SUCCESS) {
+        batch_commit(import);
+    } else {
+        batch_rollback(import);
+    }
+    
+    S3Result *result = import->result;
+    free(import);
+    
+    return result;
+}
+
+/**
+ * Abandon an import, rolling back the open batch
+ * 
+ * @param import import in progress (freed by this call)
+ */
+void s3_import_abort(S3Import *import) {
+    if (!import) {
+        return;
+    }
+    
+    batch_rollback(import);
+    
+    s3_result_free(import->result);
+    free(import);
+}
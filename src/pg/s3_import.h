@@ -0,0 +1,92 @@
+#ifndef S3_IMPORT_H
+#define S3_IMPORT_H
+
+#include <stddef.h>
+#include <libpq-fe.h>
+#include "s3_api.h"
+
+// A batch is merged and committed once it holds this many files...
+#define S3_IMPORT_BATCH_FILES 10000
+
+// ...or this many content bytes
+#define S3_IMPORT_BATCH_BYTES ((size_t)256 * 1024 * 1024)
+
+// Block size used to read files
+#define S3_IMPORT_READ_SIZE (1024 * 1024)
+
+/**
+ * Bulk load of local files into the public bucket
+ * 
+ * Files are streamed with COPY ... FROM STDIN (FORMAT binary) into a
+ * temporary staging table, straight from disk in S3_IMPORT_READ_SIZE
+ * blocks, and each batch is merged into s3.objects with one upsert and
+ * committed. Per-file cost is a few bytes of COPY framing rather than a
+ * round trip. Files larger than one chunk under the chunked layout are
+ * written as a regular chunked upload between batches; under the inline
+ * layout, a file over S3_INLINE_MAX_SIZE fails the import before any of
+ * it is sent, keeping the batches staged so far.
+ */
+typedef struct S3Import {
+    PGconn *conn;
+    size_t chunk_size;      // 0 = inline layout
+    int in_copy;            // a batch transaction with an open COPY
+    long batch_files;       // files sent in the open batch
+    size_t batch_bytes;
+    long files;             // files committed
+    size_t bytes;           // content bytes committed
+    S3Result *result;       // first error, returned by s3_import_finish
+} S3Import;
+
+/**
+ * Start an import
+ * 
+ * @param conn PostgreSQL connection, used exclusively until finish/abort
+ * @param chunk_size chunk size for the chunked layout, 0 to store inline
+ * @return import handle or NULL on memory error
+ */
+S3Import* s3_import_begin(PGconn *conn, size_t chunk_size);
+
+/**
+ * Import one file
+ * 
+ * @param import import in progress
+ * @param key object key
+ * @param path local file to read
+ * @param content_type content type
+ * @return 0 on success, -1 on error (the import is then failed; details
+ *         are reported by s3_import_finish)
+ */
+int s3_import_file(S3Import *import, const char *key, const char *path,
+                   const char *content_type);
+
+/**
+ * Fail an import for a reason found by the caller, such as a directory
+ * that cannot be read
+ * 
+ * Later files are refused and s3_import_finish rolls the open batch back
+ * and reports the message.
+ * 
+ * @param import import in progress
+ * @param message error message
+ * @return -1
+ */
+int s3_import_fail(S3Import *import, const char *message);
+
+/**
+ * Commit the last batch, or roll it back if the import failed
+ * 
+ * @param import import in progress (freed by this call)
+ * @return S3Result with status
+ */
+S3Result* s3_import_finish(S3Import *import);
+
+/**
+ * Abandon an import, rolling back the open batch
+ * 
+ * Batches committed earlier are kept.
+ * 
+ * @param import import in progress (freed by this call)
+ */
+void s3_import_abort(S3Import *import);
+
+#endif /* S3_IMPORT_H */
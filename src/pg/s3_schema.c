@@ -0,0 +1,421 @@
+#include "s3_schema.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Advisory lock key serializing concurrent migrations
+#define S3_SCHEMA_LOCK_KEY "pgs3.schema"
+
+// Objects rewritten per transaction by s3_schema_rewrite_compressed
+#define S3_SCHEMA_REWRITE_BATCH 64
+
+// One batch of inline content that TOAST still holds compressed: stored
+// smaller than its length, which pg_column_size and octet_length both
+// read from the value header without decompressing. Concatenating an
+// empty string builds a fresh value, which STORAGE EXTERNAL keeps
+// uncompressed. Ids are walked upwards from $1; returns the number
+// rewritten and the last id looked at.
+#define S3_SCHEMA_REWRITE_SQL \
+    "WITH batch AS (" \
+    "   SELECT id FROM s3.objects " \
+    "   WHERE id > $1::bigint AND NOT chunked AND content_encoding IS NULL " \
+    "     AND pg_column_size(content) < octet_length(content) " \
+    "   ORDER BY id LIMIT $2::int" \
+    "), rewritten AS (" \
+    "   UPDATE s3.objects o SET content = o.content || ''::bytea " \
+    "   FROM batch WHERE o.id = batch.id " \
+    "   RETURNING o.id" \
+    ") " \
+    "SELECT (SELECT count(*) FROM rewritten), (SELECT max(id) FROM batch);"
+
+/**
+ * Schema migration step
+ */
+typedef struct {
+    int version;
+    const char *description;
+    const char *sql;
+} S3Migration;
+
+/**
+ * Ordered list of migrations. Never edit an applied step; append a new one
+ * and bump S3_SCHEMA_VERSION instead.
+ */
+static const S3Migration migrations[] = {
+    {
+        1, "create objects table",
+        // IF NOT EXISTS keeps databases created before versioning working
+        "CREATE TABLE IF NOT EXISTS s3.objects ("
+        "   path TEXT PRIMARY KEY,"
+        "   content BYTEA NOT NULL,"
+        "   content_type TEXT NOT NULL,"
+        "   size BIGINT NOT NULL,"
+        "   last_modified TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+        ");"
+    },
+    {
+        2, "add chunked storage layout",
+        // Chunk rows are keyed by the byte offset they start at, so a byte
+        // position maps to its chunk through the primary key
+        "ALTER TABLE s3.objects ADD COLUMN id BIGSERIAL;"
+        "ALTER TABLE s3.objects ADD CONSTRAINT objects_id_key UNIQUE (id);"
+        "ALTER TABLE s3.objects ADD COLUMN chunked BOOLEAN NOT NULL DEFAULT false;"
+        "ALTER TABLE s3.objects ALTER COLUMN content DROP NOT NULL;"
+        "CREATE TABLE s3.chunks ("
+        "   object_id BIGINT NOT NULL REFERENCES s3.objects (id) ON DELETE CASCADE,"
+        "   seq BIGINT NOT NULL,"
+        "   data BYTEA NOT NULL,"
+        "   PRIMARY KEY (object_id, seq)"
+        ");"
+        "CREATE TABLE s3.settings ("
+        "   name TEXT PRIMARY KEY,"
+        "   value TEXT NOT NULL"
+        ");"
+        "INSERT INTO s3.settings (name, value) VALUES "
+        "   ('storage_layout', 'inline'),"
+        "   ('chunk_size', '1048576');"
+    },
+    {
+        3, "store content uncompressed out of line",
+        // EXTERNAL skips TOAST compression, so substring() on a value only
+        // fetches the TOAST slices it covers. Affects values written from now
+        // on; s3_schema_rewrite_compressed converts the older ones.
+        "ALTER TABLE s3.objects ALTER COLUMN content SET STORAGE EXTERNAL;"
+        "ALTER TABLE s3.chunks ALTER COLUMN data SET STORAGE EXTERNAL;"
+    },
+    {
+        4, "store content MD5 as ETag",
+        // Hex MD5 of the content; NULL for objects written before this step
+        "ALTER TABLE s3.objects ADD COLUMN etag TEXT;"
+    },
+    {
+        5, "index keys in byte order for listing",
+        // Listings page through keys in C collation so prefix ranges are
+        // plain index ranges whatever the database collation is
+        "CREATE INDEX objects_path_c_idx ON s3.objects (path COLLATE \"C\");"
+    },
+    {
+        6, "notify object changes",
+        // Every committed write names its key on S3_NOTIFY_CHANNEL so servers
+        // can drop cached copies. Payloads are capped at 8000 bytes; an empty
+        // one (overlong key or TRUNCATE) means "anything may have changed".
+        "CREATE FUNCTION s3.notify_object_change() RETURNS trigger"
+        "   LANGUAGE plpgsql AS $$"
+        "   DECLARE"
+        "       changed TEXT := CASE WHEN TG_OP = 'DELETE' THEN OLD.path ELSE NEW.path END;"
+        "   BEGIN"
+        "       PERFORM pg_notify('" S3_NOTIFY_CHANNEL "',"
+        "           CASE WHEN octet_length(changed) < 7900 THEN changed ELSE '' END);"
+        "       RETURN NULL;"
+        "   END $$;"
+        "CREATE FUNCTION s3.notify_objects_truncated() RETURNS trigger"
+        "   LANGUAGE plpgsql AS $$"
+        "   BEGIN"
+        "       PERFORM pg_notify('" S3_NOTIFY_CHANNEL "', '');"
+        "       RETURN NULL;"
+        "   END $$;"
+        "CREATE TRIGGER objects_notify AFTER INSERT OR UPDATE OR DELETE ON s3.objects"
+        "   FOR EACH ROW EXECUTE FUNCTION s3.notify_object_change();"
+        "CREATE TRIGGER objects_notify_truncate AFTER TRUNCATE ON s3.objects"
+        "   FOR EACH STATEMENT EXECUTE FUNCTION s3.notify_objects_truncated();"
+    },
+    {
+        7, "add multipart uploads",
+        // Part bytes are stored as chunks keyed like s3.chunks (byte offset
+        // within the part), so completing an upload is one INSERT ... SELECT
+        // into s3.chunks. Chunks hang off the upload rather than the part
+        // row, which is only written once the part's last chunk is in.
+        "CREATE TABLE s3.multipart_uploads ("
+        "   upload_id TEXT PRIMARY KEY,"
+        "   path TEXT NOT NULL,"
+        "   content_type TEXT NOT NULL,"
+        "   created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+        ");"
+        "CREATE INDEX multipart_uploads_created_at_idx ON s3.multipart_uploads (created_at);"
+        "CREATE TABLE s3.multipart_parts ("
+        "   upload_id TEXT NOT NULL REFERENCES s3.multipart_uploads ON DELETE CASCADE,"
+        "   part_number INTEGER NOT NULL,"
+        "   size BIGINT NOT NULL,"
+        "   etag TEXT NOT NULL,"
+        "   last_modified TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
+        "   PRIMARY KEY (upload_id, part_number)"
+        ");"
+        "CREATE TABLE s3.multipart_chunks ("
+        "   upload_id TEXT NOT NULL REFERENCES s3.multipart_uploads ON DELETE CASCADE,"
+        "   part_number INTEGER NOT NULL,"
+        "   seq BIGINT NOT NULL,"
+        "   data BYTEA NOT NULL,"
+        "   PRIMARY KEY (upload_id, part_number, seq)"
+        ");"
+        "ALTER TABLE s3.multipart_chunks ALTER COLUMN data SET STORAGE EXTERNAL;"
+    },
+    {
+        8, "record content encoding",
+        // Codec of compressed inline content (only 'gzip' so far); NULL
+        // means the content is stored as-is. size stays the decoded size.
+        "ALTER TABLE s3.objects ADD COLUMN content_encoding TEXT;"
+        "INSERT INTO s3.settings (name, value) VALUES ('compress_types', '') "
+        "ON CONFLICT (name) DO NOTHING;"
+    },
+};
+
+#define S3_MIGRATION_COUNT ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+/**
+ * Execute a statement that returns no rows
+ * 
+ * @param conn PostgreSQL connection
+ * @param sql SQL text, may contain several statements
+ * @return 0 on success, -1 on error
+ */
+static int exec_command(PGconn *conn, const char *sql) {
+    PGresult *res = PQexec(conn, sql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK && PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "Schema migration failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    
+    PQclear(res);
+    return 0;
+}
+
+/**
+ * Get the schema version recorded in the database
+ * 
+ * @param conn PostgreSQL connection
+ * @return schema version, 0 if the schema was never bootstrapped, -1 on error
+ */
+int s3_schema_get_version(PGconn *conn) {
+    if (!conn) {
+        return -1;
+    }
+    
+    // Look the table up through the catalog so a missing schema is not an error
+    PGresult *res = PQexec(conn,
+        "SELECT to_regclass('s3.schema_version') IS NOT NULL;");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        PQclear(res);
+        return -1;
+    }
+    
+    int exists = PQgetvalue(res, 0, 0)[0] == 't';
+    PQclear(res);
+    
+    if (!exists) {
+        return 0;
+    }
+    
+    res = PQexec(conn, "SELECT coalesce(max(version), 0) FROM s3.schema_version;");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        PQclear(res);
+        return -1;
+    }
+    
+    int version = atoi(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    
+    return version;
+}
+
+/**
+ * Bring the S3 schema up to S3_SCHEMA_VERSION
+ * 
+ * @param conn PostgreSQL connection
+ * @return number of migrations applied, -1 on error
+ */
+int s3_schema_migrate(PGconn *conn) {
+    if (!conn) {
+        return -1;
+    }
+    
+    // Fast path: nothing to do, no locks taken
+    int version = s3_schema_get_version(conn);
+    if (version < 0) {
+        return -1;
+    }
+    if (version >= S3_SCHEMA_VERSION) {
+        return 0;
+    }
+    
+    if (exec_command(conn, "BEGIN;") != 0) {
+        return -1;
+    }
+    
+    // Serialize with other instances and re-read the version under the lock
+    if (exec_command(conn,
+            "SELECT pg_advisory_xact_lock(hashtext('" S3_SCHEMA_LOCK_KEY "'));"
+            "CREATE SCHEMA IF NOT EXISTS s3;"
+            "CREATE TABLE IF NOT EXISTS s3.schema_version ("
+            "   version INTEGER PRIMARY KEY,"
+            "   description TEXT NOT NULL,"
+            "   applied_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+            ");") != 0) {
+        exec_command(conn, "ROLLBACK;");
+        return -1;
+    }
+    
+    version = s3_schema_get_version(conn);
+    if (version < 0) {
+        exec_command(conn, "ROLLBACK;");
+        return -1;
+    }
+    
+    int applied = 0;
+    for (int i = 0; i < S3_MIGRATION_COUNT; i++) {
+        const S3Migration *migration = &migrations[i];
+        if (migration->version <= version) {
+            continue;
+        }
+        
+        if (exec_command(conn, migration->sql) != 0) {
+            exec_command(conn, "ROLLBACK;");
+            return -1;
+        }
+        
+        // Record the step
+        char version_str[16];
+        snprintf(version_str, sizeof(version_str), "%d", migration->version);
+        const char *params[2] = {version_str, migration->description};
+        
+        PGresult *res = PQexecParams(conn,
+            "INSERT INTO s3.schema_version (version, description) VALUES ($1, $2);",
+            2, NULL, params, NULL, NULL, 0);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "Schema migration failed: %s", PQerrorMessage(conn));
+            PQclear(res);
+            exec_command(conn, "ROLLBACK;");
+            return -1;
+        }
+        PQclear(res);
+        
+        applied++;
+    }
+    
+    if (exec_command(conn, "COMMIT;") != 0) {
+        return -1;
+    }
+    
+    return applied;
+}
+
+/**
+ * Read the storage settings
+ * 
+ * @param conn PostgreSQL connection
+ * @param settings output settings
+ * @return 0 on success, -1 on error
+ */
+int s3_schema_load_settings(PGconn *conn, S3StorageSettings *settings) {
+    if (!conn || !settings) {
+        return -1;
+    }
+    
+    settings->layout = S3_LAYOUT_INLINE;
+    settings->chunk_size = S3_DEFAULT_CHUNK_SIZE;
+    settings->compress_types[0] = '\0';
+    
+    PGresult *res = PQexec(conn, "SELECT name, value FROM s3.settings;");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "Failed to read settings: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    
+    for (int i = 0; i < PQntuples(res); i++) {
+        const char *name = PQgetvalue(res, i, 0);
+        const char *value = PQgetvalue(res, i, 1);
+        
+        if (strcmp(name, "storage_layout") == 0) {
+            settings->layout = strcmp(value, "chunked") == 0 ? S3_LAYOUT_CHUNKED : S3_LAYOUT_INLINE;
+        } else if (strcmp(name, "chunk_size") == 0) {
+            long long chunk_size = atoll(value);
+            if (chunk_size > 0) {
+                settings->chunk_size = (size_t)chunk_size;
+            }
+        } else if (strcmp(name, "compress_types") == 0) {
+            snprintf(settings->compress_types, sizeof(settings->compress_types), "%s", value);
+        }
+    }
+    
+    PQclear(res);
+    return 0;
+}
+
+/**
+ * Choose the storage layout used for new objects
+ * 
+ * @param conn PostgreSQL connection
+ * @param settings layout, chunk size and compression policy to record
+ * @return 0 on success, -1 on error
+ */
+int s3_schema_save_settings(PGconn *conn, const S3StorageSettings *settings) {
+    if (!conn || !settings || settings->chunk_size == 0) {
+        return -1;
+    }
+    
+    char chunk_size[32];
+    snprintf(chunk_size, sizeof(chunk_size), "%zu", settings->chunk_size);
+    
+    const char *params[3] = {
+        settings->layout == S3_LAYOUT_CHUNKED ? "chunked" : "inline",
+        chunk_size,
+        settings->compress_types
+    };
+    
+    PGresult *res = PQexecParams(conn,
+        "INSERT INTO s3.settings (name, value) VALUES "
+        "   ('storage_layout', $1), ('chunk_size', $2), ('compress_types', $3) "
+        "ON CONFLICT (name) DO UPDATE SET value = EXCLUDED.value;",
+        3, NULL, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        fprintf(stderr, "Failed to save settings: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    
+    PQclear(res);
+    return 0;
+}
+
+/**
+ * Rewrite inline content stored before migration 3 without compression
+ * 
+ * TOAST-compressed values have to be decompressed from the start for every
+ * substring(), so reading a large one window by window costs time
+ * quadratic in its size. Runs in batches of S3_SCHEMA_REWRITE_BATCH
+ * objects, each committed on its own; ETags and timestamps are kept.
+ * 
+ * @param conn PostgreSQL connection
+ * @return number of objects rewritten, -1 on error
+ */
+long s3_schema_rewrite_compressed(PGconn *conn) {
+    if (!conn) {
+        return -1;
+    }
+    
+    char last_id[32] = "0";
+    char limit[16];
+    snprintf(limit, sizeof(limit), "%d", S3_SCHEMA_REWRITE_BATCH);
+    long rewritten = 0;
+    
+    for (;;) {
+        const char *params[2] = {last_id, limit};
+        PGresult *res = PQexecParams(conn, S3_SCHEMA_REWRITE_SQL, 2, NULL, params, NULL, NULL, 0);
+        if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+            fprintf(stderr, "Failed to rewrite compressed objects: %s", PQerrorMessage(conn));
+            PQclear(res);
+            return -1;
+        }
+        
+        // No id means no compressed value is left past the last batch
+        if (PQgetisnull(res, 0, 1)) {
+            PQclear(res);
+            return rewritten;
+        }
+        
+        rewritten += atol(PQgetvalue(res, 0, 0));
+        snprintf(last_id, sizeof(last_id), "%s", PQgetvalue(res, 0, 1));
+        PQclear(res);
+    }
+}
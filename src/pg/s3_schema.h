@@ -0,0 +1,100 @@
+#ifndef S3_SCHEMA_H
+#define S3_SCHEMA_H
+
+#include <libpq-fe.h>
+
+/**
+ * Schema version this build expects; bump it whenever a migration is
+ * appended to the list in s3_schema.c
+ */
+#define S3_SCHEMA_VERSION 8
+
+/**
+ * Channel the s3.objects trigger notifies with the key of every changed
+ * object, or an empty payload when any object may have changed
+ */
+#define S3_NOTIFY_CHANNEL "pgs3_objects"
+
+/**
+ * Object storage layouts
+ * 
+ * Inline keeps each object in s3.objects.content. Chunked keeps a header
+ * row in s3.objects and the bytes in fixed-size rows of s3.chunks, so no
+ * single value has to hold the whole object. The layout only decides how
+ * new objects are written; every object records its own layout, so both
+ * kinds can be read regardless of the current setting.
+ */
+typedef enum {
+    S3_LAYOUT_INLINE,
+    S3_LAYOUT_CHUNKED
+} S3StorageLayout;
+
+#define S3_DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+// Room for the compression policy, a comma-separated list of content types
+#define S3_COMPRESS_TYPES_SIZE 512
+
+/**
+ * Storage settings recorded in s3.settings
+ * 
+ * New objects whose content type matches compress_types are stored
+ * gzip-compressed when they are stored inline and no larger than
+ * S3_COMPRESS_MAX_SIZE. An empty policy turns compression off.
+ */
+typedef struct {
+    S3StorageLayout layout;
+    size_t chunk_size;
+    char compress_types[S3_COMPRESS_TYPES_SIZE];
+} S3StorageSettings;
+
+/**
+ * Get the schema version recorded in the database
+ * 
+ * @param conn PostgreSQL connection
+ * @return schema version, 0 if the schema was never bootstrapped, -1 on error
+ */
+int s3_schema_get_version(PGconn *conn);
+
+/**
+ * Bring the S3 schema up to S3_SCHEMA_VERSION
+ * 
+ * Runs all pending migrations in one transaction under an advisory lock,
+ * so concurrent callers are safe. When the schema is already current this
+ * costs a single catalog lookup and no DDL.
+ * 
+ * @param conn PostgreSQL connection
+ * @return number of migrations applied, -1 on error
+ */
+int s3_schema_migrate(PGconn *conn);
+
+/**
+ * Read the storage settings
+ * 
+ * @param conn PostgreSQL connection
+ * @param settings output settings
+ * @return 0 on success, -1 on error
+ */
+int s3_schema_load_settings(PGconn *conn, S3StorageSettings *settings);
+
+/**
+ * Choose the storage layout used for new objects
+ * 
+ * @param conn PostgreSQL connection
+ * @param settings layout, chunk size and compression policy to record
+ * @return 0 on success, -1 on error
+ */
+int s3_schema_save_settings(PGconn *conn, const S3StorageSettings *settings);
+
+/**
+ * Rewrite inline content stored before migration 3 without compression
+ * 
+ * Migration 3 only keeps new values uncompressed; older compressed ones
+ * make windowed reads of large objects decompress from the start for
+ * every window. Only the storage of the values changes.
+ * 
+ * @param conn PostgreSQL connection
+ * @return number of objects rewritten, -1 on error
+ */
+long s3_schema_rewrite_compressed(PGconn *conn);
+
+#endif /* S3_SCHEMA_H */
@@ -0,0 +1,285 @@
+#include "s3_statements.h"
+#include <stdio.h>
+
+/**
+ * Statement registry entry
+ */
+typedef struct {
+    const char *name;
+    const char *sql;
+    int n_params;
+} S3Statement;
+
+/*
+ * Directory-style listing: a recursive skip scan over the path index that
+ * emits either a key or, when the key has the delimiter $4 after prefix $2,
+ * its common prefix. After a common prefix the walk jumps straight to the
+ * first key past the group (the prefix with the delimiter replaced by $5,
+ * its successor), so a group costs one index probe however many keys it
+ * holds. The seed row is the start-after key $1; a seed that is itself a
+ * common prefix (a continuation token) skips its group too. Returns up to
+ * $3 entries: path or prefix, size, lastmod, etag, is_prefix.
+ */
+#define S3_COMMON_PREFIX_OF(x) \
+    "CASE WHEN left(" x ", char_length($2)) = $2 " \
+    "      AND strpos(substr(" x ", char_length($2) + 1), $4) > 0 " \
+    "THEN left(" x ", char_length($2) + strpos(substr(" x ", char_length($2) + 1), $4) " \
+    "               + char_length($4) - 1) END"
+
+#define S3_LIST_DELIMITED_SQL(upper_bound_condition) \
+    "WITH RECURSIVE walk (path, size, lastmod, etag, common_prefix, n) AS (" \
+    "   SELECT $1::text, NULL::bigint, NULL::text, NULL::text, " \
+    "          " S3_COMMON_PREFIX_OF("$1::text") ", 0 " \
+    "   UNION ALL " \
+    "   SELECT o.path, o.size, o.lastmod, o.etag, " S3_COMMON_PREFIX_OF("o.path") ", w.n + 1 " \
+    "   FROM walk w CROSS JOIN LATERAL (" \
+    "       SELECT path, size, etag, " \
+    "              to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') AS lastmod " \
+    "       FROM s3.objects " \
+    "       WHERE path COLLATE \"C\" > w.path " \
+    "         AND path COLLATE \"C\" >= CASE WHEN w.common_prefix IS NULL THEN $2 " \
+    "             ELSE left(w.common_prefix, -char_length($4)) || $5 END " \
+    "         " upper_bound_condition " " \
+    "       ORDER BY path COLLATE \"C\" LIMIT 1" \
+    "   ) o " \
+    "   WHERE w.n < $3" \
+    ") " \
+    "SELECT coalesce(common_prefix, path), size, lastmod, etag, common_prefix IS NOT NULL " \
+    "FROM walk WHERE n > 0 ORDER BY n;"
+
+// Indexed by S3StatementId
+static const S3Statement statements[S3_STMT_COUNT] = {
+    // One page of keys after $1 and at or after prefix $2, in byte order
+    [S3_STMT_LIST_OBJECTS] = {
+        "s3_list_objects",
+        "SELECT path, size, to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod, etag "
+        "FROM s3.objects "
+        "WHERE path COLLATE \"C\" > $1 AND path COLLATE \"C\" >= $2 "
+        "ORDER BY path COLLATE \"C\" LIMIT $3;",
+        3
+    },
+    // Same, bounded above by $4, the first string past every key starting with $2
+    [S3_STMT_LIST_PREFIX] = {
+        "s3_list_prefix",
+        "SELECT path, size, to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod, etag "
+        "FROM s3.objects "
+        "WHERE path COLLATE \"C\" > $1 AND path COLLATE \"C\" >= $2 AND path COLLATE \"C\" < $4 "
+        "ORDER BY path COLLATE \"C\" LIMIT $3;",
+        4
+    },
+    [S3_STMT_LIST_DELIMITED] = {
+        "s3_list_delimited",
+        S3_LIST_DELIMITED_SQL(""),
+        5
+    },
+    // Same, bounded above by $6 like S3_STMT_LIST_PREFIX
+    [S3_STMT_LIST_DELIMITED_PREFIX] = {
+        "s3_list_delimited_prefix",
+        S3_LIST_DELIMITED_SQL("AND path COLLATE \"C\" < $6"),
+        6
+    },
+    // Metadata plus the content of inline objects up to $2 bytes. Compressed
+    // content can only be decoded whole, so it always comes along.
+    [S3_STMT_GET_OBJECT] = {
+        "s3_get_object",
+        "SELECT CASE WHEN NOT chunked AND (size <= $2 OR content_encoding IS NOT NULL) "
+        "            THEN content END, "
+        "       content_type, chunked, id, size, "
+        "       floor(extract(epoch FROM last_modified))::bigint, etag, content_encoding "
+        "FROM s3.objects WHERE path = $1;",
+        2
+    },
+    // Metadata only; never touches the content column
+    [S3_STMT_STAT_OBJECT] = {
+        "s3_stat_object",
+        "SELECT size, content_type, floor(extract(epoch FROM last_modified))::bigint, etag "
+        "FROM s3.objects WHERE path = $1;",
+        1
+    },
+    // Inline upsert; also drops the chunks of a previous chunked version.
+    // $6 is the content's encoding, NULL when stored as-is
+    [S3_STMT_PUT_OBJECT] = {
+        "s3_put_object",
+        "WITH old_chunks AS ("
+        "   DELETE FROM s3.chunks WHERE object_id = (SELECT id FROM s3.objects WHERE path = $1)"
+        ") "
+        "INSERT INTO s3.objects (path, content, content_type, size, chunked, etag, "
+        "                        content_encoding, last_modified) "
+        "VALUES ($1, $2, $3, $4, false, $5, $6, CURRENT_TIMESTAMP) "
+        "ON CONFLICT (path) DO UPDATE "
+        "SET content = $2, content_type = $3, size = $4, chunked = false, etag = $5, "
+        "    content_encoding = $6, last_modified = CURRENT_TIMESTAMP "
+        "RETURNING to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod;",
+        6
+    },
+    // Chunked upload: header row first, size is filled in by FINISH_OBJECT
+    [S3_STMT_PUT_OBJECT_HEADER] = {
+        "s3_put_object_header",
+        "INSERT INTO s3.objects (path, content, content_type, size, chunked, last_modified) "
+        "VALUES ($1, NULL, $2, 0, true, CURRENT_TIMESTAMP) "
+        "ON CONFLICT (path) DO UPDATE "
+        "SET content = NULL, content_type = $2, size = 0, chunked = true, etag = NULL, "
+        "    content_encoding = NULL, last_modified = CURRENT_TIMESTAMP "
+        "RETURNING id;",
+        2
+    },
+    [S3_STMT_DELETE_CHUNKS] = {
+        "s3_delete_chunks",
+        "DELETE FROM s3.chunks WHERE object_id = $1;",
+        1
+    },
+    [S3_STMT_PUT_CHUNK] = {
+        "s3_put_chunk",
+        "INSERT INTO s3.chunks (object_id, seq, data) VALUES ($1, $2, $3);",
+        3
+    },
+    [S3_STMT_FINISH_OBJECT] = {
+        "s3_finish_object",
+        "UPDATE s3.objects SET size = $2, etag = $3, last_modified = CURRENT_TIMESTAMP "
+        "WHERE id = $1 "
+        "RETURNING to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod;",
+        3
+    },
+    // Up to $3 bytes of the chunk holding byte offset $2, starting there, as
+    // long as the object still has ETag $4 (an overwrite keeps the id)
+    [S3_STMT_GET_CHUNK] = {
+        "s3_get_chunk",
+        "SELECT c.seq, substring(c.data from ($2::bigint - c.seq + 1)::int for $3::int) "
+        "FROM s3.chunks c JOIN s3.objects o ON o.id = c.object_id "
+        "WHERE c.object_id = $1 AND c.seq <= $2::bigint "
+        "  AND o.chunked AND o.etag IS NOT DISTINCT FROM $4::text "
+        "ORDER BY c.seq DESC LIMIT 1;",
+        4
+    },
+    // Slice of an inline object's content, under the same ETag check
+    [S3_STMT_READ_WINDOW] = {
+        "s3_read_window",
+        "SELECT substring(content from $2 for $3) FROM s3.objects "
+        "WHERE id = $1 AND NOT chunked AND content_encoding IS NULL "
+        "  AND etag IS NOT DISTINCT FROM $4::text;",
+        4
+    },
+    [S3_STMT_DELETE_OBJECT] = {
+        "s3_delete_object",
+        "DELETE FROM s3.objects WHERE path = $1 RETURNING 1;",
+        1
+    },
+    // One statement for a whole DeleteObjects request; $1 is a text[]
+    [S3_STMT_DELETE_OBJECTS] = {
+        "s3_delete_objects",
+        "DELETE FROM s3.objects WHERE path = ANY ($1::text[]);",
+        1
+    },
+    // Up to $3 objects with keys in [$1, $2), in key order
+    [S3_STMT_DELETE_PREFIX_BATCH] = {
+        "s3_delete_prefix_batch",
+        "DELETE FROM s3.objects WHERE id IN ("
+        "   SELECT id FROM s3.objects "
+        "   WHERE path COLLATE \"C\" >= $1 AND path COLLATE \"C\" < $2 "
+        "   ORDER BY path COLLATE \"C\" LIMIT $3"
+        ");",
+        3
+    },
+    [S3_STMT_CREATE_UPLOAD] = {
+        "s3_create_upload",
+        "INSERT INTO s3.multipart_uploads (upload_id, path, content_type) VALUES ($1, $2, $3);",
+        3
+    },
+    // Taken by every part upload; keeps the upload from being completed or
+    // aborted underneath it while letting other parts proceed
+    [S3_STMT_CHECK_UPLOAD] = {
+        "s3_check_upload",
+        "SELECT 1 FROM s3.multipart_uploads WHERE upload_id = $1 AND path = $2 FOR KEY SHARE;",
+        2
+    },
+    [S3_STMT_DELETE_PART_CHUNKS] = {
+        "s3_delete_part_chunks",
+        "DELETE FROM s3.multipart_chunks WHERE upload_id = $1 AND part_number = $2;",
+        2
+    },
+    [S3_STMT_PUT_PART_CHUNK] = {
+        "s3_put_part_chunk",
+        "INSERT INTO s3.multipart_chunks (upload_id, part_number, seq, data) VALUES ($1, $2, $3, $4);",
+        4
+    },
+    [S3_STMT_PUT_PART] = {
+        "s3_put_part",
+        "INSERT INTO s3.multipart_parts (upload_id, part_number, size, etag) VALUES ($1, $2, $3, $4) "
+        "ON CONFLICT (upload_id, part_number) DO UPDATE "
+        "SET size = $3, etag = $4, last_modified = CURRENT_TIMESTAMP "
+        "RETURNING to_char(last_modified, 'YYYY-MM-DD\"T\"HH24:MI:SS.MS\"Z\"') as lastmod;",
+        4
+    },
+    // Completion and abort hold this until commit, waiting out part uploads
+    [S3_STMT_LOCK_UPLOAD] = {
+        "s3_lock_upload",
+        "SELECT content_type FROM s3.multipart_uploads WHERE upload_id = $1 AND path = $2 FOR UPDATE;",
+        2
+    },
+    [S3_STMT_LIST_PARTS] = {
+        "s3_list_parts",
+        "SELECT part_number, size, etag FROM s3.multipart_parts "
+        "WHERE upload_id = $1 ORDER BY part_number;",
+        1
+    },
+    // Copy the chunks of parts $3 (an int[] in part order) into object $1,
+    // shifting each part's chunk offsets by the sizes of the parts before it
+    [S3_STMT_ASSEMBLE_PARTS] = {
+        "s3_assemble_parts",
+        "INSERT INTO s3.chunks (object_id, seq, data) "
+        "SELECT $1, p.part_offset + c.seq, c.data "
+        "FROM (SELECT part_number, "
+        "             (sum(size) OVER (ORDER BY part_number) - size)::bigint AS part_offset "
+        "      FROM s3.multipart_parts "
+        "      WHERE upload_id = $2 AND part_number = ANY ($3::int[])) p "
+        "JOIN s3.multipart_chunks c ON c.upload_id = $2 AND c.part_number = p.part_number;",
+        3
+    },
+    // Parts and their chunks go with it
+    [S3_STMT_DELETE_UPLOAD] = {
+        "s3_delete_upload",
+        "DELETE FROM s3.multipart_uploads WHERE upload_id = $1 AND path = $2 RETURNING 1;",
+        2
+    },
+    [S3_STMT_EXPIRE_UPLOADS] = {
+        "s3_expire_uploads",
+        "DELETE FROM s3.multipart_uploads "
+        "WHERE created_at < CURRENT_TIMESTAMP - $1::bigint * interval '1 second';",
+        1
+    },
+};
+
+/**
+ * Get the server-side name of a prepared statement
+ * 
+ * @param id statement identifier
+ * @return statement name
+ */
+const char *s3_statement_name(S3StatementId id) {
+    return statements[id].name;
+}
+
+/**
+ * Prepare every S3 statement on a connection
+ * 
+ * @param conn PostgreSQL connection
+ * @return 0 on success, -1 on error
+ */
+int s3_statements_prepare(PGconn *conn) {
+    if (!conn) {
+        return -1;
+    }
+    
+    for (int i = 0; i < S3_STMT_COUNT; i++) {
+        PGresult *res = PQprepare(conn, statements[i].name, statements[i].sql,
+                                  statements[i].n_params, NULL);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "Failed to prepare %s: %s", statements[i].name, PQerrorMessage(conn));
+            PQclear(res);
+            return -1;
+        }
+        PQclear(res);
+    }
+    
+    return 0;
+}
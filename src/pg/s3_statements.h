@@ -0,0 +1,58 @@
+#ifndef S3_STATEMENTS_H
+#define S3_STATEMENTS_H
+
+#include <libpq-fe.h>
+
+/**
+ * Prepared statements used by the S3 API
+ */
+typedef enum {
+    S3_STMT_LIST_OBJECTS,
+    S3_STMT_LIST_PREFIX,
+    S3_STMT_LIST_DELIMITED,
+    S3_STMT_LIST_DELIMITED_PREFIX,
+    S3_STMT_GET_OBJECT,
+    S3_STMT_STAT_OBJECT,
+    S3_STMT_PUT_OBJECT,
+    S3_STMT_PUT_OBJECT_HEADER,
+    S3_STMT_DELETE_CHUNKS,
+    S3_STMT_PUT_CHUNK,
+    S3_STMT_FINISH_OBJECT,
+    S3_STMT_GET_CHUNK,
+    S3_STMT_READ_WINDOW,
+    S3_STMT_DELETE_OBJECT,
+    S3_STMT_DELETE_OBJECTS,
+    S3_STMT_DELETE_PREFIX_BATCH,
+    S3_STMT_CREATE_UPLOAD,
+    S3_STMT_CHECK_UPLOAD,
+    S3_STMT_DELETE_PART_CHUNKS,
+    S3_STMT_PUT_PART_CHUNK,
+    S3_STMT_PUT_PART,
+    S3_STMT_LOCK_UPLOAD,
+    S3_STMT_LIST_PARTS,
+    S3_STMT_ASSEMBLE_PARTS,
+    S3_STMT_DELETE_UPLOAD,
+    S3_STMT_EXPIRE_UPLOADS,
+    S3_STMT_COUNT
+} S3StatementId;
+
+/**
+ * Get the server-side name of a prepared statement
+ * 
+ * @param id statement identifier
+ * @return statement name
+ */
+const char *s3_statement_name(S3StatementId id);
+
+/**
+ * Prepare every S3 statement on a connection
+ * 
+ * Must be called once per session, i.e. after connecting and again after
+ * every reconnect, before any s3_api_* call uses the connection.
+ * 
+ * @param conn PostgreSQL connection
+ * @return 0 on success, -1 on error
+ */
+int s3_statements_prepare(PGconn *conn);
+
+#endif /* S3_STATEMENTS_H */
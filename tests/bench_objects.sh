@@ -0,0 +1,88 @@
+#!/bin/bash
+# Benchmark put/get throughput and peak RSS of the pgs3 CLI for
+# 1 KB, 1 MB and 100 MB objects.
+#
+# Usage: tests/bench_objects.sh [iterations]
+#
+# Set BASELINE_BIN to a second pgs3 binary (e.g. one built from an older
+# commit) to print its numbers next to the current build for comparison.
+set -e
+
+# Ensure we're in the project root directory
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+cd "$SCRIPT_DIR/.."
+
+# Set default environment variables for benchmarking
+export PGHOST=${PGHOST:-localhost}
+export PGPORT=${PGPORT:-5432}
+export PGDATABASE=${PGDATABASE:-postgres}
+export PGUSER=${PGUSER:-postgres}
+export PGPASSWORD=${PGPASSWORD:-postgres}
+
+ITERATIONS=${1:-5}
+BENCH_DIR=$(mktemp -d)
+trap 'rm -rf "$BENCH_DIR"' EXIT
+
+# Ensure we have a built binary
+if [ ! -f "bin/pgs3" ]; then
+    echo "Building pgs3..."
+    make
+fi
+
+if ! /usr/bin/time -f "%M" true 2>/dev/null; then
+    echo "GNU time (/usr/bin/time) is required to measure RSS"
+    exit 1
+fi
+
+# Create test payloads
+head -c 1024 /dev/urandom > "$BENCH_DIR/1KB.bin"
+head -c 1048576 /dev/urandom > "$BENCH_DIR/1MB.bin"
+head -c 104857600 /dev/urandom > "$BENCH_DIR/100MB.bin"
+
+# Run one operation, print "<seconds> <max rss kb>"
+measure() {
+    local start end rss
+    start=$(date +%s.%N)
+    rss=$( { /usr/bin/time -f "%M" "$@" > /dev/null; } 2>&1 | tail -n 1 )
+    end=$(date +%s.%N)
+    echo "$(echo "$end - $start" | bc) $rss"
+}
+
+bench_binary() {
+    local bin=$1
+    local label=$2
+
+    for size in 1KB 1MB 100MB; do
+        local file="$BENCH_DIR/$size.bin"
+        local key="bench/$size-$$.bin"
+        local bytes
+        bytes=$(stat -c %s "$file")
+        local put_time=0 get_time=0 put_rss=0 get_rss=0
+
+        for _ in $(seq "$ITERATIONS"); do
+            read -r t r < <(measure "$bin" put "$key" < "$file")
+            put_time=$(echo "$put_time + $t" | bc)
+            [ "$r" -gt "$put_rss" ] && put_rss=$r
+
+            read -r t r < <(measure "$bin" get "$key")
+            get_time=$(echo "$get_time + $t" | bc)
+            [ "$r" -gt "$get_rss" ] && get_rss=$r
+        done
+
+        "$bin" delete "$key" > /dev/null
+
+        local put_mbs get_mbs
+        put_mbs=$(echo "scale=2; $bytes * $ITERATIONS / $put_time / 1048576" | bc)
+        get_mbs=$(echo "scale=2; $bytes * $ITERATIONS / $get_time / 1048576" | bc)
+
+        printf "%-10s %-6s put %10s MB/s %8s KB RSS   get %10s MB/s %8s KB RSS\n" \
+            "$label" "$size" "$put_mbs" "$put_rss" "$get_mbs" "$get_rss"
+    done
+}
+
+echo "Benchmarking put/get ($ITERATIONS iterations per size)..."
+bench_binary "bin/pgs3" "current"
+
+if [ -n "$BASELINE_BIN" ]; then
+    bench_binary "$BASELINE_BIN" "baseline"
+fi
@@ -39,10 +39,64 @@ echo -n "Testing get command: "
 GET_CONTENT=$(bin/pgs3 get "$TEST_FILE")
 [ "$GET_CONTENT" = "$TEST_CONTENT" ] && echo "OK" || { echo "FAILED"; exit 1; }
 
+# Test file input and output
+echo -n "Testing put --file and get --out: "
+bin/pgs3 put "$TEST_FILE" --file "/tmp/$TEST_FILE" > /dev/null && \
+    bin/pgs3 get "$TEST_FILE" --out "/tmp/$TEST_FILE.out" && \
+    cmp -s "/tmp/$TEST_FILE" "/tmp/$TEST_FILE.out" && echo "OK" || { echo "FAILED"; exit 1; }
+rm -f "/tmp/$TEST_FILE.out"
+
 # Test delete command
 echo -n "Testing delete command: "
 bin/pgs3 delete "$TEST_FILE" > /dev/null && echo "OK" || { echo "FAILED"; exit 1; }
 
+# Test rewriting content stored before migration 3; leaves objects readable
+echo -n "Testing migrate --rewrite-compressed: "
+bin/pgs3 put "$TEST_FILE" --file "/tmp/$TEST_FILE" > /dev/null && \
+    bin/pgs3 migrate --rewrite-compressed | grep -q "Rewrote [0-9]* compressed objects" && \
+    [ "$(bin/pgs3 get "$TEST_FILE")" = "$TEST_CONTENT" ] && \
+    bin/pgs3 delete "$TEST_FILE" > /dev/null && echo "OK" || { echo "FAILED"; exit 1; }
+
+# Test compressed storage; the object is read back over HTTP below
+echo -n "Testing migrate --compress: "
+GZIP_FILE="gzip-$TEST_FILE"
+seq 1 2000 > "/tmp/$GZIP_FILE"
+bin/pgs3 migrate --compress "text/*" | grep -q "text/\*" && \
+    bin/pgs3 put "$GZIP_FILE" --file "/tmp/$GZIP_FILE" > /dev/null && \
+    bin/pgs3 migrate --compress none | grep -q "uncompressed" && \
+    bin/pgs3 get "$GZIP_FILE" --out "/tmp/$GZIP_FILE.out" && \
+    cmp -s "/tmp/$GZIP_FILE" "/tmp/$GZIP_FILE.out" && echo "OK" || { echo "FAILED"; bin/pgs3 migrate --compress none > /dev/null; exit 1; }
+rm -f "/tmp/$GZIP_FILE.out"
+
+# Test pipelined batches
+echo -n "Testing bench command: "
+bin/pgs3 bench --count 20 --size 100 | grep -q "^get" && [ "$(bin/pgs3 ls _pgs3_bench/)" = "[]" ] && echo "OK" || { echo "FAILED"; exit 1; }
+
+# Test directory import
+echo -n "Testing import command: "
+IMPORT_DIR=$(mktemp -d)
+mkdir -p "$IMPORT_DIR/sub"
+echo "first" > "$IMPORT_DIR/a.txt"
+echo "second" > "$IMPORT_DIR/sub/b.json"
+: > "$IMPORT_DIR/sub/empty"
+IMPORT_PREFIX="import-$(date +%s)/"
+bin/pgs3 import "$IMPORT_DIR" "$IMPORT_PREFIX" 2>&1 | grep -q "Imported 3 files" && \
+    [ "$(bin/pgs3 get "${IMPORT_PREFIX}sub/b.json")" = "second" ] && \
+    bin/pgs3 ls "$IMPORT_PREFIX" | grep -q "${IMPORT_PREFIX}sub/empty" && \
+    echo "OK" || { echo "FAILED"; rm -rf "$IMPORT_DIR"; exit 1; }
+
+# Test parallel copy in both directions, reusing the import tree
+echo -n "Testing cp command: "
+CP_DIR=$(mktemp -d)
+bin/pgs3 cp s3://public/"$IMPORT_PREFIX" "$CP_DIR" -j 2 2> /dev/null && \
+    diff -r "$IMPORT_DIR" "$CP_DIR" > /dev/null && \
+    bin/pgs3 cp "$CP_DIR" s3://public/"${IMPORT_PREFIX}copy/" -j 2 2> /dev/null && \
+    [ "$(bin/pgs3 get "${IMPORT_PREFIX}copy/sub/b.json")" = "second" ] && \
+    bin/pgs3 mirror "$CP_DIR" s3://public/"${IMPORT_PREFIX}copy/" -j 2 2>&1 | grep -q "0 copied, 3 unchanged" && \
+    echo "OK" || { echo "FAILED"; rm -rf "$IMPORT_DIR" "$CP_DIR"; exit 1; }
+rm -rf "$IMPORT_DIR" "$CP_DIR"
+bin/pgs3 rm-prefix "$IMPORT_PREFIX" > /dev/null
+
 # Test HTTP server
 echo "Running HTTP server tests..."
 
@@ -66,15 +120,158 @@ curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/$TEST_
 echo -n "Testing GET /public: "
 curl -s "http://localhost:$AWS_S3_PORT/public" | grep -q "$TEST_FILE" && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
 
+# Test paginated listing
+echo -n "Testing GET /public?list-type=2: "
+curl -s "http://localhost:$AWS_S3_PORT/public?list-type=2&prefix=$TEST_FILE&max-keys=1" | grep -q "<Key>$TEST_FILE</Key>" && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test delimiter listing
+echo -n "Testing GET /public?delimiter=/: "
+TEST_DIR="test-dir-$(date +%s)"
+curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/$TEST_DIR/nested/$TEST_FILE" > /dev/null
+curl -s "http://localhost:$AWS_S3_PORT/public?list-type=2&prefix=$TEST_DIR/&delimiter=/" | grep -q "<Prefix>$TEST_DIR/nested/</Prefix>" && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+curl -s -X DELETE "http://localhost:$AWS_S3_PORT/public/$TEST_DIR/nested/$TEST_FILE" > /dev/null
+
 # Test get object
 echo -n "Testing GET /public/$TEST_FILE: "
 HTTP_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/$TEST_FILE")
 [ "$HTTP_CONTENT" = "$TEST_CONTENT" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
 
+# Test range requests
+echo -n "Testing GET /public/$TEST_FILE with Range: "
+RANGE_CONTENT=$(curl -s -r 0-3 "http://localhost:$AWS_S3_PORT/public/$TEST_FILE")
+RANGE_STATUS=$(curl -s -o /dev/null -w "%{http_code}" -r 100000- "http://localhost:$AWS_S3_PORT/public/$TEST_FILE")
+[ "$RANGE_CONTENT" = "${TEST_CONTENT:0:4}" ] && [ "$RANGE_STATUS" = "416" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test compressed objects, passed through only to clients that accept gzip
+echo -n "Testing GET /public/$GZIP_FILE with Accept-Encoding: "
+GZIP_ENCODING=$(curl -s -o /dev/null -D - -H "Accept-Encoding: gzip" "http://localhost:$AWS_S3_PORT/public/$GZIP_FILE" | tr -d '\r' | sed -n 's/^Content-Encoding: //Ip')
+curl -s --compressed "http://localhost:$AWS_S3_PORT/public/$GZIP_FILE" -o "/tmp/$GZIP_FILE.gz.out"
+curl -s "http://localhost:$AWS_S3_PORT/public/$GZIP_FILE" -o "/tmp/$GZIP_FILE.out"
+[ "$GZIP_ENCODING" = "gzip" ] && cmp -s "/tmp/$GZIP_FILE" "/tmp/$GZIP_FILE.gz.out" && cmp -s "/tmp/$GZIP_FILE" "/tmp/$GZIP_FILE.out" && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+curl -s -X DELETE "http://localhost:$AWS_S3_PORT/public/$GZIP_FILE" > /dev/null
+rm -f "/tmp/$GZIP_FILE" "/tmp/$GZIP_FILE.out" "/tmp/$GZIP_FILE.gz.out"
+
+# Test head object
+echo -n "Testing HEAD /public/$TEST_FILE: "
+HEAD_LENGTH=$(curl -s -I "http://localhost:$AWS_S3_PORT/public/$TEST_FILE" | tr -d '\r' | sed -n 's/^Content-Length: //Ip')
+HEAD_STATUS=$(curl -s -o /dev/null -w "%{http_code}" -I "http://localhost:$AWS_S3_PORT/public/missing-$TEST_FILE")
+[ "$HEAD_LENGTH" = "$(stat -c %s "/tmp/$TEST_FILE")" ] && [ "$HEAD_STATUS" = "404" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test conditional get
+echo -n "Testing GET /public/$TEST_FILE with If-None-Match: "
+ETAG=$(curl -s -I "http://localhost:$AWS_S3_PORT/public/$TEST_FILE" | tr -d '\r' | sed -n 's/^ETag: //Ip')
+ETAG_STATUS=$(curl -s -o /dev/null -w "%{http_code}" -H "If-None-Match: $ETAG" "http://localhost:$AWS_S3_PORT/public/$TEST_FILE")
+[ "$ETAG" = "\"$(md5sum < "/tmp/$TEST_FILE" | cut -d' ' -f1)\"" ] && [ "$ETAG_STATUS" = "304" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test object cache invalidation
+echo -n "Testing GET /public/$TEST_FILE after overwrite: "
+curl -s "http://localhost:$AWS_S3_PORT/public/$TEST_FILE" > /dev/null
+echo "updated - $TEST_CONTENT" | curl -s -X PUT -T - "http://localhost:$AWS_S3_PORT/public/$TEST_FILE" > /dev/null
+HTTP_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/$TEST_FILE")
+[ "$HTTP_CONTENT" = "updated - $TEST_CONTENT" ] && curl -s "http://localhost:$AWS_S3_PORT/_pgs3/cache" | grep -q '"hits"' && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test Prometheus metrics; the GETs above were counted
+echo -n "Testing GET /metrics: "
+METRICS=$(curl -s "http://localhost:$AWS_S3_PORT/metrics")
+echo "$METRICS" | grep -q 'pgs3_http_requests_total{operation="GetObject",code="200"}' && echo "$METRICS" | grep -q 'pgs3_http_request_duration_seconds_bucket{operation="PutObject",code="200",le="+Inf"}' && echo "$METRICS" | grep -q '^pgs3_db_connections_in_use' && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test multipart upload
+echo -n "Testing multipart upload of /public/multi-$TEST_FILE: "
+MULTI_URL="http://localhost:$AWS_S3_PORT/public/multi-$TEST_FILE"
+UPLOAD_ID=$(curl -s -X POST "$MULTI_URL?uploads" | sed -n 's/.*<UploadId>\(.*\)<\/UploadId>.*/\1/p')
+PART1=$(echo -n "first part - " | curl -s -i -X PUT -T - "$MULTI_URL?partNumber=1&uploadId=$UPLOAD_ID" | tr -d '\r' | sed -n 's/^ETag: //Ip')
+PART2=$(echo -n "$TEST_CONTENT" | curl -s -i -X PUT -T - "$MULTI_URL?partNumber=2&uploadId=$UPLOAD_ID" | tr -d '\r' | sed -n 's/^ETag: //Ip')
+curl -s -X POST --data-binary "<CompleteMultipartUpload><Part><PartNumber>1</PartNumber><ETag>$PART1</ETag></Part><Part><PartNumber>2</PartNumber><ETag>$PART2</ETag></Part></CompleteMultipartUpload>" "$MULTI_URL?uploadId=$UPLOAD_ID" > /dev/null
+HTTP_CONTENT=$(curl -s "$MULTI_URL")
+ABORT_STATUS=$(curl -s -o /dev/null -w "%{http_code}" -X DELETE "$MULTI_URL?uploadId=$UPLOAD_ID")
+curl -s -X DELETE "$MULTI_URL" > /dev/null
+[ -n "$UPLOAD_ID" ] && [ "$HTTP_CONTENT" = "first part - $TEST_CONTENT" ] && [ "$ABORT_STATUS" = "404" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+# Test multi-object delete
+echo -n "Testing POST /public?delete: "
+curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/batch-1-$TEST_FILE" > /dev/null
+curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/batch-2-$TEST_FILE" > /dev/null
+DELETE_RESULT=$(curl -s -X POST --data-binary "<Delete><Object><Key>batch-1-$TEST_FILE</Key></Object><Object><Key>batch-2-$TEST_FILE</Key></Object></Delete>" "http://localhost:$AWS_S3_PORT/public?delete")
+BATCH_STATUS=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:$AWS_S3_PORT/public/batch-2-$TEST_FILE")
+echo "$DELETE_RESULT" | grep -q "<Deleted><Key>batch-1-$TEST_FILE</Key></Deleted>" && [ "$BATCH_STATUS" = "404" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
 # Test delete object
 echo -n "Testing DELETE /public/$TEST_FILE: "
 curl -s -X DELETE "http://localhost:$AWS_S3_PORT/public/$TEST_FILE" > /dev/null && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
 
+kill $SERVER_PID
+wait $SERVER_PID 2> /dev/null || true
+
+# Test suspended requests served through the event loop
+echo -n "Testing GET/HEAD with PGS3_ASYNC_CONNECTIONS: "
+PGS3_ASYNC_CONNECTIONS=2 bin/pgs3 serve $AWS_S3_PORT > /dev/null 2>&1 &
+SERVER_PID=$!
+sleep 2
+curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/async-$TEST_FILE" > /dev/null
+CURL_PIDS=""
+for i in $(seq 1 20); do
+    curl -s -o /dev/null "http://localhost:$AWS_S3_PORT/public/async-$TEST_FILE" &
+    CURL_PIDS="$CURL_PIDS $!"
+done
+wait $CURL_PIDS
+HTTP_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/async-$TEST_FILE")
+HEAD_LENGTH=$(curl -s -I "http://localhost:$AWS_S3_PORT/public/async-$TEST_FILE" | tr -d '\r' | sed -n 's/^Content-Length: //Ip')
+MISSING_STATUS=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:$AWS_S3_PORT/public/missing-$TEST_FILE")
+curl -s -X DELETE "http://localhost:$AWS_S3_PORT/public/async-$TEST_FILE" > /dev/null
+[ "$HTTP_CONTENT" = "$TEST_CONTENT" ] && [ "$HEAD_LENGTH" = "$(stat -c %s "/tmp/$TEST_FILE")" ] && [ "$MISSING_STATUS" = "404" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+kill $SERVER_PID
+wait $SERVER_PID 2> /dev/null || true
+
+# Test reads routed to a hot standby; set PGS3_TEST_REPLICA to a real one,
+# by default the primary stands in for it. The unreachable one is left out.
+echo -n "Testing reads with PGS3_REPLICAS: "
+TEST_REPLICA=${PGS3_TEST_REPLICA:-"dbname=$PGDATABASE"}
+bin/pgs3 put "standby-$TEST_FILE" --file "/tmp/$TEST_FILE" > /dev/null
+PGS3_REPLICAS="$TEST_REPLICA;host=localhost port=1 connect_timeout=1" PGS3_ASYNC_CONNECTIONS=2 \
+    bin/pgs3 serve $AWS_S3_PORT > /dev/null 2>&1 &
+SERVER_PID=$!
+sleep 3
+curl -s -X PUT -T "/tmp/$TEST_FILE" "http://localhost:$AWS_S3_PORT/public/replica-$TEST_FILE" > /dev/null
+HTTP_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/replica-$TEST_FILE")
+HEAD_STATUS=$(curl -s -o /dev/null -I -w "%{http_code}" "http://localhost:$AWS_S3_PORT/public/replica-$TEST_FILE")
+curl -s -X DELETE "http://localhost:$AWS_S3_PORT/public/replica-$TEST_FILE" > /dev/null
+DELETED_STATUS=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:$AWS_S3_PORT/public/replica-$TEST_FILE")
+LIST_STATUS=$(curl -s -o /dev/null -w "%{http_code}" "http://localhost:$AWS_S3_PORT/public?prefix=replica-")
+# A key this server never wrote is read from the standby and not cached
+INSERTIONS_BEFORE=$(curl -s "http://localhost:$AWS_S3_PORT/_pgs3/cache" | grep -o '"insertions":[0-9]*')
+STANDBY_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/standby-$TEST_FILE")
+curl -s "http://localhost:$AWS_S3_PORT/public/standby-$TEST_FILE" > /dev/null
+INSERTIONS_AFTER=$(curl -s "http://localhost:$AWS_S3_PORT/_pgs3/cache" | grep -o '"insertions":[0-9]*')
+bin/pgs3 delete "standby-$TEST_FILE" > /dev/null
+[ "$HTTP_CONTENT" = "$TEST_CONTENT" ] && [ "$HEAD_STATUS" = "200" ] && [ "$DELETED_STATUS" = "404" ] && [ "$LIST_STATUS" = "200" ] && \
+    [ "$STANDBY_CONTENT" = "$TEST_CONTENT" ] && [ -n "$INSERTIONS_BEFORE" ] && [ "$INSERTIONS_BEFORE" = "$INSERTIONS_AFTER" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
+kill $SERVER_PID
+wait $SERVER_PID 2> /dev/null || true
+
+# Test sharding: objects written to the first database are moved by
+# rebalance, then served and listed across shards. Set PGS3_TEST_SHARDS to
+# another database's connection string; by default there is one shard.
+echo -n "Testing PGS3_SHARDS and rebalance: "
+TEST_SHARDS="dbname=$PGDATABASE${PGS3_TEST_SHARDS:+;$PGS3_TEST_SHARDS}"
+DELETE_DOCUMENT="<Delete>"
+for i in 1 2 3 4 5 6 7 8; do
+    bin/pgs3 put "shard-$i-$TEST_FILE" --file "/tmp/$TEST_FILE" > /dev/null
+    DELETE_DOCUMENT="$DELETE_DOCUMENT<Object><Key>shard-$i-$TEST_FILE</Key></Object>"
+done
+DELETE_DOCUMENT="$DELETE_DOCUMENT</Delete>"
+PGS3_SHARDS="$TEST_SHARDS" bin/pgs3 rebalance > /dev/null
+REMAINING=$(PGS3_SHARDS="$TEST_SHARDS" bin/pgs3 rebalance --dry-run)
+PGS3_SHARDS="$TEST_SHARDS" bin/pgs3 serve $AWS_S3_PORT > /dev/null 2>&1 &
+SERVER_PID=$!
+sleep 2
+HTTP_CONTENT=$(curl -s "http://localhost:$AWS_S3_PORT/public/shard-5-$TEST_FILE")
+LISTED=$(curl -s "http://localhost:$AWS_S3_PORT/public?list-type=2&prefix=shard-" | grep -o "<Key>shard-[0-9]-$TEST_FILE</Key>" | wc -l)
+curl -s -X POST --data-binary "$DELETE_DOCUMENT" "http://localhost:$AWS_S3_PORT/public?delete" > /dev/null
+LEFT=$(PGS3_SHARDS="$TEST_SHARDS" bin/pgs3 ls shard- | grep -c "$TEST_FILE" || true)
+[ "$REMAINING" = "0 objects to move" ] && [ "$HTTP_CONTENT" = "$TEST_CONTENT" ] && [ "$LISTED" = "8" ] && [ "$LEFT" = "0" ] && echo "OK" || { echo "FAILED"; kill $SERVER_PID; exit 1; }
+
 # Clean up
 kill $SERVER_PID
 rm -f "/tmp/$TEST_FILE"